@@ -0,0 +1,50 @@
+// Fizzy: A fast WebAssembly interpreter
+// Copyright 2020 The Fizzy Authors.
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include "memory_resource.hpp"
+#include <cstddef>
+#include <memory>
+
+namespace fizzy
+{
+/// The bump-pointer memory arena for the data sharing the lifetime of the owning object.
+///
+/// Memory is allocated from growing chunks and is released all at once with the arena.
+/// Containers reference the arena by the pmr::polymorphic_allocator, so:
+/// - the moved-from and the moved-to owners share the arena, so both can be safely used,
+/// - a copy gets a new arena, as copied pmr containers use the default memory resource anyway,
+/// - a copy assignment keeps the current arena, as pmr containers never propagate allocators,
+/// - a move assignment swaps the arenas: the moved-to owner takes the arena of the data it takes
+///   over, and the moved-from owner keeps the previous arena alive until the data allocated from
+///   it is destroyed.
+class Arena
+{
+    /// The size of the first memory chunk. Next chunks grow geometrically.
+    static constexpr size_t initial_size = 4096;
+
+    std::shared_ptr<pmr::monotonic_buffer_resource> m_resource;
+
+public:
+    Arena() : m_resource{std::make_shared<pmr::monotonic_buffer_resource>(initial_size)} {}
+
+    Arena(const Arena& /*other*/) : Arena{} {}
+
+    Arena(Arena&& other) noexcept : m_resource{other.m_resource} {}
+
+    Arena& operator=(const Arena& /*other*/) noexcept { return *this; }
+
+    Arena& operator=(Arena&& other) noexcept
+    {
+        m_resource.swap(other.m_resource);
+        return *this;
+    }
+
+    ~Arena() noexcept = default;
+
+    /// Returns the memory resource allocating from the arena.
+    [[nodiscard]] pmr::memory_resource* resource() const noexcept { return m_resource.get(); }
+};
+}  // namespace fizzy
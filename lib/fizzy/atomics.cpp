@@ -0,0 +1,233 @@
+// Fizzy: A fast WebAssembly interpreter
+// Copyright 2020 The Fizzy Authors.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "atomics.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+namespace fizzy
+{
+namespace
+{
+/// The kind of the atomic operation, the index of its group of 7 in AtomicOp.
+enum class AtomicKind : uint8_t
+{
+    load,
+    store,
+    add,
+    sub,
+    and_,
+    or_,
+    xor_,
+    xchg,
+    cmpxchg,
+};
+
+/// Executes the atomic access of the aligned value. The operands are truncated to the access
+/// size and the result is zero-extended.
+template <typename T>
+uint64_t access(AtomicKind kind, uint8_t* ptr, const uint64_t* operands) noexcept
+{
+    auto* const value = reinterpret_cast<T*>(ptr);
+    const auto operand = static_cast<T>(operands[0]);
+    switch (kind)
+    {
+    case AtomicKind::load:
+        return __atomic_load_n(value, __ATOMIC_SEQ_CST);
+    case AtomicKind::store:
+        __atomic_store_n(value, operand, __ATOMIC_SEQ_CST);
+        return 0;
+    case AtomicKind::add:
+        return __atomic_fetch_add(value, operand, __ATOMIC_SEQ_CST);
+    case AtomicKind::sub:
+        return __atomic_fetch_sub(value, operand, __ATOMIC_SEQ_CST);
+    case AtomicKind::and_:
+        return __atomic_fetch_and(value, operand, __ATOMIC_SEQ_CST);
+    case AtomicKind::or_:
+        return __atomic_fetch_or(value, operand, __ATOMIC_SEQ_CST);
+    case AtomicKind::xor_:
+        return __atomic_fetch_xor(value, operand, __ATOMIC_SEQ_CST);
+    case AtomicKind::xchg:
+        return __atomic_exchange_n(value, operand, __ATOMIC_SEQ_CST);
+    case AtomicKind::cmpxchg:
+    {
+        // The expected value receives the loaded one when they differ, so it is the old value
+        // in both cases.
+        auto expected = operand;
+        __atomic_compare_exchange_n(value, &expected, static_cast<T>(operands[1]), false,
+            __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+        return expected;
+    }
+    }
+    assert(false);
+    return 0;
+}
+
+/// The threads waiting in memory.atomic.wait, by the waited address.
+///
+/// Each waiter blocks on its own condition variable (the futex on Linux), so the notify wakes up
+/// exactly the chosen waiters, in the order of the waits. The waiters are divided into buckets
+/// by the address, so the waits of unrelated addresses rarely contend.
+class ParkingLot
+{
+    struct Waiter
+    {
+        const uint8_t* address = nullptr;
+        std::condition_variable woken;
+        bool notified = false;
+    };
+
+    struct Bucket
+    {
+        std::mutex mutex;
+        std::vector<Waiter*> waiters;
+    };
+
+    static constexpr size_t NumBuckets = 64;
+
+    /// The longest timeout waited for, the longer ones wait forever.
+    static constexpr std::chrono::hours MaxTimeout{24 * 365};
+
+    Bucket m_buckets[NumBuckets];
+
+    Bucket& get_bucket(const uint8_t* address) noexcept
+    {
+        return m_buckets[(reinterpret_cast<uintptr_t>(address) >> 2) % NumBuckets];
+    }
+
+public:
+    /// Blocks the calling thread if the value at the address equals the expected one,
+    /// until the notify() or the timeout in nanoseconds, if not negative.
+    /// Returns 0 if woken by notify(), 1 if the value differs, 2 if timed out.
+    template <typename T>
+    uint32_t wait(const uint8_t* address, T expected, int64_t timeout)
+    {
+        auto& bucket = get_bucket(address);
+        std::unique_lock lock{bucket.mutex};
+
+        // The value is loaded under the lock, so the notify() following the store of the new
+        // value by another thread cannot be missed.
+        if (__atomic_load_n(reinterpret_cast<const T*>(address), __ATOMIC_SEQ_CST) != expected)
+            return 1;
+
+        Waiter waiter;
+        waiter.address = address;
+        bucket.waiters.emplace_back(&waiter);
+
+        const auto is_notified = [&waiter] { return waiter.notified; };
+        const auto timeout_duration = std::chrono::nanoseconds{timeout};
+        if (timeout < 0 || timeout_duration > MaxTimeout)
+            waiter.woken.wait(lock, is_notified);
+        else
+            waiter.woken.wait_for(lock, timeout_duration, is_notified);
+
+        if (waiter.notified)
+            return 0;
+
+        auto& waiters = bucket.waiters;
+        waiters.erase(std::find(waiters.begin(), waiters.end(), &waiter));
+        return 2;
+    }
+
+    /// Wakes up at most @p count threads waiting at the address, the longest waiting first.
+    /// Returns the number of the woken threads.
+    uint32_t notify(const uint8_t* address, uint32_t count)
+    {
+        auto& bucket = get_bucket(address);
+        const std::lock_guard lock{bucket.mutex};
+
+        uint32_t num_woken = 0;
+        auto& waiters = bucket.waiters;
+        auto it = waiters.begin();
+        while (it != waiters.end() && num_woken < count)
+        {
+            auto* const waiter = *it;
+            if (waiter->address != address)
+            {
+                ++it;
+                continue;
+            }
+            // The waiter leaves wait() only after the lock is released.
+            waiter->notified = true;
+            waiter->woken.notify_one();
+            it = waiters.erase(it);
+            ++num_woken;
+        }
+        return num_woken;
+    }
+};
+
+ParkingLot parking_lot;
+}  // namespace
+
+void atomic_fence() noexcept
+{
+#if defined(__SANITIZE_THREAD__)
+    // ThreadSanitizer does not support the fences, but the read-modify-write of the same
+    // variable by all threads orders the memory accesses for it in the same way.
+    static std::atomic<int> fence_variable;
+    fence_variable.fetch_add(0, std::memory_order_seq_cst);
+#else
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+#endif
+}
+
+bool execute_atomic(AtomicOp op, bytes& memory, bool shared, uint32_t address, uint32_t offset,
+    const uint64_t* operands, uint64_t& result)
+{
+    assert(op != AtomicOp::atomic_fence);
+
+    // Addressing is 32-bit, but we keep the value as 64-bit to detect overflows.
+    const auto access_size = get_atomic_access_size(op);
+    const auto effective_address = uint64_t{address} + offset;
+    if (effective_address + access_size > memory.size() || effective_address % access_size != 0)
+        return false;
+    auto* const ptr = memory.data() + effective_address;
+
+    switch (op)
+    {
+    case AtomicOp::memory_atomic_notify:
+        // No thread can wait on the not shared memory.
+        result = shared ? parking_lot.notify(ptr, static_cast<uint32_t>(operands[0])) : 0;
+        return true;
+    case AtomicOp::memory_atomic_wait32:
+        if (!shared)
+            return false;
+        result = parking_lot.wait(
+            ptr, static_cast<uint32_t>(operands[0]), static_cast<int64_t>(operands[1]));
+        return true;
+    case AtomicOp::memory_atomic_wait64:
+        if (!shared)
+            return false;
+        result = parking_lot.wait(ptr, operands[0], static_cast<int64_t>(operands[1]));
+        return true;
+    default:
+        break;
+    }
+
+    const auto kind = static_cast<AtomicKind>(
+        (static_cast<uint32_t>(op) - static_cast<uint32_t>(AtomicOp::i32_atomic_load)) / 7);
+    switch (access_size)
+    {
+    case 1:
+        result = access<uint8_t>(kind, ptr, operands);
+        break;
+    case 2:
+        result = access<uint16_t>(kind, ptr, operands);
+        break;
+    case 4:
+        result = access<uint32_t>(kind, ptr, operands);
+        break;
+    default:
+        result = access<uint64_t>(kind, ptr, operands);
+        break;
+    }
+    return true;
+}
+}  // namespace fizzy
@@ -0,0 +1,100 @@
+// Fizzy: A fast WebAssembly interpreter
+// Copyright 2020 The Fizzy Authors.
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include "bytes.hpp"
+#include "types.hpp"
+#include <cstdint>
+
+namespace fizzy
+{
+// The atomic operations of the threads proposal, shared by the interpreters.
+// https://github.com/WebAssembly/threads/blob/main/proposals/threads/Overview.md
+
+/// Checks if the instruction is one of the internal atomic instructions.
+constexpr bool is_atomic(Instr instr) noexcept
+{
+    return instr >= Instr::atomic_load && instr <= Instr::atomic_fence;
+}
+
+/// Returns the internal instruction of the atomic operation of the binary encoding,
+/// or Instr::unreachable if there is no such operation.
+constexpr Instr get_atomic_instr(uint32_t op) noexcept
+{
+    switch (op)
+    {
+    case static_cast<uint32_t>(AtomicOp::memory_atomic_notify):
+        return Instr::atomic_rmw;
+    case static_cast<uint32_t>(AtomicOp::memory_atomic_wait32):
+    case static_cast<uint32_t>(AtomicOp::memory_atomic_wait64):
+        return Instr::atomic_cmpxchg;
+    case static_cast<uint32_t>(AtomicOp::atomic_fence):
+        return Instr::atomic_fence;
+    default:
+        break;
+    }
+
+    constexpr auto first = static_cast<uint32_t>(AtomicOp::i32_atomic_load);
+    if (op < first || op > static_cast<uint32_t>(AtomicOp::i64_atomic_rmw32_cmpxchg_u))
+        return Instr::unreachable;
+    switch ((op - first) / 7)
+    {
+    case 0:
+        return Instr::atomic_load;
+    case 1:
+        return Instr::atomic_store;
+    case 8:
+        return Instr::atomic_cmpxchg;
+    default:
+        return Instr::atomic_rmw;
+    }
+}
+
+/// Returns the number of the memory bytes accessed by the atomic operation, 0 for atomic.fence.
+/// The address of the access must be aligned to it.
+constexpr uint32_t get_atomic_access_size(AtomicOp op) noexcept
+{
+    switch (op)
+    {
+    case AtomicOp::memory_atomic_notify:
+    case AtomicOp::memory_atomic_wait32:
+        return 4;
+    case AtomicOp::memory_atomic_wait64:
+        return 8;
+    case AtomicOp::atomic_fence:
+        return 0;
+    default:
+    {
+        constexpr uint8_t sizes[] = {4, 8, 1, 2, 1, 2, 4};
+        const auto index =
+            static_cast<uint32_t>(op) - static_cast<uint32_t>(AtomicOp::i32_atomic_load);
+        return sizes[index % 7];
+    }
+    }
+}
+
+/// Executes atomic.fence.
+void atomic_fence() noexcept;
+
+/// Executes the atomic operation, except atomic.fence, accessing the memory at the address
+/// increased by the offset.
+///
+/// The memory.atomic.wait blocks the calling thread until the memory.atomic.notify of the same
+/// address by another thread or the timeout. It is not interrupted by
+/// Instance::interrupt_requested.
+///
+/// @param op        The atomic operation.
+/// @param memory    The instance's memory.
+/// @param shared    Whether the memory is shared, only these can be waited on.
+/// @param address   The address operand.
+/// @param offset    The offset immediate.
+/// @param operands  The 2 values, the operands following the address in the stack order.
+///                  Only the operation's ones are used, as by its instruction's stack effect.
+/// @param result    Receives the result of the operations having one, i.e. all except stores.
+/// @return          False if the operation traps: the access is out of bounds or unaligned,
+///                  or the wait is on the not shared memory.
+bool execute_atomic(AtomicOp op, bytes& memory, bool shared, uint32_t address, uint32_t offset,
+    const uint64_t* operands, uint64_t& result);
+}  // namespace fizzy
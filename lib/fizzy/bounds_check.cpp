@@ -0,0 +1,313 @@
+// Fizzy: A fast WebAssembly interpreter
+// Copyright 2020 The Fizzy Authors.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "bounds_check.hpp"
+#include "instructions.hpp"
+#include "limits.hpp"
+#include <algorithm>
+#include <cassert>
+#include <limits>
+#include <optional>
+
+namespace fizzy
+{
+namespace
+{
+/// The memory access of a load or store instruction.
+struct MemoryAccess
+{
+    /// The variant of the instruction without the bounds check.
+    Instr unchecked;
+
+    /// The number of bytes accessed.
+    uint8_t size;
+
+    /// Whether the instruction is a store, which takes the value above the address.
+    bool is_store;
+};
+
+std::optional<MemoryAccess> get_memory_access(Instr instr) noexcept
+{
+    switch (instr)
+    {
+    case Instr::i32_load:
+        return MemoryAccess{Instr::i32_load_unchecked, 4, false};
+    case Instr::i64_load:
+        return MemoryAccess{Instr::i64_load_unchecked, 8, false};
+    case Instr::i32_load8_s:
+        return MemoryAccess{Instr::i32_load8_s_unchecked, 1, false};
+    case Instr::i32_load8_u:
+        return MemoryAccess{Instr::i32_load8_u_unchecked, 1, false};
+    case Instr::i32_load16_s:
+        return MemoryAccess{Instr::i32_load16_s_unchecked, 2, false};
+    case Instr::i32_load16_u:
+        return MemoryAccess{Instr::i32_load16_u_unchecked, 2, false};
+    case Instr::i64_load8_s:
+        return MemoryAccess{Instr::i64_load8_s_unchecked, 1, false};
+    case Instr::i64_load8_u:
+        return MemoryAccess{Instr::i64_load8_u_unchecked, 1, false};
+    case Instr::i64_load16_s:
+        return MemoryAccess{Instr::i64_load16_s_unchecked, 2, false};
+    case Instr::i64_load16_u:
+        return MemoryAccess{Instr::i64_load16_u_unchecked, 2, false};
+    case Instr::i64_load32_s:
+        return MemoryAccess{Instr::i64_load32_s_unchecked, 4, false};
+    case Instr::i64_load32_u:
+        return MemoryAccess{Instr::i64_load32_u_unchecked, 4, false};
+    case Instr::i32_store:
+        return MemoryAccess{Instr::i32_store_unchecked, 4, true};
+    case Instr::i64_store:
+        return MemoryAccess{Instr::i64_store_unchecked, 8, true};
+    case Instr::i32_store8:
+        return MemoryAccess{Instr::i32_store8_unchecked, 1, true};
+    case Instr::i32_store16:
+        return MemoryAccess{Instr::i32_store16_unchecked, 2, true};
+    case Instr::i64_store8:
+        return MemoryAccess{Instr::i64_store8_unchecked, 1, true};
+    case Instr::i64_store16:
+        return MemoryAccess{Instr::i64_store16_unchecked, 2, true};
+    case Instr::i64_store32:
+        return MemoryAccess{Instr::i64_store32_unchecked, 4, true};
+    default:
+        return std::nullopt;
+    }
+}
+
+/// The value on the operand stack as known to the analysis.
+struct StackValue
+{
+    enum class Kind : uint8_t
+    {
+        unknown,
+        constant,
+        local,
+    };
+
+    Kind kind = Kind::unknown;
+
+    /// The index of the local for Kind::local.
+    uint32_t local_idx = 0;
+
+    /// The constant, or the value added to the local's value modulo 2^32.
+    uint64_t addend = 0;
+};
+
+/// Returns the minimum size of the memory in bytes, as declared by the module.
+uint64_t get_min_memory_size(const Module& module) noexcept
+{
+    if (!module.memorysec.empty())
+        return uint64_t{module.memorysec[0].limits.min} * PageSize;
+    if (!module.imported_memory_types.empty())
+        return uint64_t{module.imported_memory_types[0].limits.min} * PageSize;
+    return 0;
+}
+
+/// The bounds check elimination in a single function.
+class BoundsCheckEliminator
+{
+    const uint64_t m_min_memory_size;
+
+    /// The operand stack with the values known to the analysis.
+    std::vector<StackValue> m_stack;
+
+    /// For each local, the number of bytes from the local's value which are in bounds.
+    /// Zero if nothing is known.
+    std::vector<uint64_t> m_local_ends;
+
+    /// The locals having the bytes in bounds, to reset them quickly.
+    std::vector<uint32_t> m_proven_locals;
+
+    /// The end of the memory range known to be in bounds.
+    uint64_t m_constant_end;
+
+    StackValue pop() noexcept
+    {
+        assert(!m_stack.empty());
+        const auto value = m_stack.back();
+        m_stack.pop_back();
+        return value;
+    }
+
+    void set_local_end(uint32_t local_idx, uint64_t end)
+    {
+        if (m_local_ends[local_idx] == 0 && end != 0)
+            m_proven_locals.emplace_back(local_idx);
+        m_local_ends[local_idx] = end;
+    }
+
+    /// Updates the proofs after the change of the local's value to the given one.
+    void set_local(uint32_t local_idx, const StackValue& value)
+    {
+        // The local increased by a constant stays in bounds by fewer bytes.
+        // If the addition wraps around, the new value is lower than the old one.
+        const auto end = m_local_ends[local_idx];
+        const auto new_end =
+            (value.kind == StackValue::Kind::local && value.local_idx == local_idx &&
+                value.addend < end) ?
+                end - value.addend :
+                0;
+        set_local_end(local_idx, new_end);
+
+        // The values on the stack refer to the previous value of the local.
+        for (auto& stack_value : m_stack)
+        {
+            if (stack_value.kind == StackValue::Kind::local && stack_value.local_idx == local_idx)
+                stack_value = {};
+        }
+    }
+
+    /// Checks the memory access and updates the proofs assuming it has not trapped.
+    /// Returns true if the access is in bounds regardless of the check.
+    bool access(const StackValue& address, uint32_t offset, uint8_t size)
+    {
+        const auto access_size = uint64_t{offset} + size;
+        switch (address.kind)
+        {
+        case StackValue::Kind::constant:
+        {
+            const auto end = address.addend + access_size;
+            if (end <= m_constant_end)
+                return true;
+            m_constant_end = end;
+            return false;
+        }
+        case StackValue::Kind::local:
+        {
+            // If the addition to the local wraps around, the address is lower than the local's
+            // value, so it is in bounds as well.
+            const auto end = address.addend + access_size;
+            if (end <= m_local_ends[address.local_idx])
+                return true;
+            if (address.addend == 0)
+                set_local_end(address.local_idx, end);
+            return false;
+        }
+        default:
+            return false;
+        }
+    }
+
+public:
+    BoundsCheckEliminator(uint64_t min_memory_size, size_t num_locals)
+      : m_min_memory_size{min_memory_size},
+        m_local_ends(num_locals, 0),
+        m_constant_end{min_memory_size}
+    {}
+
+    /// Forgets everything, as at the start of the extended basic block.
+    void reset(int stack_height)
+    {
+        m_stack.assign(static_cast<size_t>(stack_height), StackValue{});
+        for (const auto local_idx : m_proven_locals)
+            m_local_ends[local_idx] = 0;
+        m_proven_locals.clear();
+        m_constant_end = m_min_memory_size;
+    }
+
+    size_t get_stack_height() const noexcept { return m_stack.size(); }
+
+    /// Analyzes the instruction and replaces it with the unchecked variant if possible.
+    void process(const Module& module, LoweredInstr& instr)
+    {
+        switch (instr.instr)
+        {
+        case Instr::i32_const:
+            m_stack.push_back({StackValue::Kind::constant, 0, instr.imm});
+            return;
+        case Instr::local_get:
+            m_stack.push_back({StackValue::Kind::local, instr.imm, 0});
+            return;
+        case Instr::local_set:
+            set_local(instr.imm, pop());
+            return;
+        case Instr::local_tee:
+            set_local(instr.imm, pop());
+            m_stack.push_back({StackValue::Kind::local, instr.imm, 0});
+            return;
+        case Instr::i32_add:
+        {
+            const auto rhs = pop();
+            const auto lhs = pop();
+            StackValue result;
+            if (lhs.kind == StackValue::Kind::constant && rhs.kind == StackValue::Kind::constant)
+                result = {StackValue::Kind::constant, 0, (lhs.addend + rhs.addend) & 0xffffffff};
+            else if (lhs.kind != rhs.kind && lhs.kind != StackValue::Kind::unknown &&
+                     rhs.kind != StackValue::Kind::unknown)
+            {
+                const auto& local = lhs.kind == StackValue::Kind::local ? lhs : rhs;
+                const auto addend = lhs.addend + rhs.addend;
+                if (addend <= std::numeric_limits<uint32_t>::max())
+                    result = {StackValue::Kind::local, local.local_idx, addend};
+            }
+            m_stack.push_back(result);
+            return;
+        }
+        case Instr::call:
+        case Instr::call_indirect:
+        {
+            // The calls may grow the memory but never shrink it.
+            const auto& func_type = instr.instr == Instr::call ?
+                                        module.get_function_type(instr.imm) :
+                                        module.typesec[instr.imm];
+            m_stack.resize(m_stack.size() - func_type.inputs.size() -
+                           (instr.instr == Instr::call_indirect ? 1 : 0));
+            m_stack.resize(m_stack.size() + func_type.outputs.size());
+            return;
+        }
+        default:
+            break;
+        }
+
+        if (const auto memory_access = get_memory_access(instr.instr))
+        {
+            if (memory_access->is_store)
+                pop();
+            if (access(pop(), instr.imm, memory_access->size))
+                instr.instr = memory_access->unchecked;
+            if (!memory_access->is_store)
+                m_stack.emplace_back();
+            return;
+        }
+
+        const auto& metrics = get_instruction_metrics_table()[static_cast<uint8_t>(instr.instr)];
+        assert(m_stack.size() >= static_cast<size_t>(metrics.stack_height_required));
+        m_stack.resize(m_stack.size() - static_cast<size_t>(metrics.stack_height_required));
+        m_stack.resize(m_stack.size() +
+                       static_cast<size_t>(
+                           metrics.stack_height_required + metrics.stack_height_change));
+    }
+};
+}  // namespace
+
+void eliminate_bounds_checks(const Module& module, size_t code_idx, LoweredCode& code)
+{
+    if (!module.has_memory())
+        return;
+
+    const auto& func_type = module.get_function_type(
+        static_cast<FuncIdx>(module.imported_function_types.size() + code_idx));
+    BoundsCheckEliminator eliminator{
+        get_min_memory_size(module), func_type.inputs.size() + size_t{code.local_count}};
+
+    const auto heights = compute_stack_heights(module, code);
+    const auto is_target = find_branch_targets(code);
+
+    // The extended basic block starts at each branch target. The code following unconditional
+    // jumps is either a branch target or is never executed.
+    bool is_block_start = true;
+    for (size_t i = 0; i < code.instructions.size(); ++i)
+    {
+        if (heights[i] == UnknownStackHeight)
+            continue;
+
+        auto& instr = code.instructions[i];
+        if (is_block_start || is_target[i])
+            eliminator.reset(heights[i]);
+        assert(eliminator.get_stack_height() == static_cast<size_t>(heights[i]));
+
+        eliminator.process(module, instr);
+        is_block_start = is_unconditional_jump(instr.instr);
+    }
+}
+}  // namespace fizzy
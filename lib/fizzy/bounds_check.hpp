@@ -0,0 +1,25 @@
+// Fizzy: A fast WebAssembly interpreter
+// Copyright 2020 The Fizzy Authors.
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include "lowered_code.hpp"
+#include "module.hpp"
+
+namespace fizzy
+{
+/// Replaces the memory instructions proven to access the memory in bounds with their unchecked
+/// variants, e.g. i32.load with i32_load_unchecked.
+///
+/// An access is proven to be in bounds by the memory's declared minimum size (for constant
+/// addresses) or by an access already checked earlier in the same extended basic block,
+/// i.e. on each path to the instruction. The addresses are tracked as constants or values of
+/// locals increased by constants. The memory never shrinks, so the proofs stay valid after
+/// memory.grow. The other accesses keep the checks and trap as before.
+///
+/// @param module    The module the code is of.
+/// @param code_idx  The index of the function's code in the module's code section.
+/// @param code      The lowered code of the function.
+void eliminate_bounds_checks(const Module& module, size_t code_idx, LoweredCode& code);
+}  // namespace fizzy
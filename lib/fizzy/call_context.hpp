@@ -0,0 +1,46 @@
+// Fizzy: A fast WebAssembly interpreter
+// Copyright 2020 The Fizzy Authors.
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include <memory>
+
+namespace fizzy
+{
+class LaneWakeup;
+class PendingCall;
+
+/// The imported function call by the lane execution, see defer_current_call().
+struct LaneCallContext
+{
+    /// The wakeup of the lane execution making the call.
+    const std::shared_ptr<LaneWakeup>& wakeup;
+
+    /// The pending call created by defer_current_call(), null if the call is not deferred.
+    std::shared_ptr<PendingCall> pending_call;
+};
+
+/// The imported function call by the lane execution in progress in the calling thread,
+/// null outside of it.
+extern thread_local LaneCallContext* current_lane_call;
+
+/// Sets the current call of the lane execution, or hides it from the host functions called by
+/// the nested execution, e.g. by execute() called by the imported function, within the scope.
+class LaneCallScope
+{
+    LaneCallContext* const m_outer_call;
+
+public:
+    explicit LaneCallScope(LaneCallContext* call = nullptr) noexcept
+      : m_outer_call{current_lane_call}
+    {
+        current_lane_call = call;
+    }
+
+    ~LaneCallScope() noexcept { current_lane_call = m_outer_call; }
+
+    LaneCallScope(const LaneCallScope&) = delete;
+    LaneCallScope& operator=(const LaneCallScope&) = delete;
+};
+}  // namespace fizzy
@@ -0,0 +1,111 @@
+// Fizzy: A fast WebAssembly interpreter
+// Copyright 2020 The Fizzy Authors.
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include "types.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+namespace fizzy
+{
+/// The size of the CPU cache line.
+constexpr size_t CacheLineSize = 64;
+
+/// The word of the executable code.
+///
+/// The instruction word is followed by the operand words required by the instruction:
+/// - i64.const: the value,
+/// - i64_add_carry: the index of the local compared with the sum,
+/// - global_get_direct, global_set_direct: the address of the global's storage,
+/// - if, else, br, br_if, return: the branch target,
+/// - br_table: the branch instruction word and the branch target for each label,
+/// - memory_loop: the loop exit target and the MemoryLoop in the following words.
+/// The structural instructions (block, loop, nop and all but the final end) are not present.
+union CodeWord
+{
+    /// The instruction with its packed immediate value.
+    struct Op
+    {
+        Instr instr;
+
+        /// The arity of the branch, or the AtomicOp of the atomic instructions.
+        uint8_t arity;
+
+        /// The instruction's 32-bit immediate value, e.g. an index or a memory offset.
+        /// For branches this is the stack height at the branch target.
+        uint32_t imm;
+    } op;
+
+    /// The 64-bit immediate value.
+    uint64_t value;
+
+    /// The branch target.
+    const CodeWord* target;
+};
+static_assert(sizeof(CodeWord) == 8);
+
+/// The allocator of memory aligned to the cache line.
+template <typename T>
+struct CacheLineAlignedAllocator
+{
+    using value_type = T;
+
+    CacheLineAlignedAllocator() noexcept = default;
+
+    template <typename U>
+    CacheLineAlignedAllocator(const CacheLineAlignedAllocator<U>& /*other*/) noexcept
+    {}
+
+    T* allocate(size_t n)
+    {
+        return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t{CacheLineSize}));
+    }
+
+    void deallocate(T* p, size_t /*n*/) noexcept
+    {
+        ::operator delete(p, std::align_val_t{CacheLineSize});
+    }
+
+    template <typename U>
+    bool operator==(const CacheLineAlignedAllocator<U>& /*other*/) const noexcept
+    {
+        return true;
+    }
+
+    template <typename U>
+    bool operator!=(const CacheLineAlignedAllocator<U>& /*other*/) const noexcept
+    {
+        return false;
+    }
+};
+
+/// The executable code of all module's functions in the single contiguous buffer.
+///
+/// The code contains pointers to itself (the branch targets) so it is not copyable:
+/// a copy is empty and the code must be laid out again. Moving keeps the buffer in place.
+class CodeImage : public std::vector<CodeWord, CacheLineAlignedAllocator<CodeWord>>
+{
+    using base = std::vector<CodeWord, CacheLineAlignedAllocator<CodeWord>>;
+
+public:
+    CodeImage() noexcept = default;
+
+    CodeImage(const CodeImage& /*other*/) noexcept : base{} {}
+
+    CodeImage(CodeImage&& other) noexcept = default;
+
+    CodeImage& operator=(const CodeImage& /*other*/) noexcept
+    {
+        clear();
+        return *this;
+    }
+
+    CodeImage& operator=(CodeImage&& other) noexcept = default;
+
+    ~CodeImage() noexcept = default;
+};
+}  // namespace fizzy
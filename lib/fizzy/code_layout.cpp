@@ -0,0 +1,444 @@
+// Fizzy: A fast WebAssembly interpreter
+// Copyright 2020 The Fizzy Authors.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "code_layout.hpp"
+#include "bounds_check.hpp"
+#include "idioms.hpp"
+#include "inliner.hpp"
+#include "lowered_code.hpp"
+#include "optimizer.hpp"
+#include <algorithm>
+#include <cassert>
+#include <numeric>
+
+namespace fizzy
+{
+namespace
+{
+constexpr size_t WordsPerCacheLine = CacheLineSize / sizeof(CodeWord);
+
+constexpr size_t align_to_cache_line(size_t num_words) noexcept
+{
+    return (num_words + WordsPerCacheLine - 1) / WordsPerCacheLine * WordsPerCacheLine;
+}
+
+inline CodeWord make_op(Instr instr, uint32_t imm = 0, uint8_t arity = 0) noexcept
+{
+    CodeWord word;
+    word.op = {instr, arity, imm};
+    return word;
+}
+
+/// Returns the number of code words the instruction with the given immediate value takes.
+inline size_t get_word_count(Instr instr, uint32_t imm) noexcept
+{
+    switch (instr)
+    {
+    case Instr::if_:
+    case Instr::else_:
+    case Instr::br:
+    case Instr::br_if:
+    case Instr::return_:
+    case Instr::i64_const:
+    case Instr::i64_add_carry:
+    case Instr::global_get_direct:
+    case Instr::global_set_direct:
+        return 2;
+    case Instr::br_table:
+        return 1 + 2 * (size_t{imm} + 1);
+    case Instr::memory_loop:
+        return 2 + MemoryLoopWordCount;
+    default:
+        return 1;
+    }
+}
+
+/// Returns the number of code words the lowered instruction is emitted to.
+inline size_t get_word_count(const LoweredInstr& instr) noexcept
+{
+    return get_word_count(instr.instr, instr.imm);
+}
+
+/// Computes the offset of each instruction of the lowered code in the code words.
+///
+/// @param code          The lowered code.
+/// @param word_offsets  The output offsets, one for each instruction.
+/// @return              The total number of code words.
+size_t compute_word_offsets(const LoweredCode& code, std::vector<size_t>& word_offsets)
+{
+    word_offsets.resize(code.instructions.size());
+
+    size_t num_words = 0;
+    for (size_t i = 0; i < code.instructions.size(); ++i)
+    {
+        word_offsets[i] = num_words;
+        num_words += get_word_count(code.instructions[i]);
+    }
+    return num_words;
+}
+
+/// Emits the branch instruction word and the target word.
+inline CodeWord* emit_branch(const LoweredInstr& instr, const CodeWord* code_words,
+    const std::vector<size_t>& word_offsets, CodeWord* out) noexcept
+{
+    *out++ = make_op(instr.instr, instr.imm, instr.arity);
+    out++->target = code_words + word_offsets[instr.target];
+    return out;
+}
+
+/// Emits the lowered code to the code words.
+void emit_code(
+    const LoweredCode& code, const std::vector<size_t>& word_offsets, CodeWord* code_words)
+{
+    auto* out = code_words;
+    for (const auto& instr : code.instructions)
+    {
+        switch (instr.instr)
+        {
+        case Instr::if_:
+        case Instr::else_:
+        case Instr::br:
+        case Instr::br_if:
+        case Instr::return_:
+            out = emit_branch(instr, code_words, word_offsets, out);
+            break;
+        case Instr::br_table:
+        {
+            *out++ = make_op(instr.instr, instr.imm);
+            const auto* const labels = &code.br_table_labels[static_cast<size_t>(instr.value)];
+            for (size_t j = 0; j <= instr.imm; ++j)
+                out = emit_branch(labels[j], code_words, word_offsets, out);
+            break;
+        }
+        case Instr::i64_const:
+            *out++ = make_op(instr.instr);
+            out++->value = instr.value;
+            break;
+        case Instr::i64_add_carry:
+        case Instr::global_get_direct:
+        case Instr::global_set_direct:
+            *out++ = make_op(instr.instr, instr.imm);
+            out++->value = instr.value;
+            break;
+        case Instr::memory_loop:
+        {
+            out = emit_branch(instr, code_words, word_offsets, out);
+            const auto& memory_loop = code.memory_loops[static_cast<size_t>(instr.value)];
+            __builtin_memcpy(out, &memory_loop, sizeof(memory_loop));
+            out += MemoryLoopWordCount;
+            break;
+        }
+        case Instr::atomic_load:
+        case Instr::atomic_store:
+        case Instr::atomic_rmw:
+        case Instr::atomic_cmpxchg:
+            *out++ = make_op(instr.instr, instr.imm, instr.arity);
+            break;
+        default:
+            *out++ = make_op(instr.instr, instr.imm);
+            break;
+        }
+    }
+    assert(out == code_words + (word_offsets.empty() ? 0 : word_offsets.back() + 1));
+}
+
+/// Replaces the global.get of the immutable i32 and i64 globals with their values.
+void substitute_constant_globals(
+    const Module& module, const CodeSpecialization& specialization, LoweredCode& code) noexcept
+{
+    const auto num_imported_globals = module.imported_globals_mutability.size();
+    for (auto& instr : code.instructions)
+    {
+        if (instr.instr != Instr::global_get || instr.imm < num_imported_globals)
+            continue;
+        const auto& value = specialization.global_values[instr.imm];
+        if (!value.has_value())
+            continue;
+
+        if (module.globalsec[instr.imm - num_imported_globals].type == ValType::i32)
+        {
+            instr.instr = Instr::i32_const;
+            instr.imm = static_cast<uint32_t>(*value);
+        }
+        else
+        {
+            instr.instr = Instr::i64_const;
+            instr.value = *value;
+        }
+    }
+}
+
+/// Replaces the other global accesses with the accesses by the direct pointers.
+void bind_globals(const CodeSpecialization& specialization, LoweredCode& code) noexcept
+{
+    for (auto& instr : code.instructions)
+    {
+        if (instr.instr != Instr::global_get && instr.instr != Instr::global_set)
+            continue;
+        instr.instr = instr.instr == Instr::global_get ? Instr::global_get_direct :
+                                                         Instr::global_set_direct;
+        instr.value = reinterpret_cast<uintptr_t>(specialization.global_storage[instr.imm]);
+    }
+}
+
+/// Computes the worst-case stack usage of each function from the call graph of the code.
+///
+/// The frame of the called function starts at its arguments on the caller's operand stack,
+/// so the sum of the frame sizes along the deepest path is the upper bound of the memory used.
+/// The calls of imported functions add to the call depth only, as their frames are not in
+/// the module's code.
+void compute_frame_bounds(Module& module, const std::vector<LoweredCode>& lowered_codes)
+{
+    const auto num_imported_functions = module.imported_function_types.size();
+    const auto code_count = module.codesec.size();
+
+    enum class State : uint8_t
+    {
+        not_visited,
+        visiting,
+        visited
+    };
+    std::vector<State> states(code_count, State::not_visited);
+
+    // Depth-first search with the explicit stack of the functions and their next instructions.
+    std::vector<std::pair<size_t, size_t>> path;
+    for (size_t root_idx = 0; root_idx < code_count; ++root_idx)
+    {
+        if (states[root_idx] != State::not_visited)
+            continue;
+
+        states[root_idx] = State::visiting;
+        path.emplace_back(root_idx, 0);
+        while (!path.empty())
+        {
+            auto& [code_idx, instr_idx] = path.back();
+            const auto& instructions = lowered_codes[code_idx].instructions;
+            while (instr_idx < instructions.size() &&
+                   (instructions[instr_idx].instr != Instr::call ||
+                       instructions[instr_idx].imm < num_imported_functions ||
+                       states[instructions[instr_idx].imm - num_imported_functions] !=
+                           State::not_visited))
+                ++instr_idx;
+
+            if (instr_idx < instructions.size())
+            {
+                const auto callee_idx = instructions[instr_idx].imm - num_imported_functions;
+                states[callee_idx] = State::visiting;
+                path.emplace_back(callee_idx, 0);
+                continue;
+            }
+
+            // All called functions are visited, a function still being visited is recursive.
+            auto& code = module.codesec[code_idx];
+            FrameBound bound;
+            bool bounded = true;
+            for (const auto& instr : instructions)
+            {
+                if (instr.instr == Instr::call_indirect)
+                    bounded = false;
+                else if (instr.instr == Instr::call)
+                {
+                    if (instr.imm < num_imported_functions)
+                    {
+                        bound.call_depth = std::max(bound.call_depth, 1);
+                        continue;
+                    }
+                    const auto callee_idx = instr.imm - num_imported_functions;
+                    const auto& callee_bound = module.codesec[callee_idx].image_frame_bound;
+                    if (states[callee_idx] != State::visited || !callee_bound.has_value())
+                        bounded = false;
+                    else
+                    {
+                        bound.frame_size = std::max(bound.frame_size, callee_bound->frame_size);
+                        bound.call_depth = std::max(bound.call_depth, callee_bound->call_depth + 1);
+                    }
+                }
+            }
+            if (bounded)
+            {
+                const auto func_idx = static_cast<FuncIdx>(num_imported_functions + code_idx);
+                const auto num_args = module.get_function_type(func_idx).inputs.size();
+                bound.frame_size += num_args + code.image_local_count +
+                                    static_cast<size_t>(code.image_max_stack_height);
+                code.image_frame_bound = bound;
+            }
+            else
+                code.image_frame_bound.reset();
+
+            states[code_idx] = State::visited;
+            path.pop_back();
+        }
+    }
+}
+
+/// Returns the order of functions in the code image.
+std::vector<size_t> get_layout_order(size_t code_count, const std::vector<uint64_t>& call_counts)
+{
+    std::vector<size_t> order(code_count);
+    std::iota(order.begin(), order.end(), size_t{0});
+
+    if (!call_counts.empty())
+    {
+        assert(call_counts.size() == code_count);
+
+        // Stable sort keeps the original order of functions with equal counts,
+        // including the never called ones.
+        std::stable_sort(order.begin(), order.end(),
+            [&call_counts](size_t a, size_t b) { return call_counts[a] > call_counts[b]; });
+    }
+    return order;
+}
+}  // namespace
+
+void layout_code(Module& module, const LayoutOptions& options)
+{
+    const auto order = get_layout_order(module.codesec.size(), options.call_counts);
+
+    std::vector<LoweredCode> lowered_codes;
+    lowered_codes.reserve(module.codesec.size());
+    for (const auto& code : module.codesec)
+    {
+        auto& lowered_code = lowered_codes.emplace_back(lower_code(code));
+        if (options.specialization != nullptr)
+            substitute_constant_globals(module, *options.specialization, lowered_code);
+        if (options.optimize)
+            optimize(lowered_code);
+    }
+
+    if (options.optimize)
+    {
+        // The inlined code is optimized again together with the caller's code around it.
+        inline_calls(module, lowered_codes);
+        for (size_t code_idx = 0; code_idx < module.codesec.size(); ++code_idx)
+        {
+            optimize(lowered_codes[code_idx]);
+            recognize_memory_loops(lowered_codes[code_idx]);
+            eliminate_bounds_checks(module, code_idx, lowered_codes[code_idx]);
+            fuse_carry_chains(module, lowered_codes[code_idx]);
+        }
+    }
+
+    if (options.specialization != nullptr)
+    {
+        // The instructions accessing the globals directly are not supported by the optimizer.
+        for (auto& lowered_code : lowered_codes)
+            bind_globals(*options.specialization, lowered_code);
+    }
+
+    for (size_t code_idx = 0; code_idx < module.codesec.size(); ++code_idx)
+    {
+        auto& code = module.codesec[code_idx];
+        code.image_local_count = lowered_codes[code_idx].local_count;
+        code.image_max_stack_height = lowered_codes[code_idx].max_stack_height;
+    }
+    compute_frame_bounds(module, lowered_codes);
+
+    std::vector<size_t> word_offsets;
+
+    size_t image_size = 0;
+    for (const auto code_idx : order)
+    {
+        module.codesec[code_idx].image_offset = image_size;
+        image_size = align_to_cache_line(
+            image_size + compute_word_offsets(lowered_codes[code_idx], word_offsets));
+    }
+
+    // The padding between functions is never executed, but fill it with traps anyway.
+    module.code_image.assign(image_size, make_op(Instr::unreachable));
+
+    for (size_t code_idx = 0; code_idx < module.codesec.size(); ++code_idx)
+    {
+        const auto& lowered_code = lowered_codes[code_idx];
+        compute_word_offsets(lowered_code, word_offsets);
+        emit_code(lowered_code, word_offsets,
+            module.code_image.data() + module.codesec[code_idx].image_offset);
+    }
+}
+
+void copy_code_image(const Module& source, Module& module)
+{
+    assert(module.codesec.size() == source.codesec.size());
+
+    const auto& source_image = source.code_image;
+    module.code_image.assign(source_image.begin(), source_image.end());
+
+    // The branch targets are the only pointers to the image itself.
+    const auto relocate = [&](size_t word_idx) noexcept {
+        module.code_image[word_idx].target =
+            module.code_image.data() + (source_image[word_idx].target - source_image.data());
+    };
+    for (size_t i = 0; i < source_image.size();)
+    {
+        const auto& op = source_image[i].op;
+        switch (op.instr)
+        {
+        case Instr::if_:
+        case Instr::else_:
+        case Instr::br:
+        case Instr::br_if:
+        case Instr::return_:
+        case Instr::memory_loop:
+            relocate(i + 1);
+            break;
+        case Instr::br_table:
+            for (size_t j = 0; j <= op.imm; ++j)
+                relocate(i + 2 + 2 * j);
+            break;
+        case Instr::global_get_direct:
+        case Instr::global_set_direct:
+            assert(false);
+            break;
+        default:
+            break;
+        }
+        i += get_word_count(op.instr, op.imm);
+    }
+}
+
+CompiledFunction compile_function(const Module& module, size_t code_idx)
+{
+    auto lowered_code = lower_code(module.codesec[code_idx]);
+    optimize(lowered_code);
+    inline_calls(module, code_idx, lowered_code);
+    optimize(lowered_code);
+    recognize_memory_loops(lowered_code);
+    eliminate_bounds_checks(module, code_idx, lowered_code);
+    fuse_carry_chains(module, lowered_code);
+
+    std::vector<size_t> word_offsets;
+    CompiledFunction compiled;
+    compiled.image.resize(compute_word_offsets(lowered_code, word_offsets));
+    emit_code(lowered_code, word_offsets, compiled.image.data());
+    compiled.local_count = lowered_code.local_count;
+    compiled.max_stack_height = lowered_code.max_stack_height;
+
+    // The loops are matched with the ones of the unoptimized code by their order.
+    const auto unoptimized_code = lower_code(module.codesec[code_idx]);
+    std::vector<size_t> unoptimized_word_offsets;
+    compute_word_offsets(unoptimized_code, unoptimized_word_offsets);
+    assert(unoptimized_code.loop_headers.size() == lowered_code.loop_headers.size());
+    for (size_t i = 0; i < lowered_code.loop_headers.size(); ++i)
+    {
+        compiled.osr_entries.emplace_back(
+            unoptimized_word_offsets[unoptimized_code.loop_headers[i]],
+            word_offsets[lowered_code.loop_headers[i]]);
+    }
+    // The nested loops starting at the same instruction have the same entry.
+    std::sort(compiled.osr_entries.begin(), compiled.osr_entries.end());
+    compiled.osr_entries.erase(
+        std::unique(compiled.osr_entries.begin(), compiled.osr_entries.end()),
+        compiled.osr_entries.end());
+    return compiled;
+}
+
+const CodeWord* find_osr_entry(const CompiledFunction& compiled, size_t loop_offset) noexcept
+{
+    const auto& entries = compiled.osr_entries;
+    const auto it = std::lower_bound(entries.begin(), entries.end(), loop_offset,
+        [](const auto& entry, size_t offset) noexcept { return entry.first < offset; });
+    if (it == entries.end() || it->first != loop_offset)
+        return nullptr;
+    return compiled.image.data() + it->second;
+}
+}  // namespace fizzy
@@ -0,0 +1,105 @@
+// Fizzy: A fast WebAssembly interpreter
+// Copyright 2020 The Fizzy Authors.
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include "code_image.hpp"
+#include "lowered_code.hpp"
+#include "module.hpp"
+#include <cstdint>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace fizzy
+{
+/// The number of code words holding the MemoryLoop following the memory_loop instruction.
+constexpr size_t MemoryLoopWordCount =
+    (sizeof(MemoryLoop) + sizeof(CodeWord) - 1) / sizeof(CodeWord);
+static_assert(std::is_trivially_copyable_v<MemoryLoop>);
+
+/// The state of the instance fixed after the instantiation, the code can be specialized for.
+struct CodeSpecialization
+{
+    /// The values of the immutable i32 and i64 globals defined by the module, in the global index
+    /// space. The other globals have no value.
+    std::vector<std::optional<uint64_t>> global_values;
+
+    /// The storage of each global, in the global index space.
+    std::vector<uint64_t*> global_storage;
+};
+
+/// The options of the code layout.
+struct LayoutOptions
+{
+    /// Whether to optimize the code with the peephole optimizer, the inliner and
+    /// the bounds check elimination.
+    bool optimize = true;
+
+    /// The optional profile data: the number of calls of each function of the code section.
+    /// When provided, the functions which have been called are placed first, starting from
+    /// the most often called ones, so the hot code is packed together.
+    std::vector<uint64_t> call_counts;
+
+    /// The optional state of the instance to specialize the code for.
+    /// The immutable globals are replaced with their values before the optimization, so they are
+    /// constant-folded, and the other globals are accessed by direct pointers.
+    const CodeSpecialization* specialization = nullptr;
+};
+
+/// Compiles the code of all module's functions to the module's single code image.
+///
+/// The code of each function is lowered to CodeWords, optimized unless disabled in the options,
+/// and starts at the cache line boundary.
+/// The codesec[] entries get offsets of their code in the image.
+///
+/// @param module   The module to lay out the code of.
+/// @param options  The layout options.
+void layout_code(Module& module, const LayoutOptions& options = {});
+
+/// Copies the code image laid out for the module to its copy, relocating the branch targets,
+/// so the copy does not have to be laid out again.
+///
+/// The code must not be specialized, as the direct accesses of the globals are not relocated.
+///
+/// @param source  The module with the laid out code.
+/// @param module  The copy of the @p source module, e.g. made before the instantiation.
+void copy_code_image(const Module& source, Module& module);
+
+/// The code of a single function compiled outside of the module's code image.
+struct CompiledFunction
+{
+    /// The code words of the function.
+    CodeImage image;
+
+    /// The number of locals and the maximum stack height, as Code::image_local_count and
+    /// Code::image_max_stack_height.
+    uint32_t local_count = 0;
+    int max_stack_height = 0;
+
+    /// The entries for the on-stack replacement: the offsets of the loop headers in the
+    /// function's unoptimized code paired with the offsets of the same loop headers in this code.
+    /// Sorted by the unoptimized code offsets.
+    std::vector<std::pair<size_t, size_t>> osr_entries;
+};
+
+/// Compiles the code of the function with all optimizations, including inlining.
+///
+/// The module is only read, so this can be done concurrently with the module's code execution.
+///
+/// @param module    The module.
+/// @param code_idx  The index of the function's code in the module's code section.
+CompiledFunction compile_function(const Module& module, size_t code_idx);
+
+/// Returns the code word of the compiled function at which the execution continues from the loop
+/// header at the offset in the function's unoptimized code, or null if the loop is not known.
+const CodeWord* find_osr_entry(const CompiledFunction& compiled, size_t loop_offset) noexcept;
+
+/// Returns the pointer to the first code word of the code in the module's code image.
+inline const CodeWord* get_code_words(const Module& module, const Code& code) noexcept
+{
+    return module.code_image.data() + code.image_offset;
+}
+}  // namespace fizzy
@@ -28,4 +28,9 @@ struct unsupported_feature : public std::runtime_error
     using runtime_error::runtime_error;
 };
 
+struct checkpoint_error : public std::runtime_error
+{
+    using runtime_error::runtime_error;
+};
+
 }  // namespace fizzy
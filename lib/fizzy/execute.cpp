@@ -3,22 +3,26 @@
 // SPDX-License-Identifier: Apache-2.0
 
 #include "execute.hpp"
+#include "atomics.hpp"
+#include "call_context.hpp"
+#include "code_layout.hpp"
+#include "integer_ops.hpp"
+#include "isa_level.hpp"
 #include "limits.hpp"
 #include "module.hpp"
 #include "stack.hpp"
+#include "tiering.hpp"
 #include "types.hpp"
 #include <algorithm>
 #include <cassert>
 #include <cstring>
+#include <limits>
 #include <stack>
 
 namespace fizzy
 {
 namespace
 {
-// code_offset + imm_offset + stack_height + arity
-constexpr auto BranchImmediateSize = 3 * sizeof(uint32_t) + sizeof(uint8_t);
-
 void match_imported_functions(const std::vector<FuncType>& module_imported_types,
     const std::vector<ExternalFunction>& imported_functions)
 {
@@ -41,6 +45,9 @@ void match_imported_functions(const std::vector<FuncType>& module_imported_types
 
 void match_limits(const Limits& external_limits, const Limits& module_limits)
 {
+    if (external_limits.shared != module_limits.shared)
+        throw instantiate_error("provided import's shared flag doesn't match the module's one");
+
     if (external_limits.min < module_limits.min)
         throw instantiate_error("provided import's min is below import's min defined in module");
 
@@ -234,25 +241,39 @@ uint64_t eval_constant_expression(ConstantExpression expr,
         return globals[global_idx - imported_globals.size()];
 }
 
-template <typename T>
-inline T read(const uint8_t*& input) noexcept
+/// Checks whether the interrupt of the instance's executions is requested.
+inline bool is_interrupt_requested(const Instance& instance) noexcept
 {
-    T ret;
-    __builtin_memcpy(&ret, input, sizeof(ret));
-    input += sizeof(ret);
-    return ret;
+    return instance.interrupt_requested.load(std::memory_order_relaxed);
 }
 
-void branch(
-    const Code& code, OperandStack& stack, const Instr*& pc, const uint8_t*& immediates) noexcept
+/// The way the execution of the code ends.
+enum class TrapKind : uint8_t
+{
+    none,       ///< The execution has completed.
+    trap,       ///< The execution has trapped.
+    interrupt,  ///< The execution has been stopped by the interrupt requested.
+};
+
+/// Returns the trap kind of the trapped execution result.
+inline TrapKind get_trap_kind(const execution_result& result) noexcept
 {
-    const auto code_offset = read<uint32_t>(immediates);
-    const auto imm_offset = read<uint32_t>(immediates);
-    const auto stack_height = static_cast<size_t>(read<uint32_t>(immediates));
-    const auto arity = read<uint8_t>(immediates);
+    if (!result.trapped)
+        return TrapKind::none;
+    return result.interrupted ? TrapKind::interrupt : TrapKind::trap;
+}
 
-    pc = code.instructions.data() + code_offset;
-    immediates = code.immediates.data() + imm_offset;
+/// Takes the branch of the branch instruction op. The pc points to the branch target word.
+/// The backward branches, i.e. the loop back-edges, are counted in back_edge_count.
+/// Returns true if the branch is the loop back-edge.
+bool branch(const CodeWord::Op& op, const CodeWord*& pc, OperandStack& stack,
+    uint64_t& back_edge_count) noexcept
+{
+    const auto stack_height = static_cast<size_t>(op.imm);
+    const auto arity = op.arity;
+    const bool is_back_edge = pc->target < pc;
+    back_edge_count += is_back_edge;
+    pc = pc->target;
 
     // When branch is taken, additional stack items must be dropped.
     assert(stack.size() >= stack_height + arity);
@@ -265,10 +286,39 @@ void branch(
     }
     else
         stack.shrink(stack_height);
+    return is_back_edge;
 }
 
+/// Switches the execution of the baseline code to the optimized code at the loop header the pc
+/// points to (the on-stack replacement), if the optimized code is already available.
+/// The back-edges taken so far are registered in the tiering state and the counter is reset.
+/// Returns true if the execution has been switched.
+bool replace_on_stack(TieringState& tiering, size_t code_idx, const CodeWord* code,
+    uint32_t local_count, const CodeWord*& pc, std::vector<uint64_t>& locals, OperandStack& stack,
+    uint64_t& back_edge_count)
+{
+    const auto* const optimized = tiering.check_osr(code_idx, back_edge_count);
+    back_edge_count = 0;
+    if (optimized == nullptr)
+        return false;
+
+    const auto* const entry = find_osr_entry(*optimized, static_cast<size_t>(pc - code));
+    if (entry == nullptr)
+        return false;
+
+    // The optimized code has the same locals followed by the ones added by inlining,
+    // and the same operand stack at the loop header.
+    locals.resize(locals.size() - local_count + optimized->local_count);
+    stack.reserve(static_cast<size_t>(optimized->max_stack_height));
+    pc = entry;
+    tiering.add_osr(code_idx);
+    return true;
+}
+
+/// Calls the function with the arguments from the stack and pushes its result.
+/// Returns the trap kind of the call.
 template <class F>
-bool invoke_function(
+TrapKind invoke_function(
     const FuncType& func_type, const F& func, Instance& instance, OperandStack& stack, int depth)
 {
     const auto num_args = func_type.inputs.size();
@@ -279,7 +329,7 @@ bool invoke_function(
     const auto ret = func(instance, std::move(call_args), depth + 1);
     // Bubble up traps
     if (ret.trapped)
-        return false;
+        return get_trap_kind(ret);
 
     const auto num_outputs = func_type.outputs.size();
     // NOTE: we can assume these two from validation
@@ -289,10 +339,10 @@ bool invoke_function(
     if (num_outputs != 0)
         stack.push(ret.stack[0]);
 
-    return true;
+    return TrapKind::none;
 }
 
-inline bool invoke_function(const FuncType& func_type, uint32_t func_idx, Instance& instance,
+inline TrapKind invoke_function(const FuncType& func_type, uint32_t func_idx, Instance& instance,
     OperandStack& stack, int depth)
 {
     const auto func = [func_idx](Instance& _instance, std::vector<uint64_t> args, int _depth) {
@@ -328,11 +378,10 @@ inline DstT extend(SrcT in) noexcept
 }
 
 template <typename DstT, typename SrcT = DstT>
-inline bool load_from_memory(bytes_view memory, OperandStack& stack, const uint8_t*& immediates)
+inline bool load_from_memory(bytes_view memory, OperandStack& stack, uint32_t offset)
 {
     const auto address = static_cast<uint32_t>(stack.pop());
     // NOTE: alignment is dropped by the parser
-    const auto offset = read<uint32_t>(immediates);
     // Addressing is 32-bit, but we keep the value as 64-bit to detect overflows.
     if ((uint64_t{address} + offset + sizeof(SrcT)) > memory.size())
         return false;
@@ -343,12 +392,11 @@ inline bool load_from_memory(bytes_view memory, OperandStack& stack, const uint8
 }
 
 template <typename DstT>
-inline bool store_into_memory(bytes& memory, OperandStack& stack, const uint8_t*& immediates)
+inline bool store_into_memory(bytes& memory, OperandStack& stack, uint32_t offset)
 {
     const auto value = static_cast<DstT>(stack.pop());
     const auto address = static_cast<uint32_t>(stack.pop());
     // NOTE: alignment is dropped by the parser
-    const auto offset = read<uint32_t>(immediates);
     // Addressing is 32-bit, but we keep the value as 64-bit to detect overflows.
     if ((uint64_t{address} + offset + sizeof(DstT)) > memory.size())
         return false;
@@ -357,110 +405,141 @@ inline bool store_into_memory(bytes& memory, OperandStack& stack, const uint8_t*
     return true;
 }
 
-template <typename Op>
-inline void unary_op(OperandStack& stack, Op op) noexcept
-{
-    using T = decltype(op(stack.top()));
-    stack.top() = op(static_cast<T>(stack.top()));
-}
-
-template <typename Op>
-inline void binary_op(OperandStack& stack, Op op) noexcept
-{
-    using T = decltype(op(stack.top(), stack.top()));
-    const auto val2 = static_cast<T>(stack.pop());
-    const auto val1 = static_cast<T>(stack.top());
-    stack.top() = static_cast<std::make_unsigned_t<T>>(op(val1, val2));
-}
-
-template <typename T, template <typename> class Op>
-inline void comparison_op(OperandStack& stack, Op<T> op) noexcept
+/// Loads from the memory at the address proven to be in bounds by eliminate_bounds_checks().
+template <typename DstT, typename SrcT = DstT>
+inline void load_from_memory_unchecked(
+    bytes_view memory, OperandStack& stack, uint32_t offset) noexcept
 {
-    const auto val2 = static_cast<T>(stack.pop());
-    const auto val1 = static_cast<T>(stack.top());
-    stack.top() = uint32_t{op(val1, val2)};
+    auto& value = stack.top();
+    const auto address = static_cast<uint32_t>(value);
+    assert((uint64_t{address} + offset + sizeof(SrcT)) <= memory.size());
+    value = extend<DstT>(load<SrcT>(memory, address + offset));
 }
 
-template <typename T>
-inline T shift_left(T lhs, T rhs) noexcept
+/// Stores into the memory at the address proven to be in bounds by eliminate_bounds_checks().
+template <typename DstT>
+inline void store_into_memory_unchecked(
+    bytes& memory, OperandStack& stack, uint32_t offset) noexcept
 {
-    constexpr T num_bits{sizeof(T) * 8};
-    const auto k = rhs & (num_bits - 1);
-    return lhs << k;
+    const auto value = static_cast<DstT>(stack.pop());
+    const auto address = static_cast<uint32_t>(stack.pop());
+    assert((uint64_t{address} + offset + sizeof(DstT)) <= memory.size());
+    store<DstT>(memory, address + offset, value);
 }
 
-template <typename T>
-inline T shift_right(T lhs, T rhs) noexcept
+/// Computes the number of iterations of the memory loop from the counter's and the bound's values.
+/// Returns 0 if the counter wraps around or does not reach the bound.
+uint64_t get_memory_loop_iteration_count(
+    const MemoryLoop& loop, uint32_t counter, uint32_t bound) noexcept
 {
-    constexpr T num_bits{sizeof(T) * 8};
-    const auto k = rhs & (num_bits - 1);
-    return lhs >> k;
+    // The loop body is executed before the first comparison, so there is at least one iteration.
+    const uint64_t increment = loop.counter_increment;
+    const uint64_t decrement = uint32_t(-loop.counter_increment);
+    switch (loop.condition)
+    {
+    case MemoryLoop::Condition::ne:
+    {
+        // The first iteration count at which the counter is equal to the bound.
+        const uint64_t distance = uint32_t(bound - counter);
+        const uint64_t reverse_distance = uint32_t(counter - bound);
+        if (increment != 0 && distance % increment == 0)
+            return distance / increment;
+        if (decrement != 0 && reverse_distance % decrement == 0)
+            return reverse_distance / decrement;
+        return 0;
+    }
+    case MemoryLoop::Condition::gt_u:
+    {
+        if (decrement == 0 || decrement > std::numeric_limits<int32_t>::max())
+            return 0;
+        const uint64_t n = counter > bound ? (counter - bound + decrement - 1) / decrement : 1;
+        return n * decrement <= counter ? n : 0;
+    }
+    case MemoryLoop::Condition::lt_u:
+    {
+        if (increment == 0 || increment > std::numeric_limits<int32_t>::max())
+            return 0;
+        const uint64_t n = counter < bound ? (bound - counter + increment - 1) / increment : 1;
+        return counter + n * increment <= std::numeric_limits<uint32_t>::max() ? n : 0;
+    }
+    }
+    return 0;
 }
 
-template <typename T>
-inline T rotl(T lhs, T rhs) noexcept
+/// Executes all iterations of the memory loop recognized by recognize_memory_loops().
+/// Returns false without any effect if the loop would trap or the copied ranges overlap,
+/// so the loop is executed instruction by instruction instead.
+bool execute_memory_loop(const MemoryLoop& loop, bytes* memory, uint64_t* locals)
 {
-    constexpr T num_bits{sizeof(T) * 8};
-    const auto k = rhs & (num_bits - 1);
-
-    if (k == 0)
-        return lhs;
-
-    return (lhs << k) | (lhs >> (num_bits - k));
-}
-
-template <typename T>
-inline T rotr(T lhs, T rhs) noexcept
-{
-    constexpr T num_bits{sizeof(T) * 8};
-    const auto k = rhs & (num_bits - 1);
-
-    if (k == 0)
-        return lhs;
+    if (memory == nullptr)
+        return false;
 
-    return (lhs >> k) | (lhs << (num_bits - k));
-}
+    const auto counter = static_cast<uint32_t>(locals[loop.counter_local]);
+    const auto bound =
+        loop.is_bound_local ? static_cast<uint32_t>(locals[loop.bound]) : loop.bound;
+    const auto n = get_memory_loop_iteration_count(loop, counter, bound);
+    if (n == 0)
+        return false;
 
-inline uint32_t clz32(uint32_t value) noexcept
-{
-    // NOTE: Wasm specifies this case, but C/C++ intrinsic leaves it as undefined.
-    if (value == 0)
-        return 32;
-    return static_cast<uint32_t>(__builtin_clz(value));
-}
+    const auto size = n * loop.step;
+    const uint64_t dst = static_cast<uint32_t>(locals[loop.dst_local]);
+    if (dst + size > memory->size())
+        return false;
 
-inline uint32_t ctz32(uint32_t value) noexcept
-{
-    // NOTE: Wasm specifies this case, but C/C++ intrinsic leaves it as undefined.
-    if (value == 0)
-        return 32;
-    return static_cast<uint32_t>(__builtin_ctz(value));
-}
+    if (loop.kind == MemoryLoop::Kind::copy)
+    {
+        // The forward copy is equal to memmove unless the destination follows the source
+        // in the overlapping ranges.
+        const uint64_t src = static_cast<uint32_t>(locals[loop.src_local]);
+        if (src + size > memory->size() || (dst > src && dst < src + size))
+            return false;
+        std::memmove(memory->data() + dst, memory->data() + src, size);
+        locals[loop.src_local] = static_cast<uint32_t>(src + size);
+    }
+    else
+    {
+        uint8_t pattern[sizeof(uint64_t)];
+        __builtin_memcpy(pattern, &locals[loop.src_local], sizeof(pattern));
+        if (std::all_of(pattern, pattern + loop.width, [&](uint8_t b) { return b == pattern[0]; }))
+            std::memset(memory->data() + dst, pattern[0], size);
+        else
+        {
+            for (uint64_t offset = 0; offset < size; offset += loop.width)
+                __builtin_memcpy(memory->data() + dst + offset, pattern, loop.width);
+        }
+    }
 
-inline uint32_t popcnt32(uint32_t value) noexcept
-{
-    return static_cast<uint32_t>(__builtin_popcount(value));
+    locals[loop.dst_local] = static_cast<uint32_t>(dst + size);
+    if (loop.counter_local != loop.dst_local && loop.counter_local != loop.src_local)
+    {
+        locals[loop.counter_local] =
+            static_cast<uint32_t>(counter + n * uint64_t{loop.counter_increment});
+    }
+    return true;
 }
 
-inline uint64_t clz64(uint64_t value) noexcept
+template <typename Op>
+inline void unary_op(OperandStack& stack, Op op) noexcept
 {
-    // NOTE: Wasm specifies this case, but C/C++ intrinsic leaves it as undefined.
-    if (value == 0)
-        return 64;
-    return static_cast<uint64_t>(__builtin_clzll(value));
+    using T = decltype(op(stack.top()));
+    stack.top() = op(static_cast<T>(stack.top()));
 }
 
-inline uint64_t ctz64(uint64_t value) noexcept
+template <typename Op>
+inline void binary_op(OperandStack& stack, Op op) noexcept
 {
-    // NOTE: Wasm specifies this case, but C/C++ intrinsic leaves it as undefined.
-    if (value == 0)
-        return 64;
-    return static_cast<uint64_t>(__builtin_ctzll(value));
+    using T = decltype(op(stack.top(), stack.top()));
+    const auto val2 = static_cast<T>(stack.pop());
+    const auto val1 = static_cast<T>(stack.top());
+    stack.top() = static_cast<std::make_unsigned_t<T>>(op(val1, val2));
 }
 
-inline uint64_t popcnt64(uint64_t value) noexcept
+template <typename T, template <typename> class Op>
+inline void comparison_op(OperandStack& stack, Op<T> op) noexcept
 {
-    return static_cast<uint64_t>(__builtin_popcountll(value));
+    const auto val2 = static_cast<T>(stack.pop());
+    const auto val1 = static_cast<T>(stack.top());
+    stack.top() = uint32_t{op(val1, val2)};
 }
 
 std::optional<uint32_t> find_export(const Module& module, ExternalKind kind, std::string_view name)
@@ -475,9 +554,11 @@ std::optional<uint32_t> find_export(const Module& module, ExternalKind kind, std
 
 std::unique_ptr<Instance> instantiate(Module module,
     std::vector<ExternalFunction> imported_functions, std::vector<ExternalTable> imported_tables,
-    std::vector<ExternalMemory> imported_memories, std::vector<ExternalGlobal> imported_globals)
+    std::vector<ExternalMemory> imported_memories, std::vector<ExternalGlobal> imported_globals,
+    const LayoutOptions& layout_options)
 {
     assert(module.funcsec.size() == module.codesec.size());
+    assert(layout_options.specialization == nullptr);
 
     match_imported_functions(module.imported_function_types, imported_functions);
     match_imported_tables(module.imported_table_types, imported_tables);
@@ -544,6 +625,11 @@ std::unique_ptr<Instance> instantiate(Module module,
             memory->data() + datasec_offsets[i]);
     }
 
+    // Build the executable code image from the current codesec, unless it is already built,
+    // e.g. copied by copy_code_image().
+    if (module.code_image.empty())
+        layout_code(module, layout_options);
+
     // We need to create instance before filling table,
     // because table functions will capture the pointer to instance.
     auto instance = std::make_unique<Instance>(std::move(module), std::move(memory), memory_limits,
@@ -562,8 +648,8 @@ std::unique_ptr<Instance> instantiate(Module module,
                 return execute(instance_ref, idx, std::move(args), depth);
             };
 
-            *it_table++ =
-                ExternalFunction{std::move(func), instance->module.get_function_type(idx)};
+            *it_table++ = ExternalFunction{
+                std::move(func), instance->module.get_function_type(idx), instance.get(), idx};
         }
     }
 
@@ -607,113 +693,230 @@ std::unique_ptr<Instance> instantiate(Module module,
     return instance;
 }
 
-execution_result execute(
-    Instance& instance, FuncIdx func_idx, std::vector<uint64_t> args, int depth)
+namespace
 {
-    assert(depth >= 0);
-    if (depth > CallStackLimit)
-        return {true, {}};
+template <IsaLevel Level>
+TrapKind execute_code(Instance& instance, size_t code_idx, uint64_t* frame,
+    std::vector<uint64_t>* locals_storage, int depth, uint64_t& result);
+
+/// Executes the code of the function.
+///
+/// This is built for each ISA level by inlining it in the execute_code() variants,
+/// so the inlined helpers use the instructions of the level.
+///
+/// The frame of the function consists of its locals, starting with the arguments, followed by
+/// its operand stack. The frames of the functions called from the preallocated frame start at
+/// their arguments on the operand stack, so they are preallocated as well.
+///
+/// @param instance        The instance.
+/// @param code_idx        The index of the function's code in the module's code section.
+/// @param frame           The memory preallocated for the function's FrameBound, starting with
+///                        the arguments, if the locals_storage is null.
+/// @param locals_storage  The arguments if the frame is not preallocated, extended to the locals.
+/// @param depth           The call depth, already checked against the call stack limit.
+/// @param result          The output result of the function, if it has one and the frame is
+///                        preallocated. Otherwise, the locals_storage is replaced with the result.
+/// @return                The kind of the trap ending the execution, if any.
+template <IsaLevel Level>
+__attribute__((always_inline)) inline TrapKind execute_code_body(Instance& instance,
+    size_t code_idx, uint64_t* frame, std::vector<uint64_t>* locals_storage, int depth,
+    uint64_t& result)
+{
+    const auto& code = instance.module.codesec[code_idx];
+    auto* const memory = instance.memory.get();
 
-    if (func_idx < instance.imported_functions.size())
-        return instance.imported_functions[func_idx].function(instance, std::move(args), depth);
+    const auto* const code_words = get_code_words(instance.module, code);
+    const CodeWord* pc = code_words;
+    auto local_count = code.image_local_count;
+    auto max_stack_height = code.image_max_stack_height;
 
-    const auto code_idx = func_idx - instance.imported_functions.size();
-    assert(code_idx < instance.module.codesec.size());
+    // The number of back-edges after which the on-stack replacement is checked.
+    auto osr_check_count = std::numeric_limits<uint64_t>::max();
 
-    const auto& code = instance.module.codesec[code_idx];
-    auto* const memory = instance.memory.get();
+    auto* const tiering = instance.tiering.get();
+    if (tiering != nullptr)
+    {
+        // The optimized code has other locals and the on-stack replacement resizes them,
+        // so the frames are never preallocated with the tiering, see execute().
+        assert(locals_storage != nullptr);
 
-    std::vector<uint64_t> locals = std::move(args);
-    locals.resize(locals.size() + code.local_count);
+        if (const auto* const optimized = tiering->enter(code_idx); optimized != nullptr)
+        {
+            pc = optimized->image.data();
+            local_count = optimized->local_count;
+            max_stack_height = optimized->max_stack_height;
+        }
+        else
+            osr_check_count = tiering->get_osr_check_interval();
+    }
 
-    OperandStack stack(static_cast<size_t>(code.max_stack_height));
+    const bool preallocated = locals_storage == nullptr;
+    uint64_t* locals = frame;
+    uint64_t* stack_storage = nullptr;
+    if (preallocated)
+    {
+        const auto func_idx = static_cast<FuncIdx>(instance.imported_functions.size() + code_idx);
+        const auto num_args = instance.module.get_function_type(func_idx).inputs.size();
+        std::fill_n(frame + num_args, local_count, uint64_t{0});
+        stack_storage = frame + num_args + local_count;
+    }
+    else
+    {
+        locals_storage->resize(locals_storage->size() + local_count);
+        locals = locals_storage->data();
+    }
+
+    OperandStack stack(static_cast<size_t>(max_stack_height), stack_storage);
 
-    bool trap = false;
+    auto trap = TrapKind::none;
+    uint64_t back_edge_count = 0;
 
-    const Instr* pc = code.instructions.data();
-    const uint8_t* immediates = code.immediates.data();
+    // The interrupt is checked at the function entry and at the loop back-edges.
+    if (is_interrupt_requested(instance))
+    {
+        trap = TrapKind::interrupt;
+        goto end;
+    }
 
     while (true)
     {
-        const auto instruction = *pc++;
-        switch (instruction)
+        const auto op = (pc++)->op;
+        switch (op.instr)
         {
         case Instr::unreachable:
-            trap = true;
+            trap = TrapKind::trap;
             goto end;
-        case Instr::nop:
-        case Instr::block:
-        case Instr::loop:
-            break;
         case Instr::if_:
         {
             if (static_cast<uint32_t>(stack.pop()) != 0)
-                immediates += 2 * sizeof(uint32_t);  // Skip the immediates for else instruction.
+                ++pc;  // Skip the else target.
             else
-            {
-                const auto target_pc = read<uint32_t>(immediates);
-                const auto target_imm = read<uint32_t>(immediates);
-
-                pc = code.instructions.data() + target_pc;
-                immediates = code.immediates.data() + target_imm;
-            }
+                pc = pc->target;
             break;
         }
         case Instr::else_:
         {
             // We reach else only after executing if block ("then" part),
             // so we need to skip else block now.
-            const auto target_pc = read<uint32_t>(immediates);
-            const auto target_imm = read<uint32_t>(immediates);
-
-            pc = code.instructions.data() + target_pc;
-            immediates = code.immediates.data() + target_imm;
-
+            pc = pc->target;
             break;
         }
         case Instr::end:
         {
-            // End execution if it's a final end instruction.
-            if (pc == &code.instructions[code.instructions.size()])
-                goto end;
-            break;
+            // Only the final end instruction is present in the code.
+            goto end;
         }
         case Instr::br:
         case Instr::br_if:
         case Instr::return_:
         {
             // Check condition for br_if.
-            if (instruction == Instr::br_if && static_cast<uint32_t>(stack.pop()) == 0)
+            if (op.instr == Instr::br_if && static_cast<uint32_t>(stack.pop()) == 0)
             {
-                immediates += BranchImmediateSize;
+                ++pc;  // Skip the branch target.
                 break;
             }
 
-            branch(code, stack, pc, immediates);
+            if (branch(op, pc, stack, back_edge_count) && is_interrupt_requested(instance))
+            {
+                trap = TrapKind::interrupt;
+                goto end;
+            }
+            if (back_edge_count >= osr_check_count &&
+                replace_on_stack(*tiering, code_idx, code_words, code.image_local_count, pc,
+                    *locals_storage, stack, back_edge_count))
+            {
+                locals = locals_storage->data();
+                osr_check_count = std::numeric_limits<uint64_t>::max();
+            }
+            break;
+        }
+        case Instr::memory_loop:
+        {
+            const auto* const exit = (pc++)->target;
+            MemoryLoop memory_loop;
+            __builtin_memcpy(static_cast<void*>(&memory_loop), pc, sizeof(memory_loop));
+            pc += MemoryLoopWordCount;
+            if (execute_memory_loop(memory_loop, memory, locals))
+                pc = exit;
+            break;
+        }
+        case Instr::i64_add_carry:
+        {
+            const auto addend_local_idx = (pc++)->value;
+            const auto rhs = stack.pop();
+            auto& carry = stack.top();
+            const auto sum = carry + rhs;
+            locals[op.imm] = sum;
+            carry = uint64_t{sum < locals[addend_local_idx]};
+            break;
+        }
+        case Instr::i128_mul_store:
+        {
+            const auto rhs_hi = stack.pop();
+            const auto rhs_lo = stack.pop();
+            const auto lhs_hi = stack.pop();
+            const auto lhs_lo = stack.pop();
+            const auto address = static_cast<uint32_t>(stack.pop());
+            if (uint64_t{address} + 2 * sizeof(uint64_t) > memory->size())
+            {
+                trap = TrapKind::trap;
+                goto end;
+            }
+            const auto [lo, hi] = mul128(lhs_lo, lhs_hi, rhs_lo, rhs_hi);
+            store<uint64_t>(*memory, address, lo);
+            store<uint64_t>(*memory, address + sizeof(uint64_t), hi);
             break;
         }
         case Instr::br_table:
         {
-            const auto br_table_size = read<uint32_t>(immediates);
+            const auto br_table_size = op.imm;
             const auto br_table_idx = stack.pop();
 
-            const auto label_idx_offset = br_table_idx < br_table_size ?
-                                              br_table_idx * BranchImmediateSize :
-                                              br_table_size * BranchImmediateSize;
-            immediates += label_idx_offset;
+            // Each label is the branch instruction word followed by the branch target word.
+            const auto label_idx = br_table_idx < br_table_size ? br_table_idx : br_table_size;
+            pc += 2 * label_idx;
+            const auto label = (pc++)->op;
 
-            branch(code, stack, pc, immediates);
+            if (branch(label, pc, stack, back_edge_count) && is_interrupt_requested(instance))
+            {
+                trap = TrapKind::interrupt;
+                goto end;
+            }
+            if (back_edge_count >= osr_check_count &&
+                replace_on_stack(*tiering, code_idx, code_words, code.image_local_count, pc,
+                    *locals_storage, stack, back_edge_count))
+            {
+                locals = locals_storage->data();
+                osr_check_count = std::numeric_limits<uint64_t>::max();
+            }
             break;
         }
         case Instr::call:
         {
-            const auto called_func_idx = read<uint32_t>(immediates);
+            const auto called_func_idx = op.imm;
             const auto& func_type = instance.module.get_function_type(called_func_idx);
+            const auto num_imported_functions = instance.imported_functions.size();
 
-            if (!invoke_function(func_type, called_func_idx, instance, stack, depth))
+            if (preallocated && called_func_idx >= num_imported_functions)
             {
-                trap = true;
-                goto end;
+                // The called function is within the bound of this frame, so neither its frame
+                // is allocated nor its call depth is checked.
+                auto* const called_frame = stack.drop(func_type.inputs.size());
+
+                uint64_t called_result = 0;
+                trap = execute_code<Level>(instance, called_func_idx - num_imported_functions,
+                    called_frame, nullptr, depth + 1, called_result);
+                if (trap != TrapKind::none)
+                    goto end;
+                if (!func_type.outputs.empty())
+                    stack.push(called_result);
+            }
+            else
+            {
+                trap = invoke_function(func_type, called_func_idx, instance, stack, depth);
+                if (trap != TrapKind::none)
+                    goto end;
             }
             break;
         }
@@ -721,20 +924,20 @@ execution_result execute(
         {
             assert(instance.table != nullptr);
 
-            const auto expected_type_idx = read<uint32_t>(immediates);
+            const auto expected_type_idx = op.imm;
             assert(expected_type_idx < instance.module.typesec.size());
 
             const auto elem_idx = stack.pop();
             if (elem_idx >= instance.table->size())
             {
-                trap = true;
+                trap = TrapKind::trap;
                 goto end;
             }
 
             const auto called_func = (*instance.table)[elem_idx];
             if (!called_func.has_value())
             {
-                trap = true;
+                trap = TrapKind::trap;
                 goto end;
             }
 
@@ -743,15 +946,17 @@ execution_result execute(
             const auto& expected_type = instance.module.typesec[expected_type_idx];
             if (expected_type != actual_type)
             {
-                trap = true;
+                trap = TrapKind::trap;
                 goto end;
             }
 
-            if (!invoke_function(actual_type, called_func->function, instance, stack, depth))
             {
-                trap = true;
-                goto end;
+                // The table may contain the host functions, see execute().
+                const LaneCallScope nested_call_scope;
+                trap = invoke_function(actual_type, called_func->function, instance, stack, depth);
             }
+            if (trap != TrapKind::none)
+                goto end;
             break;
         }
         case Instr::drop:
@@ -773,28 +978,25 @@ execution_result execute(
         }
         case Instr::local_get:
         {
-            const auto idx = read<uint32_t>(immediates);
-            assert(idx <= locals.size());
+            const auto idx = op.imm;
             stack.push(locals[idx]);
             break;
         }
         case Instr::local_set:
         {
-            const auto idx = read<uint32_t>(immediates);
-            assert(idx <= locals.size());
+            const auto idx = op.imm;
             locals[idx] = stack.pop();
             break;
         }
         case Instr::local_tee:
         {
-            const auto idx = read<uint32_t>(immediates);
-            assert(idx <= locals.size());
+            const auto idx = op.imm;
             locals[idx] = stack.top();
             break;
         }
         case Instr::global_get:
         {
-            const auto idx = read<uint32_t>(immediates);
+            const auto idx = op.imm;
             assert(idx < instance.imported_globals.size() + instance.globals.size());
             if (idx < instance.imported_globals.size())
             {
@@ -810,7 +1012,7 @@ execution_result execute(
         }
         case Instr::global_set:
         {
-            const auto idx = read<uint32_t>(immediates);
+            const auto idx = op.imm;
             if (idx < instance.imported_globals.size())
             {
                 assert(instance.imported_globals[idx].is_mutable);
@@ -825,128 +1027,134 @@ execution_result execute(
             }
             break;
         }
+        case Instr::global_get_direct:
+            stack.push(*reinterpret_cast<const uint64_t*>((pc++)->value));
+            break;
+        case Instr::global_set_direct:
+            *reinterpret_cast<uint64_t*>((pc++)->value) = stack.pop();
+            break;
         case Instr::i32_load:
         {
-            if (!load_from_memory<uint32_t>(*memory, stack, immediates))
+            if (!load_from_memory<uint32_t>(*memory, stack, op.imm))
             {
-                trap = true;
+                trap = TrapKind::trap;
                 goto end;
             }
             break;
         }
         case Instr::i64_load:
         {
-            if (!load_from_memory<uint64_t>(*memory, stack, immediates))
+            if (!load_from_memory<uint64_t>(*memory, stack, op.imm))
             {
-                trap = true;
+                trap = TrapKind::trap;
                 goto end;
             }
             break;
         }
         case Instr::i32_load8_s:
         {
-            if (!load_from_memory<uint32_t, int8_t>(*memory, stack, immediates))
+            if (!load_from_memory<uint32_t, int8_t>(*memory, stack, op.imm))
             {
-                trap = true;
+                trap = TrapKind::trap;
                 goto end;
             }
             break;
         }
         case Instr::i32_load8_u:
         {
-            if (!load_from_memory<uint32_t, uint8_t>(*memory, stack, immediates))
+            if (!load_from_memory<uint32_t, uint8_t>(*memory, stack, op.imm))
             {
-                trap = true;
+                trap = TrapKind::trap;
                 goto end;
             }
             break;
         }
         case Instr::i32_load16_s:
         {
-            if (!load_from_memory<uint32_t, int16_t>(*memory, stack, immediates))
+            if (!load_from_memory<uint32_t, int16_t>(*memory, stack, op.imm))
             {
-                trap = true;
+                trap = TrapKind::trap;
                 goto end;
             }
             break;
         }
         case Instr::i32_load16_u:
         {
-            if (!load_from_memory<uint32_t, uint16_t>(*memory, stack, immediates))
+            if (!load_from_memory<uint32_t, uint16_t>(*memory, stack, op.imm))
             {
-                trap = true;
+                trap = TrapKind::trap;
                 goto end;
             }
             break;
         }
         case Instr::i64_load8_s:
         {
-            if (!load_from_memory<uint64_t, int8_t>(*memory, stack, immediates))
+            if (!load_from_memory<uint64_t, int8_t>(*memory, stack, op.imm))
             {
-                trap = true;
+                trap = TrapKind::trap;
                 goto end;
             }
             break;
         }
         case Instr::i64_load8_u:
         {
-            if (!load_from_memory<uint64_t, uint8_t>(*memory, stack, immediates))
+            if (!load_from_memory<uint64_t, uint8_t>(*memory, stack, op.imm))
             {
-                trap = true;
+                trap = TrapKind::trap;
                 goto end;
             }
             break;
         }
         case Instr::i64_load16_s:
         {
-            if (!load_from_memory<uint64_t, int16_t>(*memory, stack, immediates))
+            if (!load_from_memory<uint64_t, int16_t>(*memory, stack, op.imm))
             {
-                trap = true;
+                trap = TrapKind::trap;
                 goto end;
             }
             break;
         }
         case Instr::i64_load16_u:
         {
-            if (!load_from_memory<uint64_t, uint16_t>(*memory, stack, immediates))
+            if (!load_from_memory<uint64_t, uint16_t>(*memory, stack, op.imm))
             {
-                trap = true;
+                trap = TrapKind::trap;
                 goto end;
             }
             break;
         }
         case Instr::i64_load32_s:
         {
-            if (!load_from_memory<uint64_t, int32_t>(*memory, stack, immediates))
+            if (!load_from_memory<uint64_t, int32_t>(*memory, stack, op.imm))
             {
-                trap = true;
+                trap = TrapKind::trap;
                 goto end;
             }
             break;
         }
         case Instr::i64_load32_u:
         {
-            if (!load_from_memory<uint64_t, uint32_t>(*memory, stack, immediates))
+            if (!load_from_memory<uint64_t, uint32_t>(*memory, stack, op.imm))
             {
-                trap = true;
+                trap = TrapKind::trap;
                 goto end;
             }
             break;
         }
         case Instr::i32_store:
         {
-            if (!store_into_memory<uint32_t>(*memory, stack, immediates))
+            if (!store_into_memory<uint32_t>(*memory, stack, op.imm))
             {
-                trap = true;
+                trap = TrapKind::trap;
                 goto end;
             }
             break;
         }
         case Instr::i64_store:
         {
-            if (!store_into_memory<uint64_t>(*memory, stack, immediates))
+            if (!store_into_memory<uint64_t>(*memory, stack, op.imm))
             {
-                trap = true;
+                trap = TrapKind::trap;
                 goto end;
             }
             break;
@@ -954,9 +1162,9 @@ execution_result execute(
         case Instr::i32_store8:
         case Instr::i64_store8:
         {
-            if (!store_into_memory<uint8_t>(*memory, stack, immediates))
+            if (!store_into_memory<uint8_t>(*memory, stack, op.imm))
             {
-                trap = true;
+                trap = TrapKind::trap;
                 goto end;
             }
             break;
@@ -964,22 +1172,75 @@ execution_result execute(
         case Instr::i32_store16:
         case Instr::i64_store16:
         {
-            if (!store_into_memory<uint16_t>(*memory, stack, immediates))
+            if (!store_into_memory<uint16_t>(*memory, stack, op.imm))
             {
-                trap = true;
+                trap = TrapKind::trap;
                 goto end;
             }
             break;
         }
         case Instr::i64_store32:
         {
-            if (!store_into_memory<uint32_t>(*memory, stack, immediates))
+            if (!store_into_memory<uint32_t>(*memory, stack, op.imm))
             {
-                trap = true;
+                trap = TrapKind::trap;
                 goto end;
             }
             break;
         }
+        case Instr::i32_load_unchecked:
+            load_from_memory_unchecked<uint32_t>(*memory, stack, op.imm);
+            break;
+        case Instr::i64_load_unchecked:
+            load_from_memory_unchecked<uint64_t>(*memory, stack, op.imm);
+            break;
+        case Instr::i32_load8_s_unchecked:
+            load_from_memory_unchecked<uint32_t, int8_t>(*memory, stack, op.imm);
+            break;
+        case Instr::i32_load8_u_unchecked:
+            load_from_memory_unchecked<uint32_t, uint8_t>(*memory, stack, op.imm);
+            break;
+        case Instr::i32_load16_s_unchecked:
+            load_from_memory_unchecked<uint32_t, int16_t>(*memory, stack, op.imm);
+            break;
+        case Instr::i32_load16_u_unchecked:
+            load_from_memory_unchecked<uint32_t, uint16_t>(*memory, stack, op.imm);
+            break;
+        case Instr::i64_load8_s_unchecked:
+            load_from_memory_unchecked<uint64_t, int8_t>(*memory, stack, op.imm);
+            break;
+        case Instr::i64_load8_u_unchecked:
+            load_from_memory_unchecked<uint64_t, uint8_t>(*memory, stack, op.imm);
+            break;
+        case Instr::i64_load16_s_unchecked:
+            load_from_memory_unchecked<uint64_t, int16_t>(*memory, stack, op.imm);
+            break;
+        case Instr::i64_load16_u_unchecked:
+            load_from_memory_unchecked<uint64_t, uint16_t>(*memory, stack, op.imm);
+            break;
+        case Instr::i64_load32_s_unchecked:
+            load_from_memory_unchecked<uint64_t, int32_t>(*memory, stack, op.imm);
+            break;
+        case Instr::i64_load32_u_unchecked:
+            load_from_memory_unchecked<uint64_t, uint32_t>(*memory, stack, op.imm);
+            break;
+        case Instr::i32_store_unchecked:
+            store_into_memory_unchecked<uint32_t>(*memory, stack, op.imm);
+            break;
+        case Instr::i64_store_unchecked:
+            store_into_memory_unchecked<uint64_t>(*memory, stack, op.imm);
+            break;
+        case Instr::i32_store8_unchecked:
+        case Instr::i64_store8_unchecked:
+            store_into_memory_unchecked<uint8_t>(*memory, stack, op.imm);
+            break;
+        case Instr::i32_store16_unchecked:
+        case Instr::i64_store16_unchecked:
+            store_into_memory_unchecked<uint16_t>(*memory, stack, op.imm);
+            break;
+        case Instr::i64_store32_unchecked:
+            store_into_memory_unchecked<uint32_t>(*memory, stack, op.imm);
+            break;
         case Instr::memory_size:
         {
             stack.push(static_cast<uint32_t>(memory->size() / PageSize));
@@ -998,7 +1259,8 @@ execution_result execute(
                 const size_t memory_max_pages =
                     (instance.memory_limits.max.has_value() ? *instance.memory_limits.max :
                                                               MemoryPagesLimit);
-                if (new_pages > memory_max_pages)
+                // The shared memory is not grown, as the other threads access it.
+                if (new_pages > memory_max_pages || (delta != 0 && instance.memory_limits.shared))
                     throw std::bad_alloc();
                 memory->resize(new_pages * PageSize);
             }
@@ -1009,16 +1271,39 @@ execution_result execute(
             stack.push(ret);
             break;
         }
+        case Instr::atomic_load:
+        case Instr::atomic_store:
+        case Instr::atomic_rmw:
+        case Instr::atomic_cmpxchg:
+        {
+            uint64_t operands[2]{};
+            if (op.instr == Instr::atomic_cmpxchg)
+                operands[1] = stack.pop();
+            if (op.instr != Instr::atomic_load)
+                operands[0] = stack.pop();
+            const auto address = static_cast<uint32_t>(stack.pop());
+            uint64_t value = 0;
+            if (!execute_atomic(static_cast<AtomicOp>(op.arity), *memory,
+                    instance.memory_limits.shared, address, op.imm, operands, value))
+            {
+                trap = TrapKind::trap;
+                goto end;
+            }
+            if (op.instr != Instr::atomic_store)
+                stack.push(value);
+            break;
+        }
+        case Instr::atomic_fence:
+            atomic_fence();
+            break;
         case Instr::i32_const:
         {
-            const auto value = read<uint32_t>(immediates);
-            stack.push(value);
+            stack.push(op.imm);
             break;
         }
         case Instr::i64_const:
         {
-            const auto value = read<uint64_t>(immediates);
-            stack.push(value);
+            stack.push((pc++)->value);
             break;
         }
         case Instr::i32_eqz:
@@ -1168,7 +1453,7 @@ execution_result execute(
             auto const lhs = static_cast<int32_t>(stack[1]);
             if (rhs == 0 || (lhs == std::numeric_limits<int32_t>::min() && rhs == -1))
             {
-                trap = true;
+                trap = TrapKind::trap;
                 goto end;
             }
             binary_op(stack, std::divides<int32_t>());
@@ -1179,7 +1464,7 @@ execution_result execute(
             auto const rhs = static_cast<uint32_t>(stack.top());
             if (rhs == 0)
             {
-                trap = true;
+                trap = TrapKind::trap;
                 goto end;
             }
             binary_op(stack, std::divides<uint32_t>());
@@ -1190,7 +1475,7 @@ execution_result execute(
             auto const rhs = static_cast<int32_t>(stack.top());
             if (rhs == 0)
             {
-                trap = true;
+                trap = TrapKind::trap;
                 goto end;
             }
             auto const lhs = static_cast<int32_t>(stack[1]);
@@ -1208,7 +1493,7 @@ execution_result execute(
             auto const rhs = static_cast<uint32_t>(stack.top());
             if (rhs == 0)
             {
-                trap = true;
+                trap = TrapKind::trap;
                 goto end;
             }
             binary_op(stack, std::modulus<uint32_t>());
@@ -1290,7 +1575,7 @@ execution_result execute(
             auto const lhs = static_cast<int64_t>(stack[1]);
             if (rhs == 0 || (lhs == std::numeric_limits<int64_t>::min() && rhs == -1))
             {
-                trap = true;
+                trap = TrapKind::trap;
                 goto end;
             }
             binary_op(stack, std::divides<int64_t>());
@@ -1301,7 +1586,7 @@ execution_result execute(
             auto const rhs = static_cast<uint64_t>(stack.top());
             if (rhs == 0)
             {
-                trap = true;
+                trap = TrapKind::trap;
                 goto end;
             }
             binary_op(stack, std::divides<uint64_t>());
@@ -1312,7 +1597,7 @@ execution_result execute(
             auto const rhs = static_cast<int64_t>(stack.top());
             if (rhs == 0)
             {
-                trap = true;
+                trap = TrapKind::trap;
                 goto end;
             }
             auto const lhs = static_cast<int64_t>(stack[1]);
@@ -1330,7 +1615,7 @@ execution_result execute(
             auto const rhs = static_cast<uint64_t>(stack.top());
             if (rhs == 0)
             {
-                trap = true;
+                trap = TrapKind::trap;
                 goto end;
             }
             binary_op(stack, std::modulus<uint64_t>());
@@ -1468,8 +1753,164 @@ execution_result execute(
     }
 
 end:
-    assert(pc == &code.instructions[code.instructions.size()] || trap);
-    return {trap, {stack.rbegin(), stack.rend()}};
+    assert(trap != TrapKind::none || pc[-1].op.instr == Instr::end);
+    if (tiering != nullptr)
+        tiering->add_back_edges(code_idx, back_edge_count);
+    if (!preallocated)
+        locals_storage->assign(stack.rbegin(), stack.rend());
+    else if (trap == TrapKind::none && stack.size() != 0)
+        result = stack.top();
+    return trap;
+}
+
+template <>
+TrapKind execute_code<IsaLevel::baseline>(Instance& instance, size_t code_idx, uint64_t* frame,
+    std::vector<uint64_t>* locals_storage, int depth, uint64_t& result)
+{
+    return execute_code_body<IsaLevel::baseline>(
+        instance, code_idx, frame, locals_storage, depth, result);
+}
+
+#if FIZZY_ISA_MULTIVERSIONING
+template <>
+FIZZY_TARGET_X86_64_V2 TrapKind execute_code<IsaLevel::x86_64_v2>(Instance& instance,
+    size_t code_idx, uint64_t* frame, std::vector<uint64_t>* locals_storage, int depth,
+    uint64_t& result)
+{
+    return execute_code_body<IsaLevel::x86_64_v2>(
+        instance, code_idx, frame, locals_storage, depth, result);
+}
+
+template <>
+FIZZY_TARGET_X86_64_V3 TrapKind execute_code<IsaLevel::x86_64_v3>(Instance& instance,
+    size_t code_idx, uint64_t* frame, std::vector<uint64_t>* locals_storage, int depth,
+    uint64_t& result)
+{
+    return execute_code_body<IsaLevel::x86_64_v3>(
+        instance, code_idx, frame, locals_storage, depth, result);
+}
+#endif
+
+/// Executes the code of the function with the variant of the selected ISA level.
+inline TrapKind execute_code(Instance& instance, size_t code_idx, uint64_t* frame,
+    std::vector<uint64_t>* locals_storage, int depth, uint64_t& result)
+{
+    switch (get_isa_level())
+    {
+#if FIZZY_ISA_MULTIVERSIONING
+    case IsaLevel::x86_64_v3:
+        return execute_code<IsaLevel::x86_64_v3>(
+            instance, code_idx, frame, locals_storage, depth, result);
+    case IsaLevel::x86_64_v2:
+        return execute_code<IsaLevel::x86_64_v2>(
+            instance, code_idx, frame, locals_storage, depth, result);
+#endif
+    default:
+        return execute_code<IsaLevel::baseline>(
+            instance, code_idx, frame, locals_storage, depth, result);
+    }
+}
+}  // namespace
+
+execution_result execute(
+    Instance& instance, FuncIdx func_idx, std::vector<uint64_t> args, int depth)
+{
+    assert(depth >= 0);
+    if (depth > CallStackLimit)
+        return {true, {}};
+
+    if (func_idx < instance.imported_functions.size())
+    {
+        // The imported function called by the nested execution cannot defer the call
+        // of the lane execution.
+        const LaneCallScope nested_call_scope;
+        return instance.imported_functions[func_idx].function(instance, std::move(args), depth);
+    }
+
+    const auto code_idx = func_idx - instance.imported_functions.size();
+    assert(code_idx < instance.module.codesec.size());
+
+    // The frames of the whole call path are preallocated at once if their size is known and
+    // the deepest call is within the limit. The optimized code of the tiering has other frames.
+    const auto& bound = instance.module.codesec[code_idx].image_frame_bound;
+    if (bound.has_value() && instance.tiering == nullptr &&
+        depth + bound->call_depth <= CallStackLimit)
+    {
+        // The memory is not initialized, the functions initialize their locals themselves.
+        const std::unique_ptr<uint64_t[]> frame{new uint64_t[bound->frame_size]};
+        std::copy(args.begin(), args.end(), frame.get());
+        uint64_t result = 0;
+        const auto trap = execute_code(instance, code_idx, frame.get(), nullptr, depth, result);
+        if (trap != TrapKind::none)
+            return {true, {}, trap == TrapKind::interrupt};
+        if (instance.module.get_function_type(func_idx).outputs.empty())
+            return {false, {}};
+        return {false, {result}};
+    }
+
+    // The storage of the arguments is reused for the locals and the result.
+    uint64_t unused_result = 0;
+    const auto trap = execute_code(instance, code_idx, nullptr, &args, depth, unused_result);
+    if (trap != TrapKind::none)
+        return {true, {}, trap == TrapKind::interrupt};
+    return {false, std::move(args)};
+}
+
+size_t execute_batch(Instance& instance, FuncIdx func_idx, const uint64_t* args, size_t num_calls,
+    uint64_t* results)
+{
+    const auto& func_type = instance.module.get_function_type(func_idx);
+    const auto num_args = func_type.inputs.size();
+    const bool has_result = !func_type.outputs.empty();
+
+    if (func_idx < instance.imported_functions.size())
+    {
+        for (size_t i = 0; i < num_calls; ++i)
+        {
+            const auto* const call_args = args + i * num_args;
+            const auto result = execute(instance, func_idx, {call_args, call_args + num_args});
+            if (result.trapped)
+                return i;
+            if (has_result)
+                results[i] = result.stack[0];
+        }
+        return num_calls;
+    }
+
+    const auto code_idx = func_idx - instance.imported_functions.size();
+    assert(code_idx < instance.module.codesec.size());
+
+    // The frame is preallocated once, as in execute().
+    const auto& bound = instance.module.codesec[code_idx].image_frame_bound;
+    if (bound.has_value() && instance.tiering == nullptr && bound->call_depth <= CallStackLimit)
+    {
+        const std::unique_ptr<uint64_t[]> frame{new uint64_t[bound->frame_size]};
+        for (size_t i = 0; i < num_calls; ++i)
+        {
+            std::copy_n(args + i * num_args, num_args, frame.get());
+            uint64_t result = 0;
+            if (execute_code(instance, code_idx, frame.get(), nullptr, 0, result) !=
+                TrapKind::none)
+                return i;
+            if (has_result)
+                results[i] = result;
+        }
+        return num_calls;
+    }
+
+    // The storage of the arguments, the locals and the result keeps its capacity between calls.
+    std::vector<uint64_t> locals_storage;
+    for (size_t i = 0; i < num_calls; ++i)
+    {
+        locals_storage.assign(args + i * num_args, args + (i + 1) * num_args);
+        uint64_t unused_result = 0;
+        if (execute_code(instance, code_idx, nullptr, &locals_storage, 0, unused_result) !=
+            TrapKind::none)
+            return i;
+        if (has_result)
+            results[i] = locals_storage[0];
+    }
+    return num_calls;
 }
 
 execution_result execute(const Module& module, FuncIdx func_idx, std::vector<uint64_t> args)
@@ -1541,7 +1982,8 @@ std::optional<ExternalFunction> find_exported_function(Instance& instance, std::
         return execute(instance, idx, std::move(args), depth);
     };
 
-    return ExternalFunction{std::move(func), instance.module.get_function_type(idx)};
+    return ExternalFunction{
+        std::move(func), instance.module.get_function_type(idx), &instance, idx};
 }
 
 std::optional<ExternalGlobal> find_exported_global(Instance& instance, std::string_view name)
@@ -4,9 +4,11 @@
 
 #pragma once
 
+#include "code_layout.hpp"
 #include "exceptions.hpp"
 #include "module.hpp"
 #include "types.hpp"
+#include <atomic>
 #include <cstdint>
 #include <functional>
 #include <memory>
@@ -21,6 +23,8 @@ struct execution_result
     // the resulting stack (e.g. return values)
     // NOTE: this can be either 0 or 1 items
     std::vector<uint64_t> stack;
+    // true if execution trapped because of the interrupt requested (see Instance)
+    bool interrupted = false;
 };
 
 struct Instance;
@@ -29,6 +33,10 @@ struct ExternalFunction
 {
     std::function<execution_result(Instance&, std::vector<uint64_t>, int depth)> function;
     FuncType type;
+    // The instance and the index of its function, if the function only executes it, e.g. the
+    // table element of the instance's own function. Lets the lane execution enter the function.
+    Instance* instance = nullptr;
+    FuncIdx func_idx = 0;
 };
 
 using table_elements = std::vector<std::optional<ExternalFunction>>;
@@ -54,6 +62,9 @@ struct ExternalGlobal
 
 using bytes_ptr = std::unique_ptr<bytes, void (*)(bytes*)>;
 
+class TieringState;
+using tiering_ptr = std::unique_ptr<TieringState, void (*)(TieringState*)>;
+
 // The module instance.
 struct Instance
 {
@@ -70,6 +81,13 @@ struct Instance
     std::vector<uint64_t> globals;
     std::vector<ExternalFunction> imported_functions;
     std::vector<ExternalGlobal> imported_globals;
+    // The state of the tiered execution, null unless enabled with enable_tiering().
+    // Must be destroyed first, as the background compilation uses the module.
+    tiering_ptr tiering = {nullptr, [](TieringState*) {}};
+    // Set by any thread to interrupt the executions of the instance, e.g. by a watchdog
+    // enforcing a deadline. These trap with the interrupted result at the next loop back-edge or
+    // function call. The flag stays set until cleared.
+    std::atomic<bool> interrupt_requested{false};
 
     Instance(Module _module, bytes_ptr _memory, Limits _memory_limits, table_ptr _table,
         Limits _table_limits, std::vector<uint64_t> _globals,
@@ -87,16 +105,27 @@ struct Instance
 };
 
 // Instantiate a module.
+// The module's code is laid out with the layout_options before the start function is executed,
+// e.g. without the optimizations to instantiate faster. The code cannot be specialized yet,
+// see specialize(). The code already laid out, e.g. copied by copy_code_image(), is kept and
+// the layout_options are ignored.
 std::unique_ptr<Instance> instantiate(Module module,
     std::vector<ExternalFunction> imported_functions = {},
     std::vector<ExternalTable> imported_tables = {},
     std::vector<ExternalMemory> imported_memories = {},
-    std::vector<ExternalGlobal> imported_globals = {});
+    std::vector<ExternalGlobal> imported_globals = {}, const LayoutOptions& layout_options = {});
 
 // Execute a function on an instance.
 execution_result execute(
     Instance& instance, FuncIdx func_idx, std::vector<uint64_t> args, int depth = 0);
 
+// Execute a function on an instance once for each of num_calls sets of arguments.
+// The args are the arguments of the consecutive calls, the results receive the result of each
+// call (untouched if the function has none). The type lookups and the call frame are shared by
+// all calls. Stops at the first trapping call and returns the number of calls completed before it.
+size_t execute_batch(Instance& instance, FuncIdx func_idx, const uint64_t* args, size_t num_calls,
+    uint64_t* results);
+
 // TODO: remove this helper
 execution_result execute(const Module& module, FuncIdx func_idx, std::vector<uint64_t> args);
 
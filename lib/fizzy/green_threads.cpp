@@ -0,0 +1,178 @@
+// Fizzy: A fast WebAssembly interpreter
+// Copyright 2020 The Fizzy Authors.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "green_threads.hpp"
+#include <algorithm>
+#include <cassert>
+
+namespace fizzy
+{
+namespace
+{
+/// Returns the latency at the given percentile of the sorted latencies.
+std::chrono::nanoseconds percentile(
+    const std::vector<std::chrono::nanoseconds>& sorted_latencies, size_t percent) noexcept
+{
+    assert(!sorted_latencies.empty());
+    const auto rank = (sorted_latencies.size() * percent + 99) / 100;
+    return sorted_latencies[std::max(rank, size_t{1}) - 1];
+}
+}  // namespace
+
+GreenThreadScheduler::GreenThreadScheduler(size_t num_threads, uint64_t quantum)
+  : m_quantum{std::max(quantum, uint64_t{1})}
+{
+    num_threads = std::max(num_threads, size_t{1});
+    m_workers.reserve(num_threads);
+    for (size_t i = 0; i < num_threads; ++i)
+        m_workers.emplace_back([this] { run_worker(); });
+}
+
+GreenThreadScheduler::~GreenThreadScheduler()
+{
+    wait();
+    {
+        const std::lock_guard lock{m_mutex};
+        m_stopping = true;
+    }
+    m_threads_available.notify_all();
+    for (auto& worker : m_workers)
+        worker.join();
+}
+
+void GreenThreadScheduler::spawn(const LaneCode& code, Instance& instance, FuncIdx func_idx,
+    const std::vector<uint64_t>& args, GreenThreadCallback callback)
+{
+    const auto spawn_time = std::chrono::steady_clock::now();
+    auto thread = std::make_unique<GreenThread>(
+        GreenThread{LaneExecution{code, {&instance}, func_idx, args.data()}, std::move(callback),
+            spawn_time});
+    {
+        const std::lock_guard lock{m_mutex};
+        if (m_latencies.empty() && m_num_pending == 0)
+            m_first_spawn_time = spawn_time;
+        ++m_num_pending;
+        m_run_queue.emplace_back(std::move(thread));
+    }
+    m_threads_available.notify_one();
+}
+
+void GreenThreadScheduler::make_ready(std::unique_ptr<GreenThread> thread)
+{
+    {
+        const std::lock_guard lock{m_mutex};
+        m_run_queue.emplace_back(std::move(thread));
+    }
+    m_threads_available.notify_one();
+}
+
+void GreenThreadScheduler::run_worker()
+{
+    std::unique_lock lock{m_mutex};
+    while (true)
+    {
+        m_threads_available.wait(lock, [this] { return m_stopping || !m_run_queue.empty(); });
+        if (m_run_queue.empty())
+            return;
+
+        auto thread = std::move(m_run_queue.front());
+        m_run_queue.pop_front();
+        lock.unlock();
+
+        auto fuel = m_quantum;
+        bool completed = false;
+        bool failed = false;
+        try
+        {
+            completed = thread->execution.resume(fuel);
+        }
+        catch (...)
+        {
+            // The exception thrown by the execution, e.g. by the host function, completes
+            // the green thread with the trap.
+            completed = true;
+            failed = true;
+        }
+
+        if (!completed && thread->execution.is_waiting())
+        {
+            // The green thread leaves the workers until its pending call completes.
+            auto& execution = thread->execution;
+            execution.when_ready([this, waiting = thread.release()] {
+                make_ready(std::unique_ptr<GreenThread>{waiting});
+            });
+            lock.lock();
+            ++m_num_waits;
+            continue;
+        }
+
+        if (!completed)
+        {
+            lock.lock();
+            ++m_num_preemptions;
+            m_run_queue.emplace_back(std::move(thread));
+            continue;
+        }
+
+        const auto completion_time = std::chrono::steady_clock::now();
+        const auto latency = completion_time - thread->spawn_time;
+        if (thread->callback)
+        {
+            thread->callback(failed ? execution_result{true, {}} :
+                                      std::move(thread->execution).results().front());
+        }
+        thread.reset();
+
+        lock.lock();
+        m_latencies.emplace_back(latency);
+        m_last_completion_time = completion_time;
+        if (--m_num_pending == 0)
+            m_all_done.notify_all();
+    }
+}
+
+void GreenThreadScheduler::wait()
+{
+    std::unique_lock lock{m_mutex};
+    m_all_done.wait(lock, [this] { return m_num_pending == 0; });
+}
+
+GreenThreadStats GreenThreadScheduler::get_stats()
+{
+    std::vector<std::chrono::nanoseconds> latencies;
+    GreenThreadStats stats;
+    {
+        const std::lock_guard lock{m_mutex};
+        latencies = m_latencies;
+        stats.num_preemptions = m_num_preemptions;
+        stats.num_waits = m_num_waits;
+        stats.num_completed = latencies.size();
+        if (!latencies.empty())
+        {
+            const std::chrono::duration<double> elapsed =
+                m_last_completion_time - m_first_spawn_time;
+            if (elapsed.count() > 0)
+                stats.throughput = static_cast<double>(latencies.size()) / elapsed.count();
+        }
+    }
+
+    if (!latencies.empty())
+    {
+        std::sort(latencies.begin(), latencies.end());
+        stats.latency_p50 = percentile(latencies, 50);
+        stats.latency_p99 = percentile(latencies, 99);
+        stats.latency_max = latencies.back();
+    }
+    return stats;
+}
+
+void GreenThreadScheduler::reset_stats()
+{
+    const std::lock_guard lock{m_mutex};
+    m_latencies.clear();
+    m_num_preemptions = 0;
+    m_num_waits = 0;
+    m_first_spawn_time = std::chrono::steady_clock::now();
+}
+}  // namespace fizzy
@@ -0,0 +1,122 @@
+// Fizzy: A fast WebAssembly interpreter
+// Copyright 2020 The Fizzy Authors.
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include "execute.hpp"
+#include "lanes.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace fizzy
+{
+/// The callback receiving the result of the green thread. It is called by the worker thread
+/// which completed the execution and must not throw. The exception thrown by the execution,
+/// e.g. by the host function, is reported as the trap.
+using GreenThreadCallback = std::function<void(execution_result result)>;
+
+/// The statistics of the green threads completed since the scheduler was created or the statistics
+/// were reset.
+struct GreenThreadStats
+{
+    size_t num_completed = 0;
+
+    /// The number of times the green threads were suspended because their fuel ran out.
+    size_t num_preemptions = 0;
+
+    /// The number of times the green threads were suspended waiting for the pending calls.
+    size_t num_waits = 0;
+
+    /// The completed green threads per second, from the first spawn to the last completion.
+    double throughput = 0;
+
+    /// The percentiles of the latency from the spawn to the completion.
+    std::chrono::nanoseconds latency_p50{0};
+    std::chrono::nanoseconds latency_p99{0};
+    std::chrono::nanoseconds latency_max{0};
+};
+
+/// The scheduler multiplexing many executions (green threads) over few worker threads
+/// (experimental).
+///
+/// The green threads wait in the single run queue. The worker takes the first one and executes
+/// it with the fuel of the quantum, see LaneExecution. When the fuel runs out, the green thread
+/// is suspended and put at the end of the queue, so the long executions do not starve
+/// the short ones. Only the calls of the host functions and of the functions of other instances
+/// are not preempted, see LaneExecution.
+///
+/// The green thread waiting for the pending calls of the imported functions, see
+/// defer_current_call(), does not occupy the worker. It is put at the end of the queue when any
+/// of the calls completes. So few workers can run many green threads waiting for the I/O.
+/// All pending calls must be completed eventually, the scheduler waits for them.
+class GreenThreadScheduler
+{
+    struct GreenThread
+    {
+        LaneExecution execution;
+        GreenThreadCallback callback;
+        std::chrono::steady_clock::time_point spawn_time;
+    };
+
+    const uint64_t m_quantum;
+
+    std::mutex m_mutex;
+    std::condition_variable m_threads_available;
+    std::condition_variable m_all_done;
+    std::deque<std::unique_ptr<GreenThread>> m_run_queue;
+
+    /// The number of spawned green threads not completed yet.
+    size_t m_num_pending = 0;
+    bool m_stopping = false;
+
+    /// The statistics state, guarded by m_mutex.
+    std::vector<std::chrono::nanoseconds> m_latencies;
+    size_t m_num_preemptions = 0;
+    size_t m_num_waits = 0;
+    std::chrono::steady_clock::time_point m_first_spawn_time;
+    std::chrono::steady_clock::time_point m_last_completion_time;
+
+    std::vector<std::thread> m_workers;
+
+    void make_ready(std::unique_ptr<GreenThread> thread);
+    void run_worker();
+
+public:
+    /// Creates the scheduler with @p num_threads worker threads (at least one), executing
+    /// the green threads for at most @p quantum instructions at once.
+    explicit GreenThreadScheduler(size_t num_threads = std::thread::hardware_concurrency(),
+        uint64_t quantum = 10000);
+
+    /// Waits for the completion of all green threads and stops the workers.
+    ~GreenThreadScheduler();
+
+    GreenThreadScheduler(const GreenThreadScheduler&) = delete;
+    GreenThreadScheduler& operator=(const GreenThreadScheduler&) = delete;
+
+    /// Spawns the green thread executing the function on the instance. The @p code is
+    /// the instance's module lane code and must outlive the execution. The instance must not be
+    /// used by anything else until the execution completes.
+    void spawn(const LaneCode& code, Instance& instance, FuncIdx func_idx,
+        const std::vector<uint64_t>& args, GreenThreadCallback callback = nullptr);
+
+    /// Waits until all spawned green threads complete.
+    void wait();
+
+    /// Returns the statistics of the completed green threads.
+    GreenThreadStats get_stats();
+
+    /// Resets the statistics.
+    void reset_stats();
+
+    /// Returns the number of worker threads.
+    size_t get_thread_count() const noexcept { return m_workers.size(); }
+};
+}  // namespace fizzy
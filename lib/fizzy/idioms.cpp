@@ -0,0 +1,691 @@
+// Fizzy: A fast WebAssembly interpreter
+// Copyright 2020 The Fizzy Authors.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "idioms.hpp"
+#include <algorithm>
+#include <cassert>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+namespace fizzy
+{
+namespace
+{
+/// Returns the number of bytes loaded by the integer load instruction or 0 for other instructions.
+uint8_t get_load_width(Instr instr) noexcept
+{
+    switch (instr)
+    {
+    case Instr::i32_load8_s:
+    case Instr::i32_load8_u:
+    case Instr::i64_load8_s:
+    case Instr::i64_load8_u:
+        return 1;
+    case Instr::i32_load16_s:
+    case Instr::i32_load16_u:
+    case Instr::i64_load16_s:
+    case Instr::i64_load16_u:
+        return 2;
+    case Instr::i32_load:
+    case Instr::i64_load32_s:
+    case Instr::i64_load32_u:
+        return 4;
+    case Instr::i64_load:
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+/// Returns the number of bytes stored by the integer store instruction or 0 for other
+/// instructions.
+uint8_t get_store_width(Instr instr) noexcept
+{
+    switch (instr)
+    {
+    case Instr::i32_store8:
+    case Instr::i64_store8:
+        return 1;
+    case Instr::i32_store16:
+    case Instr::i64_store16:
+        return 2;
+    case Instr::i32_store:
+    case Instr::i64_store32:
+        return 4;
+    case Instr::i64_store:
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+/// The address of the memory access: the value of the local increased by the constant.
+struct Address
+{
+    uint32_t local_idx = 0;
+    uint64_t displacement = 0;
+};
+
+/// The store in the loop body.
+struct Store
+{
+    MemoryLoop::Kind kind = MemoryLoop::Kind::fill;
+    uint8_t width = 0;
+    Address dst;
+
+    /// The address of the load for the copy, the local of the value for the fill.
+    Address src;
+};
+
+/// The matcher of the loop body instructions.
+class LoopBodyMatcher
+{
+    const std::vector<LoweredInstr>& m_instructions;
+    const size_t m_end;
+    size_t m_pos;
+
+public:
+    LoopBodyMatcher(const std::vector<LoweredInstr>& instructions, size_t begin, size_t end)
+      : m_instructions{instructions}, m_end{end}, m_pos{begin}
+    {}
+
+    size_t get_position() const noexcept { return m_pos; }
+    void set_position(size_t pos) noexcept { m_pos = pos; }
+    bool is_at_end() const noexcept { return m_pos == m_end; }
+
+    /// Returns the next instruction if it is the given one and advances past it.
+    const LoweredInstr* match(Instr instr) noexcept
+    {
+        if (m_pos == m_end || m_instructions[m_pos].instr != instr)
+            return nullptr;
+        return &m_instructions[m_pos++];
+    }
+
+    /// Returns the next instruction if the predicate holds for it and advances past it.
+    template <typename Predicate>
+    const LoweredInstr* match_if(Predicate predicate) noexcept
+    {
+        if (m_pos == m_end || !predicate(m_instructions[m_pos].instr))
+            return nullptr;
+        return &m_instructions[m_pos++];
+    }
+
+    /// Matches `local.get` optionally followed by `i32.const i32.add`.
+    std::optional<Address> match_address() noexcept
+    {
+        const auto* const local_get = match(Instr::local_get);
+        if (local_get == nullptr)
+            return std::nullopt;
+
+        Address address{local_get->imm, 0};
+        const auto pos = m_pos;
+        if (const auto* const constant = match(Instr::i32_const); constant != nullptr)
+        {
+            if (match(Instr::i32_add) != nullptr)
+                address.displacement = constant->imm;
+            else
+                m_pos = pos;
+        }
+        return address;
+    }
+
+    /// Matches the store of the local's value or of the loaded value.
+    std::optional<Store> match_store() noexcept
+    {
+        const auto pos = m_pos;
+        if (const auto dst = match_address())
+        {
+            const auto src_pos = m_pos;
+            if (const auto* const value = match(Instr::local_get); value != nullptr)
+            {
+                if (const auto* const store = match_if(get_store_width); store != nullptr)
+                {
+                    return Store{MemoryLoop::Kind::fill, get_store_width(store->instr),
+                        {dst->local_idx, dst->displacement + store->imm}, {value->imm, 0}};
+                }
+            }
+            m_pos = src_pos;
+
+            if (const auto src = match_address())
+            {
+                const auto* const load = match_if(get_load_width);
+                const auto* const store = load != nullptr ? match_if(get_store_width) : nullptr;
+                if (store != nullptr &&
+                    get_load_width(load->instr) == get_store_width(store->instr))
+                {
+                    return Store{MemoryLoop::Kind::copy, get_store_width(store->instr),
+                        {dst->local_idx, dst->displacement + store->imm},
+                        {src->local_idx, src->displacement + load->imm}};
+                }
+            }
+        }
+        m_pos = pos;
+        return std::nullopt;
+    }
+
+    /// Matches `local.get i32.const i32.add` followed by the given instruction on the same local.
+    /// Returns the index of the local and the added constant.
+    std::optional<std::pair<uint32_t, uint32_t>> match_increment(Instr set_instr) noexcept
+    {
+        const auto pos = m_pos;
+        const auto* const local_get = match(Instr::local_get);
+        const auto* const constant = local_get != nullptr ? match(Instr::i32_const) : nullptr;
+        const auto* const add = constant != nullptr ? match(Instr::i32_add) : nullptr;
+        const auto* const set = add != nullptr ? match(set_instr) : nullptr;
+        if (set == nullptr || set->imm != local_get->imm)
+        {
+            m_pos = pos;
+            return std::nullopt;
+        }
+        return std::pair{local_get->imm, constant->imm};
+    }
+};
+
+inline bool is_loop_condition(Instr instr) noexcept
+{
+    return instr == Instr::i32_ne || instr == Instr::i32_gt_u || instr == Instr::i32_lt_u;
+}
+
+/// Matches the body of the loop from the loop header to the backward br_if.
+std::optional<MemoryLoop> match_memory_loop(
+    const std::vector<LoweredInstr>& instructions, size_t begin, size_t end)
+{
+    LoopBodyMatcher matcher{instructions, begin, end};
+
+    std::vector<Store> stores;
+    while (const auto store = matcher.match_store())
+        stores.emplace_back(*store);
+    if (stores.empty())
+        return std::nullopt;
+
+    // The increments of the locals, at most one per local.
+    std::vector<std::pair<uint32_t, uint32_t>> increments;
+    const auto find_increment = [&increments](uint32_t local_idx) noexcept {
+        return std::find_if(increments.begin(), increments.end(),
+            [local_idx](const auto& increment) noexcept { return increment.first == local_idx; });
+    };
+    const auto add_increment = [&](const std::pair<uint32_t, uint32_t>& increment) {
+        if (find_increment(increment.first) != increments.end())
+            return false;
+        increments.emplace_back(increment);
+        return true;
+    };
+    while (const auto increment = matcher.match_increment(Instr::local_set))
+    {
+        if (!add_increment(*increment))
+            return std::nullopt;
+    }
+
+    MemoryLoop loop;
+
+    // The counter is either incremented by local.tee or already incremented.
+    if (const auto increment = matcher.match_increment(Instr::local_tee))
+    {
+        if (!add_increment(*increment))
+            return std::nullopt;
+        loop.counter_local = increment->first;
+    }
+    else if (const auto* const local_get = matcher.match(Instr::local_get); local_get != nullptr)
+        loop.counter_local = local_get->imm;
+    else
+        return std::nullopt;
+
+    if (matcher.is_at_end())
+    {
+        // The br_if checks the counter is not zero.
+        loop.condition = MemoryLoop::Condition::ne;
+        loop.bound = 0;
+    }
+    else
+    {
+        if (const auto* const constant = matcher.match(Instr::i32_const); constant != nullptr)
+            loop.bound = constant->imm;
+        else if (const auto* const local_get = matcher.match(Instr::local_get);
+                 local_get != nullptr)
+        {
+            loop.is_bound_local = true;
+            loop.bound = local_get->imm;
+        }
+        else
+            return std::nullopt;
+
+        const auto* const comparison = matcher.match_if(is_loop_condition);
+        if (comparison == nullptr || !matcher.is_at_end())
+            return std::nullopt;
+        loop.condition = comparison->instr == Instr::i32_ne   ? MemoryLoop::Condition::ne :
+                         comparison->instr == Instr::i32_gt_u ? MemoryLoop::Condition::gt_u :
+                                                                MemoryLoop::Condition::lt_u;
+    }
+
+    // The stores are of the same kind, width and locals.
+    const auto& first = stores.front();
+    loop.kind = first.kind;
+    loop.width = first.width;
+    loop.dst_local = first.dst.local_idx;
+    loop.src_local = first.src.local_idx;
+    loop.step = static_cast<uint32_t>(stores.size() * first.width);
+    if (loop.dst_local == loop.src_local)
+        return std::nullopt;
+    for (const auto& store : stores)
+    {
+        if (store.kind != loop.kind || store.width != loop.width ||
+            store.dst.local_idx != loop.dst_local || store.src.local_idx != loop.src_local)
+            return std::nullopt;
+    }
+
+    if (loop.kind == MemoryLoop::Kind::fill)
+    {
+        // The stores cover the step bytes exactly, in any order.
+        std::vector<uint64_t> displacements;
+        for (const auto& store : stores)
+            displacements.emplace_back(store.dst.displacement);
+        std::sort(displacements.begin(), displacements.end());
+        for (size_t i = 0; i < displacements.size(); ++i)
+        {
+            if (displacements[i] != i * loop.width)
+                return std::nullopt;
+        }
+    }
+    else
+    {
+        // The copy is forward, one load and store per iteration.
+        if (stores.size() != 1 || first.dst.displacement != 0 || first.src.displacement != 0)
+            return std::nullopt;
+    }
+
+    // The destination advances by the step, the copy source too, the fill value is invariant.
+    const auto dst_increment = find_increment(loop.dst_local);
+    const auto src_increment = find_increment(loop.src_local);
+    if (dst_increment == increments.end() || dst_increment->second != loop.step)
+        return std::nullopt;
+    if (loop.kind == MemoryLoop::Kind::copy ?
+            (src_increment == increments.end() || src_increment->second != loop.step) :
+            src_increment != increments.end())
+        return std::nullopt;
+
+    const auto counter_increment = find_increment(loop.counter_local);
+    if (counter_increment == increments.end())
+        return std::nullopt;
+    loop.counter_increment = counter_increment->second;
+
+    // No other locals are modified, the bound is invariant.
+    const auto num_increments = loop.kind == MemoryLoop::Kind::copy ? 2u : 1u;
+    const bool is_counter_address =
+        loop.counter_local == loop.dst_local ||
+        (loop.kind == MemoryLoop::Kind::copy && loop.counter_local == loop.src_local);
+    if (increments.size() != num_increments + (is_counter_address ? 0 : 1))
+        return std::nullopt;
+    if (loop.is_bound_local && find_increment(loop.bound) != increments.end())
+        return std::nullopt;
+
+    return loop;
+}
+
+/// The instruction of the reference code: the i64.const value or the immediate value.
+struct ReferenceInstr
+{
+    Instr instr;
+    uint64_t operand;
+};
+
+/// The lowered code of __multi3, the 128-bit multiplication of compiler-rt, as compiled by clang:
+/// (i32 result address, i64 a_lo, i64 a_hi, i64 b_lo, i64 b_hi) with 2 i64 locals.
+/// It computes the product from 32-bit partial products and stores the high and low halves.
+constexpr ReferenceInstr Multi3Code[] = {
+    {Instr::local_get, 0}, {Instr::local_get, 3}, {Instr::i64_const, 32}, {Instr::i64_shr_u, 0},
+    {Instr::local_tee, 5}, {Instr::local_get, 1}, {Instr::i64_const, 32}, {Instr::i64_shr_u, 0},
+    {Instr::local_tee, 6}, {Instr::i64_mul, 0}, {Instr::local_get, 3}, {Instr::local_get, 2},
+    {Instr::i64_mul, 0}, {Instr::i64_add, 0}, {Instr::local_get, 4}, {Instr::local_get, 1},
+    {Instr::i64_mul, 0}, {Instr::i64_add, 0}, {Instr::local_get, 3}, {Instr::i64_const, 0xffffffff},
+    {Instr::i64_and, 0}, {Instr::local_tee, 3}, {Instr::local_get, 1},
+    {Instr::i64_const, 0xffffffff}, {Instr::i64_and, 0}, {Instr::local_tee, 1}, {Instr::i64_mul, 0},
+    {Instr::local_tee, 4}, {Instr::i64_const, 32}, {Instr::i64_shr_u, 0}, {Instr::local_get, 3},
+    {Instr::local_get, 6}, {Instr::i64_mul, 0}, {Instr::i64_add, 0}, {Instr::local_tee, 3},
+    {Instr::i64_const, 32}, {Instr::i64_shr_u, 0}, {Instr::i64_add, 0}, {Instr::local_get, 3},
+    {Instr::i64_const, 0xffffffff}, {Instr::i64_and, 0}, {Instr::local_get, 5},
+    {Instr::local_get, 1}, {Instr::i64_mul, 0}, {Instr::i64_add, 0}, {Instr::local_tee, 3},
+    {Instr::i64_const, 32}, {Instr::i64_shr_u, 0}, {Instr::i64_add, 0}, {Instr::i64_store, 8},
+    {Instr::local_get, 0}, {Instr::local_get, 3}, {Instr::i64_const, 32}, {Instr::i64_shl, 0},
+    {Instr::local_get, 4}, {Instr::i64_const, 0xffffffff}, {Instr::i64_and, 0}, {Instr::i64_or, 0},
+    {Instr::i64_store, 0}, {Instr::end, 0}
+};
+
+/// The maximum number of instructions of the function matched with __multi3.
+constexpr size_t MaxMulti3Size = 4 * std::size(Multi3Code);
+
+/// The maximum length of the canonical form of an expression. It grows exponentially with
+/// the nesting of the reused subexpressions, e.g. by squaring the value repeatedly.
+constexpr size_t MaxExpressionKeySize = 4096;
+
+/// The i64 value computed by the straight-line code from the parameters and the constants.
+struct Expression
+{
+    /// local_get for the parameter, i64_const for the constant, or the operation.
+    Instr op = Instr::i64_const;
+
+    /// The operands of the operation. The nested operands of the associative and commutative
+    /// operations are flattened into their single operation and sorted by their keys.
+    std::vector<std::shared_ptr<const Expression>> operands;
+
+    /// The canonical form of the expression, equal for the expressions which differ only in
+    /// the order and grouping of the operands of the associative and commutative operations.
+    std::string key;
+};
+
+using ExpressionPtr = std::shared_ptr<const Expression>;
+
+bool is_associative_commutative(Instr instr) noexcept
+{
+    return instr == Instr::i64_add || instr == Instr::i64_mul || instr == Instr::i64_and ||
+           instr == Instr::i64_or || instr == Instr::i64_xor;
+}
+
+ExpressionPtr make_leaf(Instr op, uint64_t value)
+{
+    auto expression = std::make_shared<Expression>();
+    expression->op = op;
+    expression->key = (op == Instr::local_get ? "p" : "c") + std::to_string(value);
+    return expression;
+}
+
+/// Returns the operation on the operands, or null if its canonical form is too long.
+ExpressionPtr make_operation(Instr op, const ExpressionPtr& lhs, const ExpressionPtr& rhs)
+{
+    auto expression = std::make_shared<Expression>();
+    expression->op = op;
+    if (is_associative_commutative(op))
+    {
+        for (const auto& operand : {lhs, rhs})
+        {
+            if (operand->op == op)
+            {
+                expression->operands.insert(expression->operands.end(),
+                    operand->operands.begin(), operand->operands.end());
+            }
+            else
+                expression->operands.emplace_back(operand);
+        }
+        std::sort(expression->operands.begin(), expression->operands.end(),
+            [](const ExpressionPtr& a, const ExpressionPtr& b) { return a->key < b->key; });
+    }
+    else
+        expression->operands = {lhs, rhs};
+
+    size_t key_size = 8;
+    for (const auto& operand : expression->operands)
+        key_size += operand->key.size() + 1;
+    if (key_size > MaxExpressionKeySize)
+        return nullptr;
+
+    expression->key = "(" + std::to_string(static_cast<int>(op));
+    for (const auto& operand : expression->operands)
+        expression->key += " " + operand->key;
+    expression->key += ")";
+    return expression;
+}
+
+/// The i64.store of the value computed by the function.
+struct SymbolicStore
+{
+    ExpressionPtr address;
+    uint32_t offset = 0;
+    ExpressionPtr value;
+};
+
+/// Evaluates the straight-line code of the function symbolically, the parameters and
+/// the locals being i64 values. Returns its i64 stores in order, or nothing if the code
+/// has other effects or instructions than the i64 arithmetic on the locals.
+std::optional<std::vector<SymbolicStore>> evaluate_stores(
+    const std::vector<LoweredInstr>& instructions, size_t num_params, size_t num_locals)
+{
+    std::vector<ExpressionPtr> locals;
+    for (size_t i = 0; i < num_params; ++i)
+        locals.emplace_back(make_leaf(Instr::local_get, i));
+    locals.resize(num_params + num_locals, make_leaf(Instr::i64_const, 0));
+
+    std::vector<ExpressionPtr> stack;
+    std::vector<SymbolicStore> stores;
+    for (const auto& instr : instructions)
+    {
+        switch (instr.instr)
+        {
+        case Instr::local_get:
+            stack.emplace_back(locals[instr.imm]);
+            break;
+        case Instr::local_set:
+            locals[instr.imm] = stack.back();
+            stack.pop_back();
+            break;
+        case Instr::local_tee:
+            locals[instr.imm] = stack.back();
+            break;
+        case Instr::drop:
+            stack.pop_back();
+            break;
+        case Instr::i64_const:
+            stack.emplace_back(make_leaf(Instr::i64_const, instr.value));
+            break;
+        case Instr::i64_add:
+        case Instr::i64_sub:
+        case Instr::i64_mul:
+        case Instr::i64_and:
+        case Instr::i64_or:
+        case Instr::i64_xor:
+        case Instr::i64_shl:
+        case Instr::i64_shr_u:
+        {
+            const auto rhs = stack.back();
+            stack.pop_back();
+            stack.back() = make_operation(instr.instr, stack.back(), rhs);
+            if (stack.back() == nullptr)
+                return std::nullopt;
+            break;
+        }
+        case Instr::i64_store:
+        {
+            const auto value = stack.back();
+            stack.pop_back();
+            stores.push_back({stack.back(), instr.imm, value});
+            stack.pop_back();
+            break;
+        }
+        case Instr::end:
+            return stores;
+        default:
+            return std::nullopt;
+        }
+    }
+    return std::nullopt;
+}
+
+/// Returns the stores of __multi3: of the high and the low halves of the product.
+const std::vector<SymbolicStore>& get_multi3_stores()
+{
+    static const auto stores = [] {
+        std::vector<LoweredInstr> instructions;
+        for (const auto& reference : Multi3Code)
+        {
+            LoweredInstr instr;
+            instr.instr = reference.instr;
+            if (instr.instr == Instr::i64_const)
+                instr.value = reference.operand;
+            else
+                instr.imm = static_cast<uint32_t>(reference.operand);
+            instructions.emplace_back(instr);
+        }
+        return *evaluate_stores(instructions, 5, 2);
+    }();
+    return stores;
+}
+
+/// Checks if the function is __multi3: it computes the same values from the parameters and
+/// stores them the same way, up to the choice of the locals, the order of the independent
+/// computations and the order and grouping of the operands of the associative and commutative
+/// operations. The high half must be stored first, so the function traps before storing
+/// anything when the result is out of bounds, as the fused instruction does.
+bool is_multi3(const Module& module, FuncIdx func_idx)
+{
+    const auto num_imported_functions = module.imported_function_types.size();
+    if (func_idx < num_imported_functions)
+        return false;
+
+    static const FuncType multi3_type{
+        {ValType::i32, ValType::i64, ValType::i64, ValType::i64, ValType::i64}, {}};
+    const auto& code = module.codesec[func_idx - num_imported_functions];
+    if (module.get_function_type(func_idx) != multi3_type ||
+        code.instructions.size() > MaxMulti3Size)
+        return false;
+
+    const auto lowered_code = lower_code(code);
+    const auto stores = evaluate_stores(
+        lowered_code.instructions, multi3_type.inputs.size(), lowered_code.local_count);
+    if (!stores.has_value())
+        return false;
+
+    const auto& expected = get_multi3_stores();
+    return std::equal(stores->begin(), stores->end(), expected.begin(), expected.end(),
+        [](const SymbolicStore& store, const SymbolicStore& expected_store) {
+            return store.address->key == expected_store.address->key &&
+                   store.offset == expected_store.offset &&
+                   store.value->key == expected_store.value->key;
+        });
+}
+}  // namespace
+
+void recognize_memory_loops(LoweredCode& code)
+{
+    auto& instructions = code.instructions;
+    const auto num_instructions = instructions.size();
+    const auto is_target = find_branch_targets(code);
+
+    // The loop found at each loop header and the index of its backward br_if.
+    std::vector<std::optional<MemoryLoop>> loops(num_instructions);
+    std::vector<size_t> back_edges(num_instructions);
+    size_t num_loops = 0;
+    for (size_t i = 0; i < num_instructions; ++i)
+    {
+        const auto& instr = instructions[i];
+        if (instr.instr != Instr::br_if || instr.target >= i || instr.arity != 0 ||
+            loops[instr.target].has_value())
+            continue;
+
+        // There is no other control flow in the loop body.
+        const auto header = instr.target;
+        if (std::any_of(is_target.begin() + static_cast<ptrdiff_t>(header) + 1,
+                is_target.begin() + static_cast<ptrdiff_t>(i) + 1, [](bool b) { return b; }))
+            continue;
+
+        loops[header] = match_memory_loop(instructions, header, i);
+        if (loops[header].has_value())
+        {
+            back_edges[header] = i;
+            ++num_loops;
+        }
+    }
+    if (num_loops == 0)
+        return;
+
+    // The new indices of the instructions, the memory_loop instruction precedes its loop.
+    std::vector<size_t> indices(num_instructions);
+    size_t num_new_instructions = 0;
+    for (size_t i = 0; i < num_instructions; ++i)
+    {
+        if (loops[i].has_value())
+            ++num_new_instructions;
+        indices[i] = num_new_instructions++;
+    }
+
+    // The branches to the loop header enter the memory loop, except the loop's own back-edge.
+    const auto map_target = [&](size_t target) noexcept {
+        return loops[target].has_value() ? indices[target] - 1 : indices[target];
+    };
+
+    std::vector<LoweredInstr> new_instructions;
+    new_instructions.reserve(num_new_instructions);
+    for (size_t i = 0; i < num_instructions; ++i)
+    {
+        if (loops[i].has_value())
+        {
+            LoweredInstr memory_loop;
+            memory_loop.instr = Instr::memory_loop;
+            memory_loop.value = code.memory_loops.size();
+            memory_loop.target = map_target(back_edges[i] + 1);
+            new_instructions.emplace_back(memory_loop);
+            code.memory_loops.emplace_back(*loops[i]);
+        }
+
+        auto instr = instructions[i];
+        if (has_target(instr.instr))
+        {
+            const bool is_back_edge = instr.target < i && loops[instr.target].has_value() &&
+                                      back_edges[instr.target] == i;
+            instr.target = is_back_edge ? indices[instr.target] : map_target(instr.target);
+        }
+        new_instructions.emplace_back(instr);
+    }
+    assert(new_instructions.size() == num_new_instructions);
+
+    for (auto& label : code.br_table_labels)
+        label.target = map_target(label.target);
+    for (auto& loop_header : code.loop_headers)
+        loop_header = map_target(loop_header);
+    instructions = std::move(new_instructions);
+}
+
+void fuse_carry_chains(const Module& module, LoweredCode& code)
+{
+    auto& instructions = code.instructions;
+    const auto is_target = find_branch_targets(code);
+    const auto num_instructions = instructions.size();
+
+    // Checks if the instructions following the one at the index match the sequence.
+    const auto matches = [&](size_t i, std::initializer_list<Instr> sequence) noexcept {
+        if (i + sequence.size() >= num_instructions)
+            return false;
+        for (const auto next : sequence)
+        {
+            ++i;
+            if (is_target[i] || instructions[i].instr != next)
+                return false;
+        }
+        return true;
+    };
+
+    std::unordered_map<uint32_t, bool> is_multi3_cache;
+    bool changed = false;
+    for (size_t i = 0; i < num_instructions; ++i)
+    {
+        auto& instr = instructions[i];
+        if (instr.instr == Instr::call)
+        {
+            const auto [it, inserted] = is_multi3_cache.try_emplace(instr.imm, false);
+            if (inserted)
+                it->second = is_multi3(module, instr.imm);
+            if (it->second)
+            {
+                instr.instr = Instr::i128_mul_store;
+                instr.imm = 0;
+            }
+        }
+        else if (instr.instr == Instr::i64_add &&
+                 matches(i, {Instr::local_tee, Instr::local_get, Instr::i64_lt_u,
+                                Instr::i64_extend_i32_u}))
+        {
+            instr.instr = Instr::i64_add_carry;
+            instr.imm = instructions[i + 1].imm;
+            instr.value = instructions[i + 2].imm;
+            for (size_t j = i + 1; j <= i + 4; ++j)
+                instructions[j].instr = DroppedInstr;
+            changed = true;
+            i += 4;
+        }
+    }
+
+    if (changed)
+        remove_dropped_instructions(code);
+}
+}  // namespace fizzy
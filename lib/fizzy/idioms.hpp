@@ -0,0 +1,37 @@
+// Fizzy: A fast WebAssembly interpreter
+// Copyright 2020 The Fizzy Authors.
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include "lowered_code.hpp"
+#include "module.hpp"
+
+namespace fizzy
+{
+/// Recognizes the loops filling or copying the memory and inserts the memory_loop instruction
+/// before each of them.
+///
+/// The recognized loop consists only of the stores to the consecutive addresses relative to
+/// the local (of the same value or of the bytes loaded relative to another local), the increments
+/// of the locals by constants, and the comparison of the counter ending with the backward br_if.
+/// The memory_loop instruction executes all iterations at once and jumps to the loop exit.
+/// If the number of iterations cannot be computed, or the accessed memory is not in bounds,
+/// or the copied ranges overlap, it does nothing and the loop is executed as before,
+/// so it traps exactly where the loop would.
+void recognize_memory_loops(LoweredCode& code);
+
+/// Replaces the instruction sequences of the multi-precision integer arithmetic with the fused
+/// instructions executed with the native carry and widening multiplication:
+/// - i64_add_carry: `i64.add local.tee S local.get A i64.lt_u i64.extend_i32_u`, storing the sum
+///   in the local S and pushing its carry when the local A is one of the addends,
+/// - i128_mul_store: the call of the function computing the 128-bit product, i.e. __multi3 of
+///   compiler-rt as compiled by clang.
+///
+/// This must be the last transformation of the code, the others do not support the fused
+/// instructions.
+///
+/// @param module  The module the code is of.
+/// @param code    The lowered code of the function.
+void fuse_carry_chains(const Module& module, LoweredCode& code);
+}  // namespace fizzy
@@ -0,0 +1,247 @@
+// Fizzy: A fast WebAssembly interpreter
+// Copyright 2020 The Fizzy Authors.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "inliner.hpp"
+#include "optimizer.hpp"
+#include <algorithm>
+#include <cassert>
+#include <limits>
+
+namespace fizzy
+{
+namespace
+{
+/// Checks if the code calls any function.
+bool is_leaf(const LoweredCode& code) noexcept
+{
+    return std::none_of(code.instructions.begin(), code.instructions.end(),
+        [](const LoweredInstr& instr) noexcept {
+            return instr.instr == Instr::call || instr.instr == Instr::call_indirect;
+        });
+}
+
+/// Returns the number of instructions replacing the call of the function.
+size_t get_inlined_size(const FuncType& func_type, const LoweredCode& code) noexcept
+{
+    // The arguments are stored in locals, the locals are initialized with zeros,
+    // and the final end is not needed.
+    return func_type.inputs.size() + 2 * size_t{code.local_count} + code.instructions.size() - 1;
+}
+
+/// Checks if the code of the function at the code index can be inlined.
+bool is_inlinable_code(const Module& module, size_t code_idx, const LoweredCode& code)
+{
+    const auto& func_type = module.get_function_type(
+        static_cast<FuncIdx>(module.imported_function_types.size() + code_idx));
+    return is_leaf(code) && get_inlined_size(func_type, code) <= MaxInlinedFunctionSize;
+}
+
+inline LoweredInstr make_instr(Instr instr, uint32_t imm) noexcept
+{
+    LoweredInstr lowered;
+    lowered.instr = instr;
+    lowered.imm = imm;
+    return lowered;
+}
+
+/// Inlines the calls in the code of the function at the code index.
+void inline_calls(const Module& module, std::vector<LoweredCode>& codes,
+    const std::vector<bool>& is_inlinable, size_t code_idx)
+{
+    const auto num_imported_functions = module.imported_function_types.size();
+    auto& caller = codes[code_idx];
+    const auto& instructions = caller.instructions;
+    const auto num_instructions = instructions.size();
+
+    const auto heights = compute_stack_heights(module, caller);
+    const auto& caller_type = module.get_function_type(
+        static_cast<FuncIdx>(num_imported_functions + code_idx));
+    const auto locals_base = uint64_t{caller_type.inputs.size()} + caller.local_count;
+
+    // Select the calls to inline and compute the new indices of the caller's instructions.
+    std::vector<bool> is_inlined(num_instructions, false);
+    std::vector<size_t> indices(num_instructions + 1);
+    auto budget = std::max(num_instructions, MinInliningBudget);
+    uint64_t num_inlined_locals = 0;
+    size_t num_new_instructions = 0;
+    bool has_inlined_calls = false;
+    for (size_t i = 0; i < num_instructions; ++i)
+    {
+        indices[i] = num_new_instructions;
+        const auto& instr = instructions[i];
+        ++num_new_instructions;
+
+        if (instr.instr != Instr::call || instr.imm < num_imported_functions ||
+            heights[i] == UnknownStackHeight)
+            continue;
+
+        const auto callee_idx = instr.imm - num_imported_functions;
+        if (!is_inlinable[callee_idx])
+            continue;
+
+        const auto& callee_type = module.get_function_type(instr.imm);
+        const auto& callee = codes[callee_idx];
+        const auto inlined_size = get_inlined_size(callee_type, callee);
+        const auto num_callee_locals = callee_type.inputs.size() + uint64_t{callee.local_count};
+        if (inlined_size > budget ||
+            locals_base + num_callee_locals > std::numeric_limits<uint32_t>::max())
+            continue;
+
+        budget -= inlined_size;
+        is_inlined[i] = true;
+        has_inlined_calls = true;
+        num_inlined_locals = std::max(num_inlined_locals, num_callee_locals);
+        num_new_instructions += inlined_size - 1;  // Replaces the call.
+    }
+    indices[num_instructions] = num_new_instructions;
+
+    if (!has_inlined_calls)
+        return;
+
+    std::vector<LoweredInstr> new_instructions;
+    new_instructions.reserve(num_new_instructions);
+    std::vector<LoweredInstr> new_labels;
+    new_labels.reserve(caller.br_table_labels.size());
+
+    for (size_t i = 0; i < num_instructions; ++i)
+    {
+        auto instr = instructions[i];
+        if (is_inlined[i])
+        {
+            const auto& callee_type = module.get_function_type(instr.imm);
+            const auto& callee = codes[instr.imm - num_imported_functions];
+            const auto num_params = static_cast<uint32_t>(callee_type.inputs.size());
+            const auto base = static_cast<uint32_t>(locals_base);
+
+            // The callee operates on the caller's stack above the call arguments.
+            const auto stack_base = static_cast<uint32_t>(heights[i]) - num_params;
+            caller.max_stack_height = std::max(caller.max_stack_height,
+                static_cast<int>(stack_base) + callee.max_stack_height);
+
+            // Move the arguments from the stack to the locals, the last argument is on top.
+            for (auto k = num_params; k-- > 0;)
+                new_instructions.emplace_back(make_instr(Instr::local_set, base + k));
+            for (auto k = num_params; k < num_params + callee.local_count; ++k)
+            {
+                new_instructions.emplace_back(make_instr(Instr::i32_const, 0));
+                new_instructions.emplace_back(make_instr(Instr::local_set, base + k));
+            }
+
+            // The callee's final end maps to the instruction following the call.
+            const auto body_start = new_instructions.size();
+            for (size_t j = 0; j < callee.instructions.size() - 1; ++j)
+            {
+                auto inlined = callee.instructions[j];
+                switch (inlined.instr)
+                {
+                case Instr::local_get:
+                case Instr::local_set:
+                case Instr::local_tee:
+                    inlined.imm += base;
+                    break;
+                case Instr::if_:
+                case Instr::else_:
+                    inlined.target += body_start;
+                    break;
+                case Instr::return_:
+                case Instr::br:
+                case Instr::br_if:
+                    if (inlined.instr == Instr::return_)
+                        inlined.instr = Instr::br;
+                    inlined.target += body_start;
+                    inlined.imm += stack_base;
+                    break;
+                case Instr::br_table:
+                {
+                    const auto first_label = static_cast<size_t>(inlined.value);
+                    inlined.value = new_labels.size();
+                    for (size_t k = 0; k <= inlined.imm; ++k)
+                    {
+                        auto label = callee.br_table_labels[first_label + k];
+                        label.target += body_start;
+                        label.imm += stack_base;
+                        new_labels.emplace_back(label);
+                    }
+                    break;
+                }
+                default:
+                    break;
+                }
+                new_instructions.emplace_back(inlined);
+            }
+            assert(new_instructions.size() == indices[i + 1]);
+            continue;
+        }
+
+        if (has_target(instr.instr))
+            instr.target = indices[instr.target];
+        else if (instr.instr == Instr::br_table)
+        {
+            const auto first_label = static_cast<size_t>(instr.value);
+            instr.value = new_labels.size();
+            for (size_t k = 0; k <= instr.imm; ++k)
+            {
+                auto label = caller.br_table_labels[first_label + k];
+                label.target = indices[label.target];
+                new_labels.emplace_back(label);
+            }
+        }
+        new_instructions.emplace_back(instr);
+    }
+
+    // The loops of the inlined code are not tracked.
+    for (auto& loop_header : caller.loop_headers)
+        loop_header = indices[loop_header];
+
+    caller.instructions = std::move(new_instructions);
+    caller.br_table_labels = std::move(new_labels);
+    caller.local_count += static_cast<uint32_t>(num_inlined_locals);
+}
+}  // namespace
+
+void inline_calls(const Module& module, std::vector<LoweredCode>& codes)
+{
+    assert(codes.size() == module.codesec.size());
+
+    std::vector<bool> is_inlinable(codes.size());
+    for (size_t i = 0; i < codes.size(); ++i)
+        is_inlinable[i] = is_inlinable_code(module, i, codes[i]);
+
+    // The leaf functions have no calls to inline, so the inlined code never changes.
+    for (size_t i = 0; i < codes.size(); ++i)
+    {
+        if (!is_leaf(codes[i]))
+            inline_calls(module, codes, is_inlinable, i);
+    }
+}
+
+void inline_calls(const Module& module, size_t code_idx, LoweredCode& code)
+{
+    if (is_leaf(code))
+        return;
+
+    const auto num_imported_functions = module.imported_function_types.size();
+
+    // Only the called functions are lowered, the others are left empty.
+    std::vector<LoweredCode> codes(module.codesec.size());
+    std::vector<bool> is_inlinable(codes.size(), false);
+    for (const auto& instr : code.instructions)
+    {
+        if (instr.instr != Instr::call || instr.imm < num_imported_functions)
+            continue;
+
+        const auto callee_idx = instr.imm - num_imported_functions;
+        if (callee_idx == code_idx || !codes[callee_idx].instructions.empty())
+            continue;
+
+        codes[callee_idx] = lower_code(module.codesec[callee_idx]);
+        optimize(codes[callee_idx]);
+        is_inlinable[callee_idx] = is_inlinable_code(module, callee_idx, codes[callee_idx]);
+    }
+
+    codes[code_idx] = std::move(code);
+    inline_calls(module, codes, is_inlinable, code_idx);
+    code = std::move(codes[code_idx]);
+}
+}  // namespace fizzy
@@ -0,0 +1,49 @@
+// Fizzy: A fast WebAssembly interpreter
+// Copyright 2020 The Fizzy Authors.
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include "lowered_code.hpp"
+#include "module.hpp"
+#include <vector>
+
+namespace fizzy
+{
+/// The maximum size of the inlined function, in lowered instructions
+/// including the ones passing the arguments and initializing the locals.
+constexpr size_t MaxInlinedFunctionSize = 64;
+
+/// The minimum number of instructions by which the code of each function may grow by inlining.
+/// Larger functions may grow up to twice their original size.
+constexpr size_t MinInliningBudget = 256;
+
+/// Replaces the calls to small internal functions with the code of the called functions.
+///
+/// Only the leaf functions, i.e. functions not calling any other function, are inlined,
+/// so the recursive functions are never inlined.
+/// The arguments of the inlined call and the locals of the inlined function are kept in
+/// additional locals of the caller. The code's local_count and max_stack_height are updated.
+///
+/// The inlined calls are not calls anymore, so they differ from the calls executed as such:
+/// - they do not count towards the call depth limit (CallStackLimit) nor FrameBound::call_depth,
+///   so the call of the leaf function which would exhaust the call stack succeeds instead
+///   (the depth is at most one lower, as only the leaf functions are inlined),
+/// - the interrupt is not checked at their entry, but still at the loop back-edges of the inlined
+///   code.
+/// The call stack exhaustion is implementation-defined by the wasm specification, so this does
+/// not change the semantics otherwise.
+///
+/// @param module  The module the code is of.
+/// @param codes   The lowered code of all functions of the module's code section.
+void inline_calls(const Module& module, std::vector<LoweredCode>& codes);
+
+/// Replaces the calls to small internal functions in the code of a single function.
+///
+/// The called functions are lowered and optimized on demand.
+///
+/// @param module    The module the code is of.
+/// @param code_idx  The index of the function's code in the module's code section.
+/// @param code      The lowered code of the function.
+void inline_calls(const Module& module, size_t code_idx, LoweredCode& code);
+}  // namespace fizzy
@@ -226,6 +226,70 @@ constexpr InstructionMetrics instruction_metrics_table[256] = {
     /* i64_reinterpret_f64 = 0xbd */ {1, 0},
     /* f32_reinterpret_i32 = 0xbe */ {1, 0},
     /* f64_reinterpret_i64 = 0xbf */ {1, 0},
+
+    /*                       0xc0 */ {},
+    /*                       0xc1 */ {},
+    /*                       0xc2 */ {},
+    /*                       0xc3 */ {},
+    /*                       0xc4 */ {},
+    /*                       0xc5 */ {},
+    /*                       0xc6 */ {},
+    /*                       0xc7 */ {},
+    /*                       0xc8 */ {},
+    /*                       0xc9 */ {},
+    /*                       0xca */ {},
+    /*                       0xcb */ {},
+    /*                       0xcc */ {},
+    /*                       0xcd */ {},
+    /*                       0xce */ {},
+    /*                       0xcf */ {},
+    /*                       0xd0 */ {},
+    /*                       0xd1 */ {},
+    /*                       0xd2 */ {},
+    /*                       0xd3 */ {},
+    /*                       0xd4 */ {},
+    /*                       0xd5 */ {},
+    /*                       0xd6 */ {},
+    /*                       0xd7 */ {},
+    /*                       0xd8 */ {},
+    /*                       0xd9 */ {},
+    /*                       0xda */ {},
+    /*                       0xdb */ {},
+    /*                       0xdc */ {},
+    /*                       0xdd */ {},
+    /*                       0xde */ {},
+    /*                       0xdf */ {},
+    /*                       0xe0 */ {},
+    /*                       0xe1 */ {},
+    /*                       0xe2 */ {},
+    /*                       0xe3 */ {},
+    /*                       0xe4 */ {},
+    /*                       0xe5 */ {},
+    /*                       0xe6 */ {},
+    /*                       0xe7 */ {},
+    /*                       0xe8 */ {},
+    /*                       0xe9 */ {},
+    /*                       0xea */ {},
+    /*                       0xeb */ {},
+    /*                       0xec */ {},
+    /*                       0xed */ {},
+    /*                       0xee */ {},
+    /*                       0xef */ {},
+    /*                       0xf0 */ {},
+    /*                       0xf1 */ {},
+    /*                       0xf2 */ {},
+    /*                       0xf3 */ {},
+    /*                       0xf4 */ {},
+    /*                       0xf5 */ {},
+    /*                       0xf6 */ {},
+    /*                       0xf7 */ {},
+
+    // The internal atomic instructions, see Instr::atomic_prefix.
+    /* atomic_load         = 0xf8 */ {1, 0},
+    /* atomic_store        = 0xf9 */ {2, -2},
+    /* atomic_rmw          = 0xfa */ {2, -1},
+    /* atomic_cmpxchg      = 0xfb */ {3, -2},
+    /* atomic_fence        = 0xfc */ {0, 0},
 };
 }  // namespace
 
@@ -0,0 +1,108 @@
+// Fizzy: A fast WebAssembly interpreter
+// Copyright 2020 The Fizzy Authors.
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include <cstdint>
+#include <utility>
+
+namespace fizzy
+{
+// The integer operations with the semantics of the WebAssembly numeric instructions,
+// shared by the interpreter and the optimizer's constant folding.
+
+template <typename T>
+inline T shift_left(T lhs, T rhs) noexcept
+{
+    constexpr T num_bits{sizeof(T) * 8};
+    const auto k = rhs & (num_bits - 1);
+    return lhs << k;
+}
+
+template <typename T>
+inline T shift_right(T lhs, T rhs) noexcept
+{
+    constexpr T num_bits{sizeof(T) * 8};
+    const auto k = rhs & (num_bits - 1);
+    return lhs >> k;
+}
+
+template <typename T>
+inline T rotl(T lhs, T rhs) noexcept
+{
+    constexpr T num_bits{sizeof(T) * 8};
+    const auto k = rhs & (num_bits - 1);
+
+    if (k == 0)
+        return lhs;
+
+    return (lhs << k) | (lhs >> (num_bits - k));
+}
+
+template <typename T>
+inline T rotr(T lhs, T rhs) noexcept
+{
+    constexpr T num_bits{sizeof(T) * 8};
+    const auto k = rhs & (num_bits - 1);
+
+    if (k == 0)
+        return lhs;
+
+    return (lhs >> k) | (lhs << (num_bits - k));
+}
+
+inline uint32_t clz32(uint32_t value) noexcept
+{
+    // NOTE: Wasm specifies this case, but C/C++ intrinsic leaves it as undefined.
+    if (value == 0)
+        return 32;
+    return static_cast<uint32_t>(__builtin_clz(value));
+}
+
+inline uint32_t ctz32(uint32_t value) noexcept
+{
+    // NOTE: Wasm specifies this case, but C/C++ intrinsic leaves it as undefined.
+    if (value == 0)
+        return 32;
+    return static_cast<uint32_t>(__builtin_ctz(value));
+}
+
+inline uint32_t popcnt32(uint32_t value) noexcept
+{
+    return static_cast<uint32_t>(__builtin_popcount(value));
+}
+
+inline uint64_t clz64(uint64_t value) noexcept
+{
+    // NOTE: Wasm specifies this case, but C/C++ intrinsic leaves it as undefined.
+    if (value == 0)
+        return 64;
+    return static_cast<uint64_t>(__builtin_clzll(value));
+}
+
+inline uint64_t ctz64(uint64_t value) noexcept
+{
+    // NOTE: Wasm specifies this case, but C/C++ intrinsic leaves it as undefined.
+    if (value == 0)
+        return 64;
+    return static_cast<uint64_t>(__builtin_ctzll(value));
+}
+
+inline uint64_t popcnt64(uint64_t value) noexcept
+{
+    return static_cast<uint64_t>(__builtin_popcountll(value));
+}
+
+/// Returns the 128-bit product of the 128-bit values given by their low and high 64-bit halves,
+/// modulo 2^128, as the low and high halves.
+inline std::pair<uint64_t, uint64_t> mul128(
+    uint64_t lhs_lo, uint64_t lhs_hi, uint64_t rhs_lo, uint64_t rhs_hi) noexcept
+{
+    // The widening 64x64 multiplication is a single instruction on 64-bit targets.
+    __extension__ using uint128 = unsigned __int128;
+    const auto product = uint128{lhs_lo} * rhs_lo;
+    const auto hi = static_cast<uint64_t>(product >> 64) + lhs_hi * rhs_lo + lhs_lo * rhs_hi;
+    return {static_cast<uint64_t>(product), hi};
+}
+}  // namespace fizzy
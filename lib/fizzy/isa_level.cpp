@@ -0,0 +1,82 @@
+// Fizzy: A fast WebAssembly interpreter
+// Copyright 2020 The Fizzy Authors.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "isa_level.hpp"
+
+#if FIZZY_ISA_MULTIVERSIONING
+#include <cpuid.h>
+#endif
+
+namespace fizzy
+{
+namespace
+{
+#if FIZZY_ISA_MULTIVERSIONING
+bool has_x86_64_v2_features() noexcept
+{
+    // The CPU detection may be used by static initializers, before it is initialized itself.
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("popcnt") && __builtin_cpu_supports("sse4.2");
+}
+
+bool has_x86_64_v3_features() noexcept
+{
+    __builtin_cpu_init();
+    if (!has_x86_64_v2_features() || !__builtin_cpu_supports("avx2") ||
+        !__builtin_cpu_supports("bmi") || !__builtin_cpu_supports("bmi2"))
+        return false;
+
+    // LZCNT is not known to __builtin_cpu_supports() of older compilers, check CPUID directly.
+    // It is reported as ABM in the extended features (bit 5 of ECX).
+    unsigned eax = 0, ebx = 0, ecx = 0, edx = 0;
+    return __get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx) != 0 && (ecx & (1u << 5)) != 0;
+}
+#endif
+
+IsaLevel detect_isa_level() noexcept
+{
+    if (is_supported(IsaLevel::x86_64_v3))
+        return IsaLevel::x86_64_v3;
+    if (is_supported(IsaLevel::x86_64_v2))
+        return IsaLevel::x86_64_v2;
+    return IsaLevel::baseline;
+}
+
+IsaLevel& selected_isa_level() noexcept
+{
+    static IsaLevel level = detect_isa_level();
+    return level;
+}
+}  // namespace
+
+bool is_supported(IsaLevel level) noexcept
+{
+    switch (level)
+    {
+    case IsaLevel::baseline:
+        return true;
+#if FIZZY_ISA_MULTIVERSIONING
+    case IsaLevel::x86_64_v2:
+        return has_x86_64_v2_features();
+    case IsaLevel::x86_64_v3:
+        return has_x86_64_v3_features();
+#endif
+    default:
+        return false;
+    }
+}
+
+IsaLevel get_isa_level() noexcept
+{
+    return selected_isa_level();
+}
+
+bool set_isa_level(IsaLevel level) noexcept
+{
+    if (!is_supported(level))
+        return false;
+    selected_isa_level() = level;
+    return true;
+}
+}  // namespace fizzy
@@ -0,0 +1,47 @@
+// Fizzy: A fast WebAssembly interpreter
+// Copyright 2020 The Fizzy Authors.
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include <cstdint>
+
+/// The performance-critical code is built in several variants for the x86-64 ISA levels,
+/// one of them is selected at runtime. The levels are spelled out as the individual features
+/// used by the code, as the level names are only known to recent compilers (GCC 12).
+/// FMA is deliberately left out, as contracting floating-point operations breaks wasm semantics.
+#if defined(__x86_64__) && defined(__GNUC__)
+#define FIZZY_ISA_MULTIVERSIONING 1
+#define FIZZY_TARGET_X86_64_V2 __attribute__((target("popcnt,sse4.2")))
+#define FIZZY_TARGET_X86_64_V3 __attribute__((target("popcnt,sse4.2,avx2,bmi,bmi2,lzcnt")))
+#else
+#define FIZZY_ISA_MULTIVERSIONING 0
+#endif
+
+namespace fizzy
+{
+/// The instruction set variants the performance-critical code is built for.
+enum class IsaLevel : uint8_t
+{
+    /// The ISA the library is compiled for.
+    baseline,
+
+    /// x86-64-v2: adds POPCNT and SSE4.2.
+    x86_64_v2,
+
+    /// x86-64-v3: adds AVX2, BMI1/BMI2 (including TZCNT) and LZCNT.
+    x86_64_v3,
+};
+
+/// Checks if the CPU supports the ISA level, so its code variant is available.
+bool is_supported(IsaLevel level) noexcept;
+
+/// Returns the ISA level of the code variants in use.
+/// By default, this is the highest level supported by the CPU, detected at the first use.
+IsaLevel get_isa_level() noexcept;
+
+/// Selects the ISA level of the code variants to use, e.g. to test all of them.
+/// Returns false and keeps the current level if the level is not supported.
+/// Not thread-safe with respect to the concurrently executed code.
+bool set_isa_level(IsaLevel level) noexcept;
+}  // namespace fizzy
@@ -0,0 +1,1660 @@
+// Fizzy: A fast WebAssembly interpreter
+// Copyright 2020 The Fizzy Authors.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "lanes.hpp"
+#include "atomics.hpp"
+#include "call_context.hpp"
+#include "inliner.hpp"
+#include "integer_ops.hpp"
+#include "limits.hpp"
+#include "optimizer.hpp"
+#include <algorithm>
+#include <cassert>
+#include <functional>
+#include <future>
+#include <limits>
+#include <type_traits>
+#include <utility>
+
+namespace fizzy
+{
+namespace
+{
+/// The call frame of the lane group.
+struct LaneFrame
+{
+    /// The index of the function's code in the module's code section.
+    size_t code_idx = 0;
+
+    /// The index of the next instruction in the function's lowered code.
+    size_t pc = 0;
+
+    /// The slot of the first local, i.e. of the first argument.
+    size_t locals_base = 0;
+
+    /// The slot of the bottom of the operand stack.
+    size_t stack_base = 0;
+};
+
+/// The lanes executing the same instructions, with their locals and operand stacks.
+///
+/// The locals and the operand stacks of all frames are kept in the consecutive slots.
+/// Each slot holds the values of all lanes of the group.
+class LaneGroup
+{
+    std::vector<uint64_t> m_values;
+
+public:
+    /// The indices of the lanes in the group.
+    std::vector<uint32_t> lanes;
+
+    std::vector<LaneFrame> frames;
+
+    /// The number of slots in use, i.e. the slot above the top of the operand stack.
+    size_t num_slots = 0;
+
+    size_t width() const noexcept { return lanes.size(); }
+
+    uint64_t* slot(size_t idx) noexcept { return m_values.data() + idx * lanes.size(); }
+
+    const uint64_t* slot(size_t idx) const noexcept
+    {
+        return m_values.data() + idx * lanes.size();
+    }
+
+    uint64_t* top() noexcept { return slot(num_slots - 1); }
+
+    uint64_t* push() noexcept { return slot(num_slots++); }
+
+    /// Removes the top slot. Returns its values, valid until the next push.
+    const uint64_t* pop() noexcept { return slot(--num_slots); }
+
+    /// Makes the first slot_count slots available.
+    void reserve(size_t slot_count)
+    {
+        if (m_values.size() < slot_count * width())
+            m_values.resize(slot_count * width());
+    }
+
+    /// Returns the group of the lanes at the positions with the mask value equal to selected.
+    LaneGroup extract(const std::vector<uint8_t>& mask, bool selected) const
+    {
+        LaneGroup group;
+        group.frames = frames;
+        group.num_slots = num_slots;
+
+        std::vector<size_t> positions;
+        for (size_t i = 0; i < lanes.size(); ++i)
+        {
+            if ((mask[i] != 0) == selected)
+            {
+                positions.emplace_back(i);
+                group.lanes.emplace_back(lanes[i]);
+            }
+        }
+
+        const auto new_width = positions.size();
+        group.m_values.resize(m_values.size() / lanes.size() * new_width);
+        for (size_t s = 0; s < num_slots; ++s)
+        {
+            for (size_t j = 0; j < new_width; ++j)
+                group.m_values[s * new_width + j] = m_values[s * lanes.size() + positions[j]];
+        }
+        return group;
+    }
+};
+
+/// Checks the i32 condition value.
+inline bool is_true(uint64_t value) noexcept
+{
+    return static_cast<uint32_t>(value) != 0;
+}
+
+/// Records the access to the memory bytes [address, address + size) as the access to their pages.
+inline void record_access(std::vector<bool>& pages, uint64_t address, size_t size)
+{
+    const auto first_page = address / AccessSet::PageSize;
+    const auto last_page = (address + size - 1) / AccessSet::PageSize;
+    if (pages.size() <= last_page)
+        pages.resize(last_page + 1);
+    for (auto page = first_page; page <= last_page; ++page)
+        pages[page] = true;
+}
+
+/// Records the access to the global.
+inline void record_access(std::vector<bool>& globals, uint32_t idx)
+{
+    if (globals.size() <= idx)
+        globals.resize(idx + 1);
+    globals[idx] = true;
+}
+
+template <typename DstT, typename SrcT>
+inline DstT extend(SrcT in) noexcept
+{
+    if constexpr (std::is_signed<SrcT>::value)
+    {
+        using SignedDstT = typename std::make_signed<DstT>::type;
+        return static_cast<DstT>(SignedDstT{in});
+    }
+    else
+        return DstT{in};
+}
+
+template <typename Op>
+inline void unary_op(LaneGroup& group, Op op) noexcept
+{
+    auto* const values = group.top();
+    using T = decltype(op(values[0]));
+    for (size_t i = 0; i < group.width(); ++i)
+        values[i] = op(static_cast<T>(values[i]));
+}
+
+template <typename Op>
+inline void binary_op(LaneGroup& group, Op op) noexcept
+{
+    const auto* const rhs = group.pop();
+    auto* const lhs = group.top();
+    using T = decltype(op(lhs[0], lhs[0]));
+    for (size_t i = 0; i < group.width(); ++i)
+    {
+        lhs[i] = static_cast<std::make_unsigned_t<T>>(
+            op(static_cast<T>(lhs[i]), static_cast<T>(rhs[i])));
+    }
+}
+
+template <typename T, template <typename> class Op>
+inline void comparison_op(LaneGroup& group, Op<T> op) noexcept
+{
+    const auto* const rhs = group.pop();
+    auto* const lhs = group.top();
+    for (size_t i = 0; i < group.width(); ++i)
+        lhs[i] = uint32_t{op(static_cast<T>(lhs[i]), static_cast<T>(rhs[i]))};
+}
+
+}  // namespace
+
+/// The notification of the lane execution about the completion of its pending calls.
+class LaneWakeup
+{
+    std::mutex m_mutex;
+    bool m_notified = false;
+    std::function<void()> m_callback;
+
+public:
+    /// Forgets the completions notified before.
+    void reset()
+    {
+        const std::lock_guard lock{m_mutex};
+        m_notified = false;
+    }
+
+    void notify()
+    {
+        std::function<void()> callback;
+        {
+            const std::lock_guard lock{m_mutex};
+            m_notified = true;
+            std::swap(callback, m_callback);
+        }
+        if (callback)
+            callback();
+    }
+
+    void when_notified(std::function<void()> callback)
+    {
+        {
+            const std::lock_guard lock{m_mutex};
+            if (!m_notified)
+            {
+                m_callback = std::move(callback);
+                return;
+            }
+        }
+        callback();
+    }
+};
+
+PendingCall::PendingCall(std::shared_ptr<LaneWakeup> wakeup) noexcept
+  : m_wakeup{std::move(wakeup)}
+{}
+
+void PendingCall::complete(execution_result result)
+{
+    {
+        const std::lock_guard lock{m_mutex};
+        assert(!m_result.has_value());
+        m_result = std::move(result);
+    }
+    m_wakeup->notify();
+}
+
+std::optional<execution_result> PendingCall::get_result()
+{
+    const std::lock_guard lock{m_mutex};
+    return m_result;
+}
+
+thread_local LaneCallContext* current_lane_call = nullptr;
+
+namespace
+{
+/// The lanes waiting for the completion of their pending calls.
+struct WaitingGroup
+{
+    LaneGroup group;
+
+    /// The pending call of each lane of the group.
+    std::vector<std::shared_ptr<PendingCall>> calls;
+
+    /// Whether the called function has the result, for which the top slot is reserved.
+    bool has_result = false;
+};
+
+/// The version of the checkpoint format, following the magic bytes.
+constexpr uint8_t CheckpointVersion = 1;
+constexpr uint8_t CheckpointMagic[]{'f', 'z', 'c', 'k'};
+
+/// The size of the memory chunks, of which only the non-zero ones are in the checkpoint.
+constexpr size_t CheckpointChunkSize = AccessSet::PageSize;
+
+/// Writes the checkpoint. The integers are encoded as LEB128.
+class CheckpointWriter
+{
+    bytes m_blob;
+
+public:
+    void u8(uint8_t value) { m_blob.push_back(value); }
+
+    void u64(uint64_t value)
+    {
+        do
+        {
+            auto byte = static_cast<uint8_t>(value & 0x7f);
+            value >>= 7;
+            if (value != 0)
+                byte |= 0x80;
+            m_blob.push_back(byte);
+        } while (value != 0);
+    }
+
+    void raw(const uint8_t* data, size_t size) { m_blob.append(data, size); }
+
+    bytes take() noexcept { return std::move(m_blob); }
+};
+
+/// Reads the checkpoint written by CheckpointWriter.
+class CheckpointReader
+{
+    bytes_view m_input;
+
+public:
+    explicit CheckpointReader(bytes_view input) noexcept : m_input{input} {}
+
+    bool empty() const noexcept { return m_input.empty(); }
+
+    uint8_t u8()
+    {
+        if (m_input.empty())
+            throw checkpoint_error{"unexpected end of the checkpoint"};
+        const auto value = m_input[0];
+        m_input.remove_prefix(1);
+        return value;
+    }
+
+    uint64_t u64()
+    {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7)
+        {
+            const auto byte = u8();
+            value |= uint64_t{byte & 0x7fu} << shift;
+            if ((byte & 0x80) == 0)
+                return value;
+        }
+        throw checkpoint_error{"invalid integer in the checkpoint"};
+    }
+
+    /// Reads the integer which must be less than the limit, e.g. the index or the size.
+    size_t u64_below(uint64_t limit)
+    {
+        const auto value = u64();
+        if (value >= limit)
+            throw checkpoint_error{"invalid value in the checkpoint"};
+        return static_cast<size_t>(value);
+    }
+
+    bytes_view raw(size_t size)
+    {
+        if (m_input.size() < size)
+            throw checkpoint_error{"unexpected end of the checkpoint"};
+        const auto data = m_input.substr(0, size);
+        m_input.remove_prefix(size);
+        return data;
+    }
+};
+
+/// Returns the FNV-1a hash of the lane code, identifying the module of the checkpoint.
+uint64_t hash_code(const LaneCode& code) noexcept
+{
+    uint64_t hash = 0xcbf29ce484222325;
+    const auto add = [&hash](uint64_t value) noexcept {
+        hash ^= value;
+        hash *= 0x100000001b3;
+    };
+    const auto add_instructions = [&add](const std::vector<LoweredInstr>& instructions) noexcept {
+        add(instructions.size());
+        for (const auto& instr : instructions)
+        {
+            add(static_cast<uint8_t>(instr.instr));
+            add(instr.arity);
+            add(instr.imm);
+            add(instr.value);
+            add(instr.target);
+        }
+    };
+    add(code.functions.size());
+    for (const auto& function : code.functions)
+    {
+        add(static_cast<uint64_t>(function.max_stack_height));
+        add(function.local_count);
+        add_instructions(function.instructions);
+        add_instructions(function.br_table_labels);
+    }
+    return hash;
+}
+
+void write_result(CheckpointWriter& writer, const execution_result& result)
+{
+    writer.u8(result.trapped);
+    writer.u64(result.stack.size());
+    for (const auto value : result.stack)
+        writer.u64(value);
+}
+
+execution_result read_result(CheckpointReader& reader)
+{
+    execution_result result{reader.u8() != 0, {}};
+    result.stack.resize(reader.u64_below(2));
+    for (auto& value : result.stack)
+        value = reader.u64();
+    return result;
+}
+
+/// Writes the memory, the globals and the table size of the instance.
+void write_instance(CheckpointWriter& writer, const Instance& instance)
+{
+    const auto* const memory = instance.memory.get();
+    const auto memory_size = memory != nullptr ? memory->size() : 0;
+    writer.u64(memory_size);
+    for (size_t offset = 0; offset < memory_size; offset += CheckpointChunkSize)
+    {
+        const auto* const chunk = memory->data() + offset;
+        const auto chunk_size = std::min(CheckpointChunkSize, memory_size - offset);
+        const bool is_zero =
+            std::all_of(chunk, chunk + chunk_size, [](uint8_t byte) noexcept { return byte == 0; });
+        writer.u8(!is_zero);
+        if (!is_zero)
+            writer.raw(chunk, chunk_size);
+    }
+
+    writer.u64(instance.globals.size());
+    for (const auto value : instance.globals)
+        writer.u64(value);
+
+    writer.u64(instance.table != nullptr ? instance.table->size() : 0);
+}
+
+/// Reads the state written by write_instance() into the instance.
+void read_instance(CheckpointReader& reader, Instance& instance)
+{
+    auto* const memory = instance.memory.get();
+    const auto memory_size = reader.u64();
+    const auto max_memory_pages =
+        std::min(instance.memory_limits.max.value_or(MemoryPagesLimit), MemoryPagesLimit);
+    const auto max_memory_size = memory != nullptr ? uint64_t{max_memory_pages} * PageSize : 0;
+    if (memory_size > max_memory_size || memory_size % PageSize != 0)
+        throw checkpoint_error{"the checkpointed memory does not fit the instance"};
+    if (memory != nullptr)
+    {
+        memory->assign(static_cast<size_t>(memory_size), 0);
+        for (size_t offset = 0; offset < memory_size; offset += CheckpointChunkSize)
+        {
+            const auto chunk_size = std::min(CheckpointChunkSize, memory->size() - offset);
+            if (reader.u8() != 0)
+            {
+                const auto chunk = reader.raw(chunk_size);
+                std::copy(chunk.begin(), chunk.end(), memory->data() + offset);
+            }
+        }
+    }
+
+    if (reader.u64() != instance.globals.size())
+        throw checkpoint_error{"the checkpointed globals do not match the instance"};
+    for (auto& value : instance.globals)
+        value = reader.u64();
+
+    if (reader.u64() != (instance.table != nullptr ? instance.table->size() : 0))
+        throw checkpoint_error{"the checkpointed table does not match the instance"};
+}
+}  // namespace
+
+std::shared_ptr<PendingCall> defer_current_call()
+{
+    if (current_lane_call == nullptr)
+        return nullptr;
+    if (current_lane_call->pending_call == nullptr)
+        current_lane_call->pending_call = std::make_shared<PendingCall>(current_lane_call->wakeup);
+    return current_lane_call->pending_call;
+}
+
+/// Executes the lane groups until all lanes complete or the fuel runs out.
+class LaneExecutor
+{
+    const LaneCode& m_code;
+    const std::vector<Instance*> m_instances;
+    const Module& m_module;
+
+    /// The groups divided from the executed ones and the suspended group, waiting for
+    /// the execution.
+    std::vector<LaneGroup> m_pending;
+
+    /// The groups waiting for the pending calls.
+    std::vector<WaitingGroup> m_waiting;
+
+    /// The flags of the lanes of the executed group, e.g. the trapped ones.
+    std::vector<uint8_t> m_mask;
+
+    /// The accesses of each lane, not recorded if null.
+    AccessSet* const m_access_sets;
+
+    /// The number of instructions left to execute.
+    uint64_t m_fuel = 0;
+
+    /// The code index of the call_indirect targets not entered by the lanes.
+    static constexpr size_t NotEntered = std::numeric_limits<size_t>::max();
+
+public:
+    std::vector<execution_result> results;
+
+    const std::shared_ptr<LaneWakeup> wakeup = std::make_shared<LaneWakeup>();
+
+    LaneExecutor(const LaneCode& code, std::vector<Instance*> instances, AccessSet* access_sets)
+      : m_code{code},
+        m_instances{std::move(instances)},
+        m_module{m_instances.front()->module},
+        m_access_sets{access_sets},
+        results(m_instances.size())
+    {}
+
+    /// Starts the execution of the function with the arguments in the group's slots.
+    void start(LaneGroup group, size_t code_idx)
+    {
+        enter(group, code_idx);
+        m_pending.emplace_back(std::move(group));
+    }
+
+    /// Continues the execution with the given fuel, which is replaced with the fuel left.
+    /// Returns true if all lanes completed.
+    bool resume(uint64_t& fuel)
+    {
+        m_fuel = fuel;
+        wakeup->reset();
+        bool out_of_fuel = false;
+        while (!out_of_fuel && wake_up_completed())
+        {
+            while (!m_pending.empty())
+            {
+                auto next = std::move(m_pending.back());
+                m_pending.pop_back();
+                if (!execute(next))
+                {
+                    m_pending.emplace_back(std::move(next));
+                    out_of_fuel = true;
+                    break;
+                }
+            }
+        }
+        fuel = m_fuel;
+        return m_pending.empty() && m_waiting.empty();
+    }
+
+    const LaneCode& code() const noexcept { return m_code; }
+
+    const std::vector<Instance*>& instances() const noexcept { return m_instances; }
+
+    /// Returns true if all lanes wait for the pending calls.
+    bool is_waiting() const noexcept { return m_pending.empty() && !m_waiting.empty(); }
+
+    /// Writes the results and the groups of the lanes.
+    void save(CheckpointWriter& writer) const
+    {
+        if (!m_waiting.empty())
+            throw checkpoint_error{"the execution waiting for the pending calls"};
+
+        for (const auto& result : results)
+            write_result(writer, result);
+
+        writer.u64(m_pending.size());
+        for (const auto& group : m_pending)
+        {
+            writer.u64(group.width());
+            for (const auto lane : group.lanes)
+                writer.u64(lane);
+
+            writer.u64(group.frames.size());
+            for (const auto& frame : group.frames)
+            {
+                writer.u64(frame.code_idx);
+                writer.u64(frame.pc);
+                writer.u64(frame.locals_base);
+                writer.u64(frame.stack_base);
+            }
+
+            writer.u64(group.num_slots);
+            for (size_t slot = 0; slot < group.num_slots; ++slot)
+            {
+                for (size_t i = 0; i < group.width(); ++i)
+                    writer.u64(group.slot(slot)[i]);
+            }
+        }
+    }
+
+    /// Reads the state written by save().
+    void load(CheckpointReader& reader)
+    {
+        for (auto& result : results)
+            result = read_result(reader);
+
+        const auto num_lanes = m_instances.size();
+        const auto num_groups = reader.u64_below(num_lanes + 1);
+        for (size_t g = 0; g < num_groups; ++g)
+        {
+            LaneGroup group;
+            group.lanes.resize(reader.u64_below(num_lanes + 1));
+            for (auto& lane : group.lanes)
+                lane = static_cast<uint32_t>(reader.u64_below(num_lanes));
+
+            // The slots of the frames must fit in the space reserved by entering them.
+            size_t num_reserved_slots = 0;
+            group.frames.resize(reader.u64_below(size_t{CallStackLimit} + 2));
+            for (auto& frame : group.frames)
+            {
+                frame.code_idx = reader.u64_below(m_code.functions.size());
+                const auto& code = m_code.functions[frame.code_idx];
+                const auto func_idx = static_cast<FuncIdx>(
+                    m_module.imported_function_types.size() + frame.code_idx);
+                const auto num_args = m_module.get_function_type(func_idx).inputs.size();
+
+                frame.pc = reader.u64_below(code.instructions.size());
+                frame.locals_base = reader.u64_below(num_reserved_slots + 1);
+                frame.stack_base =
+                    reader.u64_below(frame.locals_base + num_args + code.local_count + 1);
+                num_reserved_slots =
+                    frame.stack_base + static_cast<size_t>(code.max_stack_height);
+            }
+            if (group.lanes.empty() || group.frames.empty())
+                throw checkpoint_error{"invalid lane group in the checkpoint"};
+
+            group.num_slots = reader.u64_below(num_reserved_slots + 1);
+            group.reserve(num_reserved_slots);
+            for (size_t slot = 0; slot < group.num_slots; ++slot)
+            {
+                for (size_t i = 0; i < group.width(); ++i)
+                    group.slot(slot)[i] = reader.u64();
+            }
+            m_pending.emplace_back(std::move(group));
+        }
+    }
+
+private:
+    Instance& instance(const LaneGroup& group, size_t i) const noexcept
+    {
+        return *m_instances[group.lanes[i]];
+    }
+
+    void clear_mask(const LaneGroup& group) { m_mask.assign(group.width(), 0); }
+
+    /// Moves the groups with all pending calls completed to the groups waiting for
+    /// the execution. Returns true if any group waits for the execution.
+    bool wake_up_completed()
+    {
+        for (auto it = m_waiting.begin(); it != m_waiting.end();)
+        {
+            std::vector<execution_result> call_results;
+            for (const auto& call : it->calls)
+            {
+                auto result = call->get_result();
+                if (!result.has_value())
+                    break;
+                call_results.emplace_back(std::move(*result));
+            }
+            if (call_results.size() != it->calls.size())
+            {
+                ++it;
+                continue;
+            }
+
+            auto& group = it->group;
+            clear_mask(group);
+            for (size_t i = 0; i < group.width(); ++i)
+            {
+                if (call_results[i].trapped)
+                    m_mask[i] = 1;
+                else if (it->has_result)
+                    group.top()[i] = call_results[i].stack[0];
+            }
+            remove_trapped(group);
+            m_pending.emplace_back(std::move(group));
+            it = m_waiting.erase(it);
+        }
+        return !m_pending.empty();
+    }
+
+    AccessSet& access_set(const LaneGroup& group, size_t i) const noexcept
+    {
+        return m_access_sets[group.lanes[i]];
+    }
+
+    /// Completes the lanes flagged in the mask with the trap and removes them from the group.
+    void remove_trapped(LaneGroup& group)
+    {
+        if (std::find(m_mask.begin(), m_mask.end(), uint8_t{1}) == m_mask.end())
+            return;
+        for (size_t i = 0; i < group.width(); ++i)
+        {
+            if (m_mask[i] != 0)
+                results[group.lanes[i]] = {true, {}};
+        }
+        group = group.extract(m_mask, false);
+    }
+
+    /// Completes the lanes of the instances requested to be interrupted with the interrupted
+    /// trap and removes them from the group. This is checked at the function entries and
+    /// the loop back-edges, as in execute().
+    void remove_interrupted(LaneGroup& group)
+    {
+        bool interrupted = false;
+        m_mask.resize(group.width());
+        for (size_t i = 0; i < group.width(); ++i)
+        {
+            m_mask[i] = instance(group, i).interrupt_requested.load(std::memory_order_relaxed);
+            interrupted |= m_mask[i] != 0;
+        }
+        if (!interrupted)
+            return;
+
+        for (size_t i = 0; i < group.width(); ++i)
+        {
+            if (m_mask[i] != 0)
+                results[group.lanes[i]] = {true, {}, true};
+        }
+        group = group.extract(m_mask, false);
+    }
+
+    void trap_all(LaneGroup& group)
+    {
+        for (const auto lane : group.lanes)
+            results[lane] = {true, {}};
+        group.lanes.clear();
+    }
+
+    /// Divides the lanes with the key different from the first lane's one into the new group,
+    /// which executes the current instruction again. The get_key returns the key of the lane
+    /// at the position in the group.
+    template <typename GetKey>
+    void divide_by(LaneGroup& group, GetKey get_key)
+    {
+        const auto first = get_key(size_t{0});
+        bool divergent = false;
+        for (size_t i = 0; i < group.width(); ++i)
+        {
+            m_mask[i] = get_key(i) != first;
+            divergent |= m_mask[i] != 0;
+        }
+        if (!divergent)
+            return;
+
+        auto& divided = m_pending.emplace_back(group.extract(m_mask, true));
+        --divided.frames.back().pc;
+        group = group.extract(m_mask, false);
+    }
+
+    /// Divides the lanes with the value in the top slot different from the first lane's one
+    /// into the new group, which executes the current instruction again.
+    /// The value is transformed by the function first, e.g. the condition is converted to bool.
+    template <typename F>
+    void divide(LaneGroup& group, F transform)
+    {
+        const auto* const values = group.top();
+        divide_by(group, [values, &transform](size_t i) { return transform(values[i]); });
+    }
+
+    /// Returns the code index of the function called by call_indirect of the lane if it is
+    /// the lane instance's own function of the expected type, so the lane enters it like
+    /// the direct call. Returns NotEntered for the other functions, called by call_each(),
+    /// and for the trapping calls.
+    size_t get_entered_code_idx(const LaneGroup& group, size_t i, uint64_t elem_idx,
+        const FuncType& expected_type) const noexcept
+    {
+        auto& lane_instance = instance(group, i);
+        const auto& table = *lane_instance.table;
+        if (elem_idx >= table.size() || !table[elem_idx].has_value())
+            return NotEntered;
+        const auto& element = *table[elem_idx];
+        const auto num_imported_functions = m_module.imported_function_types.size();
+        if (element.instance != &lane_instance || element.func_idx < num_imported_functions ||
+            element.type != expected_type)
+            return NotEntered;
+        return element.func_idx - num_imported_functions;
+    }
+
+    /// Takes the branch. The stack is cut to the branch target's height keeping the result.
+    static void branch(LaneGroup& group, const LoweredInstr& instr) noexcept
+    {
+        auto& frame = group.frames.back();
+        frame.pc = instr.target;
+
+        const auto stack_height = frame.stack_base + instr.imm;
+        assert(group.num_slots >= stack_height + instr.arity);
+        if (instr.arity != 0)
+        {
+            assert(instr.arity == 1);
+            if (group.num_slots - 1 != stack_height)
+                std::copy_n(group.top(), group.width(), group.slot(stack_height));
+        }
+        group.num_slots = stack_height + instr.arity;
+    }
+
+    /// Takes the branch of the instruction at the @p pc, checking the interrupt at the loop
+    /// back-edges.
+    void take_branch(LaneGroup& group, const LoweredInstr& instr, size_t pc)
+    {
+        branch(group, instr);
+        if (instr.target <= pc)
+            remove_interrupted(group);
+    }
+
+    void enter(LaneGroup& group, size_t code_idx)
+    {
+        const auto func_idx =
+            static_cast<FuncIdx>(m_module.imported_function_types.size() + code_idx);
+        const auto num_args = m_module.get_function_type(func_idx).inputs.size();
+        const auto& code = m_code.functions[code_idx];
+
+        LaneFrame frame;
+        frame.code_idx = code_idx;
+        frame.locals_base = group.num_slots - num_args;
+        frame.stack_base = group.num_slots + code.local_count;
+        group.reserve(frame.stack_base + static_cast<size_t>(code.max_stack_height));
+        std::fill_n(group.slot(group.num_slots), code.local_count * group.width(), uint64_t{0});
+        group.num_slots = frame.stack_base;
+        group.frames.emplace_back(frame);
+        remove_interrupted(group);
+    }
+
+    /// Returns from the function, the result replaces the arguments.
+    /// Completes the lanes when the entry function returns.
+    void leave(LaneGroup& group)
+    {
+        const auto& frame = group.frames.back();
+        const auto func_idx =
+            static_cast<FuncIdx>(m_module.imported_function_types.size() + frame.code_idx);
+        const bool has_result = !m_module.get_function_type(func_idx).outputs.empty();
+
+        if (group.frames.size() == 1)
+        {
+            for (size_t i = 0; i < group.width(); ++i)
+            {
+                results[group.lanes[i]] = has_result ? execution_result{false, {group.top()[i]}} :
+                                                       execution_result{false, {}};
+            }
+            group.lanes.clear();
+            return;
+        }
+
+        const auto locals_base = frame.locals_base;
+        if (has_result && group.num_slots - 1 != locals_base)
+            std::copy_n(group.top(), group.width(), group.slot(locals_base));
+        group.num_slots = locals_base + (has_result ? 1 : 0);
+        group.frames.pop_back();
+    }
+
+    /// Calls the function of each lane separately with the arguments from the stack.
+    /// Only the imported functions called directly, i.e. not by call_indirect, may defer
+    /// the call, see defer_current_call().
+    template <typename GetFunction>
+    void call_each(LaneGroup& group, const FuncType& func_type, bool imported,
+        GetFunction get_function)
+    {
+        const auto num_args = func_type.inputs.size();
+        const bool has_result = !func_type.outputs.empty();
+        const auto args_base = group.num_slots - num_args;
+        const auto depth = static_cast<int>(group.frames.size()) - 1;
+
+        clear_mask(group);
+        std::vector<uint64_t> results_values(group.width());
+        std::vector<uint8_t> waiting_mask(group.width());
+        std::vector<std::shared_ptr<PendingCall>> calls;
+        for (size_t i = 0; i < group.width(); ++i)
+        {
+            const auto* const function = get_function(i);
+            if (function == nullptr)
+            {
+                m_mask[i] = 1;
+                continue;
+            }
+
+            std::vector<uint64_t> args(num_args);
+            for (size_t k = 0; k < num_args; ++k)
+                args[k] = group.slot(args_base + k)[i];
+
+            LaneCallContext context{wakeup, nullptr};
+            execution_result ret;
+            {
+                const LaneCallScope call_scope{imported ? &context : nullptr};
+                ret = (*function)(instance(group, i), std::move(args), depth + 1);
+            }
+
+            if (context.pending_call != nullptr)
+            {
+                waiting_mask[i] = 1;
+                calls.emplace_back(std::move(context.pending_call));
+            }
+            else if (ret.trapped)
+                m_mask[i] = 1;
+            else if (has_result)
+                results_values[i] = ret.stack[0];
+        }
+
+        group.num_slots = args_base;
+        if (has_result)
+            std::copy(results_values.begin(), results_values.end(), group.push());
+
+        if (!calls.empty())
+        {
+            m_waiting.push_back({group.extract(waiting_mask, true), std::move(calls), has_result});
+            group = group.extract(waiting_mask, false);
+            size_t num_remaining = 0;
+            for (size_t i = 0; i < waiting_mask.size(); ++i)
+            {
+                if (waiting_mask[i] == 0)
+                    m_mask[num_remaining++] = m_mask[i];
+            }
+            m_mask.resize(num_remaining);
+        }
+        remove_trapped(group);
+    }
+
+    template <typename DstT, typename SrcT = DstT>
+    void load(LaneGroup& group, uint32_t offset)
+    {
+        clear_mask(group);
+        auto* const values = group.top();
+        for (size_t i = 0; i < group.width(); ++i)
+        {
+            const auto& memory = *instance(group, i).memory;
+            const auto address = static_cast<uint32_t>(values[i]);
+            if ((uint64_t{address} + offset + sizeof(SrcT)) > memory.size())
+            {
+                if (m_access_sets != nullptr)
+                    access_set(group, i).memory_size_read = true;
+                m_mask[i] = 1;
+                continue;
+            }
+            if (m_access_sets != nullptr)
+            {
+                record_access(
+                    access_set(group, i).read_pages, uint64_t{address} + offset, sizeof(SrcT));
+            }
+            SrcT value;
+            __builtin_memcpy(&value, memory.data() + address + offset, sizeof(value));
+            values[i] = extend<DstT>(value);
+        }
+        remove_trapped(group);
+    }
+
+    template <typename DstT>
+    void store(LaneGroup& group, uint32_t offset)
+    {
+        clear_mask(group);
+        const auto* const values = group.pop();
+        const auto* const addresses = group.pop();
+        for (size_t i = 0; i < group.width(); ++i)
+        {
+            auto& memory = *instance(group, i).memory;
+            const auto address = static_cast<uint32_t>(addresses[i]);
+            if ((uint64_t{address} + offset + sizeof(DstT)) > memory.size())
+            {
+                if (m_access_sets != nullptr)
+                    access_set(group, i).memory_size_read = true;
+                m_mask[i] = 1;
+                continue;
+            }
+            if (m_access_sets != nullptr)
+            {
+                record_access(
+                    access_set(group, i).written_pages, uint64_t{address} + offset, sizeof(DstT));
+            }
+            const auto value = static_cast<DstT>(values[i]);
+            __builtin_memcpy(memory.data() + address + offset, &value, sizeof(value));
+        }
+        remove_trapped(group);
+    }
+
+    /// Executes the atomic instruction other than atomic_fence for each lane. The access is
+    /// recorded as both the load and the store.
+    void atomic(LaneGroup& group, const LoweredInstr& instr)
+    {
+        clear_mask(group);
+        const auto op = static_cast<AtomicOp>(instr.arity);
+        const uint64_t* replacements = nullptr;
+        const uint64_t* values = nullptr;
+        if (instr.instr == Instr::atomic_cmpxchg)
+            replacements = group.pop();
+        if (instr.instr != Instr::atomic_load)
+            values = group.pop();
+        // The result replaces the address, the store's one is popped after the loop.
+        auto* const addresses = group.top();
+        for (size_t i = 0; i < group.width(); ++i)
+        {
+            auto& inst = instance(group, i);
+            const auto address = static_cast<uint32_t>(addresses[i]);
+            const uint64_t operands[2]{
+                values != nullptr ? values[i] : 0, replacements != nullptr ? replacements[i] : 0};
+            uint64_t result = 0;
+            if (!execute_atomic(op, *inst.memory, inst.memory_limits.shared, address, instr.imm,
+                    operands, result))
+            {
+                if (m_access_sets != nullptr)
+                    access_set(group, i).memory_size_read = true;
+                m_mask[i] = 1;
+                continue;
+            }
+            if (m_access_sets != nullptr)
+            {
+                const auto effective_address = uint64_t{address} + instr.imm;
+                const auto size = get_atomic_access_size(op);
+                record_access(access_set(group, i).read_pages, effective_address, size);
+                record_access(access_set(group, i).written_pages, effective_address, size);
+            }
+            addresses[i] = result;
+        }
+        if (instr.instr == Instr::atomic_store)
+            group.pop();
+        remove_trapped(group);
+    }
+
+    /// Executes the division-like operation, trapping the lanes for which it is undefined.
+    template <typename T, typename Op>
+    void division_op(LaneGroup& group, Op op)
+    {
+        clear_mask(group);
+        const auto* const rhs = group.slot(group.num_slots - 1);
+        const auto* const lhs = group.slot(group.num_slots - 2);
+        for (size_t i = 0; i < group.width(); ++i)
+        {
+            const auto r = static_cast<T>(rhs[i]);
+            const auto l = static_cast<T>(lhs[i]);
+            m_mask[i] = r == 0 || (std::is_same_v<Op, std::divides<T>> && std::is_signed_v<T> &&
+                                      l == std::numeric_limits<T>::min() && r == T(-1));
+        }
+        remove_trapped(group);
+        if (group.lanes.empty())
+            return;
+
+        binary_op(group, [op](T l, T r) noexcept {
+            // The signed remainder of the minimum value and -1 is 0, but the C++ one is undefined.
+            if constexpr (std::is_signed_v<T>)
+            {
+                if (r == T(-1))
+                    return std::is_same_v<Op, std::divides<T>> ? T(-l) : T(0);
+            }
+            return op(l, r);
+        });
+    }
+
+    uint64_t& global(Instance& inst, uint32_t idx) noexcept
+    {
+        if (idx < inst.imported_globals.size())
+            return *inst.imported_globals[idx].value;
+        return inst.globals[idx - inst.imported_globals.size()];
+    }
+
+    /// Executes the group until its lanes complete and returns true, or until the fuel runs out
+    /// and returns false.
+    bool execute(LaneGroup& group);
+};
+
+bool LaneExecutor::execute(LaneGroup& group)
+{
+    while (!group.lanes.empty())
+    {
+        if (m_fuel == 0)
+            return false;
+        --m_fuel;
+
+        const auto pc = group.frames.back().pc++;
+        const auto& code = m_code.functions[group.frames.back().code_idx];
+        const auto& instr = code.instructions[pc];
+        const auto width = group.width();
+        m_mask.resize(width);
+
+        switch (instr.instr)
+        {
+        case Instr::unreachable:
+            trap_all(group);
+            break;
+        case Instr::if_:
+        {
+            divide(group, is_true);
+            if (!is_true(group.pop()[0]))
+                group.frames.back().pc = instr.target;
+            break;
+        }
+        case Instr::else_:
+            group.frames.back().pc = instr.target;
+            break;
+        case Instr::end:
+            leave(group);
+            break;
+        case Instr::br_if:
+        {
+            divide(group, is_true);
+            if (is_true(group.pop()[0]))
+                take_branch(group, instr, pc);
+            break;
+        }
+        case Instr::br:
+        case Instr::return_:
+            take_branch(group, instr, pc);
+            break;
+        case Instr::br_table:
+        {
+            const auto br_table_size = instr.imm;
+            const auto get_label_idx = [br_table_size](uint64_t value) noexcept {
+                const auto idx = static_cast<uint32_t>(value);
+                return idx < br_table_size ? idx : br_table_size;
+            };
+            divide(group, get_label_idx);
+            const auto label_idx = get_label_idx(group.pop()[0]);
+            const auto& label = code.br_table_labels[instr.value + label_idx];
+            take_branch(group, label, pc);
+            break;
+        }
+        case Instr::call:
+        {
+            const auto called_func_idx = instr.imm;
+            const auto num_imported_functions = m_module.imported_function_types.size();
+            if (called_func_idx < num_imported_functions)
+            {
+                call_each(group, m_module.imported_function_types[called_func_idx], true,
+                    [this, &group, called_func_idx](size_t i) {
+                        return &instance(group, i).imported_functions[called_func_idx].function;
+                    });
+            }
+            else if (group.frames.size() > static_cast<size_t>(CallStackLimit))
+                trap_all(group);
+            else
+                enter(group, called_func_idx - num_imported_functions);
+            break;
+        }
+        case Instr::call_indirect:
+        {
+            const auto& expected_type = m_module.typesec[instr.imm];
+
+            // The lanes entering the different functions continue separately.
+            divide_by(group, [this, &group, &expected_type](size_t i) {
+                return get_entered_code_idx(group, i, group.top()[i], expected_type);
+            });
+            const auto code_idx = get_entered_code_idx(group, 0, group.top()[0], expected_type);
+            if (code_idx != NotEntered)
+            {
+                group.pop();
+                if (group.frames.size() > static_cast<size_t>(CallStackLimit))
+                    trap_all(group);
+                else
+                    enter(group, code_idx);
+                break;
+            }
+
+            const auto* const elem_indices = group.pop();
+            std::vector<uint64_t> elem_idx(elem_indices, elem_indices + group.width());
+            call_each(group, expected_type, false,
+                [this, &group, &elem_idx, &expected_type](size_t i) {
+                    const auto& table = *instance(group, i).table;
+                    const std::function<execution_result(Instance&, std::vector<uint64_t>, int)>*
+                        function = nullptr;
+                    if (elem_idx[i] < table.size() && table[elem_idx[i]].has_value() &&
+                        table[elem_idx[i]]->type == expected_type)
+                        function = &table[elem_idx[i]]->function;
+                    return function;
+                });
+            break;
+        }
+        case Instr::drop:
+            group.pop();
+            break;
+        case Instr::select:
+        {
+            const auto* const condition = group.pop();
+            const auto* const val2 = group.pop();
+            auto* const val1 = group.top();
+            for (size_t i = 0; i < width; ++i)
+                val1[i] = static_cast<uint32_t>(condition[i]) != 0 ? val1[i] : val2[i];
+            break;
+        }
+        case Instr::local_get:
+        {
+            const auto* const local = group.slot(group.frames.back().locals_base + instr.imm);
+            std::copy_n(local, width, group.push());
+            break;
+        }
+        case Instr::local_set:
+        {
+            auto* const local = group.slot(group.frames.back().locals_base + instr.imm);
+            std::copy_n(group.pop(), width, local);
+            break;
+        }
+        case Instr::local_tee:
+        {
+            auto* const local = group.slot(group.frames.back().locals_base + instr.imm);
+            std::copy_n(group.top(), width, local);
+            break;
+        }
+        case Instr::global_get:
+        {
+            auto* const values = group.push();
+            for (size_t i = 0; i < width; ++i)
+                values[i] = global(instance(group, i), instr.imm);
+            if (m_access_sets != nullptr)
+            {
+                for (size_t i = 0; i < width; ++i)
+                    record_access(access_set(group, i).read_globals, instr.imm);
+            }
+            break;
+        }
+        case Instr::global_set:
+        {
+            const auto* const values = group.pop();
+            for (size_t i = 0; i < width; ++i)
+                global(instance(group, i), instr.imm) = values[i];
+            if (m_access_sets != nullptr)
+            {
+                for (size_t i = 0; i < width; ++i)
+                    record_access(access_set(group, i).written_globals, instr.imm);
+            }
+            break;
+        }
+        case Instr::i32_load:
+            load<uint32_t>(group, instr.imm);
+            break;
+        case Instr::i64_load:
+            load<uint64_t>(group, instr.imm);
+            break;
+        case Instr::i32_load8_s:
+            load<uint32_t, int8_t>(group, instr.imm);
+            break;
+        case Instr::i32_load8_u:
+            load<uint32_t, uint8_t>(group, instr.imm);
+            break;
+        case Instr::i32_load16_s:
+            load<uint32_t, int16_t>(group, instr.imm);
+            break;
+        case Instr::i32_load16_u:
+            load<uint32_t, uint16_t>(group, instr.imm);
+            break;
+        case Instr::i64_load8_s:
+            load<uint64_t, int8_t>(group, instr.imm);
+            break;
+        case Instr::i64_load8_u:
+            load<uint64_t, uint8_t>(group, instr.imm);
+            break;
+        case Instr::i64_load16_s:
+            load<uint64_t, int16_t>(group, instr.imm);
+            break;
+        case Instr::i64_load16_u:
+            load<uint64_t, uint16_t>(group, instr.imm);
+            break;
+        case Instr::i64_load32_s:
+            load<uint64_t, int32_t>(group, instr.imm);
+            break;
+        case Instr::i64_load32_u:
+            load<uint64_t, uint32_t>(group, instr.imm);
+            break;
+        case Instr::i32_store:
+            store<uint32_t>(group, instr.imm);
+            break;
+        case Instr::i64_store:
+            store<uint64_t>(group, instr.imm);
+            break;
+        case Instr::i32_store8:
+        case Instr::i64_store8:
+            store<uint8_t>(group, instr.imm);
+            break;
+        case Instr::i32_store16:
+        case Instr::i64_store16:
+            store<uint16_t>(group, instr.imm);
+            break;
+        case Instr::i64_store32:
+            store<uint32_t>(group, instr.imm);
+            break;
+        case Instr::memory_size:
+        {
+            auto* const values = group.push();
+            for (size_t i = 0; i < width; ++i)
+                values[i] = static_cast<uint32_t>(instance(group, i).memory->size() / PageSize);
+            if (m_access_sets != nullptr)
+            {
+                for (size_t i = 0; i < width; ++i)
+                    access_set(group, i).memory_size_read = true;
+            }
+            break;
+        }
+        case Instr::memory_grow:
+        {
+            auto* const values = group.top();
+            for (size_t i = 0; i < width; ++i)
+            {
+                auto& inst = instance(group, i);
+                const auto delta = static_cast<uint32_t>(values[i]);
+                const auto cur_pages = inst.memory->size() / PageSize;
+                const auto new_pages = cur_pages + delta;
+                const size_t memory_max_pages =
+                    inst.memory_limits.max.has_value() ? *inst.memory_limits.max : MemoryPagesLimit;
+                uint32_t ret = static_cast<uint32_t>(cur_pages);
+                try
+                {
+                    if (new_pages > memory_max_pages || (delta != 0 && inst.memory_limits.shared))
+                        throw std::bad_alloc();
+                    inst.memory->resize(new_pages * PageSize);
+                }
+                catch (std::bad_alloc const&)
+                {
+                    ret = static_cast<uint32_t>(-1);
+                }
+                values[i] = ret;
+                if (m_access_sets != nullptr)
+                {
+                    access_set(group, i).memory_size_read = true;
+                    access_set(group, i).memory_size_written |=
+                        delta != 0 && ret != static_cast<uint32_t>(-1);
+                }
+            }
+            break;
+        }
+        case Instr::atomic_load:
+        case Instr::atomic_store:
+        case Instr::atomic_rmw:
+        case Instr::atomic_cmpxchg:
+            atomic(group, instr);
+            break;
+        case Instr::atomic_fence:
+            atomic_fence();
+            break;
+        case Instr::i32_const:
+            std::fill_n(group.push(), width, uint64_t{instr.imm});
+            break;
+        case Instr::i64_const:
+            std::fill_n(group.push(), width, instr.value);
+            break;
+        case Instr::i32_eqz:
+            unary_op(group, [](uint32_t value) noexcept { return uint32_t{value == 0}; });
+            break;
+        case Instr::i32_eq:
+            comparison_op(group, std::equal_to<uint32_t>());
+            break;
+        case Instr::i32_ne:
+            comparison_op(group, std::not_equal_to<uint32_t>());
+            break;
+        case Instr::i32_lt_s:
+            comparison_op(group, std::less<int32_t>());
+            break;
+        case Instr::i32_lt_u:
+            comparison_op(group, std::less<uint32_t>());
+            break;
+        case Instr::i32_gt_s:
+            comparison_op(group, std::greater<int32_t>());
+            break;
+        case Instr::i32_gt_u:
+            comparison_op(group, std::greater<uint32_t>());
+            break;
+        case Instr::i32_le_s:
+            comparison_op(group, std::less_equal<int32_t>());
+            break;
+        case Instr::i32_le_u:
+            comparison_op(group, std::less_equal<uint32_t>());
+            break;
+        case Instr::i32_ge_s:
+            comparison_op(group, std::greater_equal<int32_t>());
+            break;
+        case Instr::i32_ge_u:
+            comparison_op(group, std::greater_equal<uint32_t>());
+            break;
+        case Instr::i64_eqz:
+            unary_op(group, [](uint64_t value) noexcept { return uint64_t{value == 0}; });
+            break;
+        case Instr::i64_eq:
+            comparison_op(group, std::equal_to<uint64_t>());
+            break;
+        case Instr::i64_ne:
+            comparison_op(group, std::not_equal_to<uint64_t>());
+            break;
+        case Instr::i64_lt_s:
+            comparison_op(group, std::less<int64_t>());
+            break;
+        case Instr::i64_lt_u:
+            comparison_op(group, std::less<uint64_t>());
+            break;
+        case Instr::i64_gt_s:
+            comparison_op(group, std::greater<int64_t>());
+            break;
+        case Instr::i64_gt_u:
+            comparison_op(group, std::greater<uint64_t>());
+            break;
+        case Instr::i64_le_s:
+            comparison_op(group, std::less_equal<int64_t>());
+            break;
+        case Instr::i64_le_u:
+            comparison_op(group, std::less_equal<uint64_t>());
+            break;
+        case Instr::i64_ge_s:
+            comparison_op(group, std::greater_equal<int64_t>());
+            break;
+        case Instr::i64_ge_u:
+            comparison_op(group, std::greater_equal<uint64_t>());
+            break;
+        case Instr::i32_clz:
+            unary_op(group, clz32);
+            break;
+        case Instr::i32_ctz:
+            unary_op(group, ctz32);
+            break;
+        case Instr::i32_popcnt:
+            unary_op(group, popcnt32);
+            break;
+        case Instr::i32_add:
+            binary_op(group, std::plus<uint32_t>());
+            break;
+        case Instr::i32_sub:
+            binary_op(group, std::minus<uint32_t>());
+            break;
+        case Instr::i32_mul:
+            binary_op(group, std::multiplies<uint32_t>());
+            break;
+        case Instr::i32_div_s:
+            division_op<int32_t>(group, std::divides<int32_t>());
+            break;
+        case Instr::i32_div_u:
+            division_op<uint32_t>(group, std::divides<uint32_t>());
+            break;
+        case Instr::i32_rem_s:
+            division_op<int32_t>(group, std::modulus<int32_t>());
+            break;
+        case Instr::i32_rem_u:
+            division_op<uint32_t>(group, std::modulus<uint32_t>());
+            break;
+        case Instr::i32_and:
+            binary_op(group, std::bit_and<uint32_t>());
+            break;
+        case Instr::i32_or:
+            binary_op(group, std::bit_or<uint32_t>());
+            break;
+        case Instr::i32_xor:
+            binary_op(group, std::bit_xor<uint32_t>());
+            break;
+        case Instr::i32_shl:
+            binary_op(group, shift_left<uint32_t>);
+            break;
+        case Instr::i32_shr_s:
+            binary_op(group, shift_right<int32_t>);
+            break;
+        case Instr::i32_shr_u:
+            binary_op(group, shift_right<uint32_t>);
+            break;
+        case Instr::i32_rotl:
+            binary_op(group, rotl<uint32_t>);
+            break;
+        case Instr::i32_rotr:
+            binary_op(group, rotr<uint32_t>);
+            break;
+        case Instr::i64_clz:
+            unary_op(group, clz64);
+            break;
+        case Instr::i64_ctz:
+            unary_op(group, ctz64);
+            break;
+        case Instr::i64_popcnt:
+            unary_op(group, popcnt64);
+            break;
+        case Instr::i64_add:
+            binary_op(group, std::plus<uint64_t>());
+            break;
+        case Instr::i64_sub:
+            binary_op(group, std::minus<uint64_t>());
+            break;
+        case Instr::i64_mul:
+            binary_op(group, std::multiplies<uint64_t>());
+            break;
+        case Instr::i64_div_s:
+            division_op<int64_t>(group, std::divides<int64_t>());
+            break;
+        case Instr::i64_div_u:
+            division_op<uint64_t>(group, std::divides<uint64_t>());
+            break;
+        case Instr::i64_rem_s:
+            division_op<int64_t>(group, std::modulus<int64_t>());
+            break;
+        case Instr::i64_rem_u:
+            division_op<uint64_t>(group, std::modulus<uint64_t>());
+            break;
+        case Instr::i64_and:
+            binary_op(group, std::bit_and<uint64_t>());
+            break;
+        case Instr::i64_or:
+            binary_op(group, std::bit_or<uint64_t>());
+            break;
+        case Instr::i64_xor:
+            binary_op(group, std::bit_xor<uint64_t>());
+            break;
+        case Instr::i64_shl:
+            binary_op(group, shift_left<uint64_t>);
+            break;
+        case Instr::i64_shr_s:
+            binary_op(group, shift_right<int64_t>);
+            break;
+        case Instr::i64_shr_u:
+            binary_op(group, shift_right<uint64_t>);
+            break;
+        case Instr::i64_rotl:
+            binary_op(group, rotl<uint64_t>);
+            break;
+        case Instr::i64_rotr:
+            binary_op(group, rotr<uint64_t>);
+            break;
+        case Instr::i32_wrap_i64:
+            unary_op(group, [](uint64_t value) noexcept { return static_cast<uint32_t>(value); });
+            break;
+        case Instr::i64_extend_i32_s:
+            unary_op(group, [](uint64_t value) noexcept {
+                return static_cast<uint64_t>(int64_t{static_cast<int32_t>(value)});
+            });
+            break;
+        case Instr::i64_extend_i32_u:
+            // effectively no-op
+            break;
+        default:
+            throw unsupported_feature("Instruction not supported in the lane execution.");
+        }
+    }
+    return true;
+}
+
+LaneCode compile_lane_code(const Module& module)
+{
+    LaneCode code;
+    code.functions.reserve(module.codesec.size());
+    for (const auto& function_code : module.codesec)
+    {
+        auto& lowered_code = code.functions.emplace_back(lower_code(function_code));
+        optimize(lowered_code);
+    }
+
+    // The inlined code is optimized again together with the caller's code around it.
+    inline_calls(module, code.functions);
+    for (auto& lowered_code : code.functions)
+        optimize(lowered_code);
+    return code;
+}
+
+LaneExecution::LaneExecution(const LaneCode& code, std::vector<Instance*> instances,
+    FuncIdx func_idx, const uint64_t* args, AccessSet* access_sets)
+{
+    if (instances.empty())
+        return;
+
+    const auto& module = instances.front()->module;
+    const auto num_args = module.get_function_type(func_idx).inputs.size();
+    const auto num_imported_functions = module.imported_function_types.size();
+
+    if (func_idx < num_imported_functions)
+    {
+        // The imported function is not executed by the lanes, but at once.
+        m_results.reserve(instances.size());
+        for (size_t lane = 0; lane < instances.size(); ++lane)
+        {
+            const auto* const lane_args = args + lane * num_args;
+            m_results.emplace_back(
+                execute(*instances[lane], func_idx, {lane_args, lane_args + num_args}));
+        }
+        return;
+    }
+
+    LaneGroup group;
+    group.lanes.resize(instances.size());
+    for (uint32_t lane = 0; lane < instances.size(); ++lane)
+        group.lanes[lane] = lane;
+
+    // The arguments are the entry function's first locals.
+    group.reserve(num_args);
+    for (size_t k = 0; k < num_args; ++k)
+    {
+        auto* const values = group.push();
+        for (size_t lane = 0; lane < instances.size(); ++lane)
+            values[lane] = args[lane * num_args + k];
+    }
+
+    m_executor = std::make_unique<LaneExecutor>(code, std::move(instances), access_sets);
+    m_executor->start(std::move(group), func_idx - num_imported_functions);
+}
+
+LaneExecution::LaneExecution() noexcept = default;
+LaneExecution::LaneExecution(LaneExecution&&) noexcept = default;
+LaneExecution& LaneExecution::operator=(LaneExecution&&) noexcept = default;
+LaneExecution::~LaneExecution() noexcept = default;
+
+bool LaneExecution::resume(uint64_t& fuel)
+{
+    if (m_executor == nullptr)
+        return true;
+
+    const bool completed = m_executor->resume(fuel);
+    if (completed)
+    {
+        m_results = std::move(m_executor->results);
+        m_executor.reset();
+    }
+    return completed;
+}
+
+bool LaneExecution::is_waiting() const noexcept
+{
+    return m_executor != nullptr && m_executor->is_waiting();
+}
+
+void LaneExecution::when_ready(std::function<void()> callback)
+{
+    if (m_executor == nullptr)
+        callback();
+    else
+        m_executor->wakeup->when_notified(std::move(callback));
+}
+
+bytes LaneExecution::checkpoint() const
+{
+    if (m_executor == nullptr)
+        throw checkpoint_error{"the execution is completed"};
+
+    CheckpointWriter writer;
+    writer.raw(CheckpointMagic, sizeof(CheckpointMagic));
+    writer.u8(CheckpointVersion);
+    writer.u64(hash_code(m_executor->code()));
+
+    const auto& instances = m_executor->instances();
+    writer.u64(instances.size());
+    for (const auto* const instance : instances)
+        write_instance(writer, *instance);
+
+    m_executor->save(writer);
+    return writer.take();
+}
+
+LaneExecution LaneExecution::restore(
+    const LaneCode& code, std::vector<Instance*> instances, bytes_view checkpoint)
+{
+    CheckpointReader reader{checkpoint};
+    const auto magic = reader.raw(sizeof(CheckpointMagic));
+    if (!std::equal(magic.begin(), magic.end(), std::begin(CheckpointMagic)) ||
+        reader.u8() != CheckpointVersion)
+        throw checkpoint_error{"invalid checkpoint"};
+
+    if (reader.u64() != hash_code(code))
+        throw checkpoint_error{"the checkpoint of the different module"};
+    if (instances.empty() || reader.u64() != instances.size())
+        throw checkpoint_error{"the checkpoint of the different number of instances"};
+    for (auto* const instance : instances)
+        read_instance(reader, *instance);
+
+    LaneExecution execution;
+    execution.m_executor = std::make_unique<LaneExecutor>(code, std::move(instances), nullptr);
+    execution.m_executor->load(reader);
+    if (!reader.empty())
+        throw checkpoint_error{"unexpected data at the end of the checkpoint"};
+    return execution;
+}
+
+BudgetedResult execute(const LaneCode& code, Instance& instance, FuncIdx func_idx,
+    const std::vector<uint64_t>& args, uint64_t budget)
+{
+    return resume(LaneExecution{code, {&instance}, func_idx, args.data()}, budget);
+}
+
+BudgetedResult resume(LaneExecution continuation, uint64_t budget)
+{
+    BudgetedResult result;
+    auto fuel = budget;
+    if (continuation.resume(fuel))
+        result.result = std::move(continuation).results().front();
+    else
+        result.continuation = std::move(continuation);
+    result.num_instructions = budget - fuel;
+    return result;
+}
+
+std::vector<execution_result> execute_lanes(const LaneCode& code,
+    const std::vector<Instance*>& instances, FuncIdx func_idx, const uint64_t* args,
+    AccessSet* access_sets)
+{
+    LaneExecution execution{code, instances, func_idx, args, access_sets};
+    auto fuel = std::numeric_limits<uint64_t>::max();
+    while (!execution.resume(fuel))
+    {
+        std::promise<void> ready;
+        auto ready_future = ready.get_future();
+        execution.when_ready([&ready] { ready.set_value(); });
+        ready_future.wait();
+    }
+    return std::move(execution).results();
+}
+}  // namespace fizzy
@@ -0,0 +1,210 @@
+// Fizzy: A fast WebAssembly interpreter
+// Copyright 2020 The Fizzy Authors.
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include "bytes.hpp"
+#include "execute.hpp"
+#include "lowered_code.hpp"
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+namespace fizzy
+{
+/// The code of all module's functions prepared for the lane-parallel execution.
+struct LaneCode
+{
+    /// The lowered code of each function of the code section, optimized by the peephole
+    /// optimizer and the inliner. The other optimizations emit the internal instructions
+    /// specific to the single instance execution, so they are not applied.
+    std::vector<LoweredCode> functions;
+};
+
+/// The parts of the instance state accessed by the execution of the lane.
+struct AccessSet
+{
+    /// The size of the memory regions recorded as a whole.
+    static constexpr uint32_t PageSize = 4096;
+
+    /// The flags of the memory pages loaded from and stored to, indexed by the page.
+    /// These may be shorter than the memory, the missing pages were not accessed.
+    std::vector<bool> read_pages;
+    std::vector<bool> written_pages;
+
+    /// The flags of the globals read and written, indexed by the global index.
+    std::vector<bool> read_globals;
+    std::vector<bool> written_globals;
+
+    /// Whether the outcome depends on the memory size, i.e. memory.size was executed or a memory
+    /// access trapped.
+    bool memory_size_read = false;
+
+    /// Whether the memory was grown.
+    bool memory_size_written = false;
+};
+
+/// Prepares the code of the module for execute_lanes().
+LaneCode compile_lane_code(const Module& module);
+
+class LaneExecutor;
+class LaneWakeup;
+
+/// The call of the imported function by the lane execution, which completes later.
+class PendingCall
+{
+    const std::shared_ptr<LaneWakeup> m_wakeup;
+    std::mutex m_mutex;
+    std::optional<execution_result> m_result;
+
+public:
+    explicit PendingCall(std::shared_ptr<LaneWakeup> wakeup) noexcept;
+
+    /// Completes the call with the result of the imported function. It may be called by any
+    /// thread, once.
+    void complete(execution_result result);
+
+    /// Returns the result if the call is completed.
+    std::optional<execution_result> get_result();
+};
+
+/// Makes the call of the imported function by the calling thread pending: the imported function
+/// returns at once, its return value is ignored, and the calling lane waits for the completion
+/// of the returned call. The other lanes continue.
+///
+/// This lets the imported function wait for the I/O without blocking the thread. It must be
+/// called by the imported function called directly by LaneExecution. Returns null when
+/// the call cannot be pending, i.e. the function is called by execute(), including the nested
+/// execute() of another imported function, or by call_indirect.
+std::shared_ptr<PendingCall> defer_current_call();
+
+/// The execution of the function on each of the instances in lock-step, as by execute_lanes(),
+/// which may be suspended when its fuel runs out and resumed later.
+///
+/// The fuel is the exact number of the executed lowered instructions, so the execution is
+/// suspended at the same point for the same fuel. The instruction executed for all lanes of
+/// the group counts once, but the instruction executed again by the lanes divided from the group
+/// by the divergent branch counts again. The call of the imported function counts as
+/// the single instruction, as does the call_indirect of the function of another instance or of
+/// the host. The call_indirect of the instance's own function is executed by the lanes, like
+/// the direct call.
+///
+/// The execution is also suspended when all lanes wait for the pending calls, see
+/// defer_current_call(). It can be resumed by any thread.
+class LaneExecution
+{
+    std::unique_ptr<LaneExecutor> m_executor;
+    std::vector<execution_result> m_results;
+
+    LaneExecution() noexcept;
+
+public:
+    /// Prepares the execution, the parameters are as of execute_lanes(). The imported function
+    /// is executed at once.
+    LaneExecution(const LaneCode& code, std::vector<Instance*> instances, FuncIdx func_idx,
+        const uint64_t* args, AccessSet* access_sets = nullptr);
+
+    LaneExecution(LaneExecution&&) noexcept;
+    LaneExecution& operator=(LaneExecution&&) noexcept;
+    ~LaneExecution() noexcept;
+
+    /// Continues the execution until all lanes complete or the @p fuel runs out.
+    /// The fuel is decreased by the number of the executed instructions, down to 0.
+    /// Returns true if the execution completed.
+    bool resume(uint64_t& fuel);
+
+    bool is_completed() const noexcept { return m_executor == nullptr; }
+
+    /// Returns true if the execution is suspended because all lanes wait for the pending calls.
+    bool is_waiting() const noexcept;
+
+    /// Calls the callback once, when any pending call completes after the last resume() or
+    /// at once if one has completed already. The callback is called by the thread completing
+    /// the call or the calling thread.
+    void when_ready(std::function<void()> callback);
+
+    /// Serializes the suspended execution to the binary blob, which restore()
+    /// continues, possibly in another process. The blob contains the call frames, the locals and
+    /// the operand stacks of the lanes, the results of the completed lanes, and the memory,
+    /// the globals and the table size of the instances. The functions of the table and
+    /// the imported globals are not included, as these are provided by the host.
+    /// Throws checkpoint_error if the execution is completed or any lane waits for
+    /// the pending call.
+    bytes checkpoint() const;
+
+    /// Restores the execution from the checkpoint() blob onto the @p instances of the same
+    /// module as the checkpointed ones. The memory and the globals of the instances are replaced
+    /// with the checkpointed ones. The accesses are not recorded.
+    /// Throws checkpoint_error if the blob is invalid or of the different module. The blob must
+    /// come from a trusted source, as the operand stack heights are not validated.
+    static LaneExecution restore(
+        const LaneCode& code, std::vector<Instance*> instances, bytes_view checkpoint);
+
+    /// Returns the result of each lane, available when the execution is completed.
+    const std::vector<execution_result>& results() const& noexcept { return m_results; }
+    std::vector<execution_result> results() && noexcept { return std::move(m_results); }
+};
+
+/// The outcome of the execution with the instruction budget.
+struct BudgetedResult
+{
+    /// The result of the function, if it completed within the budget.
+    std::optional<execution_result> result;
+
+    /// The suspended execution, if the budget ran out or the call is pending. It is continued
+    /// by resume().
+    std::optional<LaneExecution> continuation;
+
+    /// The number of the instructions executed, up to the budget.
+    uint64_t num_instructions = 0;
+};
+
+/// Executes the function on the instance until it completes or exactly @p budget instructions
+/// are executed, counted as by LaneExecution (experimental). Then the execution can be continued
+/// from where it stopped, e.g. to time-slice the deterministic workloads.
+///
+/// The function is executed by the lane interpreter with the single lane.
+///
+/// @param code      The lane code of the instance's module, from compile_lane_code().
+/// @param instance  The instance, not used by anything else until the execution completes.
+/// @param func_idx  The index of the function.
+/// @param args      The arguments of the function.
+/// @param budget    The maximum number of the instructions to execute.
+BudgetedResult execute(const LaneCode& code, Instance& instance, FuncIdx func_idx,
+    const std::vector<uint64_t>& args, uint64_t budget);
+
+/// Continues the suspended execution with the @p budget of the further instructions.
+BudgetedResult resume(LaneExecution continuation, uint64_t budget);
+
+/// Executes the function on each of the instances in lock-step (experimental).
+///
+/// Each instance is the lane of the execution. The locals and the operand stack items are
+/// the vectors of the values of all lanes, so each instruction is executed for all lanes by
+/// a loop the compiler vectorizes, and the instruction dispatch is shared by the lanes.
+/// When a branch condition differs between the lanes, the lanes are divided into groups
+/// following each path, which continue separately until the function returns. The lanes which
+/// trap leave their group. The call_indirect of the different functions divides the lanes too.
+/// The imported functions and the call_indirect targets other than the instance's own functions
+/// are called for each lane separately. The lanes waiting for the pending calls, see
+/// defer_current_call(), block the calling thread until the calls complete.
+///
+/// This is efficient for the control-flow-uniform computations, e.g. hashing many inputs of
+/// the same length, when the groups rarely divide.
+///
+/// @param code       The lane code of the instances' module, from compile_lane_code().
+/// @param instances  The instances of the same module, one per lane.
+/// @param func_idx   The index of the function.
+/// @param args         The arguments of the lanes: for each lane, the function's inputs in order.
+/// @param access_sets  If not null, receives the accesses of each lane to its instance's memory
+///                     and globals, excluding the accesses by the called imported functions
+///                     and the call_indirect targets of other instances. Must have the element
+///                     for each lane.
+/// @return             The result of each lane, as returned by execute().
+std::vector<execution_result> execute_lanes(const LaneCode& code,
+    const std::vector<Instance*>& instances, FuncIdx func_idx, const uint64_t* args,
+    AccessSet* access_sets = nullptr);
+}  // namespace fizzy
@@ -0,0 +1,164 @@
+// Fizzy: A fast WebAssembly interpreter
+// Copyright 2020 The Fizzy Authors.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "leb128.hpp"
+#include "isa_level.hpp"
+#include <cstring>
+#include <tuple>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace fizzy
+{
+namespace
+{
+#if defined(__SSE2__)
+/// The number of input bytes inspected in a single step.
+constexpr size_t ChunkSize = sizeof(__m128i);
+
+/// The number of input bytes required to be available for a single step.
+/// Values are loaded with 8-byte loads, so this allows loading a value from any chunk position.
+constexpr size_t ChunkInputSize = ChunkSize + sizeof(uint64_t);
+
+/// Packs the 7-bit groups of the LEB128 encoding of at most 5 bytes stored in little-endian @p w.
+/// Bits above the encoding length must be already cleared.
+inline uint32_t pack_leb128_groups(uint64_t w) noexcept
+{
+    return static_cast<uint32_t>((w & 0x7f) | ((w >> 1) & (0x7f << 7)) |
+                                 ((w >> 2) & (0x7f << 14)) | ((w >> 3) & (0x7f << 21)) |
+                                 ((w >> 4) & (uint64_t{0x7f} << 28)));
+}
+#endif
+
+/// The implementation of leb128u_decode_u32_vec() compiled into the variant of each ISA level.
+template <IsaLevel Level>
+__attribute__((always_inline)) inline const uint8_t* decode_u32_vec(
+    const uint8_t* input, const uint8_t* end, uint32_t* output, size_t count)
+{
+    uint32_t* const output_end = output + count;
+
+#if defined(__SSE2__)
+    while (output != output_end && static_cast<size_t>(end - input) >= ChunkInputSize)
+    {
+        const auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input));
+
+        // The bit i is set if the byte i has the continuation bit set.
+        const auto continuation_mask = static_cast<uint32_t>(_mm_movemask_epi8(chunk));
+
+        if (continuation_mask == 0 && static_cast<size_t>(output_end - output) >= ChunkSize)
+        {
+            // Fast path: all bytes are single-byte values, just zero-extend them.
+            const auto zero = _mm_setzero_si128();
+            const auto lo = _mm_unpacklo_epi8(chunk, zero);
+            const auto hi = _mm_unpackhi_epi8(chunk, zero);
+            auto* const out = reinterpret_cast<__m128i*>(output);
+            _mm_storeu_si128(out + 0, _mm_unpacklo_epi16(lo, zero));
+            _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(lo, zero));
+            _mm_storeu_si128(out + 2, _mm_unpacklo_epi16(hi, zero));
+            _mm_storeu_si128(out + 3, _mm_unpackhi_epi16(hi, zero));
+            input += ChunkSize;
+            output += ChunkSize;
+            continue;
+        }
+
+        if (continuation_mask == 0x5555 &&
+            static_cast<size_t>(output_end - output) >= ChunkSize / 2)
+        {
+            // Fast path: all values are two-byte values, merge the 7-bit groups in 16-bit lanes.
+            const auto lo_groups = _mm_and_si128(chunk, _mm_set1_epi16(0x007f));
+            const auto hi_groups = _mm_srli_epi16(_mm_and_si128(chunk, _mm_set1_epi16(0x7f00)), 1);
+            const auto values = _mm_or_si128(lo_groups, hi_groups);
+            const auto zero = _mm_setzero_si128();
+            auto* const out = reinterpret_cast<__m128i*>(output);
+            _mm_storeu_si128(out + 0, _mm_unpacklo_epi16(values, zero));
+            _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(values, zero));
+            input += ChunkSize;
+            output += ChunkSize / 2;
+            continue;
+        }
+
+        // Decode all values terminated within the chunk.
+        auto terminator_mask = ~continuation_mask & 0xffff;
+        size_t value_begin = 0;
+        while (terminator_mask != 0 && output != output_end)
+        {
+            const auto value_end = static_cast<size_t>(__builtin_ctz(terminator_mask)) + 1;
+            const auto length = value_end - value_begin;
+
+            // Too long encodings and unused bits set in the 5th byte are invalid,
+            // leave them to the scalar decoder to report the error.
+            if (length > 5 || (length == 5 && input[value_end - 1] > 0x0f))
+                break;
+
+            uint64_t w;
+            std::memcpy(&w, &input[value_begin], sizeof(w));
+            w &= (uint64_t{1} << (length * 8)) - 1;
+            *output++ = pack_leb128_groups(w);
+
+            value_begin = value_end;
+            terminator_mask &= terminator_mask - 1;
+        }
+
+        if (value_begin == 0)
+        {
+            // No progress: the value is invalid or the chunk does not contain its end.
+            std::tie(*output++, input) = leb128u_decode<uint32_t>(input, end);
+        }
+        else
+            input += value_begin;
+    }
+#endif
+
+    for (; output != output_end; ++output)
+        std::tie(*output, input) = leb128u_decode<uint32_t>(input, end);
+
+    return input;
+}
+
+template <IsaLevel Level>
+const uint8_t* decode_u32_vec_variant(
+    const uint8_t* input, const uint8_t* end, uint32_t* output, size_t count);
+
+template <>
+const uint8_t* decode_u32_vec_variant<IsaLevel::baseline>(
+    const uint8_t* input, const uint8_t* end, uint32_t* output, size_t count)
+{
+    return decode_u32_vec<IsaLevel::baseline>(input, end, output, count);
+}
+
+#if FIZZY_ISA_MULTIVERSIONING
+template <>
+FIZZY_TARGET_X86_64_V2 const uint8_t* decode_u32_vec_variant<IsaLevel::x86_64_v2>(
+    const uint8_t* input, const uint8_t* end, uint32_t* output, size_t count)
+{
+    return decode_u32_vec<IsaLevel::x86_64_v2>(input, end, output, count);
+}
+
+template <>
+FIZZY_TARGET_X86_64_V3 const uint8_t* decode_u32_vec_variant<IsaLevel::x86_64_v3>(
+    const uint8_t* input, const uint8_t* end, uint32_t* output, size_t count)
+{
+    return decode_u32_vec<IsaLevel::x86_64_v3>(input, end, output, count);
+}
+#endif
+}  // namespace
+
+const uint8_t* leb128u_decode_u32_vec(
+    const uint8_t* input, const uint8_t* end, uint32_t* output, size_t count)
+{
+    switch (get_isa_level())
+    {
+#if FIZZY_ISA_MULTIVERSIONING
+    case IsaLevel::x86_64_v3:
+        return decode_u32_vec_variant<IsaLevel::x86_64_v3>(input, end, output, count);
+    case IsaLevel::x86_64_v2:
+        return decode_u32_vec_variant<IsaLevel::x86_64_v2>(input, end, output, count);
+#endif
+    default:
+        return decode_u32_vec_variant<IsaLevel::baseline>(input, end, output, count);
+    }
+}
+}  // namespace fizzy
@@ -5,6 +5,7 @@
 #pragma once
 
 #include "exceptions.hpp"
+#include <cstddef>
 #include <cstdint>
 #include <limits>
 #include <utility>
@@ -87,4 +88,18 @@ inline std::pair<T, const uint8_t*> leb128s_decode(const uint8_t* input, const u
     throw parser_error("invalid LEB128 encoding: too many bytes");
 }
 
+/// Decodes the sequence of @p count unsigned LEB128 encoded uint32 values.
+///
+/// Value boundaries are located with SIMD instructions (if available) so many values are decoded
+/// per step. The values not fully contained in the inspected input chunk, the invalid encodings
+/// and the input tail are handled by leb128u_decode<uint32_t>(), so the same errors are reported.
+///
+/// @param input   The beginning of the input.
+/// @param end     The end of the input.
+/// @param output  The output buffer of at least @p count values.
+/// @param count   The number of values to decode.
+/// @return        The position after the last decoded value.
+const uint8_t* leb128u_decode_u32_vec(
+    const uint8_t* input, const uint8_t* end, uint32_t* output, size_t count);
+
 }  // namespace fizzy
@@ -0,0 +1,340 @@
+// Fizzy: A fast WebAssembly interpreter
+// Copyright 2020 The Fizzy Authors.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "lowered_code.hpp"
+#include "instructions.hpp"
+#include <cassert>
+
+namespace fizzy
+{
+namespace
+{
+/// The size of the br/br_if/return immediates in Code::immediates:
+/// code offset, immediates offset, stack height and arity.
+constexpr size_t BranchImmediateSize = 3 * sizeof(uint32_t) + sizeof(uint8_t);
+
+template <typename T>
+inline T read(const uint8_t*& input) noexcept
+{
+    T ret;
+    __builtin_memcpy(&ret, input, sizeof(ret));
+    input += sizeof(ret);
+    return ret;
+}
+
+/// Returns the size of the instruction's immediates in Code::immediates.
+size_t get_immediates_size(Instr instr, const uint8_t* immediates) noexcept
+{
+    switch (instr)
+    {
+    case Instr::if_:
+    case Instr::else_:
+        return 2 * sizeof(uint32_t);
+    case Instr::br:
+    case Instr::br_if:
+    case Instr::return_:
+        return BranchImmediateSize;
+    case Instr::br_table:
+        return sizeof(uint32_t) + (size_t{read<uint32_t>(immediates)} + 1) * BranchImmediateSize;
+    case Instr::call:
+    case Instr::call_indirect:
+    case Instr::local_get:
+    case Instr::local_set:
+    case Instr::local_tee:
+    case Instr::global_get:
+    case Instr::global_set:
+    case Instr::i32_const:
+    case Instr::i32_load:
+    case Instr::i64_load:
+    case Instr::i32_load8_s:
+    case Instr::i32_load8_u:
+    case Instr::i32_load16_s:
+    case Instr::i32_load16_u:
+    case Instr::i64_load8_s:
+    case Instr::i64_load8_u:
+    case Instr::i64_load16_s:
+    case Instr::i64_load16_u:
+    case Instr::i64_load32_s:
+    case Instr::i64_load32_u:
+    case Instr::i32_store:
+    case Instr::i64_store:
+    case Instr::i32_store8:
+    case Instr::i32_store16:
+    case Instr::i64_store8:
+    case Instr::i64_store16:
+    case Instr::i64_store32:
+        return sizeof(uint32_t);
+    case Instr::i64_const:
+        return sizeof(uint64_t);
+    case Instr::atomic_load:
+    case Instr::atomic_store:
+    case Instr::atomic_rmw:
+    case Instr::atomic_cmpxchg:
+        return sizeof(uint32_t) + sizeof(uint8_t);
+    default:
+        return 0;
+    }
+}
+
+/// Checks if the instruction is present in the lowered code.
+inline bool is_lowered(Instr instr, bool is_final) noexcept
+{
+    switch (instr)
+    {
+    case Instr::nop:
+    case Instr::block:
+    case Instr::loop:
+        return false;
+    case Instr::end:
+        return is_final;
+    default:
+        return true;
+    }
+}
+
+/// Decodes the branch immediates.
+LoweredInstr lower_branch(
+    Instr instr, const uint8_t*& immediates, const std::vector<size_t>& indices) noexcept
+{
+    LoweredInstr lowered;
+    lowered.instr = instr;
+    lowered.target = indices[read<uint32_t>(immediates)];
+    immediates += sizeof(uint32_t);  // The immediates offset is not needed.
+    lowered.imm = read<uint32_t>(immediates);
+    lowered.arity = read<uint8_t>(immediates);
+    return lowered;
+}
+}  // namespace
+
+LoweredCode lower_code(const Code& code)
+{
+    const auto num_instructions = code.instructions.size();
+
+    // The indices of the instructions in the lowered code.
+    // The index of an instruction not present in the lowered code is the index of the next one.
+    std::vector<size_t> indices(num_instructions);
+    size_t num_lowered = 0;
+    for (size_t i = 0; i < num_instructions; ++i)
+    {
+        indices[i] = num_lowered;
+        if (is_lowered(code.instructions[i], i == num_instructions - 1))
+            ++num_lowered;
+    }
+
+    LoweredCode lowered_code;
+    lowered_code.max_stack_height = code.max_stack_height;
+    lowered_code.local_count = code.local_count;
+    auto& lowered_instructions = lowered_code.instructions;
+    lowered_instructions.reserve(num_lowered);
+
+    const auto* immediates = code.immediates.data();
+    for (size_t i = 0; i < num_instructions; ++i)
+    {
+        const auto instr = code.instructions[i];
+        if (instr == Instr::loop)
+            lowered_code.loop_headers.emplace_back(indices[i]);
+        if (!is_lowered(instr, i == num_instructions - 1))
+            continue;
+
+        switch (instr)
+        {
+        case Instr::if_:
+        case Instr::else_:
+        {
+            LoweredInstr lowered;
+            lowered.instr = instr;
+            lowered.target = indices[read<uint32_t>(immediates)];
+            immediates += sizeof(uint32_t);  // The immediates offset is not needed.
+            lowered_instructions.emplace_back(lowered);
+            break;
+        }
+        case Instr::br:
+        case Instr::br_if:
+        case Instr::return_:
+            lowered_instructions.emplace_back(lower_branch(instr, immediates, indices));
+            break;
+        case Instr::br_table:
+        {
+            LoweredInstr lowered;
+            lowered.instr = instr;
+            lowered.imm = read<uint32_t>(immediates);
+            lowered.value = lowered_code.br_table_labels.size();
+            for (size_t j = 0; j <= lowered.imm; ++j)
+            {
+                lowered_code.br_table_labels.emplace_back(
+                    lower_branch(Instr::br, immediates, indices));
+            }
+            lowered_instructions.emplace_back(lowered);
+            break;
+        }
+        case Instr::i64_const:
+        {
+            LoweredInstr lowered;
+            lowered.instr = instr;
+            lowered.value = read<uint64_t>(immediates);
+            lowered_instructions.emplace_back(lowered);
+            break;
+        }
+        case Instr::atomic_load:
+        case Instr::atomic_store:
+        case Instr::atomic_rmw:
+        case Instr::atomic_cmpxchg:
+        {
+            LoweredInstr lowered;
+            lowered.instr = instr;
+            lowered.imm = read<uint32_t>(immediates);
+            lowered.arity = read<uint8_t>(immediates);
+            lowered_instructions.emplace_back(lowered);
+            break;
+        }
+        default:
+        {
+            const auto immediates_size = get_immediates_size(instr, immediates);
+            assert(immediates_size == 0 || immediates_size == sizeof(uint32_t));
+            LoweredInstr lowered;
+            lowered.instr = instr;
+            lowered.imm = immediates_size != 0 ? read<uint32_t>(immediates) : 0;
+            lowered_instructions.emplace_back(lowered);
+            break;
+        }
+        }
+    }
+    assert(lowered_instructions.size() == num_lowered);
+    return lowered_code;
+}
+
+std::vector<FuncIdx> get_called_functions(const Code& code)
+{
+    std::vector<FuncIdx> called_functions;
+    const auto* immediates = code.immediates.data();
+    for (const auto instr : code.instructions)
+    {
+        if (instr == Instr::call)
+            called_functions.emplace_back(read<uint32_t>(immediates));
+        else
+            immediates += get_immediates_size(instr, immediates);
+    }
+    return called_functions;
+}
+
+std::vector<bool> find_branch_targets(const LoweredCode& code)
+{
+    std::vector<bool> is_target(code.instructions.size(), false);
+    for (const auto& instr : code.instructions)
+    {
+        if (has_target(instr.instr))
+            is_target[instr.target] = true;
+    }
+    for (const auto& label : code.br_table_labels)
+        is_target[label.target] = true;
+    return is_target;
+}
+
+std::vector<int> compute_stack_heights(const Module& module, const LoweredCode& code)
+{
+    const auto& instructions = code.instructions;
+    const auto* const metrics_table = get_instruction_metrics_table();
+
+    std::vector<int> heights(instructions.size(), UnknownStackHeight);
+
+    // The heights at the forward branch targets.
+    std::vector<int> target_heights(instructions.size(), UnknownStackHeight);
+    const auto set_target_height = [&](size_t target, int height) noexcept {
+        assert(target_heights[target] == UnknownStackHeight || target_heights[target] == height);
+        target_heights[target] = height;
+    };
+
+    int height = 0;
+    for (size_t i = 0; i < instructions.size(); ++i)
+    {
+        const auto& instr = instructions[i];
+        if (height == UnknownStackHeight)
+            height = target_heights[i];
+        heights[i] = height;
+        if (height == UnknownStackHeight)
+            continue;
+
+        switch (instr.instr)
+        {
+        case Instr::unreachable:
+        case Instr::return_:
+            height = UnknownStackHeight;
+            break;
+        case Instr::if_:
+            // The else branch starts with the height of the then branch.
+            --height;
+            set_target_height(instr.target, height);
+            break;
+        case Instr::else_:
+            set_target_height(instr.target, height);
+            height = UnknownStackHeight;
+            break;
+        case Instr::br:
+            set_target_height(instr.target, static_cast<int>(instr.imm + instr.arity));
+            height = UnknownStackHeight;
+            break;
+        case Instr::br_if:
+            --height;
+            set_target_height(instr.target, static_cast<int>(instr.imm + instr.arity));
+            break;
+        case Instr::memory_loop:
+            // The loop exit.
+            set_target_height(instr.target, height);
+            break;
+        case Instr::br_table:
+        {
+            const auto* const labels = &code.br_table_labels[static_cast<size_t>(instr.value)];
+            for (size_t j = 0; j <= instr.imm; ++j)
+            {
+                set_target_height(
+                    labels[j].target, static_cast<int>(labels[j].imm + labels[j].arity));
+            }
+            height = UnknownStackHeight;
+            break;
+        }
+        case Instr::call:
+        case Instr::call_indirect:
+        {
+            const auto& func_type = instr.instr == Instr::call ?
+                                        module.get_function_type(instr.imm) :
+                                        module.typesec[instr.imm];
+            height += static_cast<int>(func_type.outputs.size()) -
+                      static_cast<int>(func_type.inputs.size()) -
+                      (instr.instr == Instr::call_indirect ? 1 : 0);
+            break;
+        }
+        default:
+            height += metrics_table[static_cast<uint8_t>(instr.instr)].stack_height_change;
+            break;
+        }
+    }
+    return heights;
+}
+
+void remove_dropped_instructions(LoweredCode& code)
+{
+    auto& instructions = code.instructions;
+
+    // The new indices of the instructions. Dropped instructions get the index of the next one.
+    std::vector<size_t> indices(instructions.size());
+    size_t num_remaining = 0;
+    for (size_t i = 0; i < instructions.size(); ++i)
+    {
+        indices[i] = num_remaining;
+        if (instructions[i].instr != DroppedInstr)
+            instructions[num_remaining++] = instructions[i];
+    }
+    instructions.resize(num_remaining);
+
+    for (auto& instr : instructions)
+    {
+        if (has_target(instr.instr))
+            instr.target = indices[instr.target];
+    }
+    for (auto& label : code.br_table_labels)
+        label.target = indices[label.target];
+    for (auto& loop_header : code.loop_headers)
+        loop_header = indices[loop_header];
+}
+}  // namespace fizzy
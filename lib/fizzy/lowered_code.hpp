@@ -0,0 +1,158 @@
+// Fizzy: A fast WebAssembly interpreter
+// Copyright 2020 The Fizzy Authors.
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include "module.hpp"
+#include "types.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace fizzy
+{
+/// The instruction of the code lowered for execution.
+///
+/// This is the decoded form of the CodeWords with branch targets being instruction indices,
+/// which is convenient for transformations before the code is emitted to the code image.
+struct LoweredInstr
+{
+    Instr instr = Instr::unreachable;
+
+    /// The arity of the branch, or the AtomicOp of the atomic instructions.
+    uint8_t arity = 0;
+
+    /// The 32-bit immediate value, as in CodeWord::Op.
+    /// For br_table this is the number of labels, not counting the default one.
+    uint32_t imm = 0;
+
+    /// The value of i64.const.
+    /// For br_table this is the index of its first label in LoweredCode::br_table_labels.
+    uint64_t value = 0;
+
+    /// The index of the branch target instruction.
+    size_t target = 0;
+};
+
+/// The loop filling or copying the memory, executed at once by the memory_loop instruction.
+///
+/// Each iteration stores the value of the src_local local (fill), or the bytes loaded from
+/// the address in the src_local local (copy), to the consecutive bytes starting at the address
+/// in the dst_local local. Then the addresses are increased by the step and the counter by
+/// the counter increment. The loop continues while the counter compared with the bound
+/// satisfies the condition.
+struct MemoryLoop
+{
+    enum class Kind : uint8_t
+    {
+        fill,
+        copy,
+    };
+
+    enum class Condition : uint8_t
+    {
+        ne,
+        gt_u,
+        lt_u,
+    };
+
+    Kind kind = Kind::fill;
+    Condition condition = Condition::ne;
+
+    /// Whether the bound is the index of the local instead of the constant.
+    bool is_bound_local = false;
+
+    /// The number of bytes of each load and store.
+    uint8_t width = 0;
+
+    uint32_t dst_local = 0;
+    uint32_t src_local = 0;
+
+    /// The number of bytes stored in each iteration.
+    uint32_t step = 0;
+
+    /// The local compared with the bound, may be dst_local or src_local.
+    uint32_t counter_local = 0;
+
+    /// The value added to the counter in each iteration, modulo 2^32.
+    uint32_t counter_increment = 0;
+
+    uint32_t bound = 0;
+};
+
+/// The code of a function lowered for execution.
+struct LoweredCode
+{
+    /// The maximum operand stack height, as in Code.
+    int max_stack_height = 0;
+
+    /// The number of locals not counting the function parameters, as in Code.
+    uint32_t local_count = 0;
+
+    /// The instructions. The structural instructions (block, loop, nop and all but the final end)
+    /// are not present.
+    std::vector<LoweredInstr> instructions;
+
+    /// The labels of all br_table instructions, in the form of br instructions.
+    std::vector<LoweredInstr> br_table_labels;
+
+    /// The indices of the first instructions of all loops, in the order of the loops in the code.
+    /// The transformations keep these, so they identify the loops across the lowered variants
+    /// of the same code.
+    std::vector<size_t> loop_headers;
+
+    /// The memory loops, indexed by the memory_loop instructions' value.
+    std::vector<MemoryLoop> memory_loops;
+};
+
+/// Checks if the lowered instruction has the branch target.
+inline bool has_target(Instr instr) noexcept
+{
+    return instr == Instr::if_ || instr == Instr::else_ || instr == Instr::br ||
+           instr == Instr::br_if || instr == Instr::return_ || instr == Instr::memory_loop;
+}
+
+/// Checks if the execution never continues to the instruction following this one.
+inline bool is_unconditional_jump(Instr instr) noexcept
+{
+    switch (instr)
+    {
+    case Instr::unreachable:
+    case Instr::else_:
+    case Instr::br:
+    case Instr::br_table:
+    case Instr::return_:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/// The marker of an instruction to be removed by remove_dropped_instructions().
+/// The nop instruction is never present in the lowered code otherwise.
+constexpr auto DroppedInstr = Instr::nop;
+
+/// Lowers the validated code.
+LoweredCode lower_code(const Code& code);
+
+/// Returns the indices of the functions called by the validated code with the call instruction,
+/// in the order of the calls.
+std::vector<FuncIdx> get_called_functions(const Code& code);
+
+/// Marks the instructions which are targets of any branch.
+std::vector<bool> find_branch_targets(const LoweredCode& code);
+
+/// The marker of the unknown stack height, i.e. of the unreachable instruction.
+constexpr int UnknownStackHeight = -1;
+
+/// Computes the operand stack height before each instruction.
+///
+/// The height after an unconditional branch is unknown until the next branch target.
+std::vector<int> compute_stack_heights(const Module& module, const LoweredCode& code);
+
+/// Removes the instructions marked with DroppedInstr and updates branch targets.
+/// The branches to a dropped instruction get the next remaining instruction as the target.
+/// The same applies to the loop headers.
+void remove_dropped_instructions(LoweredCode& code);
+}  // namespace fizzy
@@ -0,0 +1,248 @@
+// Fizzy: A fast WebAssembly interpreter
+// Copyright 2020 The Fizzy Authors.
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#if __has_include(<memory_resource>)
+#include <memory_resource>
+#endif
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+/// The polymorphic memory resources are used from the standard library where available.
+/// Some standard libraries (e.g. libc++ of Xcode before 15) do not provide them,
+/// so the subset used by Fizzy is implemented here as the fallback.
+#if defined(__cpp_lib_memory_resource)
+
+namespace fizzy::pmr
+{
+using std::pmr::get_default_resource;
+using std::pmr::memory_resource;
+using std::pmr::monotonic_buffer_resource;
+using std::pmr::polymorphic_allocator;
+
+template <typename T>
+using vector = std::pmr::vector<T>;
+
+template <typename CharT>
+using basic_string = std::pmr::basic_string<CharT>;
+}  // namespace fizzy::pmr
+
+#else
+
+namespace fizzy::pmr
+{
+class memory_resource
+{
+    static constexpr size_t max_align = alignof(std::max_align_t);
+
+public:
+    virtual ~memory_resource() = default;
+
+    void* allocate(size_t bytes, size_t alignment = max_align)
+    {
+        return do_allocate(bytes, alignment);
+    }
+
+    void deallocate(void* p, size_t bytes, size_t alignment = max_align)
+    {
+        do_deallocate(p, bytes, alignment);
+    }
+
+    bool is_equal(const memory_resource& other) const noexcept { return do_is_equal(other); }
+
+private:
+    virtual void* do_allocate(size_t bytes, size_t alignment) = 0;
+    virtual void do_deallocate(void* p, size_t bytes, size_t alignment) = 0;
+    virtual bool do_is_equal(const memory_resource& other) const noexcept = 0;
+};
+
+inline bool operator==(const memory_resource& a, const memory_resource& b) noexcept
+{
+    return &a == &b || a.is_equal(b);
+}
+
+inline bool operator!=(const memory_resource& a, const memory_resource& b) noexcept
+{
+    return !(a == b);
+}
+
+/// The memory resource using the global operator new and operator delete.
+/// Unlike in the standard library, it is the only default resource and cannot be replaced,
+/// and it does not support alignments over the default new alignment.
+inline memory_resource* get_default_resource() noexcept
+{
+    class new_delete_resource final : public memory_resource
+    {
+        void* do_allocate(size_t bytes, [[maybe_unused]] size_t alignment) override
+        {
+            assert(alignment <= __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+            return ::operator new(bytes);
+        }
+
+        void do_deallocate(void* p, size_t /*bytes*/, size_t /*alignment*/) override
+        {
+            ::operator delete(p);
+        }
+
+        bool do_is_equal(const memory_resource& other) const noexcept override
+        {
+            return this == &other;
+        }
+    };
+
+    // Never destroyed, as the containers of static objects may use it during their destruction.
+    static auto* const resource = new new_delete_resource;
+    return resource;
+}
+
+template <typename T>
+class polymorphic_allocator
+{
+    memory_resource* m_resource;
+
+public:
+    using value_type = T;
+
+    polymorphic_allocator() noexcept : m_resource{get_default_resource()} {}
+
+    // NOLINTNEXTLINE(google-explicit-constructor)
+    polymorphic_allocator(memory_resource* resource) noexcept : m_resource{resource}
+    {
+        assert(resource != nullptr);
+    }
+
+    template <typename U>
+    // NOLINTNEXTLINE(google-explicit-constructor)
+    polymorphic_allocator(const polymorphic_allocator<U>& other) noexcept
+      : m_resource{other.resource()}
+    {}
+
+    polymorphic_allocator& operator=(const polymorphic_allocator&) = delete;
+
+    T* allocate(size_t n)
+    {
+        return static_cast<T*>(m_resource->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* p, size_t n) noexcept
+    {
+        m_resource->deallocate(p, n * sizeof(T), alignof(T));
+    }
+
+    /// Copies of containers use the default memory resource, as in the standard library.
+    polymorphic_allocator select_on_container_copy_construction() const noexcept
+    {
+        return {};
+    }
+
+    memory_resource* resource() const noexcept { return m_resource; }
+};
+
+template <typename T, typename U>
+inline bool operator==(
+    const polymorphic_allocator<T>& a, const polymorphic_allocator<U>& b) noexcept
+{
+    return *a.resource() == *b.resource();
+}
+
+template <typename T, typename U>
+inline bool operator!=(
+    const polymorphic_allocator<T>& a, const polymorphic_allocator<U>& b) noexcept
+{
+    return !(a == b);
+}
+
+/// The bump-pointer memory resource releasing all the memory on destruction.
+/// Memory is allocated from the initial buffer, and then from chunks growing geometrically
+/// taken from the default memory resource.
+class monotonic_buffer_resource final : public memory_resource
+{
+    static constexpr size_t min_chunk_size = 1024;
+
+    /// The header of a chunk taken from the default memory resource.
+    struct Chunk
+    {
+        Chunk* prev;
+        size_t size;
+    };
+
+    Chunk* m_chunks = nullptr;
+    void* m_current = nullptr;
+    size_t m_space = 0;
+    size_t m_next_chunk_size = min_chunk_size;
+
+public:
+    monotonic_buffer_resource() noexcept = default;
+
+    explicit monotonic_buffer_resource(size_t initial_size) noexcept
+      : m_next_chunk_size{std::max(initial_size, min_chunk_size)}
+    {}
+
+    monotonic_buffer_resource(void* buffer, size_t buffer_size) noexcept
+      : m_current{buffer},
+        m_space{buffer_size},
+        m_next_chunk_size{std::max(buffer_size, min_chunk_size)}
+    {}
+
+    monotonic_buffer_resource(const monotonic_buffer_resource&) = delete;
+    monotonic_buffer_resource& operator=(const monotonic_buffer_resource&) = delete;
+
+    ~monotonic_buffer_resource() noexcept override { release(); }
+
+    void release() noexcept
+    {
+        while (m_chunks != nullptr)
+        {
+            const auto chunk = m_chunks;
+            m_chunks = chunk->prev;
+            get_default_resource()->deallocate(chunk, chunk->size, alignof(Chunk));
+        }
+        m_current = nullptr;
+        m_space = 0;
+    }
+
+private:
+    void* do_allocate(size_t bytes, size_t alignment) override
+    {
+        if (std::align(alignment, bytes, m_current, m_space) == nullptr)
+        {
+            // The chunk must fit the header and the allocation with any alignment padding.
+            const auto chunk_size = std::max(m_next_chunk_size, sizeof(Chunk) + alignment + bytes);
+            m_chunks = ::new (get_default_resource()->allocate(chunk_size, alignof(Chunk)))
+                Chunk{m_chunks, chunk_size};
+            m_current = m_chunks + 1;
+            m_space = chunk_size - sizeof(Chunk);
+            m_next_chunk_size = chunk_size * 2;
+            std::align(alignment, bytes, m_current, m_space);
+        }
+        const auto p = m_current;
+        m_current = static_cast<std::byte*>(m_current) + bytes;
+        m_space -= bytes;
+        return p;
+    }
+
+    void do_deallocate(void* /*p*/, size_t /*bytes*/, size_t /*alignment*/) override {}
+
+    bool do_is_equal(const memory_resource& other) const noexcept override
+    {
+        return this == &other;
+    }
+};
+
+template <typename T>
+using vector = std::vector<T, polymorphic_allocator<T>>;
+
+template <typename CharT>
+using basic_string =
+    std::basic_string<CharT, std::char_traits<CharT>, polymorphic_allocator<CharT>>;
+}  // namespace fizzy::pmr
+
+#endif
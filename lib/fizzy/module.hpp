@@ -4,6 +4,8 @@
 
 #pragma once
 
+#include "arena.hpp"
+#include "code_image.hpp"
 #include "types.hpp"
 #include <cassert>
 #include <optional>
@@ -13,6 +15,10 @@ namespace fizzy
 {
 struct Module
 {
+    // The memory arena for the module's own data, e.g. the code of functions.
+    // Must be declared first to be destroyed after all the data allocated from it.
+    Arena arena;
+
     // https://webassembly.github.io/spec/core/binary/modules.html#type-section
     std::vector<FuncType> typesec;
     // https://webassembly.github.io/spec/core/binary/modules.html#import-section
@@ -45,6 +51,10 @@ struct Module
     // Mutability of globals defined in import section
     std::vector<bool> imported_globals_mutability;
 
+    // The executable code of all functions in the single contiguous buffer.
+    // Built from codesec by layout_code().
+    CodeImage code_image;
+
     const FuncType& get_function_type(FuncIdx idx) const noexcept
     {
         assert(idx < imported_function_types.size() + funcsec.size());
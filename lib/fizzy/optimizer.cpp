@@ -0,0 +1,470 @@
+// Fizzy: A fast WebAssembly interpreter
+// Copyright 2020 The Fizzy Authors.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "optimizer.hpp"
+#include "integer_ops.hpp"
+#include <limits>
+#include <optional>
+#include <type_traits>
+
+namespace fizzy
+{
+namespace
+{
+/// The integer arithmetic instructions in the order of their opcodes, the same for i32 and i64.
+enum class ArithmeticOp : uint8_t
+{
+    add,
+    sub,
+    mul,
+    div_s,
+    div_u,
+    rem_s,
+    rem_u,
+    and_,
+    or_,
+    xor_,
+    shl,
+    shr_s,
+    shr_u,
+    rotl,
+    rotr,
+};
+
+/// The integer comparison instructions in the order of their opcodes, the same for i32 and i64.
+enum class ComparisonOp : uint8_t
+{
+    eq,
+    ne,
+    lt_s,
+    lt_u,
+    gt_s,
+    gt_u,
+    le_s,
+    le_u,
+    ge_s,
+    ge_u,
+};
+
+static_assert(static_cast<int>(Instr::i32_rotr) - static_cast<int>(Instr::i32_add) ==
+              static_cast<int>(ArithmeticOp::rotr));
+static_assert(static_cast<int>(Instr::i64_rotr) - static_cast<int>(Instr::i64_add) ==
+              static_cast<int>(ArithmeticOp::rotr));
+static_assert(static_cast<int>(Instr::i32_ge_u) - static_cast<int>(Instr::i32_eq) ==
+              static_cast<int>(ComparisonOp::ge_u));
+static_assert(static_cast<int>(Instr::i64_ge_u) - static_cast<int>(Instr::i64_eq) ==
+              static_cast<int>(ComparisonOp::ge_u));
+
+/// Returns the operation of the instruction in the [first, last] range of the opcodes.
+template <typename Op>
+inline std::optional<Op> get_op(Instr instr, Instr first, Instr last) noexcept
+{
+    if (instr < first || instr > last)
+        return std::nullopt;
+    return static_cast<Op>(static_cast<int>(instr) - static_cast<int>(first));
+}
+
+/// Evaluates the arithmetic operation. Returns nothing when the operation traps.
+template <typename T>
+std::optional<T> eval(ArithmeticOp op, T lhs, T rhs) noexcept
+{
+    using S = std::make_signed_t<T>;
+    const auto slhs = static_cast<S>(lhs);
+    const auto srhs = static_cast<S>(rhs);
+    switch (op)
+    {
+    case ArithmeticOp::add:
+        return lhs + rhs;
+    case ArithmeticOp::sub:
+        return lhs - rhs;
+    case ArithmeticOp::mul:
+        return lhs * rhs;
+    case ArithmeticOp::div_s:
+        if (srhs == 0 || (slhs == std::numeric_limits<S>::min() && srhs == -1))
+            return std::nullopt;
+        return static_cast<T>(slhs / srhs);
+    case ArithmeticOp::div_u:
+        if (rhs == 0)
+            return std::nullopt;
+        return lhs / rhs;
+    case ArithmeticOp::rem_s:
+        if (srhs == 0)
+            return std::nullopt;
+        if (srhs == -1)
+            return T{0};
+        return static_cast<T>(slhs % srhs);
+    case ArithmeticOp::rem_u:
+        if (rhs == 0)
+            return std::nullopt;
+        return lhs % rhs;
+    case ArithmeticOp::and_:
+        return lhs & rhs;
+    case ArithmeticOp::or_:
+        return lhs | rhs;
+    case ArithmeticOp::xor_:
+        return lhs ^ rhs;
+    case ArithmeticOp::shl:
+        return shift_left(lhs, rhs);
+    case ArithmeticOp::shr_s:
+        return static_cast<T>(shift_right(slhs, srhs));
+    case ArithmeticOp::shr_u:
+        return shift_right(lhs, rhs);
+    case ArithmeticOp::rotl:
+        return rotl(lhs, rhs);
+    case ArithmeticOp::rotr:
+        return rotr(lhs, rhs);
+    }
+    return std::nullopt;
+}
+
+/// Evaluates the comparison operation.
+template <typename T>
+bool eval(ComparisonOp op, T lhs, T rhs) noexcept
+{
+    using S = std::make_signed_t<T>;
+    const auto slhs = static_cast<S>(lhs);
+    const auto srhs = static_cast<S>(rhs);
+    switch (op)
+    {
+    case ComparisonOp::eq:
+        return lhs == rhs;
+    case ComparisonOp::ne:
+        return lhs != rhs;
+    case ComparisonOp::lt_s:
+        return slhs < srhs;
+    case ComparisonOp::lt_u:
+        return lhs < rhs;
+    case ComparisonOp::gt_s:
+        return slhs > srhs;
+    case ComparisonOp::gt_u:
+        return lhs > rhs;
+    case ComparisonOp::le_s:
+        return slhs <= srhs;
+    case ComparisonOp::le_u:
+        return lhs <= rhs;
+    case ComparisonOp::ge_s:
+        return slhs >= srhs;
+    case ComparisonOp::ge_u:
+        return lhs >= rhs;
+    }
+    return false;
+}
+
+inline LoweredInstr make_i32_const(uint32_t value) noexcept
+{
+    LoweredInstr instr;
+    instr.instr = Instr::i32_const;
+    instr.imm = value;
+    return instr;
+}
+
+inline LoweredInstr make_i64_const(uint64_t value) noexcept
+{
+    LoweredInstr instr;
+    instr.instr = Instr::i64_const;
+    instr.value = value;
+    return instr;
+}
+
+inline bool is_const(const LoweredInstr& instr) noexcept
+{
+    return instr.instr == Instr::i32_const || instr.instr == Instr::i64_const;
+}
+
+/// Returns the value of the i32.const or i64.const instruction.
+inline uint64_t get_const(const LoweredInstr& instr) noexcept
+{
+    return instr.instr == Instr::i32_const ? instr.imm : instr.value;
+}
+
+/// Evaluates the binary instruction with the constant operands.
+/// Returns nothing if the instruction is not an integer binary instruction or it would trap.
+std::optional<LoweredInstr> fold_binary(Instr instr, uint64_t lhs, uint64_t rhs) noexcept
+{
+    const auto lhs32 = static_cast<uint32_t>(lhs);
+    const auto rhs32 = static_cast<uint32_t>(rhs);
+
+    if (const auto op = get_op<ArithmeticOp>(instr, Instr::i32_add, Instr::i32_rotr))
+    {
+        if (const auto result = eval(*op, lhs32, rhs32))
+            return make_i32_const(*result);
+    }
+    else if (const auto op64 = get_op<ArithmeticOp>(instr, Instr::i64_add, Instr::i64_rotr))
+    {
+        if (const auto result = eval(*op64, lhs, rhs))
+            return make_i64_const(*result);
+    }
+    else if (const auto cmp = get_op<ComparisonOp>(instr, Instr::i32_eq, Instr::i32_ge_u))
+        return make_i32_const(eval(*cmp, lhs32, rhs32));
+    else if (const auto cmp64 = get_op<ComparisonOp>(instr, Instr::i64_eq, Instr::i64_ge_u))
+        return make_i32_const(eval(*cmp64, lhs, rhs));
+
+    return std::nullopt;
+}
+
+/// Evaluates the unary instruction with the constant operand.
+/// Returns nothing if the instruction is not an integer unary or conversion instruction.
+std::optional<LoweredInstr> fold_unary(Instr instr, uint64_t operand) noexcept
+{
+    const auto operand32 = static_cast<uint32_t>(operand);
+    switch (instr)
+    {
+    case Instr::i32_eqz:
+        return make_i32_const(operand32 == 0);
+    case Instr::i32_clz:
+        return make_i32_const(clz32(operand32));
+    case Instr::i32_ctz:
+        return make_i32_const(ctz32(operand32));
+    case Instr::i32_popcnt:
+        return make_i32_const(popcnt32(operand32));
+    case Instr::i64_eqz:
+        return make_i32_const(operand == 0);
+    case Instr::i64_clz:
+        return make_i64_const(clz64(operand));
+    case Instr::i64_ctz:
+        return make_i64_const(ctz64(operand));
+    case Instr::i64_popcnt:
+        return make_i64_const(popcnt64(operand));
+    case Instr::i32_wrap_i64:
+        return make_i32_const(operand32);
+    case Instr::i64_extend_i32_s:
+        return make_i64_const(static_cast<uint64_t>(int64_t{static_cast<int32_t>(operand32)}));
+    case Instr::i64_extend_i32_u:
+        return make_i64_const(operand32);
+    default:
+        return std::nullopt;
+    }
+}
+
+/// Checks if the binary instruction with the constant right-hand side operand returns
+/// the left-hand side operand unchanged.
+bool is_identity(Instr instr, uint64_t rhs) noexcept
+{
+    auto op = get_op<ArithmeticOp>(instr, Instr::i32_add, Instr::i32_rotr);
+    const auto is_64 = !op.has_value();
+    if (is_64)
+        op = get_op<ArithmeticOp>(instr, Instr::i64_add, Instr::i64_rotr);
+    if (!op)
+        return false;
+
+    switch (*op)
+    {
+    case ArithmeticOp::add:
+    case ArithmeticOp::sub:
+    case ArithmeticOp::or_:
+    case ArithmeticOp::xor_:
+        return rhs == 0;
+    case ArithmeticOp::shl:
+    case ArithmeticOp::shr_s:
+    case ArithmeticOp::shr_u:
+    case ArithmeticOp::rotl:
+    case ArithmeticOp::rotr:
+        // The shift count is taken modulo the bit width.
+        return (rhs & (is_64 ? 63 : 31)) == 0;
+    case ArithmeticOp::mul:
+    case ArithmeticOp::div_s:
+    case ArithmeticOp::div_u:
+        return rhs == 1;
+    case ArithmeticOp::and_:
+        return rhs == (is_64 ? std::numeric_limits<uint64_t>::max() :
+                               std::numeric_limits<uint32_t>::max());
+    default:
+        return false;
+    }
+}
+
+/// Replaces the multiplication, unsigned division and unsigned remainder by a power of two
+/// constant with the shift or the bitwise and. Returns true if the instructions were replaced.
+bool reduce_strength(LoweredInstr& constant, LoweredInstr& instr) noexcept
+{
+    const auto value = get_const(constant);
+    if (value == 0 || (value & (value - 1)) != 0)
+        return false;
+    const auto log2_value = static_cast<uint64_t>(__builtin_ctzll(value));
+    const auto is_64 = constant.instr == Instr::i64_const;
+    const auto make_const = [is_64](uint64_t v) noexcept {
+        return is_64 ? make_i64_const(v) : make_i32_const(static_cast<uint32_t>(v));
+    };
+
+    switch (instr.instr)
+    {
+    case Instr::i32_mul:
+    case Instr::i64_mul:
+        constant = make_const(log2_value);
+        instr.instr = is_64 ? Instr::i64_shl : Instr::i32_shl;
+        return true;
+    case Instr::i32_div_u:
+    case Instr::i64_div_u:
+        constant = make_const(log2_value);
+        instr.instr = is_64 ? Instr::i64_shr_u : Instr::i32_shr_u;
+        return true;
+    case Instr::i32_rem_u:
+    case Instr::i64_rem_u:
+        constant = make_const(value - 1);
+        instr.instr = is_64 ? Instr::i64_and : Instr::i32_and;
+        return true;
+    default:
+        return false;
+    }
+}
+
+/// Applies the peephole transformations in a single pass over the code.
+/// The replaced instructions are marked with DroppedInstr.
+/// Returns true if any transformation has been applied.
+bool optimize_pass(LoweredCode& code)
+{
+    auto& instructions = code.instructions;
+    const auto is_target = find_branch_targets(code);
+    const auto num_instructions = instructions.size();
+
+    // Checks if the instruction at the index can be merged with the preceding one.
+    const auto is_mergeable = [&](size_t i) noexcept {
+        return i < num_instructions && !is_target[i];
+    };
+
+    bool changed = false;
+    for (size_t i = 0; i < num_instructions; ++i)
+    {
+        auto& instr = instructions[i];
+
+        if (is_unconditional_jump(instr.instr))
+        {
+            // The instructions up to the next branch target are never executed.
+            // The final end is always kept.
+            size_t j = i + 1;
+            for (; is_mergeable(j) && instructions[j].instr != Instr::end; ++j)
+            {
+                instructions[j].instr = DroppedInstr;
+                changed = true;
+            }
+
+            // The else jumping to the next instruction is redundant.
+            if (instr.instr == Instr::else_ && instr.target == j)
+            {
+                instr.instr = DroppedInstr;
+                changed = true;
+            }
+            i = j - 1;
+            continue;
+        }
+
+        if (!is_mergeable(i + 1))
+            continue;
+        auto& next = instructions[i + 1];
+
+        if (is_const(instr))
+        {
+            const auto value = get_const(instr);
+
+            if (is_mergeable(i + 2) && is_const(next))
+            {
+                if (const auto folded =
+                        fold_binary(instructions[i + 2].instr, value, get_const(next)))
+                {
+                    instr = *folded;
+                    next.instr = DroppedInstr;
+                    instructions[i + 2].instr = DroppedInstr;
+                    changed = true;
+                    i += 2;
+                    continue;
+                }
+            }
+
+            if (const auto folded = fold_unary(next.instr, value))
+            {
+                instr = *folded;
+                next.instr = DroppedInstr;
+                changed = true;
+                ++i;
+                continue;
+            }
+
+            switch (next.instr)
+            {
+            case Instr::drop:
+                instr.instr = DroppedInstr;
+                next.instr = DroppedInstr;
+                break;
+            case Instr::if_:
+                // The true condition enters the then branch, the false one jumps to the else.
+                if (value == 0)
+                    next.instr = Instr::else_;
+                else
+                    next.instr = DroppedInstr;
+                instr.instr = DroppedInstr;
+                break;
+            case Instr::br_if:
+                if (value == 0)
+                    next.instr = DroppedInstr;
+                else
+                    next.instr = Instr::br;
+                instr.instr = DroppedInstr;
+                break;
+            case Instr::select:
+                // The true condition selects the first value, so the second one is dropped.
+                if (value == 0)
+                    continue;
+                instr.instr = DroppedInstr;
+                next.instr = Instr::drop;
+                break;
+            default:
+                if (is_identity(next.instr, value))
+                {
+                    instr.instr = DroppedInstr;
+                    next.instr = DroppedInstr;
+                }
+                else if (!reduce_strength(instr, next))
+                    continue;
+                break;
+            }
+            changed = true;
+            ++i;
+            continue;
+        }
+
+        switch (instr.instr)
+        {
+        case Instr::local_get:
+            if (next.instr == Instr::drop ||
+                (next.instr == Instr::local_set && next.imm == instr.imm))
+            {
+                instr.instr = DroppedInstr;
+                next.instr = DroppedInstr;
+                break;
+            }
+            continue;
+        case Instr::local_set:
+            if (next.instr == Instr::local_get && next.imm == instr.imm)
+            {
+                instr.instr = Instr::local_tee;
+                next.instr = DroppedInstr;
+                break;
+            }
+            continue;
+        case Instr::local_tee:
+            if (next.instr == Instr::drop)
+            {
+                instr.instr = Instr::local_set;
+                next.instr = DroppedInstr;
+                break;
+            }
+            continue;
+        default:
+            continue;
+        }
+        changed = true;
+        ++i;
+    }
+    return changed;
+}
+}  // namespace
+
+void optimize(LoweredCode& code)
+{
+    // Each pass may expose new opportunities to the following one,
+    // e.g. folded constants become operands of other instructions.
+    while (optimize_pass(code))
+        remove_dropped_instructions(code);
+}
+}  // namespace fizzy
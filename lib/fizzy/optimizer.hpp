@@ -0,0 +1,23 @@
+// Fizzy: A fast WebAssembly interpreter
+// Copyright 2020 The Fizzy Authors.
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include "lowered_code.hpp"
+
+namespace fizzy
+{
+/// Optimizes the lowered code with peephole transformations.
+///
+/// The transformations are:
+/// - constant folding of the integer instructions with constant operands,
+/// - strength reduction and removal of the identity operations with a constant operand,
+/// - removal of the redundant stack shuffles, e.g. local.get followed by drop,
+/// - resolving the conditional branches with a constant condition,
+/// - dead code elimination of the unreachable instructions after unconditional branches.
+///
+/// The observable behavior of the code is preserved, including traps: the instructions which
+/// would trap are never folded.
+void optimize(LoweredCode& code);
+}  // namespace fizzy
@@ -5,9 +5,14 @@
 #include "parser.hpp"
 #include "leb128.hpp"
 #include "limits.hpp"
+#include "lowered_code.hpp"
+#include "memory_resource.hpp"
 #include "types.hpp"
 #include "utf8.hpp"
+#include <algorithm>
 #include <cassert>
+#include <cstddef>
+#include <memory>
 #include <unordered_set>
 
 namespace fizzy
@@ -35,6 +40,25 @@ inline parser_result<std::vector<T>> parse_vec(const uint8_t* pos, const uint8_t
     return {result, pos};
 }
 
+template <>
+inline parser_result<std::vector<uint32_t>> parse_vec(const uint8_t* pos, const uint8_t* end)
+{
+    uint32_t size;
+    std::tie(size, pos) = leb128u_decode<uint32_t>(pos, end);
+
+    // Each value takes at least 1 byte, so the input size limits the memory to be allocated.
+    // For bigger sizes the EOF is reported after decoding all input values.
+    const auto num_values = std::min(size_t{size}, static_cast<size_t>(end - pos));
+
+    std::vector<uint32_t> result(num_values);
+    pos = leb128u_decode_u32_vec(pos, end, result.data(), num_values);
+
+    if (num_values != size)
+        throw parser_error{"unexpected EOF"};
+
+    return {result, pos};
+}
+
 template <>
 inline parser_result<uint32_t> parse(const uint8_t* pos, const uint8_t* end)
 {
@@ -84,9 +108,11 @@ inline parser_result<FuncType> parse(const uint8_t* pos, const uint8_t* end)
     return {result, pos};
 }
 
-inline std::tuple<bool, const uint8_t*> parse_global_type(const uint8_t* pos, const uint8_t* end)
+inline std::tuple<ValType, bool, const uint8_t*> parse_global_type(
+    const uint8_t* pos, const uint8_t* end)
 {
-    std::tie(std::ignore, pos) = parse<ValType>(pos, end);
+    ValType type;
+    std::tie(type, pos) = parse<ValType>(pos, end);
 
     uint8_t mutability;
     std::tie(mutability, pos) = parse_byte(pos, end);
@@ -97,7 +123,7 @@ inline std::tuple<bool, const uint8_t*> parse_global_type(const uint8_t* pos, co
     }
 
     const bool is_mutable = (mutability == 0x01);
-    return {is_mutable, pos};
+    return {type, is_mutable, pos};
 }
 
 inline parser_result<ConstantExpression> parse_constant_expression(
@@ -167,13 +193,15 @@ template <>
 inline parser_result<Global> parse(const uint8_t* pos, const uint8_t* end)
 {
     Global result;
-    std::tie(result.is_mutable, pos) = parse_global_type(pos, end);
+    std::tie(result.type, result.is_mutable, pos) = parse_global_type(pos, end);
     std::tie(result.expression, pos) = parse_constant_expression(pos, end);
 
     return {result, pos};
 }
 
-inline parser_result<Limits> parse_limits(const uint8_t* pos, const uint8_t* end)
+/// Parses the limits. The shared limits of the threads proposal are allowed for the memories.
+inline parser_result<Limits> parse_limits(
+    const uint8_t* pos, const uint8_t* end, bool allow_shared = false)
 {
     if (pos == end)
         throw parser_error{"unexpected EOF"};
@@ -186,14 +214,23 @@ inline parser_result<Limits> parse_limits(const uint8_t* pos, const uint8_t* end
         std::tie(result.min, pos) = leb128u_decode<uint32_t>(pos, end);
         return {result, pos};
     case 0x01:
+    case 0x03:
+        if (b == 0x03 && !allow_shared)
+            break;
         std::tie(result.min, pos) = leb128u_decode<uint32_t>(pos, end);
         std::tie(result.max, pos) = leb128u_decode<uint32_t>(pos, end);
         if (result.min > *result.max)
             throw validation_error("malformed limits (minimum is larger than maximum)");
+        result.shared = b == 0x03;
         return {result, pos};
+    case 0x02:
+        if (allow_shared)
+            throw validation_error("shared memory must have maximum");
+        break;
     default:
-        throw parser_error{"invalid limits " + std::to_string(b)};
+        break;
     }
+    throw parser_error{"invalid limits " + std::to_string(b)};
 }
 
 template <>
@@ -214,7 +251,7 @@ template <>
 inline parser_result<Memory> parse(const uint8_t* pos, const uint8_t* end)
 {
     Limits limits;
-    std::tie(limits, pos) = parse_limits(pos, end);
+    std::tie(limits, pos) = parse_limits(pos, end, true);
     if ((limits.min > MemoryPagesValidationLimit) ||
         (limits.max.has_value() && *limits.max > MemoryPagesValidationLimit))
         throw validation_error{"maximum memory page limit exceeded"};
@@ -262,7 +299,7 @@ inline parser_result<Import> parse(const uint8_t* pos, const uint8_t* end)
         break;
     case 0x03:
         result.kind = ExternalKind::Global;
-        std::tie(result.desc.global_mutable, pos) = parse_global_type(pos, end);
+        std::tie(std::ignore, result.desc.global_mutable, pos) = parse_global_type(pos, end);
         break;
     default:
         throw parser_error{"unexpected import kind value " + std::to_string(kind)};
@@ -340,16 +377,20 @@ inline parser_result<code_view> parse(const uint8_t* pos, const uint8_t* end)
     return {{code_begin, code_size}, code_end};
 }
 
-inline Code parse_code(code_view code_binary, FuncIdx func_idx, const Module& module)
+inline Code parse_code(code_view code_binary, FuncIdx func_idx, const Module& module,
+    pmr::memory_resource* scratch)
 {
     const auto begin = code_binary.begin();
     const auto end = code_binary.end();
     const auto [locals_vec, pos1] = parse_vec<Locals>(begin, end);
 
-    auto [code, pos2] = parse_expr(pos1, end, func_idx, module);
+    // The code is moved out of the result, as returning the structured binding would copy it
+    // to the default memory resource.
+    auto expr_result = parse_expr(pos1, end, func_idx, module, scratch);
+    Code code = std::move(std::get<0>(expr_result));
 
     // Size is the total bytes of locals and expressions.
-    if (pos2 != end)
+    if (std::get<1>(expr_result) != end)
         throw parser_error{"malformed size field for function"};
 
     uint64_t local_count = 0;
@@ -387,7 +428,7 @@ inline parser_result<Data> parse(const uint8_t* pos, const uint8_t* end)
     return {{offset, std::move(init)}, pos};
 }
 
-Module parse(bytes_view input)
+Module parse(bytes_view input, const ParseOptions& options)
 {
     if (input.substr(0, wasm_prefix.size()) != wasm_prefix)
         throw parser_error{"invalid wasm module prefix"};
@@ -575,10 +616,73 @@ Module parse(bytes_view input)
             throw validation_error{"invalid start function type"};
     }
 
+    // The scratch memory for parsing the code, reused for all functions.
+    // Each function gets the bump allocator over this buffer, released after the function
+    // is parsed. Only functions not fitting in the buffer fall back to the heap allocations.
+    constexpr size_t scratch_buffer_size = 64 * 1024;
+    const std::unique_ptr<std::byte[]> scratch_buffer{new std::byte[scratch_buffer_size]};
+
+    const auto parse_code_at = [&](size_t code_idx) {
+        pmr::monotonic_buffer_resource scratch{scratch_buffer.get(), scratch_buffer_size};
+        const auto func_idx = static_cast<FuncIdx>(code_idx);
+        return parse_code(code_binaries[code_idx], func_idx, module, &scratch);
+    };
+
     // Process code. TODO: This can be done lazily.
     module.codesec.reserve(code_binaries.size());
-    for (size_t i = 0; i < code_binaries.size(); ++i)
-        module.codesec.emplace_back(parse_code(code_binaries[i], static_cast<FuncIdx>(i), module));
+    if (!options.prune_unreachable_functions)
+    {
+        for (size_t i = 0; i < code_binaries.size(); ++i)
+            module.codesec.emplace_back(parse_code_at(i));
+        return module;
+    }
+
+    // Parse the code of the reachable functions only, following the calls from the roots.
+    const auto num_imported_functions = module.imported_function_types.size();
+    std::vector<std::optional<Code>> reachable_codes(code_binaries.size());
+    std::vector<size_t> worklist;
+    const auto mark_reachable = [&](FuncIdx func_idx) {
+        // The element segments are validated at instantiation, so the index can be invalid.
+        if (func_idx < num_imported_functions || func_idx >= total_func_count)
+            return;
+        const auto code_idx = func_idx - num_imported_functions;
+        if (!reachable_codes[code_idx].has_value())
+        {
+            reachable_codes[code_idx] = parse_code_at(code_idx);
+            worklist.emplace_back(code_idx);
+        }
+    };
+
+    for (const auto& export_ : module.exportsec)
+    {
+        if (export_.kind == ExternalKind::Function)
+            mark_reachable(export_.index);
+    }
+    if (module.startfunc)
+        mark_reachable(*module.startfunc);
+    for (const auto& element : module.elementsec)
+    {
+        for (const auto func_idx : element.init)
+            mark_reachable(func_idx);
+    }
+    while (!worklist.empty())
+    {
+        const auto code_idx = worklist.back();
+        worklist.pop_back();
+        for (const auto func_idx : get_called_functions(*reachable_codes[code_idx]))
+            mark_reachable(func_idx);
+    }
+
+    const auto arena = module.arena.resource();
+    for (auto& code : reachable_codes)
+    {
+        if (code.has_value())
+            module.codesec.emplace_back(std::move(*code));
+        else
+            module.codesec.emplace_back(
+                Code{0, 0, {{Instr::unreachable, Instr::end}, arena},
+                    pmr::basic_string<uint8_t>{arena}});
+    }
 
     return module;
 }
@@ -17,7 +17,17 @@ constexpr bytes_view wasm_prefix{wasm_prefix_data, sizeof(wasm_prefix_data)};
 template <typename T>
 using parser_result = std::tuple<T, const uint8_t*>;
 
-Module parse(bytes_view input);
+/// The options of the module parsing.
+struct ParseOptions
+{
+    /// Whether to skip the code of the functions not reachable by the direct calls from
+    /// the exported functions, the start function and the functions of the element segments.
+    /// The code of each skipped function is neither parsed nor validated and is replaced with
+    /// the trapping `unreachable` stub, so the function indices stay the same.
+    bool prune_unreachable_functions = false;
+};
+
+Module parse(bytes_view input, const ParseOptions& options = {});
 
 inline const uint8_t* skip(size_t num_bytes, const uint8_t* input, const uint8_t* end)
 {
@@ -41,9 +51,11 @@ inline parser_result<uint8_t> parse_byte(const uint8_t* pos, const uint8_t* end)
 /// @param input    The beginning of the expr binary input.
 /// @param end      The end of the binary input.
 /// @param func_idx Index of the function being parsed.
-/// @param module   Module that this code is part of.
-parser_result<Code> parse_expr(
-    const uint8_t* input, const uint8_t* end, FuncIdx func_idx, const Module& module);
+/// @param module   Module that this code is part of. The code is allocated from its arena.
+/// @param scratch  The memory resource for temporary parsing data. It is meant to be reused
+///                 by consecutive parse_expr() calls so allocations are amortized.
+parser_result<Code> parse_expr(const uint8_t* input, const uint8_t* end, FuncIdx func_idx,
+    const Module& module, pmr::memory_resource* scratch = pmr::get_default_resource());
 
 parser_result<std::string> parse_string(const uint8_t* pos, const uint8_t* end);
 
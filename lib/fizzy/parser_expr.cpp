@@ -2,6 +2,7 @@
 // Copyright 2019-2020 The Fizzy Authors.
 // SPDX-License-Identifier: Apache-2.0
 
+#include "atomics.hpp"
 #include "instructions.hpp"
 #include "module.hpp"
 #include "parser.hpp"
@@ -18,8 +19,8 @@ inline void store(uint8_t* dst, T value) noexcept
     __builtin_memcpy(dst, &value, sizeof(value));
 }
 
-template <typename T>
-inline void push(bytes& b, T value)
+template <typename T, typename Bytes>
+inline void push(Bytes& b, T value)
 {
     uint8_t storage[sizeof(T)];
     store(storage, value);
@@ -56,16 +57,17 @@ struct ControlFrame
     bool unreachable{false};
 
     /// Offsets of br/br_if/br_table instruction immediates, to be filled at the end of the block
-    std::vector<size_t> br_immediate_offsets{};
+    pmr::vector<size_t> br_immediate_offsets;
 
-    ControlFrame(Instr _instruction, uint8_t _arity, int _parent_stack_height,
-        size_t _code_offset = 0, size_t _immediates_offset = 0) noexcept
+    ControlFrame(pmr::memory_resource* memory, Instr _instruction, uint8_t _arity,
+        int _parent_stack_height, size_t _code_offset = 0, size_t _immediates_offset = 0) noexcept
       : instruction{_instruction},
         arity{_arity},
         code_offset{_code_offset},
         immediates_offset{_immediates_offset},
         parent_stack_height{_parent_stack_height},
-        stack_height{_parent_stack_height}
+        stack_height{_parent_stack_height},
+        br_immediate_offsets{memory}
     {}
 };
 
@@ -126,7 +128,8 @@ inline uint8_t get_branch_arity(const ControlFrame& frame) noexcept
     return frame.instruction == Instr::loop ? 0 : frame.arity;
 }
 
-void push_branch_immediates(const ControlFrame& frame, bytes& immediates)
+template <typename Bytes>
+void push_branch_immediates(const ControlFrame& frame, Bytes& immediates)
 {
     // Push frame start location as br immediates - these are final if frame is loop,
     // but for block/if/else these are just placeholders, to be filled at end instruction.
@@ -138,20 +141,24 @@ void push_branch_immediates(const ControlFrame& frame, bytes& immediates)
 
 }  // namespace
 
-parser_result<Code> parse_expr(
-    const uint8_t* pos, const uint8_t* end, FuncIdx func_idx, const Module& module)
+parser_result<Code> parse_expr(const uint8_t* pos, const uint8_t* end, FuncIdx func_idx,
+    const Module& module, pmr::memory_resource* scratch)
 {
-    Code code;
+    // The code is collected in the scratch memory, and copied to the module's arena when complete,
+    // so the arena does not keep memory of intermediate buffers.
+    pmr::vector<Instr> instructions{scratch};
+    pmr::basic_string<uint8_t> immediates{scratch};
+    int max_stack_height = 0;
 
     // The stack of control frames allowing to distinguish between block/if/else and label
     // instructions as defined in Wasm Validation Algorithm.
-    Stack<ControlFrame> control_stack;
+    Stack<ControlFrame, pmr::polymorphic_allocator<ControlFrame>> control_stack{scratch};
 
     const auto func_type_idx = module.funcsec[func_idx];
     assert(func_type_idx < module.typesec.size());
     const auto function_arity = static_cast<uint8_t>(module.typesec[func_type_idx].outputs.size());
     // The function's implicit block.
-    control_stack.emplace(Instr::block, function_arity, 0);
+    control_stack.emplace(scratch, Instr::block, function_arity, 0);
 
     const auto metrics_table = get_instruction_metrics_table();
 
@@ -161,6 +168,10 @@ parser_result<Code> parse_expr(
         uint8_t opcode;
         std::tie(opcode, pos) = parse_byte(pos, end);
 
+        // The internal atomic instructions have the stack effect, but are not in the binary.
+        if (is_atomic(static_cast<Instr>(opcode)))
+            throw parser_error{"invalid instruction " + std::to_string(opcode)};
+
         auto& frame = control_stack.top();
         const auto& metrics = metrics_table[opcode];
 
@@ -175,7 +186,7 @@ parser_result<Code> parse_expr(
             // This way the update is skipped for end/else instructions (because their frame is
             // already popped/reset), but it does not matter, as these instructions do not modify
             // stack height anyway.
-            code.max_stack_height = std::max(code.max_stack_height, frame.stack_height);
+            max_stack_height = std::max(max_stack_height, frame.stack_height);
         }
 
         frame.stack_height += metrics.stack_height_change;
@@ -343,8 +354,8 @@ parser_result<Code> parse_expr(
             std::tie(arity, pos) = parse_blocktype(pos, end);
 
             // Push label with immediates offset after arity.
-            control_stack.emplace(Instr::block, arity, frame.stack_height, code.instructions.size(),
-                code.immediates.size());
+            control_stack.emplace(scratch, Instr::block, arity, frame.stack_height,
+                instructions.size(), immediates.size());
             break;
         }
 
@@ -353,8 +364,8 @@ parser_result<Code> parse_expr(
             uint8_t arity;
             std::tie(arity, pos) = parse_blocktype(pos, end);
 
-            control_stack.emplace(Instr::loop, arity, frame.stack_height, code.instructions.size(),
-                code.immediates.size());
+            control_stack.emplace(scratch, Instr::loop, arity, frame.stack_height,
+                instructions.size(), immediates.size());
 
             break;
         }
@@ -364,12 +375,12 @@ parser_result<Code> parse_expr(
             uint8_t arity;
             std::tie(arity, pos) = parse_blocktype(pos, end);
 
-            control_stack.emplace(Instr::if_, arity, frame.stack_height, code.instructions.size(),
-                code.immediates.size());
+            control_stack.emplace(scratch, Instr::if_, arity, frame.stack_height,
+                instructions.size(), immediates.size());
 
             // Placeholders for immediate values, filled at the matching end or else instructions.
-            push(code.immediates, uint32_t{0});  // Diff to the else instruction
-            push(code.immediates, uint32_t{0});  // Diff for the immediates.
+            push(immediates, uint32_t{0});  // Diff to the else instruction
+            push(immediates, uint32_t{0});  // Diff for the immediates.
 
             break;
         }
@@ -385,18 +396,18 @@ parser_result<Code> parse_expr(
             frame.stack_height = frame.parent_stack_height;
             frame.unreachable = false;
             const auto if_imm_offset = frame.immediates_offset;
-            frame.immediates_offset = code.immediates.size();
+            frame.immediates_offset = immediates.size();
 
             // Placeholders for immediate values, filled at the matching end instructions.
-            push(code.immediates, uint32_t{0});  // Diff to the end instruction.
-            push(code.immediates, uint32_t{0});  // Diff for the immediates
+            push(immediates, uint32_t{0});  // Diff to the end instruction.
+            push(immediates, uint32_t{0});  // Diff for the immediates
 
             // Fill in if's immediates with offsets of first instruction in else block.
-            const auto target_pc = static_cast<uint32_t>(code.instructions.size() + 1);
-            const auto target_imm = static_cast<uint32_t>(code.immediates.size());
+            const auto target_pc = static_cast<uint32_t>(instructions.size() + 1);
+            const auto target_imm = static_cast<uint32_t>(immediates.size());
 
             // Set the imm values for else instruction.
-            auto* if_imm = code.immediates.data() + if_imm_offset;
+            auto* if_imm = immediates.data() + if_imm_offset;
             store(if_imm, target_pc);
             if_imm += sizeof(target_pc);
             store(if_imm, target_imm);
@@ -414,16 +425,16 @@ parser_result<Code> parse_expr(
                 // we want br to jump to the final end of the function.
                 // Otherwise jump to the next instruction after block's end.
                 const auto target_pc = control_stack.size() == 1 ?
-                                           static_cast<uint32_t>(code.instructions.size()) :
-                                           static_cast<uint32_t>(code.instructions.size() + 1);
-                const auto target_imm = static_cast<uint32_t>(code.immediates.size());
+                                           static_cast<uint32_t>(instructions.size()) :
+                                           static_cast<uint32_t>(instructions.size() + 1);
+                const auto target_imm = static_cast<uint32_t>(immediates.size());
 
                 if (frame.instruction == Instr::if_)
                 {
                     // We're at the end instruction of the if block without else or at the end of
                     // else block. Fill in if/else's immediates with offsets of first instruction
                     // after if/else block.
-                    auto* if_imm = code.immediates.data() + frame.immediates_offset;
+                    auto* if_imm = immediates.data() + frame.immediates_offset;
                     store(if_imm, target_pc);
                     if_imm += sizeof(target_pc);
                     store(if_imm, target_imm);
@@ -432,7 +443,7 @@ parser_result<Code> parse_expr(
                 // Fill in immediates all br/br_table instructions jumping out of this block.
                 for (const auto br_imm_offset : frame.br_immediate_offsets)
                 {
-                    auto* br_imm = code.immediates.data() + br_imm_offset;
+                    auto* br_imm = immediates.data() + br_imm_offset;
                     store(br_imm, static_cast<uint32_t>(target_pc));
                     br_imm += sizeof(uint32_t);
                     store(br_imm, static_cast<uint32_t>(target_imm));
@@ -460,9 +471,9 @@ parser_result<Code> parse_expr(
 
             // Remember this br immediates offset to fill it at end instruction.
             auto& branch_frame = control_stack[label_idx];
-            branch_frame.br_immediate_offsets.push_back(code.immediates.size());
+            branch_frame.br_immediate_offsets.push_back(immediates.size());
 
-            push_branch_immediates(branch_frame, code.immediates);
+            push_branch_immediates(branch_frame, immediates);
 
             if (instr == Instr::br)
                 frame.unreachable = true;
@@ -490,7 +501,7 @@ parser_result<Code> parse_expr(
             const auto default_branch_arity = get_branch_arity(default_branch_frame);
 
             // Remember immediates offset for all br items to fill them at end instruction.
-            push(code.immediates, static_cast<uint32_t>(label_indices.size()));
+            push(immediates, static_cast<uint32_t>(label_indices.size()));
             for (const auto idx : label_indices)
             {
                 auto& branch_frame = control_stack[idx];
@@ -498,12 +509,12 @@ parser_result<Code> parse_expr(
                 if (get_branch_arity(branch_frame) != default_branch_arity)
                     throw validation_error{"br_table labels have inconsistent types"};
 
-                branch_frame.br_immediate_offsets.push_back(code.immediates.size());
-                push_branch_immediates(branch_frame, code.immediates);
+                branch_frame.br_immediate_offsets.push_back(immediates.size());
+                push_branch_immediates(branch_frame, immediates);
             }
 
-            default_branch_frame.br_immediate_offsets.push_back(code.immediates.size());
-            push_branch_immediates(default_branch_frame, code.immediates);
+            default_branch_frame.br_immediate_offsets.push_back(immediates.size());
+            push_branch_immediates(default_branch_frame, immediates);
 
             frame.unreachable = true;
 
@@ -517,9 +528,9 @@ parser_result<Code> parse_expr(
             const uint32_t label_idx = static_cast<uint32_t>(control_stack.size() - 1);
 
             auto& branch_frame = control_stack[label_idx];
-            branch_frame.br_immediate_offsets.push_back(code.immediates.size());
+            branch_frame.br_immediate_offsets.push_back(immediates.size());
 
-            push_branch_immediates(control_stack[label_idx], code.immediates);
+            push_branch_immediates(control_stack[label_idx], immediates);
 
             frame.unreachable = true;
             break;
@@ -536,7 +547,7 @@ parser_result<Code> parse_expr(
             const auto& func_type = module.get_function_type(callee_func_idx);
             update_caller_frame(frame, func_type);
 
-            push(code.immediates, callee_func_idx);
+            push(immediates, callee_func_idx);
             break;
         }
 
@@ -554,7 +565,7 @@ parser_result<Code> parse_expr(
             const auto& func_type = module.typesec[type_idx];
             update_caller_frame(frame, func_type);
 
-            push(code.immediates, type_idx);
+            push(immediates, type_idx);
 
             if (pos == end)
                 throw parser_error{"unexpected EOF"};
@@ -571,7 +582,7 @@ parser_result<Code> parse_expr(
         {
             uint32_t local_idx;
             std::tie(local_idx, pos) = leb128u_decode<uint32_t>(pos, end);
-            push(code.immediates, local_idx);
+            push(immediates, local_idx);
             break;
         }
 
@@ -587,7 +598,7 @@ parser_result<Code> parse_expr(
             if (instr == Instr::global_set && !module.is_global_mutable(global_idx))
                 throw validation_error{"trying to mutate immutable global"};
 
-            push(code.immediates, global_idx);
+            push(immediates, global_idx);
             break;
         }
 
@@ -595,7 +606,7 @@ parser_result<Code> parse_expr(
         {
             int32_t value;
             std::tie(value, pos) = leb128s_decode<int32_t>(pos, end);
-            push(code.immediates, static_cast<uint32_t>(value));
+            push(immediates, static_cast<uint32_t>(value));
             break;
         }
 
@@ -603,7 +614,7 @@ parser_result<Code> parse_expr(
         {
             int64_t value;
             std::tie(value, pos) = leb128s_decode<int64_t>(pos, end);
-            push(code.immediates, static_cast<uint64_t>(value));
+            push(immediates, static_cast<uint64_t>(value));
             break;
         }
 
@@ -632,7 +643,7 @@ parser_result<Code> parse_expr(
 
             uint32_t offset;
             std::tie(offset, pos) = leb128u_decode<uint32_t>(pos, end);
-            push(code.immediates, offset);
+            push(immediates, offset);
 
             if (!module.has_memory())
                 throw validation_error{"memory instructions require imported or defined memory"};
@@ -652,10 +663,60 @@ parser_result<Code> parse_expr(
                 throw validation_error{"memory instructions require imported or defined memory"};
             break;
         }
+        case Instr::atomic_prefix:
+        {
+            uint32_t atomic_opcode;
+            std::tie(atomic_opcode, pos) = leb128u_decode<uint32_t>(pos, end);
+            const auto atomic_instr = get_atomic_instr(atomic_opcode);
+            if (atomic_instr == Instr::unreachable)
+                throw parser_error{"invalid atomic instruction " + std::to_string(atomic_opcode)};
+
+            // The prefix has no stack effect, the atomic instruction's one is applied here.
+            const auto& atomic_metrics = metrics_table[static_cast<uint8_t>(atomic_instr)];
+            if (!frame.unreachable &&
+                (frame.stack_height - frame.parent_stack_height) <
+                    atomic_metrics.stack_height_required)
+                throw validation_error{"stack underflow"};
+            frame.stack_height += atomic_metrics.stack_height_change;
+
+            if (atomic_instr == Instr::atomic_fence)
+            {
+                uint8_t flags;
+                std::tie(flags, pos) = parse_byte(pos, end);
+                if (flags != 0)
+                    throw parser_error{"invalid atomic.fence flags " + std::to_string(flags)};
+            }
+            else
+            {
+                const auto atomic_op = static_cast<AtomicOp>(atomic_opcode);
+                uint32_t alignment;
+                std::tie(alignment, pos) = leb128u_decode<uint32_t>(pos, end);
+                const auto access_size = get_atomic_access_size(atomic_op);
+                if (alignment >= 32 || (uint32_t{1} << alignment) != access_size)
+                    throw validation_error{"atomic alignment must be natural"};
+
+                uint32_t offset;
+                std::tie(offset, pos) = leb128u_decode<uint32_t>(pos, end);
+                push(immediates, offset);
+                push(immediates, static_cast<uint8_t>(atomic_op));
+
+                if (!module.has_memory())
+                {
+                    throw validation_error{
+                        "memory instructions require imported or defined memory"};
+                }
+            }
+            instructions.emplace_back(atomic_instr);
+            continue;
+        }
         }
-        code.instructions.emplace_back(instr);
+        instructions.emplace_back(instr);
     }
     assert(control_stack.empty());
-    return {code, pos};
+
+    const auto arena = module.arena.resource();
+    Code code{max_stack_height, 0, {instructions.begin(), instructions.end(), arena},
+        {immediates.begin(), immediates.end(), arena}};
+    return {std::move(code), pos};
 }
 }  // namespace fizzy
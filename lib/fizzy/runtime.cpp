@@ -0,0 +1,248 @@
+// Fizzy: A fast WebAssembly interpreter
+// Copyright 2020 The Fizzy Authors.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "runtime.hpp"
+#include "code_layout.hpp"
+#include <algorithm>
+#include <cassert>
+
+namespace fizzy
+{
+namespace
+{
+Module lay_out(Module module)
+{
+    layout_code(module);
+    return module;
+}
+}  // namespace
+
+InstancePool::InstancePool(Module module, std::vector<ExternalFunction> imported_functions)
+  : m_module(lay_out(std::move(module))), m_imported_functions(std::move(imported_functions))
+{
+    m_instances.emplace_back(create_instance());
+}
+
+std::unique_ptr<Instance> InstancePool::create_instance() const
+{
+    auto module = m_module;
+    copy_code_image(m_module, module);
+    return instantiate(std::move(module), m_imported_functions);
+}
+
+std::unique_ptr<Instance> InstancePool::acquire()
+{
+    {
+        const std::lock_guard lock{m_mutex};
+        if (!m_instances.empty())
+        {
+            auto instance = std::move(m_instances.back());
+            m_instances.pop_back();
+            return instance;
+        }
+    }
+    // Instantiate outside of the lock, the module and imports are only read.
+    return create_instance();
+}
+
+void InstancePool::release(std::unique_ptr<Instance> instance)
+{
+    const std::lock_guard lock{m_mutex};
+    m_instances.emplace_back(std::move(instance));
+}
+
+Runtime::Runtime(size_t num_threads)
+{
+    num_threads = std::max(num_threads, size_t{1});
+
+    m_queues.reserve(num_threads);
+    for (size_t i = 0; i < num_threads; ++i)
+        m_queues.emplace_back(std::make_unique<WorkerQueue>());
+
+    m_workers.reserve(num_threads);
+    for (size_t i = 0; i < num_threads; ++i)
+        m_workers.emplace_back(&Runtime::run_worker, this, i);
+}
+
+Runtime::~Runtime()
+{
+    wait();
+    {
+        const std::lock_guard lock{m_mutex};
+        m_stopping = true;
+    }
+    m_tasks_available.notify_all();
+    for (auto& worker : m_workers)
+        worker.join();
+}
+
+ModuleId Runtime::add_module(Module module, std::vector<ExternalFunction> imported_functions)
+{
+    auto pool = std::make_unique<InstancePool>(std::move(module), std::move(imported_functions));
+
+    const std::lock_guard lock{m_modules_mutex};
+    m_modules.emplace_back(std::move(pool));
+    return m_modules.size() - 1;
+}
+
+InstancePool& Runtime::get_pool(ModuleId module_id)
+{
+    const std::lock_guard lock{m_modules_mutex};
+    assert(module_id < m_modules.size());
+    return *m_modules[module_id];
+}
+
+std::vector<std::future<execution_result>> Runtime::submit(std::vector<Job> jobs)
+{
+    std::vector<std::future<execution_result>> futures;
+    futures.reserve(jobs.size());
+
+    std::vector<Task> tasks;
+    tasks.reserve(jobs.size());
+    for (size_t i = 0; i < jobs.size(); ++i)
+    {
+        auto& task = tasks.emplace_back(
+            Task{&get_pool(jobs[i].module_id), jobs[i].func_idx, std::move(jobs[i].args), i});
+        futures.emplace_back(task.promise.emplace().get_future());
+    }
+
+    enqueue(std::move(tasks));
+    return futures;
+}
+
+void Runtime::submit(std::vector<Job> jobs, JobCallback callback)
+{
+    const auto shared_callback = std::make_shared<const JobCallback>(std::move(callback));
+
+    std::vector<Task> tasks;
+    tasks.reserve(jobs.size());
+    for (size_t i = 0; i < jobs.size(); ++i)
+    {
+        tasks.emplace_back(Task{&get_pool(jobs[i].module_id), jobs[i].func_idx,
+            std::move(jobs[i].args), i, shared_callback});
+    }
+
+    enqueue(std::move(tasks));
+}
+
+void Runtime::enqueue(std::vector<Task> tasks)
+{
+    if (tasks.empty())
+        return;
+
+    size_t first_queue = 0;
+    {
+        const std::lock_guard lock{m_mutex};
+        m_num_pending += tasks.size();
+        m_num_queued += tasks.size();
+        first_queue = m_next_queue;
+        m_next_queue = (m_next_queue + tasks.size()) % m_queues.size();
+    }
+
+    // Distribute the tasks round-robin, locking each queue once.
+    const auto num_queues = m_queues.size();
+    for (size_t q = 0; q < std::min(num_queues, tasks.size()); ++q)
+    {
+        auto& queue = *m_queues[(first_queue + q) % num_queues];
+        const std::lock_guard lock{queue.mutex};
+        for (size_t i = q; i < tasks.size(); i += num_queues)
+            queue.tasks.emplace_back(std::move(tasks[i]));
+    }
+
+    m_tasks_available.notify_all();
+}
+
+std::optional<Runtime::Task> Runtime::take_task(size_t worker_idx)
+{
+    {
+        auto& own_queue = *m_queues[worker_idx];
+        const std::lock_guard lock{own_queue.mutex};
+        if (!own_queue.tasks.empty())
+        {
+            auto task = std::move(own_queue.tasks.back());
+            own_queue.tasks.pop_back();
+            --m_num_queued;
+            return task;
+        }
+    }
+
+    // Steal from the other queues, starting from the next one to spread the thieves.
+    const auto num_queues = m_queues.size();
+    for (size_t i = 1; i < num_queues; ++i)
+    {
+        auto& queue = *m_queues[(worker_idx + i) % num_queues];
+        const std::lock_guard lock{queue.mutex};
+        if (!queue.tasks.empty())
+        {
+            auto task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+            --m_num_queued;
+            return task;
+        }
+    }
+    return std::nullopt;
+}
+
+void Runtime::run_worker(size_t worker_idx)
+{
+    // The instances of the worker, one per module it executed the jobs of.
+    std::vector<std::pair<InstancePool*, std::unique_ptr<Instance>>> instances;
+
+    while (true)
+    {
+        auto task = take_task(worker_idx);
+        if (!task)
+        {
+            std::unique_lock lock{m_mutex};
+            // The counter is incremented before the tasks are pushed, so the woken worker may
+            // briefly find no task and retry.
+            m_tasks_available.wait(lock, [this] { return m_num_queued != 0 || m_stopping; });
+            if (m_num_queued == 0 && m_stopping)
+                break;
+            continue;
+        }
+
+        std::optional<execution_result> result;
+        std::exception_ptr error;
+        try
+        {
+            auto it = std::find_if(instances.begin(), instances.end(),
+                [pool = task->pool](const auto& entry) { return entry.first == pool; });
+            if (it == instances.end())
+                it = instances.emplace(instances.end(), task->pool, task->pool->acquire());
+
+            result = execute(*it->second, task->func_idx, std::move(task->args));
+        }
+        catch (...)
+        {
+            error = std::current_exception();
+        }
+
+        if (task->callback)
+        {
+            (*task->callback)(task->job_idx,
+                result ? std::move(*result) : execution_result{true, {}}, std::move(error));
+        }
+        else if (result)
+            task->promise->set_value(std::move(*result));
+        else
+            task->promise->set_exception(error);
+
+        if (--m_num_pending == 0)
+        {
+            const std::lock_guard lock{m_mutex};
+            m_all_done.notify_all();
+        }
+    }
+
+    for (auto& [pool, instance] : instances)
+        pool->release(std::move(instance));
+}
+
+void Runtime::wait()
+{
+    std::unique_lock lock{m_mutex};
+    m_all_done.wait(lock, [this] { return m_num_pending == 0; });
+}
+}  // namespace fizzy
@@ -0,0 +1,157 @@
+// Fizzy: A fast WebAssembly interpreter
+// Copyright 2020 The Fizzy Authors.
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include "execute.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+namespace fizzy
+{
+/// The identifier of the module added to the runtime.
+using ModuleId = size_t;
+
+/// The call of the function of the module added to the runtime.
+struct Job
+{
+    ModuleId module_id = 0;
+    FuncIdx func_idx = 0;
+    std::vector<uint64_t> args;
+};
+
+/// The callback receiving the result of the job with the @p job_idx index in the submitted batch.
+/// The @p error is the exception thrown by the execution, e.g. by the imported function,
+/// and null otherwise. The result of such job is the trap.
+/// It is called by the worker thread which executed the job and must not throw.
+using JobCallback =
+    std::function<void(size_t job_idx, execution_result result, std::exception_ptr error)>;
+
+/// The pool of the instances of the module, created on demand.
+class InstancePool
+{
+    /// The module with the code laid out once, copied by the instances.
+    const Module m_module;
+    const std::vector<ExternalFunction> m_imported_functions;
+
+    std::mutex m_mutex;
+    std::vector<std::unique_ptr<Instance>> m_instances;
+
+    /// Instantiates the copy of the module with its laid out code.
+    std::unique_ptr<Instance> create_instance() const;
+
+public:
+    /// Creates the pool and its first instance, so the instantiation errors are reported here.
+    InstancePool(Module module, std::vector<ExternalFunction> imported_functions);
+
+    InstancePool(const InstancePool&) = delete;
+    InstancePool& operator=(const InstancePool&) = delete;
+
+    /// Takes the idle instance from the pool or creates the new one if there is none.
+    std::unique_ptr<Instance> acquire();
+
+    /// Returns the instance to the pool.
+    void release(std::unique_ptr<Instance> instance);
+};
+
+/// The multi-threaded runtime executing batches of independent jobs.
+///
+/// The jobs of a batch are distributed among the queues of the worker threads. The worker
+/// executes the jobs from its own queue and steals the jobs from the other queues when its queue
+/// is empty. Each worker executes the jobs on its own instance of the module, taken from
+/// the module's instance pool on first use, so the instances are never shared between threads.
+/// The instances are reused by subsequent jobs, so the jobs must not depend on the memory and
+/// globals state left by other jobs. The imported functions may be called concurrently.
+class Runtime
+{
+    struct Task
+    {
+        InstancePool* pool = nullptr;
+        FuncIdx func_idx = 0;
+        std::vector<uint64_t> args;
+
+        /// The job's index in the batch, passed to the callback.
+        size_t job_idx = 0;
+
+        /// Either the callback or the promise receives the result.
+        std::shared_ptr<const JobCallback> callback = nullptr;
+        std::optional<std::promise<execution_result>> promise = std::nullopt;
+    };
+
+    /// The queue of the worker. The owner takes the tasks from the back, the thieves from
+    /// the front, so the stolen tasks are the ones the owner would execute last.
+    struct WorkerQueue
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    std::mutex m_modules_mutex;
+    std::vector<std::unique_ptr<InstancePool>> m_modules;
+
+    std::vector<std::unique_ptr<WorkerQueue>> m_queues;
+    std::vector<std::thread> m_workers;
+
+    /// Guards the waiting for the tasks and for the completion of all jobs.
+    std::mutex m_mutex;
+    std::condition_variable m_tasks_available;
+    std::condition_variable m_all_done;
+
+    /// The number of tasks in the queues. Incremented under m_mutex, so no wakeup is lost.
+    std::atomic<size_t> m_num_queued{0};
+
+    /// The number of submitted jobs not completed yet.
+    std::atomic<size_t> m_num_pending{0};
+
+    /// The queue the next batch starts to be distributed from.
+    size_t m_next_queue = 0;
+
+    bool m_stopping = false;
+
+    InstancePool& get_pool(ModuleId module_id);
+    void enqueue(std::vector<Task> tasks);
+    std::optional<Task> take_task(size_t worker_idx);
+    void run_worker(size_t worker_idx);
+
+public:
+    /// Creates the runtime with @p num_threads worker threads (at least one).
+    explicit Runtime(size_t num_threads = std::thread::hardware_concurrency());
+
+    /// Waits for the completion of all jobs and stops the workers.
+    ~Runtime();
+
+    Runtime(const Runtime&) = delete;
+    Runtime& operator=(const Runtime&) = delete;
+
+    /// Adds the module executed with the @p imported_functions.
+    /// The module is instantiated once to report the instantiation errors, i.e. throws
+    /// the instantiate_error.
+    ModuleId add_module(Module module, std::vector<ExternalFunction> imported_functions = {});
+
+    /// Submits the batch of jobs. Returns the futures of their results, in the order of the jobs.
+    /// The exception thrown by the execution, e.g. by the imported function, is stored in
+    /// the future.
+    std::vector<std::future<execution_result>> submit(std::vector<Job> jobs);
+
+    /// Submits the batch of jobs, the results and the exceptions thrown by the execution
+    /// are passed to the @p callback.
+    void submit(std::vector<Job> jobs, JobCallback callback);
+
+    /// Waits until all submitted jobs are completed.
+    void wait();
+
+    /// Returns the number of worker threads.
+    size_t get_thread_count() const noexcept { return m_workers.size(); }
+};
+}  // namespace fizzy
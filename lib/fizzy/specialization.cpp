@@ -0,0 +1,33 @@
+// Fizzy: A fast WebAssembly interpreter
+// Copyright 2020 The Fizzy Authors.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "specialization.hpp"
+#include "code_layout.hpp"
+
+namespace fizzy
+{
+void specialize(Instance& instance)
+{
+    // Stop the compilation for the previous code layout before changing it.
+    instance.tiering.reset();
+
+    CodeSpecialization specialization;
+    for (const auto& global : instance.imported_globals)
+    {
+        specialization.global_values.emplace_back();
+        specialization.global_storage.emplace_back(global.value);
+    }
+    for (size_t i = 0; i < instance.module.globalsec.size(); ++i)
+    {
+        const auto& global = instance.module.globalsec[i];
+        const bool is_constant =
+            !global.is_mutable && (global.type == ValType::i32 || global.type == ValType::i64);
+        specialization.global_values.emplace_back(
+            is_constant ? std::optional{instance.globals[i]} : std::nullopt);
+        specialization.global_storage.emplace_back(&instance.globals[i]);
+    }
+
+    layout_code(instance.module, {true, {}, &specialization});
+}
+}  // namespace fizzy
@@ -0,0 +1,22 @@
+// Fizzy: A fast WebAssembly interpreter
+// Copyright 2020 The Fizzy Authors.
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include "execute.hpp"
+
+namespace fizzy
+{
+/// Lays out the instance's code again, specialized for the instance's state fixed after
+/// the instantiation.
+///
+/// The values of the immutable i32 and i64 globals defined by the module are propagated into
+/// the code as constants and folded by the optimizer. The other globals are accessed by direct
+/// pointers to their storage, without checking if they are imported.
+/// The code image is owned by the instance's module, so the specialized code is private to
+/// the instance. This is meant for the long-lived instances, as the layout takes time.
+/// Stops the tiered execution, if enabled. Must not be called during the execution of
+/// the instance.
+void specialize(Instance& instance);
+}  // namespace fizzy
@@ -4,6 +4,7 @@
 
 #pragma once
 
+#include <algorithm>
 #include <cassert>
 #include <cstdint>
 #include <memory>
@@ -11,19 +12,21 @@
 
 namespace fizzy
 {
-template <typename T>
-class Stack : public std::vector<T>
+template <typename T, typename Allocator = std::allocator<T>>
+class Stack : public std::vector<T, Allocator>
 {
+    using base = std::vector<T, Allocator>;
+
 public:
-    using difference_type = typename std::vector<T>::difference_type;
+    using difference_type = typename base::difference_type;
 
-    using std::vector<T>::vector;
+    using base::base;
 
-    using std::vector<T>::back;
-    using std::vector<T>::emplace_back;
-    using std::vector<T>::pop_back;
-    using std::vector<T>::resize;
-    using std::vector<T>::size;
+    using base::back;
+    using base::emplace_back;
+    using base::pop_back;
+    using base::resize;
+    using base::size;
 
     // Also used: size(), resize(), clear(), empty(), end()
 
@@ -32,7 +35,7 @@ public:
     template <typename... Args>
     void emplace(Args&&... args)
     {
-        std::vector<T>::emplace_back(std::forward<Args>(args)...);
+        base::emplace_back(std::forward<Args>(args)...);
     }
 
     T pop()
@@ -42,7 +45,7 @@ public:
         return res;
     }
 
-    T& operator[](size_t index) noexcept { return std::vector<T>::operator[](size() - index - 1); }
+    T& operator[](size_t index) noexcept { return base::operator[](size() - index - 1); }
 
     T& top() noexcept { return (*this)[0]; }
 
@@ -84,12 +87,18 @@ class OperandStack
 public:
     /// Default constructor.
     ///
-    /// Based on @p max_stack_height decides if to use small pre-allocated storage or allocate
-    /// large storage.
+    /// Uses the @p external_storage if provided. It is never reallocated, so it must fit
+    /// the @p max_stack_height and reserve() must not be used.
+    /// Otherwise, based on @p max_stack_height decides if to use small pre-allocated storage or
+    /// allocate large storage.
     /// Sets the top item pointer to below the stack bottom.
-    explicit OperandStack(size_t max_stack_height)
+    explicit OperandStack(size_t max_stack_height, uint64_t* external_storage = nullptr)
     {
-        if (max_stack_height <= small_storage_size)
+        if (external_storage != nullptr)
+        {
+            m_bottom = external_storage;
+        }
+        else if (max_stack_height <= small_storage_size)
         {
             m_bottom = &m_small_storage[0];
         }
@@ -146,6 +155,35 @@ public:
         m_top = m_bottom + new_size - 1;
     }
 
+    /// Drops the given number of items from the top of the stack and returns the pointer to
+    /// the first of them. The items stay in the storage until overwritten by the next push.
+    ///
+    /// Requires num_items <= size().
+    uint64_t* drop(size_t num_items) noexcept
+    {
+        assert(num_items <= size());
+        m_top -= num_items;
+        return m_top + 1;
+    }
+
+    /// Reallocates the storage for the new maximum stack height, keeping the items.
+    ///
+    /// Requires new_max_stack_height >= size().
+    /// Used when the execution continues in a code with a different maximum stack height.
+    void reserve(size_t new_max_stack_height)
+    {
+        const auto height = size();
+        assert(new_max_stack_height >= height);
+        if (new_max_stack_height <= small_storage_size && m_large_storage == nullptr)
+            return;
+
+        auto storage = std::make_unique<uint64_t[]>(new_max_stack_height);
+        std::copy(m_bottom, m_top + 1, storage.get());
+        m_large_storage = std::move(storage);
+        m_bottom = &m_large_storage[0];
+        m_top = m_bottom + height - 1;
+    }
+
     /// Returns iterator to the bottom of the stack.
     [[nodiscard]] const uint64_t* rbegin() const noexcept { return m_bottom; }
 
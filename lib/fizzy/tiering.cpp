@@ -0,0 +1,127 @@
+// Fizzy: A fast WebAssembly interpreter
+// Copyright 2020 The Fizzy Authors.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "tiering.hpp"
+#include <cassert>
+
+namespace fizzy
+{
+TieringState::TieringState(const Module& module, const TieringOptions& options)
+  : m_module{module}, m_options{options}, m_functions(module.codesec.size())
+{}
+
+TieringState::~TieringState()
+{
+    {
+        const std::lock_guard lock{m_mutex};
+        m_stopping = true;
+    }
+    m_queue_changed.notify_all();
+    if (m_worker.joinable())
+        m_worker.join();
+}
+
+void TieringState::promote(size_t code_idx)
+{
+    auto& function = m_functions[code_idx];
+    assert(!function.promoted.load(relaxed));
+    function.promoted.store(true, relaxed);
+
+    if (!m_options.background)
+    {
+        compile(code_idx);
+        return;
+    }
+
+    {
+        const std::lock_guard lock{m_mutex};
+        m_queue.push_back(code_idx);
+
+        // The worker is started with the first promotion, so cold instances have no thread.
+        if (!m_worker.joinable())
+            m_worker = std::thread{&TieringState::run_worker, this};
+    }
+    m_queue_changed.notify_all();
+}
+
+void TieringState::compile(size_t code_idx)
+{
+    auto& function = m_functions[code_idx];
+    function.compiled = std::make_unique<CompiledFunction>(compile_function(m_module, code_idx));
+    function.optimized_code.store(function.compiled.get(), std::memory_order_release);
+}
+
+void TieringState::run_worker()
+{
+    std::unique_lock lock{m_mutex};
+    while (true)
+    {
+        m_queue_changed.wait(lock, [this] { return m_stopping || !m_queue.empty(); });
+        if (m_stopping)
+            return;
+
+        const auto code_idx = m_queue.front();
+        m_queue.pop_front();
+        ++m_num_in_progress;
+
+        lock.unlock();
+        compile(code_idx);
+        lock.lock();
+
+        --m_num_in_progress;
+        m_queue_changed.notify_all();
+    }
+}
+
+void TieringState::wait()
+{
+    std::unique_lock lock{m_mutex};
+    m_queue_changed.wait(lock, [this] { return m_queue.empty() && m_num_in_progress == 0; });
+}
+
+TieringStats TieringState::get_stats() const
+{
+    TieringStats stats;
+    stats.functions.reserve(m_functions.size());
+    for (const auto& function : m_functions)
+    {
+        FunctionTieringStats function_stats;
+        function_stats.call_count = function.call_count.load(relaxed);
+        function_stats.back_edge_count = function.back_edge_count.load(relaxed);
+        function_stats.osr_count = function.osr_count.load(relaxed);
+        function_stats.promoted = function.promoted.load(relaxed);
+        function_stats.tier = function.optimized_code.load(std::memory_order_acquire) != nullptr ?
+                                  Tier::optimized :
+                                  Tier::baseline;
+        stats.functions.emplace_back(function_stats);
+
+        if (function_stats.promoted)
+            ++stats.promoted_count;
+        if (function_stats.tier == Tier::optimized)
+            ++stats.optimized_count;
+    }
+    return stats;
+}
+
+void enable_tiering(Instance& instance, const TieringOptions& options)
+{
+    // Stop the compilation for the previous code layout before changing it.
+    instance.tiering.reset();
+
+    layout_code(instance.module, {false, {}});
+    instance.tiering = {new TieringState{instance.module, options},
+        [](TieringState* tiering) { delete tiering; }};
+}
+
+TieringStats get_tiering_stats(const Instance& instance)
+{
+    return instance.tiering != nullptr ? instance.tiering->get_stats() : TieringStats{};
+}
+
+void wait_for_promotions(Instance& instance)
+{
+    if (instance.tiering != nullptr)
+        instance.tiering->wait();
+}
+}  // namespace fizzy
@@ -0,0 +1,190 @@
+// Fizzy: A fast WebAssembly interpreter
+// Copyright 2020 The Fizzy Authors.
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include "code_layout.hpp"
+#include "execute.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace fizzy
+{
+/// The tier of the function's code.
+enum class Tier : uint8_t
+{
+    /// The unoptimized code from the module's code image.
+    baseline,
+
+    /// The code compiled with all optimizations.
+    optimized,
+};
+
+/// The options of the tiered execution.
+struct TieringOptions
+{
+    /// The number of calls of the function after which it is promoted to the optimized tier.
+    uint64_t call_threshold = 1000;
+
+    /// The number of loop back-edges taken in the function after which it is promoted to
+    /// the optimized tier.
+    uint64_t back_edge_threshold = 100000;
+
+    /// The number of loop back-edges taken by a running baseline code between the checks
+    /// if its execution can continue in the optimized code (the on-stack replacement).
+    uint64_t osr_check_interval = 1000;
+
+    /// Whether the optimized code is compiled by the background thread.
+    /// Otherwise it is compiled by the executing thread when the function is promoted.
+    bool background = true;
+};
+
+/// The tiering statistics of a function.
+struct FunctionTieringStats
+{
+    /// The number of calls of the function.
+    uint64_t call_count = 0;
+
+    /// The number of loop back-edges taken in the function.
+    uint64_t back_edge_count = 0;
+
+    /// The number of executions of the function switched to the optimized code in a loop.
+    uint64_t osr_count = 0;
+
+    /// Whether the function has been promoted. The compilation may still be in progress.
+    bool promoted = false;
+
+    /// The tier of the code executed by new calls of the function.
+    Tier tier = Tier::baseline;
+};
+
+/// The tiering statistics of an instance.
+struct TieringStats
+{
+    /// The statistics of each function of the module's code section.
+    std::vector<FunctionTieringStats> functions;
+
+    /// The number of functions promoted to the optimized tier.
+    size_t promoted_count = 0;
+
+    /// The number of functions which optimized code is already in use.
+    size_t optimized_count = 0;
+};
+
+/// The state of the tiered execution of an instance.
+///
+/// The counters are updated by the executing thread only, but may be read by get_tiering_stats()
+/// from any thread, so they are atomic with the relaxed order. The optimized code is compiled by
+/// the background thread and swapped in atomically, so the calls started after that use it.
+/// The calls in progress continue in the baseline code, unless they switch to the optimized code
+/// at a loop header (the on-stack replacement). The optimized code is kept until the tiering
+/// state is destroyed.
+class TieringState
+{
+    struct FunctionState
+    {
+        std::atomic<uint64_t> call_count{0};
+        std::atomic<uint64_t> back_edge_count{0};
+        std::atomic<uint64_t> osr_count{0};
+        std::atomic<bool> promoted{false};
+
+        /// The optimized code, owned by the compiling thread until published in optimized_code.
+        std::unique_ptr<CompiledFunction> compiled;
+        std::atomic<const CompiledFunction*> optimized_code{nullptr};
+    };
+
+    const Module& m_module;
+    const TieringOptions m_options;
+    std::vector<FunctionState> m_functions;
+
+    std::thread m_worker;
+    std::mutex m_mutex;
+    std::condition_variable m_queue_changed;
+    std::deque<size_t> m_queue;
+    size_t m_num_in_progress = 0;
+    bool m_stopping = false;
+
+    static constexpr auto relaxed = std::memory_order_relaxed;
+
+    /// Increments the counter written by the executing thread only. This is cheaper than
+    /// the atomic read-modify-write and the readers still never see a torn value.
+    static uint64_t increment(std::atomic<uint64_t>& counter, uint64_t value) noexcept
+    {
+        const auto new_value = counter.load(relaxed) + value;
+        counter.store(new_value, relaxed);
+        return new_value;
+    }
+
+    void promote(size_t code_idx);
+    void compile(size_t code_idx);
+    void run_worker();
+
+public:
+    TieringState(const Module& module, const TieringOptions& options);
+    ~TieringState();
+
+    TieringState(const TieringState&) = delete;
+    TieringState& operator=(const TieringState&) = delete;
+
+    /// Registers the call of the function.
+    /// Returns the optimized code of the function or null if the baseline code is to be used.
+    const CompiledFunction* enter(size_t code_idx)
+    {
+        auto& function = m_functions[code_idx];
+        const auto call_count = increment(function.call_count, 1);
+        if (call_count >= m_options.call_threshold && !function.promoted.load(relaxed))
+            promote(code_idx);
+        return function.optimized_code.load(std::memory_order_acquire);
+    }
+
+    /// Registers the loop back-edges taken during the execution of the function.
+    void add_back_edges(size_t code_idx, uint64_t count)
+    {
+        auto& function = m_functions[code_idx];
+        const auto back_edge_count = increment(function.back_edge_count, count);
+        if (back_edge_count >= m_options.back_edge_threshold && !function.promoted.load(relaxed))
+            promote(code_idx);
+    }
+
+    /// Returns the number of loop back-edges between the on-stack replacement checks.
+    uint64_t get_osr_check_interval() const noexcept { return m_options.osr_check_interval; }
+
+    /// Registers the loop back-edges taken so far by the running baseline code of the function.
+    /// Returns the optimized code of the function to continue the execution with, or null.
+    const CompiledFunction* check_osr(size_t code_idx, uint64_t back_edge_count)
+    {
+        add_back_edges(code_idx, back_edge_count);
+        return m_functions[code_idx].optimized_code.load(std::memory_order_acquire);
+    }
+
+    /// Registers the switch of the running function to the optimized code.
+    void add_osr(size_t code_idx) noexcept { increment(m_functions[code_idx].osr_count, 1); }
+
+    /// Waits until the compilation of all promoted functions completes.
+    void wait();
+
+    TieringStats get_stats() const;
+};
+
+/// Enables the tiered execution of the instance.
+///
+/// The instance's code is laid out without optimizations, which is fast to compile,
+/// and the functions are promoted to the optimized tier individually when they become hot.
+/// The specialization of the instance's code, see specialize(), is discarded, as neither tier
+/// is specialized. Must not be called during the execution of the instance.
+void enable_tiering(Instance& instance, const TieringOptions& options = {});
+
+/// Returns the tiering statistics of the instance.
+/// Returns empty statistics if the tiering is not enabled.
+TieringStats get_tiering_stats(const Instance& instance);
+
+/// Waits until the background compilation of all promoted functions of the instance completes.
+void wait_for_promotions(Instance& instance);
+}  // namespace fizzy
@@ -0,0 +1,451 @@
+// Fizzy: A fast WebAssembly interpreter
+// Copyright 2020 The Fizzy Authors.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "transactions.hpp"
+#include "atomics.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <exception>
+#include <limits>
+#include <optional>
+
+namespace fizzy
+{
+namespace
+{
+thread_local HostStateView* current_host_state_view = nullptr;
+
+/// Makes the host state view current for the calling thread for the lifetime of the guard.
+class HostStateGuard
+{
+    HostStateView* const m_previous;
+
+public:
+    explicit HostStateGuard(HostStateView& host_state) noexcept
+      : m_previous{current_host_state_view}
+    {
+        current_host_state_view = &host_state;
+    }
+
+    ~HostStateGuard() noexcept { current_host_state_view = m_previous; }
+
+    HostStateGuard(const HostStateGuard&) = delete;
+    HostStateGuard& operator=(const HostStateGuard&) = delete;
+};
+
+/// The version of the snapshot's page changed by the execution on the snapshot.
+constexpr auto ChangedVersion = std::numeric_limits<uint64_t>::max();
+
+size_t get_page_count(const bytes& memory) noexcept
+{
+    return memory.size() / AccessSet::PageSize;
+}
+
+uint64_t& global_value(Instance& instance, size_t idx) noexcept
+{
+    if (idx < instance.imported_globals.size())
+        return *instance.imported_globals[idx].value;
+    return instance.globals[idx - instance.imported_globals.size()];
+}
+
+/// Checks if any of the accessed items was changed after the version.
+bool is_changed(const std::vector<bool>& accessed, const std::vector<uint64_t>& versions,
+    uint64_t version) noexcept
+{
+    const auto size = std::min(accessed.size(), versions.size());
+    for (size_t i = 0; i < size; ++i)
+    {
+        if (accessed[i] && versions[i] > version)
+            return true;
+    }
+    return false;
+}
+}  // namespace
+
+uint64_t HostStateView::load(uint64_t key)
+{
+    m_reads.insert(key);
+    if (const auto it = m_writes.find(key); it != m_writes.end())
+        return it->second;
+    const auto it = m_committed.find(key);
+    return it != m_committed.end() ? it->second : 0;
+}
+
+void HostStateView::store(uint64_t key, uint64_t value)
+{
+    m_writes[key] = value;
+}
+
+HostStateView* current_host_state() noexcept
+{
+    return current_host_state_view;
+}
+
+/// The worker's copy of the instance's memory and globals.
+struct TransactionScheduler::Snapshot
+{
+    /// The storage of the imported globals of the instance.
+    std::vector<uint64_t> imported_globals;
+
+    std::unique_ptr<Instance> instance;
+
+    /// The versions of the memory pages copied to the snapshot, ChangedVersion for the pages
+    /// changed since.
+    std::vector<uint64_t> page_versions;
+};
+
+/// The speculative execution of the transaction and the state it changed.
+struct TransactionScheduler::Execution
+{
+    /// The version of the state the execution started from.
+    uint64_t version = 0;
+
+    execution_result result{false, {}};
+
+    /// The exception thrown by the execution, if any.
+    std::exception_ptr exception;
+
+    AccessSet accesses;
+
+    /// The contents of the written pages, in the order of the pages.
+    bytes written_memory;
+
+    size_t memory_size = 0;
+
+    /// The values of all globals, the imported ones first.
+    std::vector<uint64_t> globals;
+
+    std::unordered_set<uint64_t> host_reads;
+    HostState host_writes;
+
+    std::chrono::nanoseconds duration{0};
+};
+
+TransactionScheduler::TransactionScheduler(
+    Instance& instance, HostState& host_state, size_t num_threads)
+  : m_instance{instance},
+    m_host_state{host_state},
+    m_num_threads{std::max(num_threads, size_t{1})},
+    m_code{compile_lane_code(instance.module)}
+{
+    // The functions which may execute call_indirect or the atomic instructions, directly or
+    // through the calls, are executed directly.
+    const auto num_imported_functions = instance.module.imported_function_types.size();
+    m_speculative.assign(m_code.functions.size(), true);
+    for (bool changed = true; changed;)
+    {
+        changed = false;
+        for (size_t code_idx = 0; code_idx < m_code.functions.size(); ++code_idx)
+        {
+            if (!m_speculative[code_idx])
+                continue;
+            for (const auto& instr : m_code.functions[code_idx].instructions)
+            {
+                if (instr.instr == Instr::call_indirect || is_atomic(instr.instr) ||
+                    (instr.instr == Instr::call && instr.imm >= num_imported_functions &&
+                        !m_speculative[instr.imm - num_imported_functions]))
+                {
+                    m_speculative[code_idx] = false;
+                    changed = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    if (instance.memory != nullptr)
+        m_page_versions.assign(get_page_count(*instance.memory), 0);
+    m_global_versions.assign(instance.imported_globals.size() + instance.globals.size(), 0);
+}
+
+TransactionScheduler::~TransactionScheduler() = default;
+
+bool TransactionScheduler::is_speculative(FuncIdx func_idx) const noexcept
+{
+    const auto num_imported_functions = m_instance.module.imported_function_types.size();
+    return func_idx >= num_imported_functions && m_speculative[func_idx - num_imported_functions];
+}
+
+TransactionScheduler::Snapshot& TransactionScheduler::get_snapshot(size_t worker_idx)
+{
+    while (m_snapshots.size() <= worker_idx)
+    {
+        auto snapshot = std::make_unique<Snapshot>();
+
+        // The snapshot's imported globals point to its own storage, so its changes are private.
+        snapshot->imported_globals.resize(m_instance.imported_globals.size());
+        std::vector<ExternalGlobal> imported_globals;
+        for (size_t i = 0; i < m_instance.imported_globals.size(); ++i)
+        {
+            imported_globals.push_back(
+                {&snapshot->imported_globals[i], m_instance.imported_globals[i].is_mutable});
+        }
+
+        bytes_ptr memory{nullptr, [](bytes*) noexcept {}};
+        if (m_instance.memory != nullptr)
+            memory = bytes_ptr{new bytes{}, [](bytes* b) noexcept { delete b; }};
+
+        snapshot->instance = std::make_unique<Instance>(m_instance.module, std::move(memory),
+            m_instance.memory_limits, table_ptr{nullptr, [](table_elements*) noexcept {}},
+            m_instance.table_limits, m_instance.globals, m_instance.imported_functions,
+            std::move(imported_globals));
+        m_snapshots.emplace_back(std::move(snapshot));
+    }
+    return *m_snapshots[worker_idx];
+}
+
+void TransactionScheduler::synchronize(Snapshot& snapshot)
+{
+    if (m_instance.memory != nullptr)
+    {
+        const auto& committed = *m_instance.memory;
+        auto& memory = *snapshot.instance->memory;
+        memory.resize(committed.size());
+        snapshot.page_versions.resize(m_page_versions.size(), ChangedVersion);
+        for (size_t page = 0; page < m_page_versions.size(); ++page)
+        {
+            if (snapshot.page_versions[page] != m_page_versions[page])
+            {
+                const auto offset = page * AccessSet::PageSize;
+                std::memcpy(&memory[offset], &committed[offset], AccessSet::PageSize);
+                snapshot.page_versions[page] = m_page_versions[page];
+            }
+        }
+    }
+
+    for (size_t i = 0; i < m_instance.imported_globals.size(); ++i)
+        snapshot.imported_globals[i] = *m_instance.imported_globals[i].value;
+    snapshot.instance->globals = m_instance.globals;
+}
+
+TransactionScheduler::Execution TransactionScheduler::execute_speculatively(
+    Snapshot& snapshot, const Transaction& transaction)
+{
+    synchronize(snapshot);
+
+    Execution execution;
+    execution.version = m_version;
+
+    HostStateView host_state{m_host_state};
+    const auto start_time = std::chrono::steady_clock::now();
+    try
+    {
+        const HostStateGuard guard{host_state};
+        execution.result = std::move(execute_lanes(m_code, {snapshot.instance.get()},
+            transaction.func_idx, transaction.args.data(), &execution.accesses)[0]);
+    }
+    catch (...)
+    {
+        execution.exception = std::current_exception();
+    }
+    execution.duration = std::chrono::steady_clock::now() - start_time;
+
+    if (const auto* const memory = snapshot.instance->memory.get(); memory != nullptr)
+    {
+        execution.memory_size = memory->size();
+        const auto& written_pages = execution.accesses.written_pages;
+        for (size_t page = 0; page < written_pages.size(); ++page)
+        {
+            if (!written_pages[page])
+                continue;
+            const auto* const page_data = memory->data() + page * AccessSet::PageSize;
+            execution.written_memory.append(page_data, AccessSet::PageSize);
+            if (page < snapshot.page_versions.size())
+                snapshot.page_versions[page] = ChangedVersion;
+        }
+    }
+
+    for (size_t i = 0; i < m_global_versions.size(); ++i)
+        execution.globals.emplace_back(global_value(*snapshot.instance, i));
+
+    execution.host_reads = host_state.reads();
+    execution.host_writes = host_state.writes();
+    return execution;
+}
+
+bool TransactionScheduler::is_valid(const Execution& execution) const
+{
+    const auto version = execution.version;
+    const auto& accesses = execution.accesses;
+
+    if (m_direct_version > version)
+        return false;
+
+    if ((accesses.memory_size_read || accesses.memory_size_written) &&
+        m_memory_size_version > version)
+        return false;
+
+    // The written pages are committed as a whole, so the other writes to them conflict too.
+    if (is_changed(accesses.read_pages, m_page_versions, version) ||
+        is_changed(accesses.written_pages, m_page_versions, version) ||
+        is_changed(accesses.read_globals, m_global_versions, version) ||
+        is_changed(accesses.written_globals, m_global_versions, version))
+        return false;
+
+    const auto is_key_changed = [this, version](uint64_t key) {
+        const auto it = m_host_versions.find(key);
+        return it != m_host_versions.end() && it->second > version;
+    };
+    for (const auto key : execution.host_reads)
+    {
+        if (is_key_changed(key))
+            return false;
+    }
+    for (const auto& [key, value] : execution.host_writes)
+    {
+        if (is_key_changed(key))
+            return false;
+    }
+    return true;
+}
+
+void TransactionScheduler::commit(const Execution& execution)
+{
+    ++m_version;
+    const auto& accesses = execution.accesses;
+
+    if (m_instance.memory != nullptr)
+    {
+        auto& memory = *m_instance.memory;
+        if (accesses.memory_size_written && execution.memory_size != memory.size())
+        {
+            memory.resize(execution.memory_size);
+            m_page_versions.resize(get_page_count(memory), m_version);
+            m_memory_size_version = m_version;
+        }
+
+        const auto* written_page_data = execution.written_memory.data();
+        for (size_t page = 0; page < accesses.written_pages.size(); ++page)
+        {
+            if (!accesses.written_pages[page])
+                continue;
+            std::memcpy(&memory[page * AccessSet::PageSize], written_page_data,
+                AccessSet::PageSize);
+            written_page_data += AccessSet::PageSize;
+            m_page_versions[page] = m_version;
+        }
+    }
+
+    for (size_t idx = 0; idx < accesses.written_globals.size(); ++idx)
+    {
+        if (!accesses.written_globals[idx])
+            continue;
+        global_value(m_instance, idx) = execution.globals[idx];
+        m_global_versions[idx] = m_version;
+    }
+
+    for (const auto& [key, value] : execution.host_writes)
+    {
+        m_host_state[key] = value;
+        m_host_versions[key] = m_version;
+    }
+}
+
+execution_result TransactionScheduler::execute_directly(const Transaction& transaction)
+{
+    HostStateView host_state{m_host_state};
+    execution_result result{false, {}};
+    {
+        const HostStateGuard guard{host_state};
+        result = execute(m_instance, transaction.func_idx, transaction.args);
+    }
+
+    // The execution may have changed any part of the state.
+    m_direct_version = ++m_version;
+    m_memory_size_version = m_version;
+    if (m_instance.memory != nullptr)
+        m_page_versions.assign(get_page_count(*m_instance.memory), m_version);
+    std::fill(m_global_versions.begin(), m_global_versions.end(), m_version);
+    for (const auto& [key, value] : host_state.writes())
+        m_host_state[key] = value;
+    return result;
+}
+
+BlockResult TransactionScheduler::execute_block(const std::vector<Transaction>& transactions)
+{
+    const auto start_time = std::chrono::steady_clock::now();
+    const auto num_transactions = transactions.size();
+
+    BlockResult block;
+    block.results.resize(num_transactions);
+    std::vector<std::optional<Execution>> executions(num_transactions);
+
+    // The index of the first transaction not committed.
+    size_t next = 0;
+    while (next < num_transactions)
+    {
+        ++block.num_rounds;
+
+        // Execute the transactions not executed yet and again the ones with the invalid
+        // execution. The latter are limited to the number of threads, because when they
+        // conflict with each other, only the first would be committed.
+        std::vector<size_t> scheduled;
+        size_t num_invalid = 0;
+        for (size_t i = next; i < num_transactions; ++i)
+        {
+            if (!is_speculative(transactions[i].func_idx))
+                continue;
+            if (!executions[i].has_value())
+                scheduled.emplace_back(i);
+            else if (num_invalid < m_num_threads && !is_valid(*executions[i]))
+            {
+                scheduled.emplace_back(i);
+                ++num_invalid;
+            }
+        }
+
+        const auto num_workers = std::min(m_num_threads, scheduled.size());
+        for (size_t worker_idx = 0; worker_idx < num_workers; ++worker_idx)
+            get_snapshot(worker_idx);
+
+        std::atomic<size_t> next_scheduled{0};
+        const auto run_worker = [&](size_t worker_idx) {
+            auto& snapshot = *m_snapshots[worker_idx];
+            for (auto i = next_scheduled++; i < scheduled.size(); i = next_scheduled++)
+            {
+                const auto transaction_idx = scheduled[i];
+                executions[transaction_idx] =
+                    execute_speculatively(snapshot, transactions[transaction_idx]);
+            }
+        };
+        std::vector<std::thread> workers;
+        for (size_t worker_idx = 1; worker_idx < num_workers; ++worker_idx)
+            workers.emplace_back(run_worker, worker_idx);
+        if (num_workers != 0)
+            run_worker(0);
+        for (auto& worker : workers)
+            worker.join();
+        block.num_executions += scheduled.size();
+
+        // Commit in the order of the block until the first conflict.
+        for (; next < num_transactions; ++next)
+        {
+            const auto& transaction = transactions[next];
+            if (!is_speculative(transaction.func_idx))
+            {
+                const auto direct_start_time = std::chrono::steady_clock::now();
+                block.results[next] = execute_directly(transaction);
+                block.serial_time += std::chrono::steady_clock::now() - direct_start_time;
+                ++block.num_executions;
+                continue;
+            }
+
+            auto& execution = executions[next];
+            if (!is_valid(*execution))
+                break;
+            if (execution->exception)
+                std::rethrow_exception(execution->exception);
+
+            commit(*execution);
+            block.results[next] = std::move(execution->result);
+            block.serial_time += execution->duration;
+            execution.reset();
+        }
+    }
+
+    block.wall_time = std::chrono::steady_clock::now() - start_time;
+    return block;
+}
+}  // namespace fizzy
@@ -0,0 +1,158 @@
+// Fizzy: A fast WebAssembly interpreter
+// Copyright 2020 The Fizzy Authors.
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include "execute.hpp"
+#include "lanes.hpp"
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace fizzy
+{
+/// The key-value state of the host, e.g. the storage of the contracts.
+using HostState = std::unordered_map<uint64_t, uint64_t>;
+
+/// The view of the host state by the transaction: the committed state with the transaction's
+/// writes applied. The reads and the writes are recorded for the conflict detection.
+class HostStateView
+{
+    const HostState& m_committed;
+    HostState m_writes;
+    std::unordered_set<uint64_t> m_reads;
+
+public:
+    explicit HostStateView(const HostState& committed) noexcept : m_committed{committed} {}
+
+    /// Returns the value of the key, 0 if it is not present.
+    uint64_t load(uint64_t key);
+
+    void store(uint64_t key, uint64_t value);
+
+    const std::unordered_set<uint64_t>& reads() const noexcept { return m_reads; }
+
+    const HostState& writes() const noexcept { return m_writes; }
+};
+
+/// Returns the host state view of the transaction executed by the calling thread, null if
+/// the thread does not execute any. The imported functions access the host state with it.
+HostStateView* current_host_state() noexcept;
+
+/// The call of the instance's function in the block of transactions.
+struct Transaction
+{
+    FuncIdx func_idx = 0;
+    std::vector<uint64_t> args;
+};
+
+/// The outcome of the block of transactions.
+struct BlockResult
+{
+    /// The result of each transaction, in the order of the block.
+    std::vector<execution_result> results;
+
+    /// The number of the rounds of parallel execution followed by commits.
+    size_t num_rounds = 0;
+
+    /// The number of executions, greater than the number of transactions when some conflicted
+    /// and were executed again.
+    size_t num_executions = 0;
+
+    /// The total execution time of the committed executions, i.e. of the serial execution.
+    std::chrono::nanoseconds serial_time{0};
+
+    /// The time of the whole block execution.
+    std::chrono::nanoseconds wall_time{0};
+
+    /// The achieved speedup over the serial execution.
+    double speedup() const noexcept
+    {
+        return wall_time.count() != 0 ?
+                   static_cast<double>(serial_time.count()) /
+                       static_cast<double>(wall_time.count()) :
+                   1.0;
+    }
+};
+
+/// The scheduler executing the blocks of transactions on the instance speculatively
+/// in parallel (experimental).
+///
+/// Each round executes the transactions in parallel, each on the worker's snapshot of
+/// the instance's memory and globals and of the host state. The snapshot is updated before each
+/// execution by copying only the pages changed since it was taken. The memory pages, globals and
+/// host state keys read and written by each execution are recorded. Then the executions are
+/// committed in the order of the block, as long as none of the state they accessed was
+/// changed by the commits after their snapshot was taken. The first conflicting transaction
+/// stops the commits and the next round executes again only the conflicting transactions (at most
+/// as many as the threads), so the results are the same as of the serial execution in the order
+/// of the block.
+///
+/// The transactions which may execute call_indirect, directly or through the calls, are executed
+/// directly on the instance at their turn, because the accesses of the functions called in this
+/// way are not recorded. The transactions which may execute the atomic instructions are executed
+/// directly too, as these may wait for or notify the other threads. So are the transactions
+/// executing the imported function itself.
+///
+/// The imported functions called by the other transactions are executed speculatively, so these
+/// may be called concurrently and more than once for the same transaction when it is executed
+/// again after the conflict. They must access only the host state through current_host_state(),
+/// not the instance's memory and globals, and have no other side effects.
+class TransactionScheduler
+{
+    struct Snapshot;
+    struct Execution;
+
+    Instance& m_instance;
+    HostState& m_host_state;
+    const size_t m_num_threads;
+
+    /// The lane code of the instance's module, executed with the access recording.
+    const LaneCode m_code;
+
+    /// Whether the function of the code section may be executed speculatively.
+    std::vector<bool> m_speculative;
+
+    std::vector<std::unique_ptr<Snapshot>> m_snapshots;
+
+    /// The number of the commits. The versions below are the values of it after the last commit
+    /// changing the given part of the state.
+    uint64_t m_version = 0;
+    std::vector<uint64_t> m_page_versions;
+    std::vector<uint64_t> m_global_versions;
+    std::unordered_map<uint64_t, uint64_t> m_host_versions;
+    uint64_t m_memory_size_version = 0;
+
+    /// The version of the last direct execution, which may have changed any part of the state.
+    uint64_t m_direct_version = 0;
+
+    bool is_speculative(FuncIdx func_idx) const noexcept;
+    Snapshot& get_snapshot(size_t worker_idx);
+    void synchronize(Snapshot& snapshot);
+    Execution execute_speculatively(Snapshot& snapshot, const Transaction& transaction);
+    bool is_valid(const Execution& execution) const;
+    void commit(const Execution& execution);
+    execution_result execute_directly(const Transaction& transaction);
+
+public:
+    /// Creates the scheduler of the transactions on the @p instance using the @p host_state,
+    /// executing them with @p num_threads threads (at least one).
+    explicit TransactionScheduler(Instance& instance, HostState& host_state,
+        size_t num_threads = std::thread::hardware_concurrency());
+
+    ~TransactionScheduler();
+
+    TransactionScheduler(const TransactionScheduler&) = delete;
+    TransactionScheduler& operator=(const TransactionScheduler&) = delete;
+
+    /// Executes the block of transactions, as if they were executed one after another.
+    /// The exception thrown by the imported function is propagated at the transaction's turn
+    /// to commit, the transactions before it remain committed.
+    BlockResult execute_block(const std::vector<Transaction>& transactions);
+};
+}  // namespace fizzy
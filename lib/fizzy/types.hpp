@@ -5,6 +5,7 @@
 #pragma once
 
 #include "bytes.hpp"
+#include "memory_resource.hpp"
 #include <cstdint>
 #include <optional>
 #include <string>
@@ -47,6 +48,12 @@ struct Limits
 {
     uint32_t min = 0;
     std::optional<uint32_t> max;
+
+    /// Whether the memory is shared between the threads, as of the threads proposal.
+    /// The shared memory has the maximum and is never grown, so it is not reallocated while
+    /// the other threads access it.
+    /// https://github.com/WebAssembly/threads/blob/main/proposals/threads/Overview.md
+    bool shared = false;
 };
 
 // https://webassembly.github.io/spec/core/binary/modules.html#binary-typeidx
@@ -265,6 +272,137 @@ enum class Instr : uint8_t
     f32_reinterpret_i32 = 0xbe,
     f64_reinterpret_i64 = 0xbf,
 
+    // The internal instructions, never present in the module binary.
+
+    // The memory instructions proven to access the memory in bounds,
+    // see eliminate_bounds_checks().
+    i32_load_unchecked = 0xe0,
+    i64_load_unchecked = 0xe1,
+    i32_load8_s_unchecked = 0xe2,
+    i32_load8_u_unchecked = 0xe3,
+    i32_load16_s_unchecked = 0xe4,
+    i32_load16_u_unchecked = 0xe5,
+    i64_load8_s_unchecked = 0xe6,
+    i64_load8_u_unchecked = 0xe7,
+    i64_load16_s_unchecked = 0xe8,
+    i64_load16_u_unchecked = 0xe9,
+    i64_load32_s_unchecked = 0xea,
+    i64_load32_u_unchecked = 0xeb,
+    i32_store_unchecked = 0xec,
+    i64_store_unchecked = 0xed,
+    i32_store8_unchecked = 0xee,
+    i32_store16_unchecked = 0xef,
+    i64_store8_unchecked = 0xf0,
+    i64_store16_unchecked = 0xf1,
+    i64_store32_unchecked = 0xf2,
+
+    // The loop filling or copying the memory, see recognize_memory_loops().
+    memory_loop = 0xf3,
+
+    // The fused multi-precision arithmetic, see fuse_carry_chains().
+    i64_add_carry = 0xf4,
+    i128_mul_store = 0xf5,
+
+    // The access to the global by the direct pointer to its storage,
+    // see LayoutOptions::specialization.
+    global_get_direct = 0xf6,
+    global_set_direct = 0xf7,
+
+    // The instructions of the threads proposal, prefixed by atomic_prefix in the binary. These are
+    // grouped by the stack effect, and the immediate AtomicOp selects the operation.
+    // The memory.atomic.notify is the atomic_rmw and the memory.atomic.wait is the atomic_cmpxchg.
+    atomic_load = 0xf8,
+    atomic_store = 0xf9,
+    atomic_rmw = 0xfa,
+    atomic_cmpxchg = 0xfb,
+    atomic_fence = 0xfc,
+
+    // The prefix of the atomic instructions in the binary, never present in the parsed code.
+    atomic_prefix = 0xfe,
+};
+
+/// The atomic operations of the threads proposal, encoded after Instr::atomic_prefix.
+/// The operations from i32_atomic_load are in the groups of 7 of the same kind, ordered by
+/// the access size: 4, 8, 1, 2, 1, 2, 4 bytes.
+/// https://github.com/WebAssembly/threads/blob/main/proposals/threads/Overview.md
+enum class AtomicOp : uint8_t
+{
+    memory_atomic_notify = 0x00,
+    memory_atomic_wait32 = 0x01,
+    memory_atomic_wait64 = 0x02,
+    atomic_fence = 0x03,
+
+    i32_atomic_load = 0x10,
+    i64_atomic_load = 0x11,
+    i32_atomic_load8_u = 0x12,
+    i32_atomic_load16_u = 0x13,
+    i64_atomic_load8_u = 0x14,
+    i64_atomic_load16_u = 0x15,
+    i64_atomic_load32_u = 0x16,
+
+    i32_atomic_store = 0x17,
+    i64_atomic_store = 0x18,
+    i32_atomic_store8 = 0x19,
+    i32_atomic_store16 = 0x1a,
+    i64_atomic_store8 = 0x1b,
+    i64_atomic_store16 = 0x1c,
+    i64_atomic_store32 = 0x1d,
+
+    i32_atomic_rmw_add = 0x1e,
+    i64_atomic_rmw_add = 0x1f,
+    i32_atomic_rmw8_add_u = 0x20,
+    i32_atomic_rmw16_add_u = 0x21,
+    i64_atomic_rmw8_add_u = 0x22,
+    i64_atomic_rmw16_add_u = 0x23,
+    i64_atomic_rmw32_add_u = 0x24,
+
+    i32_atomic_rmw_sub = 0x25,
+    i64_atomic_rmw_sub = 0x26,
+    i32_atomic_rmw8_sub_u = 0x27,
+    i32_atomic_rmw16_sub_u = 0x28,
+    i64_atomic_rmw8_sub_u = 0x29,
+    i64_atomic_rmw16_sub_u = 0x2a,
+    i64_atomic_rmw32_sub_u = 0x2b,
+
+    i32_atomic_rmw_and = 0x2c,
+    i64_atomic_rmw_and = 0x2d,
+    i32_atomic_rmw8_and_u = 0x2e,
+    i32_atomic_rmw16_and_u = 0x2f,
+    i64_atomic_rmw8_and_u = 0x30,
+    i64_atomic_rmw16_and_u = 0x31,
+    i64_atomic_rmw32_and_u = 0x32,
+
+    i32_atomic_rmw_or = 0x33,
+    i64_atomic_rmw_or = 0x34,
+    i32_atomic_rmw8_or_u = 0x35,
+    i32_atomic_rmw16_or_u = 0x36,
+    i64_atomic_rmw8_or_u = 0x37,
+    i64_atomic_rmw16_or_u = 0x38,
+    i64_atomic_rmw32_or_u = 0x39,
+
+    i32_atomic_rmw_xor = 0x3a,
+    i64_atomic_rmw_xor = 0x3b,
+    i32_atomic_rmw8_xor_u = 0x3c,
+    i32_atomic_rmw16_xor_u = 0x3d,
+    i64_atomic_rmw8_xor_u = 0x3e,
+    i64_atomic_rmw16_xor_u = 0x3f,
+    i64_atomic_rmw32_xor_u = 0x40,
+
+    i32_atomic_rmw_xchg = 0x41,
+    i64_atomic_rmw_xchg = 0x42,
+    i32_atomic_rmw8_xchg_u = 0x43,
+    i32_atomic_rmw16_xchg_u = 0x44,
+    i64_atomic_rmw8_xchg_u = 0x45,
+    i64_atomic_rmw16_xchg_u = 0x46,
+    i64_atomic_rmw32_xchg_u = 0x47,
+
+    i32_atomic_rmw_cmpxchg = 0x48,
+    i64_atomic_rmw_cmpxchg = 0x49,
+    i32_atomic_rmw8_cmpxchg_u = 0x4a,
+    i32_atomic_rmw16_cmpxchg_u = 0x4b,
+    i64_atomic_rmw8_cmpxchg_u = 0x4c,
+    i64_atomic_rmw16_cmpxchg_u = 0x4d,
+    i64_atomic_rmw32_cmpxchg_u = 0x4e,
 };
 
 // https://webassembly.github.io/spec/core/binary/modules.html#table-section
@@ -300,6 +438,7 @@ struct Global
 {
     bool is_mutable = false;
     ConstantExpression expression;
+    ValType type = ValType::i32;
 };
 
 enum class ExternalKind : uint8_t
@@ -341,6 +480,18 @@ struct Element
     std::vector<FuncIdx> init;
 };
 
+/// The worst-case stack usage of the execution of a function, including all functions it calls.
+struct FrameBound
+{
+    /// The total number of words of the locals (including arguments) and the operand stacks
+    /// of the frames on the deepest path of calls.
+    size_t frame_size = 0;
+
+    /// The maximum number of calls nested in the execution, 0 if the function calls nothing.
+    /// The calls replaced by the inliner are not counted, see inline_calls().
+    int call_depth = 0;
+};
+
 /// The element of the code section.
 /// https://webassembly.github.io/spec/core/binary/modules.html#code-section
 struct Code
@@ -351,11 +502,25 @@ struct Code
 
     // The instructions bytecode without immediate values.
     // https://webassembly.github.io/spec/core/binary/instructions.html
-    std::vector<Instr> instructions;
+    // Allocated from the module's arena.
+    pmr::vector<Instr> instructions;
 
     // The decoded instructions' immediate values.
     // These are instruction-type dependent fixed size value in the order of instructions.
-    bytes immediates;
+    // Allocated from the module's arena.
+    pmr::basic_string<uint8_t> immediates;
+
+    // The offset of the executable code in the module's code image (in words).
+    size_t image_offset = 0;
+
+    // The number of locals and the maximum stack height of the executable code.
+    // These exceed the values above when other functions are inlined into the code.
+    uint32_t image_local_count = 0;
+    int image_max_stack_height = 0;
+
+    // The worst-case stack usage of the executable code, computed from the call graph.
+    // Empty when unbounded, i.e. the function can reach a recursive or an indirect call.
+    std::optional<FrameBound> image_frame_bound = std::nullopt;
 };
 
 /// The reference to the `code` in the wasm binary.
@@ -0,0 +1,81 @@
+// Fizzy: A fast WebAssembly interpreter
+// Copyright 2020 The Fizzy Authors.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "execute.hpp"
+#include "limits.hpp"
+#include "parser.hpp"
+#include <benchmark/benchmark.h>
+#include <test/utils/hex.hpp>
+#include <cstring>
+#include <thread>
+
+namespace
+{
+/* wat2wasm --enable-threads
+(memory (import "env" "memory") 64 64 shared)
+(func $sum (param $begin i32) (param $end i32) (local $acc i64)
+  (block $done
+    (loop $l
+      (br_if $done (i32.ge_u (local.get $begin) (local.get $end)))
+      (local.set $acc (i64.add (local.get $acc) (i64.load32_u offset=8 (local.get $begin))))
+      (local.set $begin (i32.add (local.get $begin) (i32.const 4)))
+      (br $l)))
+  (drop (i64.atomic.rmw.add (i32.const 0) (local.get $acc))))
+*/
+const auto reduction_wasm = fizzy::from_hex(
+    "0061736d0100000001060160027f7f0002100103656e76066d656d6f727902034040030201000a2f012d01017e02"
+    "400340200020014f0d01200220003502087c2102200041046a21000c000b0b41002002fe1f03001a0b");
+
+constexpr uint32_t reduction_num_pages = 64;
+
+/// Sums the 32-bit values filling the shared memory of 4 MiB with state.range(0) host threads,
+/// each executing the instance importing the memory on its part of the values. The partial sums
+/// are added to the result at the address 0 by i64.atomic.rmw.add.
+void atomics_parallel_reduction(benchmark::State& state)
+{
+    constexpr uint32_t data_size = reduction_num_pages * fizzy::PageSize - 8;
+    constexpr uint32_t num_values = data_size / 4;
+
+    const auto num_threads = static_cast<uint32_t>(state.range(0));
+
+    fizzy::bytes memory(reduction_num_pages * fizzy::PageSize, 0);
+    for (uint32_t i = 0; i < num_values; ++i)
+        std::memcpy(&memory[8 + i * 4], &i, sizeof(i));
+    const uint64_t expected_sum = uint64_t{num_values} * (num_values - 1) / 2;
+
+    std::vector<std::unique_ptr<fizzy::Instance>> instances;
+    for (uint32_t t = 0; t < num_threads; ++t)
+    {
+        instances.emplace_back(fizzy::instantiate(fizzy::parse(reduction_wasm), {}, {},
+            {{&memory, {reduction_num_pages, reduction_num_pages, true}}}));
+    }
+
+    for ([[maybe_unused]] auto _ : state)
+    {
+        std::memset(memory.data(), 0, sizeof(uint64_t));
+
+        std::vector<std::thread> threads;
+        for (uint32_t t = 0; t < num_threads; ++t)
+        {
+            const uint64_t begin = uint64_t{num_values} * t / num_threads * 4;
+            const uint64_t end = uint64_t{num_values} * (t + 1) / num_threads * 4;
+            threads.emplace_back([&instance = *instances[t], begin, end] {
+                fizzy::execute(instance, 0, {begin, end});
+            });
+        }
+        for (auto& thread : threads)
+            thread.join();
+
+        uint64_t sum;
+        std::memcpy(&sum, memory.data(), sizeof(sum));
+        if (sum != expected_sum)
+        {
+            state.SkipWithError("incorrect sum");
+            return;
+        }
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * int64_t{data_size});
+}
+BENCHMARK(atomics_parallel_reduction)->Arg(1)->Arg(2)->Arg(4)->Arg(8)->UseRealTime();
+}  // namespace
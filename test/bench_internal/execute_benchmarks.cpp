@@ -0,0 +1,67 @@
+// Fizzy: A fast WebAssembly interpreter
+// Copyright 2020 The Fizzy Authors.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "execute.hpp"
+#include "parser.hpp"
+#include <benchmark/benchmark.h>
+#include <test/utils/hex.hpp>
+
+namespace
+{
+/// The micro/factorial benchmark module.
+const auto factorial_wasm = fizzy::from_hex(
+    "0061736d0100000001060160017e017e03020100070d0109666163746f7269616c00000a17011500200050044042"
+    "010f0b2000200042017d10007e0b");
+
+/// The micro/fibonacci benchmark module.
+const auto fibonacci_wasm = fizzy::from_hex(
+    "0061736d0100000001060160017f017f03020100070d01096669626f6e6163636900000a27012500200045044041"
+    "000f0b2000410146044041010f0b200041016b1000200041026b10006a0b");
+
+/// The small leaf function, its calls have the preallocated frames.
+/* wat2wasm
+(func (param i64) (result i64) (i64.rem_u (i64.mul (local.get 0) (i64.const 31)) (i64.const 7)))
+*/
+const auto leaf_wasm = fizzy::from_hex(
+    "0061736d0100000001060160017e017e030201000a0c010a002000421f7e4207820b");
+
+constexpr size_t num_calls = 1000;
+
+/// Calls the function with the small argument state.range(0) num_calls times with execute().
+void execute_calls(benchmark::State& state, const fizzy::bytes& wasm)
+{
+    const auto instance = fizzy::instantiate(fizzy::parse(wasm));
+    const auto arg = static_cast<uint64_t>(state.range(0));
+
+    for ([[maybe_unused]] auto _ : state)
+    {
+        for (size_t i = 0; i < num_calls; ++i)
+            benchmark::DoNotOptimize(fizzy::execute(*instance, 0, {arg}));
+    }
+    state.SetItemsProcessed(state.iterations() * int64_t{num_calls});
+}
+
+/// Calls the function with the small argument state.range(0) num_calls times with
+/// execute_batch().
+void execute_batch_calls(benchmark::State& state, const fizzy::bytes& wasm)
+{
+    const auto instance = fizzy::instantiate(fizzy::parse(wasm));
+    const std::vector<uint64_t> args(num_calls, static_cast<uint64_t>(state.range(0)));
+    std::vector<uint64_t> results(num_calls);
+
+    for ([[maybe_unused]] auto _ : state)
+    {
+        fizzy::execute_batch(*instance, 0, args.data(), num_calls, results.data());
+        benchmark::DoNotOptimize(results.data());
+    }
+    state.SetItemsProcessed(state.iterations() * int64_t{num_calls});
+}
+}  // namespace
+
+BENCHMARK_CAPTURE(execute_calls, leaf, leaf_wasm)->Arg(1);
+BENCHMARK_CAPTURE(execute_batch_calls, leaf, leaf_wasm)->Arg(1);
+BENCHMARK_CAPTURE(execute_calls, factorial, factorial_wasm)->Arg(1)->Arg(5);
+BENCHMARK_CAPTURE(execute_batch_calls, factorial, factorial_wasm)->Arg(1)->Arg(5);
+BENCHMARK_CAPTURE(execute_calls, fibonacci, fibonacci_wasm)->Arg(1)->Arg(5);
+BENCHMARK_CAPTURE(execute_batch_calls, fibonacci, fibonacci_wasm)->Arg(1)->Arg(5);
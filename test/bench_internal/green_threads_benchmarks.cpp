@@ -0,0 +1,165 @@
+// Fizzy: A fast WebAssembly interpreter
+// Copyright 2020 The Fizzy Authors.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "green_threads.hpp"
+#include "parser.hpp"
+#include <benchmark/benchmark.h>
+#include <test/utils/hex.hpp>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+namespace
+{
+/* wat2wasm
+(func $sum (param $n i32) (result i32) (local $acc i32)
+  (block $done
+    (loop $l
+      (br_if $done (i32.eqz (local.get $n)))
+      (local.set $acc (i32.add (local.get $acc) (local.get $n)))
+      (local.set $n (i32.sub (local.get $n) (i32.const 1)))
+      (br $l)))
+  (local.get $acc))
+*/
+const auto sum_wasm = fizzy::from_hex(
+    "0061736d0100000001060160017f017f030201000a23012101017f024003402000450d01200120006a2101200041"
+    "016b21000c000b0b20010b");
+
+/// Executes the mixed workload of 4 long and 60 short green threads, spawned interleaved,
+/// on the single worker thread with the quantum of state.range(0) instructions.
+/// The counters are the latencies of the green threads and the throughput.
+void green_threads_mixed(benchmark::State& state)
+{
+    constexpr size_t num_green_threads = 64;
+    constexpr uint64_t long_loop_count = 200'000;
+    constexpr uint64_t short_loop_count = 200;
+
+    const auto quantum = static_cast<uint64_t>(state.range(0));
+
+    std::vector<std::unique_ptr<fizzy::Instance>> instances;
+    for (size_t i = 0; i < num_green_threads; ++i)
+        instances.emplace_back(fizzy::instantiate(fizzy::parse(sum_wasm)));
+    const auto code = fizzy::compile_lane_code(instances.front()->module);
+
+    fizzy::GreenThreadScheduler scheduler{1, quantum};
+    for ([[maybe_unused]] auto _ : state)
+    {
+        for (size_t i = 0; i < num_green_threads; ++i)
+        {
+            const auto n = i % 16 == 0 ? long_loop_count : short_loop_count;
+            scheduler.spawn(code, *instances[i], 0, {n});
+        }
+        scheduler.wait();
+    }
+
+    const auto stats = scheduler.get_stats();
+    state.counters["p50_us"] = static_cast<double>(stats.latency_p50.count()) / 1000;
+    state.counters["p99_us"] = static_cast<double>(stats.latency_p99.count()) / 1000;
+    state.counters["throughput"] = stats.throughput;
+    state.counters["preemptions"] =
+        static_cast<double>(stats.num_preemptions) / static_cast<double>(state.iterations());
+    state.SetItemsProcessed(state.iterations() * int64_t{num_green_threads});
+}
+BENCHMARK(green_threads_mixed)->Arg(1'000)->Arg(10'000)->Arg(int64_t{1} << 62)->UseRealTime();
+
+/* wat2wasm
+(func $read (import "env" "read") (param i32) (result i32))
+(func (param i32) (result i32)
+  (i32.add (call $read (local.get 0)) (call $read (i32.add (local.get 0) (i32.const 1)))))
+*/
+const auto read_wasm = fizzy::from_hex(
+    "0061736d0100000001060160017f017f020c0103656e7604726561640000030201000a10010e0020001000200041"
+    "016a10006a0b");
+
+constexpr auto io_latency = std::chrono::microseconds{200};
+
+/// The simulated I/O device completing the pending calls after the I/O latency.
+class IoDevice
+{
+    using Clock = std::chrono::steady_clock;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::deque<std::pair<Clock::time_point, std::shared_ptr<fizzy::PendingCall>>> m_calls;
+    bool m_stopping = false;
+    std::thread m_thread{[this] { run(); }};
+
+    void run()
+    {
+        std::unique_lock lock{m_mutex};
+        while (true)
+        {
+            m_cv.wait(lock, [this] { return m_stopping || !m_calls.empty(); });
+            if (m_calls.empty())
+                return;
+            auto [deadline, call] = std::move(m_calls.front());
+            m_calls.pop_front();
+            lock.unlock();
+            std::this_thread::sleep_until(deadline);
+            call->complete({false, {1}});
+            lock.lock();
+        }
+    }
+
+public:
+    ~IoDevice()
+    {
+        {
+            const std::lock_guard lock{m_mutex};
+            m_stopping = true;
+        }
+        m_cv.notify_one();
+        m_thread.join();
+    }
+
+    void submit(std::shared_ptr<fizzy::PendingCall> call)
+    {
+        {
+            const std::lock_guard lock{m_mutex};
+            m_calls.emplace_back(Clock::now() + io_latency, std::move(call));
+        }
+        m_cv.notify_one();
+    }
+};
+
+/// Executes 256 green threads, each reading twice from the simulated I/O device, on 4 workers.
+/// The reads block the worker when state.range(0) is 0, and are pending calls otherwise.
+void green_threads_io(benchmark::State& state)
+{
+    constexpr size_t num_green_threads = 256;
+    const bool async = state.range(0) != 0;
+
+    IoDevice io_device;
+    const auto read = [async, &io_device](fizzy::Instance&, std::vector<uint64_t>, int) {
+        if (!async)
+        {
+            std::this_thread::sleep_for(io_latency);
+            return fizzy::execution_result{false, {1}};
+        }
+        io_device.submit(fizzy::defer_current_call());
+        return fizzy::execution_result{true, {}};
+    };
+    const fizzy::ExternalFunction read_function{
+        read, fizzy::FuncType{{fizzy::ValType::i32}, {fizzy::ValType::i32}}};
+
+    std::vector<std::unique_ptr<fizzy::Instance>> instances;
+    for (size_t i = 0; i < num_green_threads; ++i)
+        instances.emplace_back(fizzy::instantiate(fizzy::parse(read_wasm), {read_function}));
+    const auto code = fizzy::compile_lane_code(instances.front()->module);
+
+    fizzy::GreenThreadScheduler scheduler{4};
+    for ([[maybe_unused]] auto _ : state)
+    {
+        for (size_t i = 0; i < num_green_threads; ++i)
+            scheduler.spawn(code, *instances[i], 1, {i});
+        scheduler.wait();
+    }
+
+    const auto stats = scheduler.get_stats();
+    state.counters["p99_us"] = static_cast<double>(stats.latency_p99.count()) / 1000;
+    state.SetItemsProcessed(state.iterations() * int64_t{num_green_threads});
+}
+BENCHMARK(green_threads_io)->Arg(0)->Arg(1)->UseRealTime()->Unit(benchmark::kMillisecond);
+}  // namespace
@@ -0,0 +1,152 @@
+// Fizzy: A fast WebAssembly interpreter
+// Copyright 2020 The Fizzy Authors.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "lanes.hpp"
+#include "parser.hpp"
+#include <benchmark/benchmark.h>
+#include <test/utils/hex.hpp>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+namespace
+{
+/* wat2wasm
+(func (param $x i64) (result i64) (local $i i32)
+  (loop $l
+    (local.set $x (i64.xor (local.get $x) (i64.shl (local.get $x) (i64.const 13))))
+    (local.set $x (i64.xor (local.get $x) (i64.shr_u (local.get $x) (i64.const 7))))
+    (local.set $x (i64.xor (local.get $x) (i64.shl (local.get $x) (i64.const 17))))
+    (br_if $l (i32.ne (local.tee $i (i32.add (local.get $i) (i32.const 1))) (i32.const 1000))))
+  (local.get $x))
+*/
+const auto xorshift_wasm = fizzy::from_hex(
+    "0061736d0100000001060160017e017e030201000a36013401017f034020002000420d8685210020002000420788"
+    "85210020002000421186852100200141016a220141e807470d000b20000b");
+
+/// Loads the module of the benchmark corpus from test/benchmarks.
+fizzy::bytes load_corpus_wasm(const std::string& name)
+{
+    std::ifstream wasm_file{std::string{FIZZY_BENCHMARKS_DIR} + "/" + name, std::ios::binary};
+    return {std::istreambuf_iterator<char>{wasm_file}, std::istreambuf_iterator<char>{}};
+}
+
+/// The instances of the module executing the function, with the arguments of each lane.
+struct Lanes
+{
+    std::vector<std::unique_ptr<fizzy::Instance>> instances;
+    std::vector<fizzy::Instance*> pointers;
+    fizzy::FuncIdx func_idx = 0;
+    size_t num_args = 0;
+    std::vector<uint64_t> args;
+
+    /// Instantiates the module for each lane, the lane_args returns the arguments of the lane.
+    template <typename F>
+    Lanes(const fizzy::bytes& wasm, fizzy::FuncIdx _func_idx, size_t num_lanes, F lane_args)
+      : func_idx{_func_idx}
+    {
+        for (size_t lane = 0; lane < num_lanes; ++lane)
+        {
+            instances.emplace_back(fizzy::instantiate(fizzy::parse(wasm)));
+            pointers.emplace_back(instances.back().get());
+            const std::vector<uint64_t> lane_args_values = lane_args(lane);
+            args.insert(args.end(), lane_args_values.begin(), lane_args_values.end());
+        }
+        num_args = instances.front()->module.get_function_type(func_idx).inputs.size();
+    }
+
+    /// Executes the function on the instances one after another with execute().
+    void execute() const
+    {
+        for (size_t lane = 0; lane < pointers.size(); ++lane)
+        {
+            const auto* const lane_args = &args[lane * num_args];
+            benchmark::DoNotOptimize(
+                fizzy::execute(*pointers[lane], func_idx, {lane_args, lane_args + num_args}));
+        }
+    }
+};
+
+/// Creates the lanes of the xorshift function, each with its own seed.
+Lanes xorshift_lanes(size_t num_lanes)
+{
+    return {xorshift_wasm, 0, num_lanes, [](size_t lane) {
+                return std::vector<uint64_t>{lane + 1};
+            }};
+}
+
+/// Executes the function on state.range(0) instances one after another with execute().
+void xorshift_execute(benchmark::State& state)
+{
+    const auto lanes = xorshift_lanes(static_cast<size_t>(state.range(0)));
+
+    for ([[maybe_unused]] auto _ : state)
+        lanes.execute();
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+/// Executes the function on state.range(0) instances in lock-step with execute_lanes().
+void xorshift_execute_lanes(benchmark::State& state)
+{
+    const auto lanes = xorshift_lanes(static_cast<size_t>(state.range(0)));
+    const auto code = fizzy::compile_lane_code(lanes.instances.front()->module);
+
+    for ([[maybe_unused]] auto _ : state)
+    {
+        benchmark::DoNotOptimize(
+            fizzy::execute_lanes(code, lanes.pointers, lanes.func_idx, lanes.args.data()));
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+/// Creates the lanes hashing 512 bytes once with the bench function of the corpus module,
+/// each lane filling the input with its own byte value.
+Lanes hash_lanes(const std::string& name, size_t num_lanes)
+{
+    const auto wasm = load_corpus_wasm(name + ".wasm");
+    const auto func_idx = *fizzy::find_exported_function(fizzy::parse(wasm), name + "_bench");
+    return {wasm, func_idx, num_lanes, [](size_t lane) {
+                return std::vector<uint64_t>{512, 85 + lane, 1};
+            }};
+}
+
+/// Hashes the inputs of state.range(0) instances one after another with execute().
+void hash_execute(benchmark::State& state, const std::string& name)
+{
+    const auto lanes = hash_lanes(name, static_cast<size_t>(state.range(0)));
+
+    for ([[maybe_unused]] auto _ : state)
+        lanes.execute();
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+/// Hashes the inputs of state.range(0) instances in lock-step with execute_lanes().
+void hash_execute_lanes(benchmark::State& state, const std::string& name)
+{
+    const auto lanes = hash_lanes(name, static_cast<size_t>(state.range(0)));
+    const auto code = fizzy::compile_lane_code(lanes.instances.front()->module);
+
+    for ([[maybe_unused]] auto _ : state)
+    {
+        const auto results =
+            fizzy::execute_lanes(code, lanes.pointers, lanes.func_idx, lanes.args.data());
+        for (const auto& result : results)
+        {
+            if (result.trapped)
+            {
+                state.SkipWithError("trapped");
+                return;
+            }
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+}  // namespace
+
+BENCHMARK(xorshift_execute)->RangeMultiplier(4)->Range(1, 64);
+BENCHMARK(xorshift_execute_lanes)->RangeMultiplier(4)->Range(1, 64);
+BENCHMARK_CAPTURE(hash_execute, keccak256, "keccak256")->RangeMultiplier(4)->Range(1, 64);
+BENCHMARK_CAPTURE(hash_execute_lanes, keccak256, "keccak256")->RangeMultiplier(4)->Range(1, 64);
+BENCHMARK_CAPTURE(hash_execute, sha256, "sha256")->RangeMultiplier(4)->Range(1, 64);
+BENCHMARK_CAPTURE(hash_execute_lanes, sha256, "sha256")->RangeMultiplier(4)->Range(1, 64);
@@ -29,6 +29,51 @@ std::vector<T> generate_samples(size_t count)
     return samples;
 }
 
+fizzy::bytes leb128u_encode_all(const std::vector<uint32_t>& values)
+{
+    fizzy::bytes result;
+    for (const auto value : values)
+        result += fizzy::test::leb128u_encode(value);
+    return result;
+}
+
+/// Generates the wasm module with @p num_functions empty functions
+/// and the element section referencing each function @p num_repeats times.
+fizzy::bytes generate_module_with_large_element_section(
+    uint32_t num_functions, uint32_t num_repeats)
+{
+    using fizzy::test::leb128u_encode;
+
+    const auto make_section = [](uint8_t id, const fizzy::bytes& content) {
+        return fizzy::bytes{id} + leb128u_encode(content.size()) + content;
+    };
+
+    const auto num_elements = num_functions * num_repeats;
+
+    fizzy::bytes function_section = leb128u_encode(num_functions);
+    fizzy::bytes code_section = leb128u_encode(num_functions);
+    for (uint32_t i = 0; i < num_functions; ++i)
+    {
+        function_section += fizzy::bytes{0x00};            // Type index 0.
+        code_section += fizzy::bytes{0x02, 0x00, 0x0b};  // Empty body.
+    }
+
+    // Table of funcref with the min limit covering all elements.
+    const auto table_section = fizzy::bytes{0x01, 0x70, 0x00} + leb128u_encode(num_elements);
+
+    fizzy::bytes element_section = fizzy::bytes{0x01, 0x00, 0x41, 0x00, 0x0b} +  // Offset 0.
+                                   leb128u_encode(num_elements);
+    for (uint32_t r = 0; r < num_repeats; ++r)
+    {
+        for (uint32_t i = 0; i < num_functions; ++i)
+            element_section += leb128u_encode(i);
+    }
+
+    return fizzy::bytes{fizzy::wasm_prefix} + make_section(1, {0x01, 0x60, 0x00, 0x00}) +
+           make_section(3, function_section) + make_section(4, table_section) +
+           make_section(9, element_section) + make_section(10, code_section);
+}
+
 fizzy::bytes generate_ascii_vec(size_t size)
 {
     std::uniform_int_distribution<uint8_t> dist{0, 0x7f};
@@ -90,3 +135,54 @@ static void parse_string(benchmark::State& state)
     state.SetItemsProcessed(static_cast<int64_t>(size));
 }
 BENCHMARK(parse_string)->RangeMultiplier(2)->Range(16, 4 * 1024);
+
+static void leb128u_decode_u32_vec(benchmark::State& state)
+{
+    constexpr size_t size = 1024;
+    const auto max_value = static_cast<uint32_t>(state.range(0));
+    const auto is_batch = state.range(1) != 0;
+
+    std::uniform_int_distribution<uint32_t> dist{0, max_value};
+    std::vector<uint32_t> samples(size);
+    std::generate_n(samples.begin(), size, [&] { return dist(g_gen); });
+    const auto input = leb128u_encode_all(samples);
+    std::vector<uint32_t> output(size);
+
+    benchmark::ClobberMemory();
+
+    const auto end = &*std::cend(input);
+    while (state.KeepRunningBatch(size))
+    {
+        auto pos = &*std::cbegin(input);
+        if (is_batch)
+            pos = fizzy::leb128u_decode_u32_vec(pos, end, output.data(), size);
+        else
+        {
+            for (size_t i = 0; i < size; ++i)
+                std::tie(output[i], pos) = fizzy::leb128u_decode<uint32_t>(pos, end);
+        }
+        benchmark::DoNotOptimize(output.data());
+        if (pos != end)
+            state.SkipWithError("Not all input processed");
+    }
+}
+BENCHMARK(leb128u_decode_u32_vec)
+    ->ArgNames({"max", "batch"})
+    ->ArgsProduct({{0x7f, 0x3fff, 0xffffffff}, {0, 1}});
+
+static void parse_large_element_section(benchmark::State& state)
+{
+    const auto num_functions = static_cast<uint32_t>(state.range(0));
+    const auto wasm = generate_module_with_large_element_section(num_functions, 16);
+
+    benchmark::ClobberMemory();
+
+    for ([[maybe_unused]] auto _ : state)
+    {
+        const auto module = fizzy::parse(wasm);
+        benchmark::DoNotOptimize(module.elementsec.data());
+    }
+
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(wasm.size()));
+}
+BENCHMARK(parse_large_element_section)->Arg(100)->Arg(1000)->Arg(10000);
@@ -0,0 +1,45 @@
+// Fizzy: A fast WebAssembly interpreter
+// Copyright 2020 The Fizzy Authors.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "parser.hpp"
+#include "runtime.hpp"
+#include <benchmark/benchmark.h>
+#include <test/utils/hex.hpp>
+
+namespace
+{
+/* wat2wasm
+(func (param $n i32) (result i32) (local $acc i32)
+  (loop $l
+    (local.set $acc (i32.add (local.get $acc) (local.get $n)))
+    (br_if $l (local.tee $n (i32.sub (local.get $n) (i32.const 1)))))
+  (local.get $acc))
+*/
+const auto sum_wasm = fizzy::from_hex(
+    "0061736d0100000001060160017f017f030201000a1b011901017f0340200120006a2101200041016b22000d000b"
+    "20010b");
+
+/// Executes batches of independent jobs by the runtime with state.range(0) threads.
+/// The items_per_second counter is the job throughput, which should scale with the threads.
+void runtime_throughput(benchmark::State& state)
+{
+    constexpr int64_t batch_size = 256;
+    constexpr uint64_t loop_count = 10000;
+
+    fizzy::Runtime runtime{static_cast<size_t>(state.range(0))};
+    const auto module_id = runtime.add_module(fizzy::parse(sum_wasm));
+
+    for ([[maybe_unused]] auto _ : state)
+    {
+        std::vector<fizzy::Job> jobs(size_t{batch_size}, {module_id, 0, {loop_count}});
+        runtime.submit(
+            std::move(jobs), [](size_t, fizzy::execution_result result, std::exception_ptr) {
+                benchmark::DoNotOptimize(result);
+            });
+        runtime.wait();
+    }
+    state.SetItemsProcessed(state.iterations() * batch_size);
+}
+BENCHMARK(runtime_throughput)->RangeMultiplier(2)->Range(1, 16)->UseRealTime();
+}  // namespace
@@ -0,0 +1,58 @@
+// Fizzy: A fast WebAssembly interpreter
+// Copyright 2020 The Fizzy Authors.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "parser.hpp"
+#include "transactions.hpp"
+#include <benchmark/benchmark.h>
+#include <test/utils/hex.hpp>
+
+namespace
+{
+/* wat2wasm
+(memory 4)
+(func (param $addr i32) (param $n i32) (result i32) (local $acc i32)
+  (loop $l
+    (local.set $acc (i32.add (local.get $acc) (local.get $n)))
+    (br_if $l (local.tee $n (i32.sub (local.get $n) (i32.const 1)))))
+  (i32.store (local.get $addr) (i32.add (i32.load (local.get $addr)) (local.get $acc)))
+  (local.get $acc))
+*/
+const auto accumulate_wasm = fizzy::from_hex(
+    "0061736d0100000001070160027f7f017f0302010005030100040a28012601017f0340200220016a210220014101"
+    "6b22010d000b2000200028020020026a36020020020b");
+
+/// Executes blocks of transactions with state.range(0) threads. The transactions write
+/// the state.range(1) different memory pages, so most of them conflict when there are few.
+/// The speedup counter is the speedup over the serial execution reported by the scheduler.
+void transactions_block(benchmark::State& state)
+{
+    constexpr uint64_t block_size = 64;
+    constexpr uint64_t loop_count = 2000;
+
+    const auto num_threads = static_cast<size_t>(state.range(0));
+    const auto num_pages = static_cast<uint64_t>(state.range(1));
+
+    const auto instance = fizzy::instantiate(fizzy::parse(accumulate_wasm));
+    fizzy::HostState host_state;
+    fizzy::TransactionScheduler scheduler{*instance, host_state, num_threads};
+
+    std::vector<fizzy::Transaction> transactions;
+    for (uint64_t i = 0; i < block_size; ++i)
+        transactions.push_back({0, {(i % num_pages) * fizzy::AccessSet::PageSize, loop_count}});
+
+    double speedup = 0;
+    size_t num_executions = 0;
+    for ([[maybe_unused]] auto _ : state)
+    {
+        const auto block = scheduler.execute_block(transactions);
+        speedup += block.speedup();
+        num_executions += block.num_executions;
+    }
+    state.counters["speedup"] = speedup / static_cast<double>(state.iterations());
+    state.counters["executions"] = static_cast<double>(num_executions) /
+                                   static_cast<double>(state.iterations());
+    state.SetItemsProcessed(state.iterations() * int64_t{block_size});
+}
+BENCHMARK(transactions_block)->ArgsProduct({{1, 2, 4, 8}, {1, 64}})->UseRealTime();
+}  // namespace
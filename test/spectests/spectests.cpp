@@ -2,6 +2,7 @@
 // Copyright 2019-2020 The Fizzy Authors.
 // SPDX-License-Identifier: Apache-2.0
 
+#include "code_layout.hpp"
 #include "execute.hpp"
 #include "parser.hpp"
 #include <nlohmann/json.hpp>
@@ -67,6 +68,7 @@ fizzy::bytes load_wasm_file(const fs::path& json_file_path, std::string_view fil
 struct test_settings
 {
     bool skip_validation = false;
+    bool no_optimize = false;
 };
 
 struct test_results
@@ -132,6 +134,9 @@ public:
                         std::move(imports.functions), std::move(imports.tables),
                         std::move(imports.memories), std::move(imports.globals));
 
+                    if (m_settings.no_optimize)
+                        fizzy::layout_code(m_instances[name]->module, {false, {}});
+
                     m_last_module_name = name;
                 }
                 catch (const fizzy::parser_error& ex)
@@ -622,6 +627,8 @@ int main(int argc, char** argv)
             {
                 if (argv[i] == std::string{"--skip-validation"})
                     settings.skip_validation = true;
+                else if (argv[i] == std::string{"--no-optimize"})
+                    settings.no_optimize = true;
                 else
                 {
                     std::cerr << "Unknown argument: " << argv[i] << "\n";
@@ -0,0 +1,364 @@
+// Fizzy: A fast WebAssembly interpreter
+// Copyright 2020 The Fizzy Authors.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "atomics.hpp"
+#include "execute.hpp"
+#include "instructions.hpp"
+#include "lanes.hpp"
+#include "limits.hpp"
+#include "parser.hpp"
+#include <gmock/gmock.h>
+#include <test/utils/asserts.hpp>
+#include <test/utils/hex.hpp>
+#include <test/utils/wasm_binary.hpp>
+#include <cstring>
+#include <thread>
+
+using namespace fizzy;
+using namespace fizzy::test;
+using namespace testing;
+
+namespace
+{
+constexpr uint8_t I32 = 0x7f;
+constexpr uint8_t I64 = 0x7e;
+
+/// Returns the type of the values the atomic load, store or read-modify-write accesses.
+uint8_t get_value_type(AtomicOp op)
+{
+    const auto index = static_cast<uint8_t>(op) - static_cast<uint8_t>(AtomicOp::i32_atomic_load);
+    return (index % 7 == 1 || index % 7 >= 4) ? I64 : I32;
+}
+
+/// Returns the module with the memory of 1 page, shared if @p shared, and the function executing
+/// the atomic operation on its parameters: the address followed by the operands.
+bytes atomic_module(AtomicOp op, bool shared = true)
+{
+    const auto instr = get_atomic_instr(static_cast<uint8_t>(op));
+    const auto& metrics = get_instruction_metrics_table()[static_cast<uint8_t>(instr)];
+    const bool has_result = metrics.stack_height_required + metrics.stack_height_change == 1;
+
+    bytes params{I32};
+    bytes results;
+    switch (op)
+    {
+    case AtomicOp::memory_atomic_notify:
+        params += bytes{I32};
+        results = bytes{I32};
+        break;
+    case AtomicOp::memory_atomic_wait32:
+    case AtomicOp::memory_atomic_wait64:
+        params += bytes{op == AtomicOp::memory_atomic_wait32 ? I32 : I64, I64};
+        results = bytes{I32};
+        break;
+    default:
+        params.append(static_cast<size_t>(metrics.stack_height_required - 1), get_value_type(op));
+        if (has_result)
+            results = bytes{get_value_type(op)};
+        break;
+    }
+
+    bytes body;
+    for (uint8_t i = 0; i < params.size(); ++i)
+        body += bytes{0x20, i};
+    const auto alignment = static_cast<uint8_t>(__builtin_ctz(get_atomic_access_size(op)));
+    body += bytes{0xfe, static_cast<uint8_t>(op), alignment, 0x00, 0x0b};
+
+    const auto type = bytes{0x60} + add_size_prefix(params) + add_size_prefix(results);
+    return bytes{wasm_prefix} + make_section(1, make_vec({type})) +
+           make_section(3, make_vec({"00"_bytes})) +
+           make_section(5, make_vec({shared ? "030101"_bytes : "0001"_bytes})) +
+           make_section(10, make_vec({add_size_prefix("00"_bytes + body)}));
+}
+
+/// Instantiates the atomic_module() of the operation.
+std::unique_ptr<Instance> instantiate_atomic(AtomicOp op, bool shared = true)
+{
+    return instantiate(parse(atomic_module(op, shared)));
+}
+
+/// Returns the value of the memory word at the address.
+uint64_t load_word(const Instance& instance, size_t address)
+{
+    uint64_t value;
+    std::memcpy(&value, instance.memory->data() + address, sizeof(value));
+    return value;
+}
+
+/* wat2wasm --enable-threads
+(memory (import "env" "memory") 1 1 shared)
+(func $count (param $n i32)
+  (block $done
+    (loop $l
+      (br_if $done (i32.eqz (local.get $n)))
+      (drop (i32.atomic.rmw.add (i32.const 0) (i32.const 1)))
+      (local.set $n (i32.sub (local.get $n) (i32.const 1)))
+      (br $l))))
+*/
+const auto counter_wasm = from_hex(
+    "0061736d0100000001050160017f0002100103656e76066d656d6f727902030101030201000a21011f0002400340"
+    "2000450d0141004101fe1e02001a200041016b21000c000b0b0b");
+
+/* wat2wasm --enable-threads
+(memory (import "env" "memory") 1 1 shared)
+(func $wait (param i32 i64) (result i32)
+  (memory.atomic.wait32 (i32.const 0) (local.get 0) (local.get 1)))
+(func $notify (param i32) (result i32)
+  (memory.atomic.notify (i32.const 0) (local.get 0)))
+*/
+const auto wait_notify_wasm = from_hex(
+    "0061736d01000000010c0260027f7e017f60017f017f02100103656e76066d656d6f72790203010103030200010a"
+    "19020c00410020002001fe0102000b0a0041002000fe0002000b");
+
+/// The shared memory of 1 page and the instances importing it.
+struct SharedInstances
+{
+    bytes memory = bytes(PageSize, 0);
+    std::vector<std::unique_ptr<Instance>> instances;
+
+    SharedInstances(const bytes& wasm, size_t num_instances)
+    {
+        for (size_t i = 0; i < num_instances; ++i)
+        {
+            instances.emplace_back(instantiate(parse(wasm), {}, {}, {{&memory, {1, 1, true}}}));
+        }
+    }
+};
+}  // namespace
+
+TEST(atomics, get_atomic_instr)
+{
+    EXPECT_EQ(get_atomic_instr(0x00), Instr::atomic_rmw);
+    EXPECT_EQ(get_atomic_instr(0x01), Instr::atomic_cmpxchg);
+    EXPECT_EQ(get_atomic_instr(0x02), Instr::atomic_cmpxchg);
+    EXPECT_EQ(get_atomic_instr(0x03), Instr::atomic_fence);
+    EXPECT_EQ(get_atomic_instr(0x04), Instr::unreachable);
+    EXPECT_EQ(get_atomic_instr(0x0f), Instr::unreachable);
+    EXPECT_EQ(get_atomic_instr(0x10), Instr::atomic_load);
+    EXPECT_EQ(get_atomic_instr(0x16), Instr::atomic_load);
+    EXPECT_EQ(get_atomic_instr(0x17), Instr::atomic_store);
+    EXPECT_EQ(get_atomic_instr(0x1d), Instr::atomic_store);
+    EXPECT_EQ(get_atomic_instr(0x1e), Instr::atomic_rmw);
+    EXPECT_EQ(get_atomic_instr(0x47), Instr::atomic_rmw);
+    EXPECT_EQ(get_atomic_instr(0x48), Instr::atomic_cmpxchg);
+    EXPECT_EQ(get_atomic_instr(0x4e), Instr::atomic_cmpxchg);
+    EXPECT_EQ(get_atomic_instr(0x4f), Instr::unreachable);
+    EXPECT_EQ(get_atomic_instr(0x100), Instr::unreachable);
+
+    EXPECT_EQ(get_atomic_access_size(AtomicOp::i64_atomic_load), 8);
+    EXPECT_EQ(get_atomic_access_size(AtomicOp::i32_atomic_store16), 2);
+    EXPECT_EQ(get_atomic_access_size(AtomicOp::i64_atomic_rmw8_xor_u), 1);
+    EXPECT_EQ(get_atomic_access_size(AtomicOp::i64_atomic_rmw32_cmpxchg_u), 4);
+    EXPECT_EQ(get_atomic_access_size(AtomicOp::memory_atomic_wait64), 8);
+}
+
+TEST(atomics, load_store)
+{
+    constexpr uint64_t value = 0x8877665544332211;
+    const std::pair<AtomicOp, AtomicOp> ops[] = {
+        {AtomicOp::i32_atomic_store, AtomicOp::i32_atomic_load},
+        {AtomicOp::i64_atomic_store, AtomicOp::i64_atomic_load},
+        {AtomicOp::i32_atomic_store8, AtomicOp::i32_atomic_load8_u},
+        {AtomicOp::i32_atomic_store16, AtomicOp::i32_atomic_load16_u},
+        {AtomicOp::i64_atomic_store8, AtomicOp::i64_atomic_load8_u},
+        {AtomicOp::i64_atomic_store16, AtomicOp::i64_atomic_load16_u},
+        {AtomicOp::i64_atomic_store32, AtomicOp::i64_atomic_load32_u},
+    };
+
+    for (const auto& [store_op, load_op] : ops)
+    {
+        const auto size = get_atomic_access_size(store_op);
+        const auto expected = size == 8 ? value : value & ((uint64_t{1} << (size * 8)) - 1);
+
+        auto store = instantiate_atomic(store_op);
+        EXPECT_THAT(execute(*store, 0, {8, value}), Result());
+        EXPECT_EQ(load_word(*store, 8), expected);
+
+        auto load = instantiate_atomic(load_op);
+        std::memcpy(load->memory->data() + 8, &value, sizeof(value));
+        EXPECT_THAT(execute(*load, 0, {8}), Result(expected));
+    }
+}
+
+TEST(atomics, rmw)
+{
+    struct TestCase
+    {
+        AtomicOp op;
+        uint64_t initial;
+        uint64_t operand;
+        uint64_t expected;
+    };
+    const TestCase test_cases[] = {
+        {AtomicOp::i32_atomic_rmw_add, 0xffffffff, 2, 1},
+        {AtomicOp::i64_atomic_rmw_add, 0xffffffff, 2, 0x100000001},
+        {AtomicOp::i32_atomic_rmw8_add_u, 0x12ff, 0x102, 0x1201},
+        {AtomicOp::i64_atomic_rmw16_sub_u, 0x10000, 1, 0x1ffff},
+        {AtomicOp::i32_atomic_rmw_and, 0xff00ff, 0x0ff0f0, 0x0f00f0},
+        {AtomicOp::i64_atomic_rmw32_or_u, 0x1'00000001, 0x2'00000010, 0x1'00000011},
+        {AtomicOp::i32_atomic_rmw16_xor_u, 0xffff, 0x0f0f, 0xf0f0},
+        {AtomicOp::i64_atomic_rmw_xchg, 1, 0x123456789, 0x123456789},
+        {AtomicOp::i64_atomic_rmw8_xchg_u, 0x1234, 0x5678, 0x1278},
+    };
+
+    for (const auto& [op, initial, operand, expected] : test_cases)
+    {
+        auto instance = instantiate_atomic(op);
+        std::memcpy(instance->memory->data() + 16, &initial, sizeof(initial));
+
+        // The old value is returned, zero-extended from the access size.
+        const auto size = get_atomic_access_size(op);
+        const auto old = size == 8 ? initial : initial & ((uint64_t{1} << (size * 8)) - 1);
+        EXPECT_THAT(execute(*instance, 0, {16, operand}), Result(old)) << int(op);
+        EXPECT_EQ(load_word(*instance, 16), expected) << int(op);
+    }
+}
+
+TEST(atomics, cmpxchg)
+{
+    auto instance = instantiate_atomic(AtomicOp::i32_atomic_rmw_cmpxchg);
+    instance->memory->at(0) = 5;
+    EXPECT_THAT(execute(*instance, 0, {0, 4, 7}), Result(5));
+    EXPECT_EQ(load_word(*instance, 0), 5);
+    EXPECT_THAT(execute(*instance, 0, {0, 5, 7}), Result(5));
+    EXPECT_EQ(load_word(*instance, 0), 7);
+
+    // The expected value is wrapped to the access size.
+    auto narrow = instantiate_atomic(AtomicOp::i64_atomic_rmw8_cmpxchg_u);
+    narrow->memory->at(1) = 0xff;
+    EXPECT_THAT(execute(*narrow, 0, {1, 0x1ff, 0x1234}), Result(0xff));
+    EXPECT_EQ(load_word(*narrow, 0), 0x3400);
+}
+
+TEST(atomics, traps)
+{
+    auto instance = instantiate_atomic(AtomicOp::i32_atomic_rmw_add);
+    EXPECT_THAT(execute(*instance, 0, {PageSize - 4, 1}), Result(0));
+    EXPECT_THAT(execute(*instance, 0, {PageSize, 1}), Traps());
+    EXPECT_THAT(execute(*instance, 0, {0xfffffffc, 1}), Traps());
+
+    // The unaligned accesses trap.
+    EXPECT_THAT(execute(*instance, 0, {2, 1}), Traps());
+    EXPECT_EQ(load_word(*instance, 0), 0);
+
+    auto narrow = instantiate_atomic(AtomicOp::i32_atomic_load16_u);
+    EXPECT_THAT(execute(*narrow, 0, {2}), Result(0));
+    EXPECT_THAT(execute(*narrow, 0, {3}), Traps());
+}
+
+TEST(atomics, wait_notify_not_shared)
+{
+    // No thread waits on the not shared memory, so the wait traps.
+    auto notify = instantiate_atomic(AtomicOp::memory_atomic_notify, false);
+    EXPECT_THAT(execute(*notify, 0, {0, 1}), Result(0));
+    EXPECT_THAT(execute(*notify, 0, {1, 1}), Traps());
+
+    auto wait32 = instantiate_atomic(AtomicOp::memory_atomic_wait32, false);
+    EXPECT_THAT(execute(*wait32, 0, {0, 0, 0}), Traps());
+    auto wait64 = instantiate_atomic(AtomicOp::memory_atomic_wait64, false);
+    EXPECT_THAT(execute(*wait64, 0, {0, 0, 0}), Traps());
+}
+
+TEST(atomics, wait_not_equal_timeout)
+{
+    auto wait32 = instantiate_atomic(AtomicOp::memory_atomic_wait32);
+    wait32->memory->at(0) = 1;
+    EXPECT_THAT(execute(*wait32, 0, {0, 0, 0}), Result(1));
+    EXPECT_THAT(execute(*wait32, 0, {0, 1, 0}), Result(2));
+    EXPECT_THAT(execute(*wait32, 0, {0, 1, 1'000'000}), Result(2));
+    EXPECT_THAT(execute(*wait32, 0, {2, 1, 0}), Traps());
+
+    auto wait64 = instantiate_atomic(AtomicOp::memory_atomic_wait64);
+    wait64->memory->at(4) = 1;
+    EXPECT_THAT(execute(*wait64, 0, {0, 1, 0}), Result(1));
+    EXPECT_THAT(execute(*wait64, 0, {0, uint64_t{1} << 32, 0}), Result(2));
+    EXPECT_THAT(execute(*wait64, 0, {4, 0, 0}), Traps());
+}
+
+TEST(atomics, wait_notify)
+{
+    constexpr size_t num_waiters = 3;
+    SharedInstances instances{wait_notify_wasm, num_waiters + 1};
+    auto& notifier = *instances.instances.back();
+
+    std::vector<execution_result> results(num_waiters);
+    std::vector<std::thread> waiters;
+    for (size_t i = 0; i < num_waiters; ++i)
+    {
+        waiters.emplace_back([&, i] {
+            results[i] = execute(*instances.instances[i], 0, {0, static_cast<uint64_t>(-1)});
+        });
+    }
+
+    // Each notify wakes up at most the given number of the waiting threads.
+    uint64_t num_woken = 0;
+    while (num_woken < num_waiters)
+    {
+        const auto result = execute(notifier, 1, {1});
+        ASSERT_THAT(result, Not(Traps()));
+        ASSERT_LE(result.stack.at(0), 1);
+        num_woken += result.stack.at(0);
+        std::this_thread::yield();
+    }
+    for (auto& waiter : waiters)
+        waiter.join();
+
+    for (const auto& result : results)
+        EXPECT_THAT(result, Result(0));
+    EXPECT_THAT(execute(notifier, 1, {1}), Result(0));
+}
+
+TEST(atomics, shared_memory_threads)
+{
+    constexpr size_t num_threads = 4;
+    constexpr uint64_t count = 10'000;
+    SharedInstances instances{counter_wasm, num_threads};
+
+    std::vector<std::thread> threads;
+    for (auto& instance : instances.instances)
+    {
+        threads.emplace_back(
+            [&instance] { EXPECT_THAT(execute(*instance, 0, {count}), Result()); });
+    }
+    for (auto& thread : threads)
+        thread.join();
+
+    EXPECT_EQ(load_word(*instances.instances.front(), 0), num_threads * count);
+}
+
+TEST(atomics, lanes)
+{
+    constexpr size_t num_lanes = 4;
+    SharedInstances instances{counter_wasm, num_lanes};
+    std::vector<Instance*> lanes;
+    for (auto& instance : instances.instances)
+        lanes.emplace_back(instance.get());
+
+    const auto code = compile_lane_code(lanes.front()->module);
+    const std::vector<uint64_t> args{10, 20, 30, 40};
+    const auto results = execute_lanes(code, lanes, 0, args.data());
+    for (const auto& result : results)
+        EXPECT_THAT(result, Result());
+    EXPECT_EQ(load_word(*lanes.front(), 0), 100);
+}
+
+TEST(atomics, shared_memory_grow)
+{
+    /* wat2wasm --enable-threads
+    (memory 1 2 shared)
+    (func (param i32) (result i32) (memory.grow (local.get 0)))
+    */
+    const auto wasm =
+        from_hex("0061736d0100000001060160017f017f030201000504010301020a08010600200040000b");
+    const auto module = parse(wasm);
+    ASSERT_EQ(module.memorysec.size(), 1);
+    EXPECT_TRUE(module.memorysec[0].limits.shared);
+
+    // The shared memory is never reallocated.
+    auto instance = instantiate(module);
+    EXPECT_TRUE(instance->memory_limits.shared);
+    EXPECT_THAT(execute(*instance, 0, {1}), Result(uint32_t(-1)));
+    EXPECT_THAT(execute(*instance, 0, {0}), Result(1));
+    EXPECT_EQ(instance->memory->size(), PageSize);
+}
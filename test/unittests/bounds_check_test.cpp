@@ -0,0 +1,174 @@
+// Fizzy: A fast WebAssembly interpreter
+// Copyright 2020 The Fizzy Authors.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "bounds_check.hpp"
+#include "execute.hpp"
+#include "limits.hpp"
+#include "parser.hpp"
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <test/utils/asserts.hpp>
+#include <test/utils/hex.hpp>
+#include <test/utils/lowered_code_utils.hpp>
+
+using namespace fizzy;
+using namespace fizzy::test;
+using namespace testing;
+
+namespace
+{
+/// Lowers the code of the function and eliminates the bounds checks.
+LoweredCode eliminate(const bytes& expr_binary, FuncType func_type, uint32_t memory_min_pages = 1)
+{
+    const auto module =
+        make_single_function_module(expr_binary, std::move(func_type), memory_min_pages);
+    auto lowered_code = lower_code(module.codesec[0]);
+    eliminate_bounds_checks(module, 0, lowered_code);
+    return lowered_code;
+}
+}  // namespace
+
+TEST(bounds_check, constant_address_in_min_memory)
+{
+    // i32.const 65532 i32.load end
+    EXPECT_THAT(get_instructions(eliminate("41fcff03280200" "0b"_bytes, i32_result)),
+        ElementsAreArray({Instr::i32_const, Instr::i32_load_unchecked, Instr::end}));
+
+    // i32.const 65533 i32.load end
+    EXPECT_THAT(get_instructions(eliminate("41fdff032802000b"_bytes, i32_result)),
+        ElementsAreArray({Instr::i32_const, Instr::i32_load, Instr::end}));
+
+    // i32.const 0 i32.load offset=65533 end
+    EXPECT_THAT(get_instructions(eliminate("41002802fdff030b"_bytes, i32_result)),
+        ElementsAreArray({Instr::i32_const, Instr::i32_load, Instr::end}));
+
+    // i32.const 65532 i32.load end, the memory with the minimum size 0
+    EXPECT_THAT(get_instructions(eliminate("41fcff032802000b"_bytes, i32_result, 0)),
+        ElementsAreArray({Instr::i32_const, Instr::i32_load, Instr::end}));
+}
+
+TEST(bounds_check, constant_address_checked_before)
+{
+    // i32.const 16 i32.load drop i32.const 8 i64.load32_u offset=8 i32.wrap_i64 end
+    const auto code = eliminate("4110280200" "1a4108350208a70b"_bytes, i32_result, 0);
+    EXPECT_THAT(get_instructions(code),
+        ElementsAreArray({Instr::i32_const, Instr::i32_load, Instr::drop, Instr::i32_const,
+            Instr::i64_load32_u_unchecked, Instr::i32_wrap_i64, Instr::end}));
+}
+
+TEST(bounds_check, local_address_checked_before)
+{
+    // local.get 0 i32.load offset=8 drop
+    // local.get 0 i32.load offset=4 drop
+    // local.get 0 i32.const 4 i32.add i32.load offset=4 drop
+    // local.get 0 i32.const 5 i32.add i32.load offset=4 drop end
+    const auto code = eliminate(
+        "20002802081a" "20002802041a" "200041046a2802041a" "200041056a2802041a0b"_bytes,
+        i32_param);
+    EXPECT_THAT(get_instructions(code),
+        ElementsAreArray({Instr::local_get, Instr::i32_load, Instr::drop, Instr::local_get,
+            Instr::i32_load_unchecked, Instr::drop, Instr::local_get, Instr::i32_const,
+            Instr::i32_add, Instr::i32_load_unchecked, Instr::drop, Instr::local_get,
+            Instr::i32_const, Instr::i32_add, Instr::i32_load, Instr::drop, Instr::end}));
+}
+
+TEST(bounds_check, store_checked_before)
+{
+    // local.get 0 i32.const 1 i32.store local.get 0 i32.load8_u offset=3 end
+    const auto code = eliminate("20004101360200" "20002d00030b"_bytes, i32_param_i32_result);
+    EXPECT_THAT(get_instructions(code),
+        ElementsAreArray({Instr::local_get, Instr::i32_const, Instr::i32_store, Instr::local_get,
+            Instr::i32_load8_u_unchecked, Instr::end}));
+}
+
+TEST(bounds_check, local_set)
+{
+    // local.get 0 i32.load drop i32.const 1 local.set 0 local.get 0 i32.load end
+    const auto set = eliminate("20002802001a41012100" "20002802000b"_bytes, i32_param_i32_result);
+    EXPECT_EQ(set.instructions[6].instr, Instr::i32_load);
+
+    // local.get 0 local.get 0 i32.load drop i32.const 1 local.set 0 i32.load end
+    // The address on the stack is the previous value of the local.
+    const auto stack = eliminate("200020002802001a41012100" "2802000b"_bytes, i32_param_i32_result);
+    EXPECT_EQ(stack.instructions[6].instr, Instr::i32_load);
+
+    // local.get 0 i32.load offset=8 drop
+    // local.get 0 i32.const 4 i32.add local.set 0 local.get 0 i32.load offset=4 end
+    const auto increment = eliminate(
+        "20002802081a" "200041046a2100" "20002802040b"_bytes, i32_param_i32_result);
+    EXPECT_EQ(increment.instructions[8].instr, Instr::i32_load_unchecked);
+
+    // local.get 0 i32.load offset=8 drop
+    // local.get 0 i32.const 8 i32.add local.set 0 local.get 0 i32.load offset=4 end
+    const auto large_increment = eliminate(
+        "20002802081a" "200041086a2100" "20002802040b"_bytes, i32_param_i32_result);
+    EXPECT_EQ(large_increment.instructions[8].instr, Instr::i32_load);
+}
+
+TEST(bounds_check, branch_target)
+{
+    // local.get 0 i32.load drop block local.get 0 br_if 0 end local.get 0 i32.load end
+    const auto br_if =
+        eliminate("20002802001a0240" "20000d000b" "20002802000b"_bytes, i32_param_i32_result);
+    EXPECT_THAT(get_instructions(br_if),
+        ElementsAreArray({Instr::local_get, Instr::i32_load, Instr::drop, Instr::local_get,
+            Instr::br_if, Instr::local_get, Instr::i32_load, Instr::end}));
+
+    // local.get 0 i32.load drop local.get 0 if local.get 0 i32.load drop end end
+    // The then branch is always entered after the check.
+    const auto if_ = eliminate("20002802001a" "20000440" "20002802001a0b0b"_bytes, i32_param);
+    EXPECT_THAT(get_instructions(if_),
+        ElementsAreArray({Instr::local_get, Instr::i32_load, Instr::drop, Instr::local_get,
+            Instr::if_, Instr::local_get, Instr::i32_load_unchecked, Instr::drop, Instr::end}));
+
+    // local.get 0 i32.load drop loop local.get 0 i32.load drop end end
+    const auto loop = eliminate("20002802001a0340" "20002802001a0b0b"_bytes, i32_param);
+    EXPECT_THAT(get_instructions(loop),
+        ElementsAreArray({Instr::local_get, Instr::i32_load, Instr::drop, Instr::local_get,
+            Instr::i32_load_unchecked, Instr::drop, Instr::end}));
+}
+
+TEST(bounds_check, no_memory)
+{
+    Module module;
+    module.typesec.emplace_back();
+    module.funcsec.emplace_back(TypeIdx{0});
+    const auto expr = "0b"_bytes;
+    module.codesec.emplace_back(
+        std::get<0>(parse_expr(expr.data(), expr.data() + expr.size(), 0, module)));
+
+    auto code = lower_code(module.codesec[0]);
+    eliminate_bounds_checks(module, 0, code);
+    EXPECT_THAT(get_instructions(code), ElementsAreArray({Instr::end}));
+}
+
+TEST(bounds_check, execute)
+{
+    // local.get 0 i32.load offset=8 drop local.get 0 i32.load offset=4 end
+    auto instance = instantiate(make_single_function_module(
+        "20002802081a" "20002802040b"_bytes, i32_param_i32_result, 1));
+    const auto* const code =
+        instance->module.code_image.data() + instance->module.codesec[0].image_offset;
+    EXPECT_EQ(code[1].op.instr, Instr::i32_load);
+    EXPECT_EQ(code[4].op.instr, Instr::i32_load_unchecked);
+
+    (*instance->memory)[PageSize - 8] = 0x2a;
+    EXPECT_THAT(execute(*instance, 0, {PageSize - 12}), Result(0x2a));
+    EXPECT_THAT(execute(*instance, 0, {PageSize - 11}), Traps());
+    EXPECT_THAT(execute(*instance, 0, {uint32_t(-4)}), Traps());
+}
+
+TEST(bounds_check, execute_after_memory_grow)
+{
+    // i32.const 65532 i32.load drop i32.const 1 memory.grow drop i32.const 65536 i32.load end
+    auto instance = instantiate(make_single_function_module(
+        "41fcff032802001a" "410140001a" "418080042802000b"_bytes, i32_result, 1));
+    const auto* const code =
+        instance->module.code_image.data() + instance->module.codesec[0].image_offset;
+    EXPECT_EQ(code[1].op.instr, Instr::i32_load_unchecked);
+    EXPECT_EQ(code[7].op.instr, Instr::i32_load);
+
+    EXPECT_THAT(execute(*instance, 0, {}), Result(0));
+    EXPECT_EQ(instance->memory->size(), 2 * PageSize);
+}
@@ -0,0 +1,285 @@
+// Fizzy: A fast WebAssembly interpreter
+// Copyright 2020 The Fizzy Authors.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "code_layout.hpp"
+#include "execute.hpp"
+#include "parser.hpp"
+#include <gtest/gtest.h>
+#include <test/utils/asserts.hpp>
+#include <test/utils/hex.hpp>
+#include <test/utils/lowered_code_utils.hpp>
+
+using namespace fizzy;
+using namespace fizzy::test;
+
+namespace
+{
+/* wat2wasm
+(func (result i32) (i32.const 0x2a002a))
+(func (result i32) (call 0))
+*/
+const auto wasm_two_functions =
+    from_hex("0061736d010000000105016000017f03030200000a0e02070041aa80a8010b040010000b");
+
+/// Creates the module with the single function of the given expression and lays out its code.
+Module layout_single_function(const bytes& expr_binary)
+{
+    Module module;
+    module.typesec.emplace_back(FuncType{{}, {}});
+    module.funcsec.emplace_back(TypeIdx{0});
+    auto [code, _] =
+        parse_expr(expr_binary.data(), expr_binary.data() + expr_binary.size(), 0, module);
+    module.codesec.emplace_back(std::move(code));
+    layout_code(module, {false, {}});
+    return module;
+}
+
+bool is_cache_line_aligned(const void* ptr) noexcept
+{
+    return reinterpret_cast<uintptr_t>(ptr) % CacheLineSize == 0;
+}
+}  // namespace
+
+TEST(code_layout, empty)
+{
+    Module module;
+    layout_code(module);
+    EXPECT_TRUE(module.code_image.empty());
+}
+
+TEST(code_layout, two_functions)
+{
+    auto module = parse(wasm_two_functions);
+    layout_code(module, {false, {}});
+
+    ASSERT_EQ(module.codesec.size(), 2);
+    EXPECT_EQ(module.code_image.size(), 2 * CacheLineSize / sizeof(CodeWord));
+    EXPECT_EQ(module.codesec[0].image_offset, 0);
+    EXPECT_EQ(module.codesec[1].image_offset, CacheLineSize / sizeof(CodeWord));
+
+    const auto* const code0 = get_code_words(module, module.codesec[0]);
+    EXPECT_TRUE(is_cache_line_aligned(code0));
+    EXPECT_EQ(code0[0].op.instr, Instr::i32_const);
+    EXPECT_EQ(code0[0].op.imm, 0x2a002a);
+    EXPECT_EQ(code0[1].op.instr, Instr::end);
+
+    const auto* const code1 = get_code_words(module, module.codesec[1]);
+    EXPECT_TRUE(is_cache_line_aligned(code1));
+    EXPECT_EQ(code1[0].op.instr, Instr::call);
+    EXPECT_EQ(code1[0].op.imm, 0);
+    EXPECT_EQ(code1[1].op.instr, Instr::end);
+}
+
+TEST(code_layout, structural_instructions_dropped)
+{
+    // block nop loop end end end
+    const auto module = layout_single_function("02400103400b0b0b"_bytes);
+    const auto* const code = get_code_words(module, module.codesec[0]);
+    EXPECT_EQ(code[0].op.instr, Instr::end);
+}
+
+TEST(code_layout, br)
+{
+    // block br 0 end end
+    const auto module = layout_single_function("02400c000b0b"_bytes);
+    const auto* const code = get_code_words(module, module.codesec[0]);
+    EXPECT_EQ(code[0].op.instr, Instr::br);
+    EXPECT_EQ(code[0].op.arity, 0);
+    EXPECT_EQ(code[0].op.imm, 0);
+    EXPECT_EQ(code[1].target, &code[2]);
+    EXPECT_EQ(code[2].op.instr, Instr::end);
+}
+
+TEST(code_layout, br_loop)
+{
+    // loop br 0 end end
+    const auto module = layout_single_function("03400c000b0b"_bytes);
+    const auto* const code = get_code_words(module, module.codesec[0]);
+    EXPECT_EQ(code[0].op.instr, Instr::br);
+    EXPECT_EQ(code[1].target, &code[0]);
+    EXPECT_EQ(code[2].op.instr, Instr::end);
+}
+
+TEST(code_layout, if_else)
+{
+    // i32.const 0 if nop else nop end end
+    const auto module = layout_single_function("410004400105010b0b"_bytes);
+    const auto* const code = get_code_words(module, module.codesec[0]);
+    EXPECT_EQ(code[0].op.instr, Instr::i32_const);
+    EXPECT_EQ(code[1].op.instr, Instr::if_);
+    EXPECT_EQ(code[2].target, &code[5]);
+    EXPECT_EQ(code[3].op.instr, Instr::else_);
+    EXPECT_EQ(code[4].target, &code[5]);
+    EXPECT_EQ(code[5].op.instr, Instr::end);
+}
+
+TEST(code_layout, br_table)
+{
+    // block i32.const 0 br_table 0 0 end end
+    const auto module = layout_single_function("024041000e0100000b0b"_bytes);
+    const auto* const code = get_code_words(module, module.codesec[0]);
+    EXPECT_EQ(code[0].op.instr, Instr::i32_const);
+    EXPECT_EQ(code[1].op.instr, Instr::br_table);
+    EXPECT_EQ(code[1].op.imm, 1);
+    EXPECT_EQ(code[2].op.instr, Instr::br);
+    EXPECT_EQ(code[3].target, &code[6]);
+    EXPECT_EQ(code[4].op.instr, Instr::br);
+    EXPECT_EQ(code[5].target, &code[6]);
+    EXPECT_EQ(code[6].op.instr, Instr::end);
+}
+
+TEST(code_layout, i64_const)
+{
+    // i64.const -1 drop end
+    const auto module = layout_single_function("427f1a0b"_bytes);
+    const auto* const code = get_code_words(module, module.codesec[0]);
+    EXPECT_EQ(code[0].op.instr, Instr::i64_const);
+    EXPECT_EQ(code[1].value, uint64_t(-1));
+    EXPECT_EQ(code[2].op.instr, Instr::drop);
+    EXPECT_EQ(code[3].op.instr, Instr::end);
+}
+
+TEST(code_layout, copy_is_empty)
+{
+    auto module = parse(wasm_two_functions);
+    layout_code(module);
+    ASSERT_FALSE(module.code_image.empty());
+
+    const auto copy = module;
+    EXPECT_TRUE(copy.code_image.empty());
+
+    const auto moved = std::move(module);
+    EXPECT_FALSE(moved.code_image.empty());
+}
+
+TEST(code_layout, copy_code_image)
+{
+    // block i32.const 0 br_table 0 0 end end
+    const auto module = layout_single_function("024041000e0100000b0b"_bytes);
+    auto copy = module;
+    copy_code_image(module, copy);
+    ASSERT_EQ(copy.code_image.size(), module.code_image.size());
+    const auto* const code = get_code_words(copy, copy.codesec[0]);
+    EXPECT_EQ(code[1].op.instr, Instr::br_table);
+    EXPECT_EQ(code[3].target, &code[6]);
+    EXPECT_EQ(code[5].target, &code[6]);
+}
+
+TEST(code_layout, execute_copied_code_image)
+{
+    // loop local.get 1 local.get 0 i32.add local.set 1
+    //   local.get 0 i32.const 1 i32.sub local.tee 0 br_if 0
+    // end local.get 1 end
+    const auto sum = "0340200120006a2101200041016b22000d000b" "20010b"_bytes;
+
+    Module copy;
+    {
+        auto module = make_module({{i32_param_i32_result, 1, sum}});
+        layout_code(module);
+        copy = module;
+        copy_code_image(module, copy);
+    }
+    // The copied code is not laid out again, and does not refer to the destroyed module.
+    const auto* const image = copy.code_image.data();
+    auto instance = instantiate(std::move(copy), {}, {}, {}, {}, {false, {}});
+    EXPECT_EQ(instance->module.code_image.data(), image);
+    EXPECT_THAT(execute(*instance, 0, {4}), Result(10));
+}
+
+TEST(code_layout, hot_functions_first)
+{
+    /* wat2wasm
+    (func)
+    (func)
+    (func)
+    (func)
+    */
+    const auto wasm =
+        from_hex("0061736d01000000010401600000030504000000000a0d0402000b02000b02000b02000b");
+    auto module = parse(wasm);
+    ASSERT_EQ(module.codesec.size(), 4);
+
+    constexpr auto line = CacheLineSize / sizeof(CodeWord);
+    layout_code(module, {true, {0, 7, 0, 9}});
+    EXPECT_EQ(module.codesec[3].image_offset, 0 * line);
+    EXPECT_EQ(module.codesec[1].image_offset, 1 * line);
+    EXPECT_EQ(module.codesec[0].image_offset, 2 * line);
+    EXPECT_EQ(module.codesec[2].image_offset, 3 * line);
+
+    // Without the profile data the original order is restored.
+    layout_code(module);
+    for (size_t i = 0; i < module.codesec.size(); ++i)
+        EXPECT_EQ(module.codesec[i].image_offset, i * line);
+}
+
+TEST(code_layout, execute_after_relayout)
+{
+    auto instance = instantiate(parse(wasm_two_functions));
+    EXPECT_THAT(execute(*instance, 1, {}), Result(0x2a002a));
+
+    layout_code(instance->module, {true, {1, 1000}});
+    EXPECT_EQ(instance->module.codesec[1].image_offset, 0);
+    EXPECT_THAT(execute(*instance, 1, {}), Result(0x2a002a));
+    EXPECT_THAT(execute(*instance, 0, {}), Result(0x2a002a));
+}
+
+TEST(code_layout, frame_bounds)
+{
+    /* wat2wasm
+    (type (func (param i32) (result i32)))
+    (type (func (result i32)))
+    (import "m" "g" (func (type 1)))
+    (table 0 funcref)
+    (func (type 0) (call 2 (local.get 0)))
+    (func (type 0) (local i64) (i32.mul (local.get 0) (i32.const 2)))
+    (func (type 1) (call 3))
+    (func (type 1) (call 0))
+    (func (type 1) (call_indirect (type 1) (i32.const 0)))
+    */
+    const auto wasm = from_hex(
+        "0061736d01000000010a0260017f017f6000017f020701016d0167000103060500000101010404017000000a24"
+        "050600200010020b0901017e200041026c0b040010030b040010000b070041001101000b");
+    auto module = parse(wasm);
+    layout_code(module, {false, {}});
+    ASSERT_EQ(module.codesec.size(), 5);
+
+    // The frame of 1 argument and 1 stack item, and the frame of the called function.
+    ASSERT_TRUE(module.codesec[0].image_frame_bound.has_value());
+    EXPECT_EQ(module.codesec[0].image_frame_bound->frame_size, 6);
+    EXPECT_EQ(module.codesec[0].image_frame_bound->call_depth, 1);
+
+    // The frame of 1 argument, 1 local and 2 stack items.
+    ASSERT_TRUE(module.codesec[1].image_frame_bound.has_value());
+    EXPECT_EQ(module.codesec[1].image_frame_bound->frame_size, 4);
+    EXPECT_EQ(module.codesec[1].image_frame_bound->call_depth, 0);
+
+    // The recursive call.
+    EXPECT_FALSE(module.codesec[2].image_frame_bound.has_value());
+
+    // The imported function adds to the call depth only.
+    ASSERT_TRUE(module.codesec[3].image_frame_bound.has_value());
+    EXPECT_EQ(module.codesec[3].image_frame_bound->frame_size, 1);
+    EXPECT_EQ(module.codesec[3].image_frame_bound->call_depth, 1);
+
+    // The indirect call.
+    EXPECT_FALSE(module.codesec[4].image_frame_bound.has_value());
+}
+
+TEST(code_layout, compile_function_osr_entries)
+{
+    // i32.const 1 drop loop loop i32.const 0 br_if 1 end end end
+    const auto module = layout_single_function("41011a0340034041000d010b0b0b"_bytes);
+    const auto compiled = compile_function(module, 0);
+
+    // Both loops start at the same instruction, which is the final end in the optimized code.
+    ASSERT_EQ(compiled.image.size(), 1);
+    EXPECT_EQ(compiled.image[0].op.instr, Instr::end);
+    ASSERT_EQ(compiled.osr_entries.size(), 1);
+    EXPECT_EQ(compiled.osr_entries[0].first, 2);
+    EXPECT_EQ(compiled.osr_entries[0].second, 0);
+
+    EXPECT_EQ(find_osr_entry(compiled, 2), compiled.image.data());
+    EXPECT_EQ(find_osr_entry(compiled, 0), nullptr);
+    EXPECT_EQ(find_osr_entry(compiled, 3), nullptr);
+}
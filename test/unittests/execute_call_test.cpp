@@ -2,6 +2,7 @@
 // Copyright 2019-2020 The Fizzy Authors.
 // SPDX-License-Identifier: Apache-2.0
 
+#include "code_layout.hpp"
 #include "execute.hpp"
 #include "limits.hpp"
 #include "parser.hpp"
@@ -475,10 +476,46 @@ TEST(execute_call, call_max_depth)
     const auto module = parse(bin);
     auto instance = instantiate(module);
 
+    // The inlined call does not count towards the call depth limit.
+    EXPECT_THAT(execute(*instance, 1, {}, 2048), Result(42));
+
+    layout_code(instance->module, {false, {}});
     EXPECT_THAT(execute(*instance, 0, {}, 2048), Result(42));
     EXPECT_THAT(execute(*instance, 1, {}, 2048), Traps());
 }
 
+TEST(execute_call, call_preallocated_frames)
+{
+    /* wat2wasm
+    (func (param i32) (result i32) (i32.add (i32.const 10) (call 1 (local.get 0))))
+    (func (param i32) (result i32)
+      (drop (i32.const 7)) (drop (i32.const 7)) (drop (i32.const 7))
+      (i32.mul (call 2 (local.get 0)) (i32.const 2))
+    )
+    (func (param i32) (result i32) (local i32)
+      (i32.add (i32.add (local.get 0) (local.get 1)) (i32.const 3))
+    )
+    */
+    const auto wasm = from_hex(
+        "0061736d0100000001060160017f017f0304030000000a2b030900410a200010016a0b12004107410741071a"
+        "1a1a2000100241026c0b0c01017f200020016a41036a0b");
+    auto instance = instantiate(parse(wasm));
+    layout_code(instance->module, {false, {}});
+
+    const auto& bound = instance->module.codesec[0].image_frame_bound;
+    ASSERT_TRUE(bound.has_value());
+    EXPECT_EQ(bound->frame_size, 11);
+    EXPECT_EQ(bound->call_depth, 2);
+
+    // The frame of the last function reuses the stack of the caller,
+    // where the values dropped before are, but its local is still zero.
+    EXPECT_THAT(execute(*instance, 0, {4}), Result(24));
+
+    // The call path deeper than the limit is executed with the checked calls.
+    EXPECT_THAT(execute(*instance, 0, {4}, CallStackLimit - 2), Result(24));
+    EXPECT_THAT(execute(*instance, 0, {4}, CallStackLimit - 1), Traps());
+}
+
 // A regression test for incorrect number of arguments passed to a call.
 TEST(execute_call, call_nonempty_stack)
 {
@@ -8,6 +8,7 @@
 #include <gtest/gtest.h>
 #include <test/utils/asserts.hpp>
 #include <test/utils/hex.hpp>
+#include <thread>
 
 using namespace fizzy;
 using namespace testing;
@@ -316,7 +317,8 @@ TEST(execute, i32_load_all_variants)
 
     auto& load_instr = module.codesec[0].instructions[1];
     ASSERT_EQ(load_instr, Instr::i32_load);
-    ASSERT_EQ(module.codesec[0].immediates.substr(4), "00000000"_bytes);  // load offset.
+    // Load offset.
+    ASSERT_EQ(bytes_view{module.codesec[0].immediates}.substr(4), "00000000"_bytes);
 
     const auto memory_fill = "deb0b1b2b3ed"_bytes;
 
@@ -354,7 +356,8 @@ TEST(execute, i64_load_all_variants)
 
     auto& load_instr = module.codesec[0].instructions[1];
     ASSERT_EQ(load_instr, Instr::i64_load);
-    ASSERT_EQ(module.codesec[0].immediates.substr(4), "00000000"_bytes);  // load offset.
+    // Load offset.
+    ASSERT_EQ(bytes_view{module.codesec[0].immediates}.substr(4), "00000000"_bytes);
 
     const auto memory_fill = "deb0b1b2b3b4b5b6b7ed"_bytes;
 
@@ -465,7 +468,8 @@ TEST(execute, i32_store_all_variants)
 
     auto& store_instr = module.codesec[0].instructions[2];
     ASSERT_EQ(store_instr, Instr::i32_store);
-    ASSERT_EQ(module.codesec[0].immediates.substr(8), "00000000"_bytes);  // store offset
+    // Store offset
+    ASSERT_EQ(bytes_view{module.codesec[0].immediates}.substr(8), "00000000"_bytes);
 
     const std::tuple<Instr, bytes> test_cases[]{
         {Instr::i32_store8, "ccb0cccccccc"_bytes},
@@ -501,7 +505,8 @@ TEST(execute, i64_store_all_variants)
 
     auto& store_instr = module.codesec[0].instructions[2];
     ASSERT_EQ(store_instr, Instr::i64_store);
-    ASSERT_EQ(module.codesec[0].immediates.substr(8), "00000000"_bytes);  // store offset
+    // Store offset
+    ASSERT_EQ(bytes_view{module.codesec[0].immediates}.substr(8), "00000000"_bytes);
 
     const std::tuple<Instr, bytes> test_cases[]{
         {Instr::i64_store8, "ccb0cccccccccccccccc"_bytes},
@@ -1054,3 +1059,148 @@ TEST(execute, stack_abuse)
 
     EXPECT_THAT(execute(parse(wasm), 0, {1000}), Result(1136));
 }
+
+TEST(execute, execute_batch)
+{
+    /* wat2wasm
+    (func (param i64 i64) (result i64) (i64.rem_u (local.get 0) (local.get 1)))
+    */
+    const auto wasm =
+        from_hex("0061736d0100000001070160027e7e017e030201000a0901070020002001820b");
+    auto instance = instantiate(parse(wasm));
+
+    const uint64_t args[]{20, 3, 23, 5, 7, 1};
+    uint64_t results[3]{};
+    EXPECT_EQ(execute_batch(*instance, 0, args, 3, results), 3);
+    EXPECT_THAT(results, ElementsAre(2, 3, 0));
+
+    // The execution stops at the trapping call.
+    const uint64_t trapping_args[]{9, 4, 1, 0, 7, 2};
+    uint64_t trapping_results[3]{};
+    EXPECT_EQ(execute_batch(*instance, 0, trapping_args, 3, trapping_results), 1);
+    EXPECT_THAT(trapping_results, ElementsAre(1, 0, 0));
+
+    EXPECT_EQ(execute_batch(*instance, 0, nullptr, 0, nullptr), 0);
+}
+
+TEST(execute, execute_batch_recursive)
+{
+    /* wat2wasm
+    (func $factorial (param i64) (result i64)
+      (if (i64.eqz (local.get 0)) (then (return (i64.const 1))))
+      (i64.mul (local.get 0) (call $factorial (i64.sub (local.get 0) (i64.const 1)))))
+    */
+    const auto wasm = from_hex(
+        "0061736d0100000001060160017e017e030201000a17011500200050044042010f0b2000200042017d10007e"
+        "0b");
+    auto instance = instantiate(parse(wasm));
+    ASSERT_FALSE(instance->module.codesec[0].image_frame_bound.has_value());
+
+    const uint64_t args[]{0, 1, 5, 20, 3};
+    uint64_t results[5]{};
+    EXPECT_EQ(execute_batch(*instance, 0, args, 5, results), 5);
+    EXPECT_THAT(results, ElementsAre(1, 1, 120, 2432902008176640000, 6));
+}
+
+TEST(execute, execute_batch_imported_function)
+{
+    /* wat2wasm
+    (import "mod" "foo" (func (param i32 i32) (result i32)))
+    */
+    const auto wasm = from_hex("0061736d0100000001070160027f7f017f020b01036d6f6403666f6f0000");
+    const auto module = parse(wasm);
+
+    constexpr auto host_foo = [](Instance&, std::vector<uint64_t> args, int) -> execution_result {
+        if (args[1] == 0)
+            return {true, {}};
+        return {false, {args[0] + args[1]}};
+    };
+    auto instance = instantiate(module, {{host_foo, module.typesec[0]}});
+
+    const uint64_t args[]{20, 22, 1, 2, 3, 0};
+    uint64_t results[3]{};
+    EXPECT_EQ(execute_batch(*instance, 0, args, 3, results), 2);
+    EXPECT_THAT(results, ElementsAre(42, 3, 0));
+}
+
+TEST(execute, interrupt)
+{
+    /* wat2wasm
+    (func $set (import "env" "set"))
+    (func $spin (loop (br 0)))
+    (func (call $set) (call $f))
+    (func $f (call $set))
+    (func (param i32 i32) (result i32) (i32.add (local.get 0) (local.get 1)))
+    */
+    const auto wasm = from_hex(
+        "0061736d01000000010a0260000060027f7f017f020b0103656e76037365740000030504000000010a1d0407"
+        "0003400c000b0b0600100010030b040010000b0700200020016a0b");
+    const auto module = parse(wasm);
+
+    constexpr auto host_set = [](Instance& instance, std::vector<uint64_t>, int) {
+        instance.interrupt_requested = true;
+        return execution_result{false, {}};
+    };
+    auto instance = instantiate(module, {{host_set, module.typesec[0]}});
+
+    // The infinite loop is interrupted by another thread.
+    std::thread watchdog{[&instance] {
+        std::this_thread::sleep_for(std::chrono::milliseconds{10});
+        instance->interrupt_requested = true;
+    }};
+    EXPECT_THAT(execute(*instance, 1, {}), Interrupted());
+    watchdog.join();
+
+    // The executions trap until the flag is cleared.
+    EXPECT_THAT(execute(*instance, 4, {1, 2}), Interrupted());
+    instance->interrupt_requested = false;
+    EXPECT_THAT(execute(*instance, 4, {1, 2}), Result(3));
+
+    // The interrupt is checked at the call of the function which is not inlined.
+    EXPECT_THAT(execute(*instance, 2, {}), Interrupted());
+    instance->interrupt_requested = false;
+
+    // The other traps are not interrupts.
+    const auto trap = execute(*instance, 4, {}, CallStackLimit + 1);
+    EXPECT_THAT(trap, Traps());
+    EXPECT_FALSE(trap.interrupted);
+}
+
+TEST(execute, interrupt_trap_kind)
+{
+    /* wat2wasm
+    (func $set (import "env" "set"))
+    (func $run (import "env" "run"))
+    (func (call $set) unreachable)
+    (func (call $run))
+    (func)
+    */
+    const auto wasm = from_hex(
+        "0061736d0100000001040160000002150203656e7603736574000003656e760372756e00000304030000000a"
+        "0f0305001000000b040010010b02000b");
+    const auto module = parse(wasm);
+
+    constexpr auto host_set = [](Instance& instance, std::vector<uint64_t>, int) {
+        instance.interrupt_requested = true;
+        return execution_result{false, {}};
+    };
+    // Executes the function interrupted at the entry, and clears the flag before returning.
+    constexpr auto host_run = [](Instance& instance, std::vector<uint64_t>, int depth) {
+        instance.interrupt_requested = true;
+        const auto result = execute(instance, 4, {}, depth + 1);
+        instance.interrupt_requested = false;
+        return result;
+    };
+    auto instance =
+        instantiate(module, {{host_set, module.typesec[0]}, {host_run, module.typesec[0]}});
+
+    // The trap of unreachable is not the interrupt, even though the flag is set.
+    const auto trap = execute(*instance, 2, {});
+    EXPECT_THAT(trap, Traps());
+    EXPECT_FALSE(trap.interrupted);
+    instance->interrupt_requested = false;
+
+    // The interrupt is reported even though the flag is cleared before returning.
+    EXPECT_THAT(execute(*instance, 3, {}), Interrupted());
+    EXPECT_FALSE(instance->interrupt_requested);
+}
@@ -0,0 +1,263 @@
+// Fizzy: A fast WebAssembly interpreter
+// Copyright 2020 The Fizzy Authors.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "green_threads.hpp"
+#include "parser.hpp"
+#include <gmock/gmock.h>
+#include <test/utils/asserts.hpp>
+#include <test/utils/hex.hpp>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+using namespace fizzy;
+using namespace testing;
+
+namespace
+{
+/* wat2wasm
+(func $sum (param $n i32) (result i32) (local $acc i32)
+  (block $done
+    (loop $l
+      (br_if $done (i32.eqz (local.get $n)))
+      (local.set $acc (i32.add (local.get $acc) (local.get $n)))
+      (local.set $n (i32.sub (local.get $n) (i32.const 1)))
+      (br $l)))
+  (local.get $acc))
+*/
+const auto sum_wasm = from_hex(
+    "0061736d0100000001060160017f017f030201000a23012101017f024003402000450d01200120006a2101200041"
+    "016b21000c000b0b20010b");
+
+/* wat2wasm
+(table 1 funcref)
+(elem (i32.const 0) $sum)
+(func $sum (param $n i32) (result i32) (local $acc i32)
+  (block $done
+    (loop $l
+      (br_if $done (i32.eqz (local.get $n)))
+      (local.set $acc (i32.add (local.get $acc) (local.get $n)))
+      (local.set $n (i32.sub (local.get $n) (i32.const 1)))
+      (br $l)))
+  (local.get $acc))
+(func $dispatch (param i32) (result i32) (call_indirect (param i32) (result i32)
+  (local.get 0) (i32.const 0)))
+*/
+const auto sum_indirect_wasm = from_hex(
+    "0061736d0100000001060160017f017f03030200000404017000010907010041000b01000a2d022101017f024003"
+    "402000450d01200120006a2101200041016b21000c000b0b20010b0900200041001100000b");
+
+/* wat2wasm
+(func $read (import "env" "read") (param i32) (result i32))
+(func (param i32) (result i32)
+  (i32.add (call $read (local.get 0)) (call $read (i32.add (local.get 0) (i32.const 1)))))
+*/
+const auto read_wasm = from_hex(
+    "0061736d0100000001060160017f017f020c0103656e7604726561640000030201000a10010e0020001000200041"
+    "016a10006a0b");
+
+/// The thread completing the pending calls of env.read in the order of the calls,
+/// with the result of the argument multiplied by 10.
+class IoThread
+{
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::deque<std::pair<std::shared_ptr<PendingCall>, uint64_t>> m_calls;
+    bool m_stopping = false;
+    std::thread m_thread{[this] { run(); }};
+
+    void run()
+    {
+        std::unique_lock lock{m_mutex};
+        while (true)
+        {
+            m_cv.wait(lock, [this] { return m_stopping || !m_calls.empty(); });
+            if (m_calls.empty())
+                return;
+            auto [call, arg] = std::move(m_calls.front());
+            m_calls.pop_front();
+            lock.unlock();
+            call->complete({false, {arg * 10}});
+            lock.lock();
+        }
+    }
+
+public:
+    ~IoThread()
+    {
+        {
+            const std::lock_guard lock{m_mutex};
+            m_stopping = true;
+        }
+        m_cv.notify_one();
+        m_thread.join();
+    }
+
+    ExternalFunction read_function()
+    {
+        const auto read = [this](Instance&, std::vector<uint64_t> args, int) {
+            {
+                const std::lock_guard lock{m_mutex};
+                m_calls.emplace_back(defer_current_call(), args[0]);
+            }
+            m_cv.notify_one();
+            return execution_result{true, {}};
+        };
+        return {read, FuncType{{ValType::i32}, {ValType::i32}}};
+    }
+};
+
+/// The instances of the module, one per green thread.
+struct Instances
+{
+    std::vector<std::unique_ptr<Instance>> instances;
+    LaneCode code;
+
+    Instances(const bytes& wasm, size_t num_instances, std::vector<ExternalFunction> imports = {})
+    {
+        for (size_t i = 0; i < num_instances; ++i)
+            instances.emplace_back(instantiate(parse(wasm), imports));
+        code = compile_lane_code(instances.front()->module);
+    }
+};
+
+/// Spawns the long and then the short green thread on the single worker thread and returns
+/// the arguments of the green threads in the order of the completion.
+std::vector<uint64_t> completion_order(
+    uint64_t quantum, const bytes& wasm = sum_wasm, FuncIdx func_idx = 0)
+{
+    Instances instances{wasm, 2};
+    std::vector<uint64_t> order;
+    {
+        GreenThreadScheduler scheduler{1, quantum};
+        for (const uint64_t n : {uint64_t{1'000'000}, uint64_t{10}})
+        {
+            scheduler.spawn(instances.code, *instances.instances[n == 10 ? 1 : 0], func_idx,
+                {n}, [&order, n](execution_result) { order.emplace_back(n); });
+        }
+        scheduler.wait();
+    }
+    return order;
+}
+}  // namespace
+
+TEST(green_threads, results)
+{
+    constexpr size_t num_threads = 20;
+    Instances instances{sum_wasm, num_threads};
+    std::vector<execution_result> results(num_threads);
+
+    GreenThreadScheduler scheduler{3, 100};
+    EXPECT_EQ(scheduler.get_thread_count(), 3);
+    for (size_t i = 0; i < num_threads; ++i)
+    {
+        scheduler.spawn(instances.code, *instances.instances[i], 0, {i * 100},
+            [&results, i](execution_result result) { results[i] = result; });
+    }
+    scheduler.wait();
+
+    for (uint64_t i = 0; i < num_threads; ++i)
+        EXPECT_THAT(results[i], Result(i * 100 * (i * 100 + 1) / 2)) << "green thread " << i;
+}
+
+TEST(green_threads, preemption)
+{
+    // The short green thread spawned after the long one completes first,
+    // only if the long one is preempted.
+    EXPECT_THAT(completion_order(1000), ElementsAre(10, 1'000'000));
+    EXPECT_THAT(completion_order(std::numeric_limits<uint64_t>::max()), ElementsAre(1'000'000, 10));
+}
+
+TEST(green_threads, preemption_call_indirect)
+{
+    // The long green thread is preempted also in the function called by call_indirect.
+    EXPECT_THAT(completion_order(1000, sum_indirect_wasm, 1), ElementsAre(10, 1'000'000));
+}
+
+TEST(green_threads, stats)
+{
+    Instances instances{sum_wasm, 10};
+    GreenThreadScheduler scheduler{2, 1000};
+    EXPECT_EQ(scheduler.get_stats().num_completed, 0);
+
+    for (auto& instance : instances.instances)
+        scheduler.spawn(instances.code, *instance, 0, {10'000});
+    scheduler.wait();
+
+    const auto stats = scheduler.get_stats();
+    EXPECT_EQ(stats.num_completed, 10);
+    EXPECT_GE(stats.num_preemptions, 10);
+    EXPECT_GT(stats.throughput, 0);
+    EXPECT_GT(stats.latency_p50.count(), 0);
+    EXPECT_LE(stats.latency_p50, stats.latency_p99);
+    EXPECT_LE(stats.latency_p99, stats.latency_max);
+
+    scheduler.reset_stats();
+    EXPECT_EQ(scheduler.get_stats().num_completed, 0);
+    EXPECT_EQ(scheduler.get_stats().num_preemptions, 0);
+}
+
+TEST(green_threads, destructor_waits)
+{
+    Instances instances{sum_wasm, 4};
+    std::vector<uint64_t> results;
+    {
+        GreenThreadScheduler scheduler{1, 10};
+        for (auto& instance : instances.instances)
+        {
+            scheduler.spawn(instances.code, *instance, 0, {100},
+                [&results](execution_result result) { results.emplace_back(result.stack.at(0)); });
+        }
+    }
+    EXPECT_THAT(results, ElementsAre(5050, 5050, 5050, 5050));
+}
+
+TEST(green_threads, pending_calls)
+{
+    constexpr size_t num_threads = 100;
+    IoThread io_thread;
+    Instances instances{read_wasm, num_threads, {io_thread.read_function()}};
+    std::vector<execution_result> results(num_threads);
+
+    GreenThreadScheduler scheduler{1};
+    for (size_t i = 0; i < num_threads; ++i)
+    {
+        scheduler.spawn(instances.code, *instances.instances[i], 1, {i},
+            [&results, i](execution_result result) { results[i] = result; });
+    }
+    scheduler.wait();
+
+    for (uint64_t i = 0; i < num_threads; ++i)
+        EXPECT_THAT(results[i], Result(i * 10 + (i + 1) * 10)) << "green thread " << i;
+
+    const auto stats = scheduler.get_stats();
+    EXPECT_EQ(stats.num_completed, num_threads);
+    EXPECT_LE(stats.num_waits, 2 * num_threads);
+}
+
+TEST(green_threads, host_function_exception)
+{
+    constexpr size_t num_threads = 3;
+    const auto throwing_read = [](Instance&, std::vector<uint64_t>, int) -> execution_result {
+        throw std::runtime_error{"read failed"};
+    };
+    Instances instances{read_wasm, num_threads,
+        {{throwing_read, FuncType{{ValType::i32}, {ValType::i32}}}}};
+    std::vector<execution_result> results(num_threads, execution_result{false, {}});
+
+    GreenThreadScheduler scheduler{1};
+    for (size_t i = 0; i < num_threads; ++i)
+    {
+        scheduler.spawn(instances.code, *instances.instances[i], 1, {i},
+            [&results, i](execution_result result) { results[i] = result; });
+    }
+    // The green threads interrupted by the exception complete, so the wait does not hang.
+    scheduler.wait();
+
+    for (const auto& result : results)
+        EXPECT_THAT(result, Traps());
+    EXPECT_EQ(scheduler.get_stats().num_completed, num_threads);
+}
@@ -0,0 +1,349 @@
+// Fizzy: A fast WebAssembly interpreter
+// Copyright 2020 The Fizzy Authors.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "code_layout.hpp"
+#include "execute.hpp"
+#include "idioms.hpp"
+#include "limits.hpp"
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <test/utils/asserts.hpp>
+#include <test/utils/hex.hpp>
+#include <test/utils/lowered_code_utils.hpp>
+#include <cstring>
+
+using namespace fizzy;
+using namespace fizzy::test;
+using namespace testing;
+
+namespace
+{
+/// Lowers the code of the function and recognizes the memory loops.
+LoweredCode recognize(const bytes& expr_binary, FuncType func_type)
+{
+    const auto module = make_single_function_module(expr_binary, std::move(func_type), 1);
+    auto lowered_code = lower_code(module.codesec[0]);
+    recognize_memory_loops(lowered_code);
+    return lowered_code;
+}
+
+Instr get_first_instruction(const Instance& instance)
+{
+    return instance.module.code_image[instance.module.codesec[0].image_offset].op.instr;
+}
+
+// loop
+//   local.get 0 local.get 2 i32.store8
+//   local.get 0 i32.const 1 i32.add local.set 0
+//   local.get 1 i32.const -1 i32.add local.tee 1 br_if 0
+// end local.get 0 end
+const auto fill8 =
+    "0340" "200020023a0000" "200041016a2100" "2001417f6a22010d00" "0b" "20000b"_bytes;
+const FuncType fill8_type{{ValType::i32, ValType::i32, ValType::i32}, {ValType::i32}};
+
+// loop
+//   local.get 0 local.get 1 i32.load i32.store
+//   local.get 1 i32.const 4 i32.add local.set 1
+//   local.get 0 i32.const 4 i32.add local.tee 0 local.get 2 i32.lt_u br_if 0
+// end local.get 0 end
+const auto copy32 =
+    "0340" "20002001280200360200" "200141046a2101" "200041046a22002002490d00" "0b" "20000b"_bytes;
+const FuncType copy32_type{{ValType::i32, ValType::i32, ValType::i32}, {ValType::i32}};
+
+// loop
+//   local.get 0 local.get 2 i64.store
+//   local.get 0 local.get 2 i64.store offset=8
+//   local.get 0 i32.const 16 i32.add local.set 0
+//   local.get 1 i32.const -16 i32.add local.tee 1 i32.const 15 i32.gt_u br_if 0
+// end local.get 0 end
+const auto fill64 = "0340" "20002002370300" "20002002370308" "200041106a2100"
+                    "200141706a2201410f4b0d00" "0b" "20000b"_bytes;
+const FuncType fill64_type{{ValType::i32, ValType::i32, ValType::i64}, {ValType::i32}};
+
+// The __multi3 of compiler-rt computing the 128-bit product.
+const auto multi3 =
+    "200020034220882205200142208822067e200320027e7c200420017e7c200342ffffffff0f832203200142ffff"
+    "ffff0f8322017e2204422088200320067e7c22034220887c200342ffffffff0f83200520017e7c22034220887c"
+    "37030820002003422086200442ffffffff0f83843703000b"_bytes;
+// The __multi3 variant with the other locals (7 and 5 instead of 5 and 6 of 3 locals) and
+// the swapped operands of the first a_hi * b_lo multiplication.
+const auto multi3_variant =
+    "200020034220882207200142208822057e200220037e7c200420017e7c200342ffffffff0f832203200142ffff"
+    "ffff0f8322017e2204422088200320057e7c22034220887c200342ffffffff0f83200720017e7c22034220887c"
+    "37030820002003422086200442ffffffff0f83843703000b"_bytes;
+const FuncType multi3_type{
+    {ValType::i32, ValType::i64, ValType::i64, ValType::i64, ValType::i64}, {}};
+
+/// Creates the module with the multiplication function and the function calling it.
+Module make_multi3_module(const bytes& multi3_binary, uint32_t local_count = 2)
+{
+    // local.get 0 local.get 1 local.get 2 local.get 3 local.get 4 call 0 end
+    const auto caller = "20002001200220032004" "10000b"_bytes;
+    return make_module({{multi3_type, local_count, multi3_binary}, {multi3_type, 0, caller}}, 1);
+}
+}  // namespace
+
+TEST(idioms, recognize_fill)
+{
+    const auto code = recognize(fill8, fill8_type);
+    ASSERT_EQ(code.instructions.size(), 15);
+    EXPECT_EQ(code.instructions[0].instr, Instr::memory_loop);
+    EXPECT_EQ(code.instructions[0].value, 0);
+    EXPECT_EQ(code.instructions[0].target, 13);
+    EXPECT_EQ(code.instructions[12].instr, Instr::br_if);
+    EXPECT_EQ(code.instructions[12].target, 1);
+
+    ASSERT_EQ(code.memory_loops.size(), 1);
+    const auto& loop = code.memory_loops[0];
+    EXPECT_EQ(loop.kind, MemoryLoop::Kind::fill);
+    EXPECT_EQ(loop.condition, MemoryLoop::Condition::ne);
+    EXPECT_FALSE(loop.is_bound_local);
+    EXPECT_EQ(loop.width, 1);
+    EXPECT_EQ(loop.dst_local, 0);
+    EXPECT_EQ(loop.src_local, 2);
+    EXPECT_EQ(loop.step, 1);
+    EXPECT_EQ(loop.counter_local, 1);
+    EXPECT_EQ(loop.counter_increment, uint32_t(-1));
+    EXPECT_EQ(loop.bound, 0);
+}
+
+TEST(idioms, recognize_unrolled_fill)
+{
+    const auto code = recognize(fill64, fill64_type);
+    EXPECT_EQ(code.instructions[0].instr, Instr::memory_loop);
+    ASSERT_EQ(code.memory_loops.size(), 1);
+    const auto& loop = code.memory_loops[0];
+    EXPECT_EQ(loop.kind, MemoryLoop::Kind::fill);
+    EXPECT_EQ(loop.condition, MemoryLoop::Condition::gt_u);
+    EXPECT_EQ(loop.width, 8);
+    EXPECT_EQ(loop.step, 16);
+    EXPECT_EQ(loop.counter_local, 1);
+    EXPECT_EQ(loop.counter_increment, uint32_t(-16));
+    EXPECT_EQ(loop.bound, 15);
+}
+
+TEST(idioms, recognize_copy)
+{
+    const auto code = recognize(copy32, copy32_type);
+    EXPECT_EQ(code.instructions[0].instr, Instr::memory_loop);
+    ASSERT_EQ(code.memory_loops.size(), 1);
+    const auto& loop = code.memory_loops[0];
+    EXPECT_EQ(loop.kind, MemoryLoop::Kind::copy);
+    EXPECT_EQ(loop.condition, MemoryLoop::Condition::lt_u);
+    EXPECT_TRUE(loop.is_bound_local);
+    EXPECT_EQ(loop.width, 4);
+    EXPECT_EQ(loop.dst_local, 0);
+    EXPECT_EQ(loop.src_local, 1);
+    EXPECT_EQ(loop.step, 4);
+    EXPECT_EQ(loop.counter_local, 0);
+    EXPECT_EQ(loop.counter_increment, 4);
+    EXPECT_EQ(loop.bound, 2);
+}
+
+TEST(idioms, not_recognized)
+{
+    // The address is increased by 2 after the single byte store.
+    // loop local.get 0 local.get 2 i32.store8 local.get 0 i32.const 2 i32.add local.set 0
+    //   local.get 1 i32.const -1 i32.add local.tee 1 br_if 0 end local.get 0 end
+    const auto gap = recognize(
+        "0340200020023a0000200041026a21002001417f6a22010d000b20000b"_bytes, fill8_type);
+    EXPECT_TRUE(gap.memory_loops.empty());
+    EXPECT_EQ(gap.instructions[0].instr, Instr::local_get);
+
+    // The stored value changes in each iteration.
+    // loop local.get 0 local.get 1 i32.store8 local.get 0 i32.const 1 i32.add local.set 0
+    //   local.get 1 i32.const -1 i32.add local.tee 1 br_if 0 end local.get 0 end
+    const auto variant = recognize(
+        "0340200020013a0000200041016a21002001417f6a22010d000b20000b"_bytes, fill8_type);
+    EXPECT_TRUE(variant.memory_loops.empty());
+
+    // The bound changes in each iteration.
+    // loop local.get 0 local.get 1 i32.load i32.store local.get 1 i32.const 4 i32.add
+    //   local.set 1 local.get 0 i32.const 4 i32.add local.tee 0 local.get 1 i32.lt_u br_if 0
+    // end local.get 0 end
+    const auto moving_bound = recognize(
+        "03402000200128020036020020014104" "6a2101200041046a22002001490d000b20000b"_bytes,
+        copy32_type);
+    EXPECT_TRUE(moving_bound.memory_loops.empty());
+}
+
+TEST(idioms, execute_fill)
+{
+    auto instance = instantiate(make_single_function_module(fill8, fill8_type, 1));
+    EXPECT_EQ(get_first_instruction(*instance), Instr::memory_loop);
+
+    EXPECT_THAT(execute(*instance, 0, {10, 5, 0x12a}), Result(15));
+    const auto& memory = *instance->memory;
+    EXPECT_EQ(memory[9], 0);
+    EXPECT_EQ(memory[10], 0x2a);
+    EXPECT_EQ(memory[14], 0x2a);
+    EXPECT_EQ(memory[15], 0);
+}
+
+TEST(idioms, execute_unrolled_fill)
+{
+    auto instance = instantiate(make_single_function_module(fill64, fill64_type, 1));
+    EXPECT_EQ(get_first_instruction(*instance), Instr::memory_loop);
+
+    EXPECT_THAT(execute(*instance, 0, {8, 40, 0x0102030405060708}), Result(40));
+    const auto& memory = *instance->memory;
+    EXPECT_EQ(memory[7], 0);
+    EXPECT_EQ(memory[8], 0x08);
+    EXPECT_EQ(memory[15], 0x01);
+    EXPECT_EQ(memory[32], 0x08);
+    EXPECT_EQ(memory[39], 0x01);
+    EXPECT_EQ(memory[40], 0);
+}
+
+TEST(idioms, execute_copy)
+{
+    auto instance = instantiate(make_single_function_module(copy32, copy32_type, 1));
+    EXPECT_EQ(get_first_instruction(*instance), Instr::memory_loop);
+
+    auto& memory = *instance->memory;
+    for (uint8_t i = 0; i < 16; ++i)
+        memory[i] = i + 1;
+
+    EXPECT_THAT(execute(*instance, 0, {64, 0, 80}), Result(80));
+    for (uint8_t i = 0; i < 16; ++i)
+        EXPECT_EQ(memory[64 + i], i + 1);
+    EXPECT_EQ(memory[80], 0);
+
+    // The overlapping copy repeats the first 4 bytes as the loop does.
+    EXPECT_THAT(execute(*instance, 0, {4, 0, 16}), Result(16));
+    for (uint8_t i = 0; i < 16; ++i)
+        EXPECT_EQ(memory[i], i % 4 + 1);
+
+    // The copy backwards in the overlapping ranges.
+    EXPECT_THAT(execute(*instance, 0, {0, 2, 8}), Result(8));
+    EXPECT_EQ(memory[0], 3);
+    EXPECT_EQ(memory[7], 2);
+}
+
+TEST(idioms, execute_out_of_bounds)
+{
+    auto instance = instantiate(make_single_function_module(fill8, fill8_type, 1));
+
+    // The loop stores the bytes in bounds before it traps.
+    EXPECT_THAT(execute(*instance, 0, {PageSize - 3, 5, 0x2a}), Traps());
+    const auto& memory = *instance->memory;
+    EXPECT_EQ(memory[PageSize - 4], 0);
+    EXPECT_EQ(memory[PageSize - 3], 0x2a);
+    EXPECT_EQ(memory[PageSize - 1], 0x2a);
+
+    // The counter starting at zero wraps around, so the loop runs until it traps.
+    EXPECT_THAT(execute(*instance, 0, {PageSize - 16, 0, 0x2b}), Traps());
+    EXPECT_EQ(memory[PageSize - 16], 0x2b);
+    EXPECT_EQ(memory[PageSize - 1], 0x2b);
+}
+
+TEST(idioms, execute_same_as_unoptimized)
+{
+    auto instance = instantiate(make_single_function_module(copy32, copy32_type, 1));
+    auto unoptimized = instantiate(make_single_function_module(copy32, copy32_type, 1));
+    layout_code(unoptimized->module, {false, {}});
+    EXPECT_NE(get_first_instruction(*unoptimized), Instr::memory_loop);
+
+    for (auto* inst : {instance.get(), unoptimized.get()})
+    {
+        for (uint32_t i = 0; i < 64; ++i)
+            (*inst->memory)[i] = static_cast<uint8_t>(i * 7);
+    }
+
+    for (const auto& args : std::vector<std::vector<uint64_t>>{
+             {32, 0, 48}, {0, 8, 4}, {3, 1, 20}, {100, 40, 90}, {PageSize - 8, 0, PageSize}})
+    {
+        const auto result = execute(*instance, 0, args);
+        const auto expected = execute(*unoptimized, 0, args);
+        EXPECT_EQ(result.trapped, expected.trapped);
+        EXPECT_EQ(result.stack, expected.stack);
+        EXPECT_EQ(*instance->memory, *unoptimized->memory);
+    }
+}
+
+TEST(idioms, fuse_add_carry)
+{
+    // local.get 0 local.get 1 i64.add local.tee 2 local.get 0 i64.lt_u i64.extend_i32_u
+    // local.get 2 i64.add end
+    const FuncType type{{ValType::i64, ValType::i64, ValType::i64}, {ValType::i64}};
+    auto module =
+        make_single_function_module("20002001" "7c22022000" "54ad20027c0b"_bytes, type, 1);
+    auto code = lower_code(module.codesec[0]);
+    fuse_carry_chains(module, code);
+    ASSERT_EQ(code.instructions.size(), 6);
+    EXPECT_EQ(code.instructions[2].instr, Instr::i64_add_carry);
+    EXPECT_EQ(code.instructions[2].imm, 2);
+    EXPECT_EQ(code.instructions[2].value, 0);
+    EXPECT_EQ(code.instructions[3].instr, Instr::local_get);
+
+    auto instance = instantiate(std::move(module));
+    const auto* const code_words =
+        instance->module.code_image.data() + instance->module.codesec[0].image_offset;
+    EXPECT_EQ(code_words[2].op.instr, Instr::i64_add_carry);
+    EXPECT_THAT(execute(*instance, 0, {1, 2, 0}), Result(3));
+    EXPECT_THAT(execute(*instance, 0, {uint64_t(-1), 2, 0}), Result(2));
+    EXPECT_THAT(execute(*instance, 0, {uint64_t(-1), uint64_t(-1), 0}), Result(uint64_t(-1)));
+}
+
+TEST(idioms, fuse_multi3)
+{
+    const auto module = make_multi3_module(multi3);
+    auto caller = lower_code(module.codesec[1]);
+    fuse_carry_chains(module, caller);
+    EXPECT_EQ(caller.instructions[5].instr, Instr::i128_mul_store);
+
+    // The function with i64.const 33 instead of i64.const 32 is not __multi3.
+    auto other = multi3;
+    other[5] = 0x21;
+    const auto other_module = make_multi3_module(other);
+    auto other_caller = lower_code(other_module.codesec[1]);
+    fuse_carry_chains(other_module, other_caller);
+    EXPECT_EQ(other_caller.instructions[5].instr, Instr::call);
+
+    // The function computing the same with other locals and operand order is __multi3.
+    const auto variant_module = make_multi3_module(multi3_variant, 3);
+    auto variant_caller = lower_code(variant_module.codesec[1]);
+    fuse_carry_chains(variant_module, variant_caller);
+    EXPECT_EQ(variant_caller.instructions[5].instr, Instr::i128_mul_store);
+}
+
+TEST(idioms, execute_multi3)
+{
+    for (const auto& [multi3_binary, local_count] :
+        {std::pair{multi3, 2u}, std::pair{multi3_variant, 3u}})
+    {
+        auto instance = instantiate(make_multi3_module(multi3_binary, local_count));
+        const auto* const code_words =
+            instance->module.code_image.data() + instance->module.codesec[1].image_offset;
+        EXPECT_EQ(code_words[5].op.instr, Instr::i128_mul_store);
+
+        const auto& memory = *instance->memory;
+        const auto load = [&memory](size_t address) {
+            uint64_t value;
+            std::memcpy(&value, memory.data() + address, sizeof(value));
+            return value;
+        };
+
+        // The fused and the original multiplication give the same results.
+        for (const auto& args : std::vector<std::vector<uint64_t>>{
+                 {0, 0xfedcba9876543210, 0x0123456789abcdef, 0xffffffffffffffff,
+                     0x8000000000000001},
+                 {0, 0xffffffffffffffff, 0, 0xffffffffffffffff, 0}, {0, 3, 0, 5, 0}})
+        {
+            EXPECT_THAT(execute(*instance, 0, args), Result());
+            const auto expected_lo = load(0);
+            const auto expected_hi = load(8);
+            auto caller_args = args;
+            caller_args[0] = 16;
+            EXPECT_THAT(execute(*instance, 1, caller_args), Result());
+            EXPECT_EQ(load(16), expected_lo);
+            EXPECT_EQ(load(24), expected_hi);
+        }
+        EXPECT_EQ(load(32), 0);
+
+        // The high half is stored first, so nothing is stored if it is out of bounds.
+        EXPECT_THAT(execute(*instance, 1, {PageSize - 8, 1, 0, 1, 0}), Traps());
+        EXPECT_EQ(load(PageSize - 8), 0);
+    }
+}
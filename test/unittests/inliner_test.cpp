@@ -0,0 +1,181 @@
+// Fizzy: A fast WebAssembly interpreter
+// Copyright 2020 The Fizzy Authors.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "execute.hpp"
+#include "inliner.hpp"
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <test/utils/asserts.hpp>
+#include <test/utils/hex.hpp>
+#include <test/utils/lowered_code_utils.hpp>
+
+using namespace fizzy;
+using namespace fizzy::test;
+using namespace testing;
+
+namespace
+{
+/// Lowers the code of all module's functions and inlines the calls.
+std::vector<LoweredCode> lower_and_inline(const Module& module)
+{
+    std::vector<LoweredCode> codes;
+    for (const auto& code : module.codesec)
+        codes.emplace_back(lower_code(code));
+    inline_calls(module, codes);
+    return codes;
+}
+}  // namespace
+
+TEST(inliner, inline_call)
+{
+    const auto module = make_module({
+        // local.get 0 local.get 1 i32.add end
+        {{{ValType::i32, ValType::i32}, {ValType::i32}}, 0, "200020016a0b"_bytes},
+        // local.get 0 i32.const 1 call 0 end
+        {{{ValType::i32}, {ValType::i32}}, 0, "2000410110000b"_bytes},
+    });
+
+    const auto codes = lower_and_inline(module);
+    const auto& caller = codes[1];
+    EXPECT_THAT(get_instructions(caller),
+        ElementsAreArray({Instr::local_get, Instr::i32_const, Instr::local_set, Instr::local_set,
+            Instr::local_get, Instr::local_get, Instr::i32_add, Instr::end}));
+    EXPECT_EQ(caller.instructions[2].imm, 2);
+    EXPECT_EQ(caller.instructions[3].imm, 1);
+    EXPECT_EQ(caller.instructions[4].imm, 1);
+    EXPECT_EQ(caller.instructions[5].imm, 2);
+    EXPECT_EQ(caller.local_count, 2);
+    EXPECT_EQ(caller.max_stack_height, 2);
+
+    // The callee is not changed.
+    EXPECT_THAT(get_instructions(codes[0]),
+        ElementsAreArray({Instr::local_get, Instr::local_get, Instr::i32_add, Instr::end}));
+}
+
+TEST(inliner, locals_initialized)
+{
+    const auto module = make_module({
+        // local.get 0 local.tee 1 drop end
+        {{{ValType::i32}, {}}, 2, "200022011a0b"_bytes},
+        // i32.const 1 call 0 end
+        {{{}, {}}, 0, "410110000b"_bytes},
+    });
+
+    const auto codes = lower_and_inline(module);
+    const auto& caller = codes[1];
+    EXPECT_THAT(get_instructions(caller),
+        ElementsAreArray({Instr::i32_const, Instr::local_set, Instr::i32_const, Instr::local_set,
+            Instr::i32_const, Instr::local_set, Instr::local_get, Instr::local_tee, Instr::drop,
+            Instr::end}));
+    EXPECT_EQ(caller.instructions[1].imm, 0);
+    EXPECT_EQ(caller.instructions[3].imm, 1);
+    EXPECT_EQ(caller.instructions[5].imm, 2);
+    EXPECT_EQ(caller.local_count, 3);
+}
+
+TEST(inliner, branches_adjusted)
+{
+    const auto module = make_module({
+        // local.get 0 return end
+        {{{ValType::i32}, {ValType::i32}}, 0, "20000f0b"_bytes},
+        // i32.const 7 i32.const 5 call 0 i32.add end
+        {{{}, {ValType::i32}}, 0, "4107410510006a0b"_bytes},
+    });
+
+    const auto codes = lower_and_inline(module);
+    const auto& caller = codes[1];
+    EXPECT_THAT(get_instructions(caller),
+        ElementsAreArray({Instr::i32_const, Instr::i32_const, Instr::local_set, Instr::local_get,
+            Instr::br, Instr::i32_add, Instr::end}));
+    const auto& br = caller.instructions[4];
+    EXPECT_EQ(br.target, 5);
+    EXPECT_EQ(br.imm, 1);
+    EXPECT_EQ(br.arity, 1);
+    EXPECT_EQ(caller.max_stack_height, 2);
+}
+
+TEST(inliner, caller_branches_adjusted)
+{
+    const auto module = make_module({
+        // end
+        {{{}, {}}, 0, "0b"_bytes},
+        // block call 0 local.get 0 br_if 0 call 0 end end
+        {{{ValType::i32}, {}}, 0, "0240100020000d0010000b0b"_bytes},
+    });
+
+    const auto codes = lower_and_inline(module);
+    const auto& caller = codes[1];
+    EXPECT_THAT(
+        get_instructions(caller), ElementsAreArray({Instr::local_get, Instr::br_if, Instr::end}));
+    EXPECT_EQ(caller.instructions[1].target, 2);
+}
+
+TEST(inliner, non_leaf_not_inlined)
+{
+    const auto module = make_module({
+        // local.get 0 call 0 end
+        {{{ValType::i32}, {}}, 0, "200010000b"_bytes},
+        // i32.const 0 call 0 end
+        {{{}, {}}, 0, "410010000b"_bytes},
+    });
+
+    const auto codes = lower_and_inline(module);
+    EXPECT_THAT(
+        get_instructions(codes[0]), ElementsAreArray({Instr::local_get, Instr::call, Instr::end}));
+    EXPECT_THAT(
+        get_instructions(codes[1]), ElementsAreArray({Instr::i32_const, Instr::call, Instr::end}));
+}
+
+TEST(inliner, large_function_not_inlined)
+{
+    bytes large_expr;
+    for (size_t i = 0; i < MaxInlinedFunctionSize / 2 + 1; ++i)
+        large_expr += "41001a"_bytes;  // i32.const 0 drop
+    large_expr += "0b"_bytes;
+
+    const auto module = make_module({
+        {{{}, {}}, 0, large_expr},
+        // call 0 end
+        {{{}, {}}, 0, "10000b"_bytes},
+    });
+
+    const auto codes = lower_and_inline(module);
+    EXPECT_THAT(get_instructions(codes[1]), ElementsAreArray({Instr::call, Instr::end}));
+}
+
+TEST(inliner, budget)
+{
+    // The function of the maximum inlined size.
+    bytes expr;
+    for (size_t i = 0; i < MaxInlinedFunctionSize / 2; ++i)
+        expr += "41001a"_bytes;  // i32.const 0 drop
+    expr += "0b"_bytes;
+
+    bytes caller_expr;
+    for (size_t i = 0; i < MinInliningBudget / MaxInlinedFunctionSize + 1; ++i)
+        caller_expr += "1000"_bytes;  // call 0
+    caller_expr += "0b"_bytes;
+
+    const auto module = make_module({{{{}, {}}, 0, expr}, {{{}, {}}, 0, caller_expr}});
+
+    const auto codes = lower_and_inline(module);
+    const auto& caller = codes[1];
+    EXPECT_EQ(caller.instructions.size(), MinInliningBudget + 2);
+    EXPECT_EQ(caller.instructions[MinInliningBudget].instr, Instr::call);
+}
+
+TEST(inliner, execute)
+{
+    // The local of the inlined function must be zero on each call.
+    const auto module = make_module({
+        // local.get 1 local.get 0 i32.add local.tee 1 end
+        {{{ValType::i32}, {ValType::i32}}, 1, "200120006a22010b"_bytes},
+        // i32.const 3 call 0 i32.const 4 call 0 i32.add end
+        {{{}, {ValType::i32}}, 0, "41031000410410006a0b"_bytes},
+    });
+
+    auto instance = instantiate(module);
+    EXPECT_GT(instance->module.codesec[1].image_local_count, 0);
+    EXPECT_THAT(execute(*instance, 1, {}), Result(7));
+}
@@ -243,6 +243,30 @@ TEST(instantiate, imported_memory_stricter_limits)
     EXPECT_EQ(instance->memory_limits.max, 2);
 }
 
+TEST(instantiate, imported_memory_shared)
+{
+    /* wat2wasm --enable-threads
+      (memory (import "mod" "m") 1 3 shared)
+    */
+    const auto bin = from_hex("0061736d01000000020b01036d6f64016d02030103");
+    const auto module = parse(bin);
+
+    bytes memory(PageSize, 0);
+    auto instance = instantiate(module, {}, {}, {{&memory, {1, 3, true}}});
+    EXPECT_EQ(instance->memory->data(), memory.data());
+    EXPECT_TRUE(instance->memory_limits.shared);
+
+    EXPECT_THROW_MESSAGE(instantiate(module, {}, {}, {{&memory, {1, 3}}}), instantiate_error,
+        "provided import's shared flag doesn't match the module's one");
+
+    /* wat2wasm
+      (memory (import "mod" "m") 1 3)
+    */
+    const auto bin_not_shared = from_hex("0061736d01000000020b01036d6f64016d02010103");
+    EXPECT_THROW_MESSAGE(instantiate(parse(bin_not_shared), {}, {}, {{&memory, {1, 3, true}}}),
+        instantiate_error, "provided import's shared flag doesn't match the module's one");
+}
+
 TEST(instantiate, imported_memory_invalid)
 {
     /* wat2wasm
@@ -867,3 +891,21 @@ TEST(instantiate, start_unreachable)
     EXPECT_THROW_MESSAGE(
         instantiate(parse(wasm)), instantiate_error, "start function failed to execute");
 }
+
+TEST(instantiate, layout_options)
+{
+    /* wat2wasm
+    (func (result i32) (i32.const 42))
+    (func (result i32) (call 0))
+    */
+    const auto wasm =
+        from_hex("0061736d010000000105016000017f03030200000a0b020400412a0b040010000b");
+
+    // The call is inlined in the optimized code only, so it is not limited by the call depth.
+    const auto optimized = instantiate(parse(wasm));
+    EXPECT_THAT(execute(*optimized, 1, {}, CallStackLimit), Result(42));
+
+    const auto unoptimized = instantiate(parse(wasm), {}, {}, {}, {}, {false, {}});
+    EXPECT_THAT(execute(*unoptimized, 1, {}, CallStackLimit), Traps());
+    EXPECT_THAT(execute(*unoptimized, 1, {}), Result(42));
+}
@@ -0,0 +1,99 @@
+// Fizzy: A fast WebAssembly interpreter
+// Copyright 2020 The Fizzy Authors.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "execute.hpp"
+#include "isa_level.hpp"
+#include "leb128.hpp"
+#include "parser.hpp"
+#include <gtest/gtest.h>
+#include <test/utils/asserts.hpp>
+#include <test/utils/hex.hpp>
+
+using namespace fizzy;
+
+namespace
+{
+constexpr IsaLevel all_isa_levels[] = {
+    IsaLevel::baseline, IsaLevel::x86_64_v2, IsaLevel::x86_64_v3};
+
+/// Restores the ISA level selected at construction.
+class IsaLevelGuard
+{
+    const IsaLevel m_level = get_isa_level();
+
+public:
+    IsaLevelGuard() = default;
+    IsaLevelGuard(const IsaLevelGuard&) = delete;
+    IsaLevelGuard& operator=(const IsaLevelGuard&) = delete;
+    ~IsaLevelGuard() { set_isa_level(m_level); }
+};
+}  // namespace
+
+TEST(isa_level, default_level)
+{
+    EXPECT_TRUE(is_supported(IsaLevel::baseline));
+    EXPECT_TRUE(is_supported(get_isa_level()));
+
+    // The highest supported level is selected by default.
+    for (const auto level : all_isa_levels)
+    {
+        if (is_supported(level))
+        {
+            EXPECT_GE(get_isa_level(), level);
+        }
+    }
+}
+
+TEST(isa_level, set_level)
+{
+    const IsaLevelGuard guard;
+    for (const auto level : all_isa_levels)
+    {
+        const auto previous = get_isa_level();
+        EXPECT_EQ(set_isa_level(level), is_supported(level));
+        EXPECT_EQ(get_isa_level(), is_supported(level) ? level : previous);
+    }
+}
+
+TEST(isa_level, execute_all_levels)
+{
+    /* wat2wasm
+    (func (param i64) (result i64)
+      (i64.add (i64.add (i64.clz (local.get 0)) (i64.ctz (local.get 0)))
+               (i64.shl (i64.popcnt (local.get 0)) (i64.const 8))))
+    */
+    const auto wasm = from_hex(
+        "0061736d0100000001060160017e017e030201000a1201100020007920007a7c20007b4208867c0b");
+    const auto module = parse(wasm);
+
+    const IsaLevelGuard guard;
+    for (const auto level : all_isa_levels)
+    {
+        if (!set_isa_level(level))
+            continue;
+        EXPECT_THAT(execute(module, 0, {0x00ff'0000'0000'ff00}), Result(8 + 8 + (16 << 8)));
+        EXPECT_THAT(execute(module, 0, {0}), Result(64 + 64));
+    }
+}
+
+TEST(isa_level, leb128u_decode_u32_vec_all_levels)
+{
+    const auto input = bytes(20, 0x01) + "e58e26"_bytes + bytes(20, 0x7f) + "ffffffff0f"_bytes;
+    std::vector<uint32_t> expected(20, 1);
+    expected.push_back(624485);
+    expected.insert(expected.end(), 20, 0x7f);
+    expected.push_back(0xffffffff);
+
+    const IsaLevelGuard guard;
+    for (const auto level : all_isa_levels)
+    {
+        if (!set_isa_level(level))
+            continue;
+        std::vector<uint32_t> output(expected.size());
+        EXPECT_EQ(leb128u_decode_u32_vec(&input[0], &input[0] + input.size(), output.data(),
+                      output.size()),
+            &input[0] + input.size());
+        EXPECT_EQ(output, expected);
+    }
+}
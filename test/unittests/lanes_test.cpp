@@ -0,0 +1,581 @@
+// Fizzy: A fast WebAssembly interpreter
+// Copyright 2020 The Fizzy Authors.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "lanes.hpp"
+#include "parser.hpp"
+#include <gmock/gmock.h>
+#include <test/utils/asserts.hpp>
+#include <test/utils/hex.hpp>
+#include <limits>
+#include <thread>
+
+using namespace fizzy;
+using namespace testing;
+
+namespace
+{
+/* wat2wasm
+(memory 1)
+(global $g (mut i32) (i32.const 0))
+(func $collatz (param $n i32) (result i32) (local $steps i32)
+  (block $done
+    (loop $l
+      (br_if $done (i32.eq (local.get $n) (i32.const 1)))
+      (if (i32.and (local.get $n) (i32.const 1))
+        (then (local.set $n (i32.add (i32.mul (local.get $n) (i32.const 3)) (i32.const 1))))
+        (else (local.set $n (i32.shr_u (local.get $n) (i32.const 1)))))
+      (local.set $steps (i32.add (local.get $steps) (i32.const 1)))
+      (br $l)))
+  (local.get $steps))
+(func $switch (param i32) (result i32)
+  (block (block (block (br_table 0 1 2 (local.get 0))) (return (i32.const 10)))
+    (return (i32.const 20)))
+  (i32.const 30))
+(func $div (param i32 i32) (result i32) (i32.div_u (local.get 0) (local.get 1)))
+(func $load (param i32) (result i32) (i32.load (local.get 0)))
+(func $state (param i32) (result i32)
+  (i32.store (i32.const 0) (local.get 0))
+  (global.set $g (i32.add (global.get $g) (local.get 0)))
+  (i32.add (i32.load (i32.const 0)) (global.get $g)))
+*/
+const auto basic_wasm = from_hex(
+    "0061736d01000000010c0260017f017f60027f7f017f030605000001000005030100010606017f0141000b0a7c05"
+    "3601017f0240034020004101460d0120004101710440200041036c41016a210005200041017621000b200141016a"
+    "21010c000b0b20010b1a0002400240024020000e020001020b410a0f0b41140f0b411e0b0700200020016e0b0700"
+    "20002802000b180041002000360200230020006a2400410028020023006a0b");
+
+/* wat2wasm
+(func $f (import "env" "f") (param i32) (result i32))
+(table 2 funcref)
+(elem (i32.const 0) $f $double)
+(func $double (param i32) (result i32) (i32.mul (local.get 0) (i32.const 2)))
+(func $dispatch (param i32 i32) (result i32)
+  (call_indirect (type 0) (local.get 0) (local.get 1)))
+(func $call (param i32) (result i32) (call $f (i32.add (local.get 0) (i32.const 1))))
+*/
+const auto imported_wasm = from_hex(
+    "0061736d01000000010c0260017f017f60027f7f017f02090103656e76016600000304030001000404017000020908"
+    "010041000b0200010a1d030700200041026c0b0900200020011100000b0900200041016a10000b");
+
+/// The micro/factorial benchmark module.
+const auto factorial_wasm = from_hex(
+    "0061736d0100000001060160017e017e03020100070d0109666163746f7269616c00000a17011500200050044042"
+    "010f0b2000200042017d10007e0b");
+
+/* wat2wasm
+(table 1 funcref)
+(elem (i32.const 0) $count)
+(func $count (param $n i32) (result i32)
+  (loop $l (br_if $l (local.tee $n (i32.sub (local.get $n) (i32.const 1)))))
+  (local.get $n))
+(func $dispatch (param i32) (result i32) (call_indirect (param i32) (result i32)
+  (local.get 0) (i32.const 0)))
+*/
+const auto count_indirect_wasm = from_hex(
+    "0061736d0100000001060160017f017f03030200000404017000010907010041000b01000a1c0210000340200041"
+    "016b22000d000b20000b0900200041001100000b");
+
+/// The instances of the same module, one per lane.
+struct Lanes
+{
+    std::vector<std::unique_ptr<Instance>> instances;
+    std::vector<Instance*> pointers;
+    LaneCode code;
+
+    Lanes(const bytes& wasm, size_t num_lanes,
+        const std::function<std::vector<ExternalFunction>(size_t lane)>& get_imports = {})
+    {
+        for (size_t lane = 0; lane < num_lanes; ++lane)
+        {
+            instances.emplace_back(instantiate(
+                parse(wasm), get_imports ? get_imports(lane) : std::vector<ExternalFunction>{}));
+            pointers.emplace_back(instances.back().get());
+        }
+        code = compile_lane_code(instances.front()->module);
+    }
+
+    std::vector<execution_result> execute(FuncIdx func_idx, const std::vector<uint64_t>& args)
+    {
+        return execute_lanes(code, pointers, func_idx, args.data());
+    }
+};
+}  // namespace
+
+TEST(lanes, no_lanes)
+{
+    const auto module = parse(basic_wasm);
+    EXPECT_THAT(execute_lanes(compile_lane_code(module), {}, 0, nullptr), IsEmpty());
+}
+
+TEST(lanes, uniform)
+{
+    Lanes lanes{basic_wasm, 4};
+    const auto results = lanes.execute(0, {27, 27, 27, 27});
+    ASSERT_EQ(results.size(), 4);
+    for (const auto& result : results)
+        EXPECT_THAT(result, Result(111));
+}
+
+TEST(lanes, divergent_branches)
+{
+    // Each lane takes a different path through the loop with the if and the br_if.
+    constexpr size_t num_lanes = 100;
+    Lanes lanes{basic_wasm, num_lanes};
+
+    std::vector<uint64_t> args;
+    for (uint64_t i = 1; i <= num_lanes; ++i)
+        args.emplace_back(i);
+
+    const auto results = lanes.execute(0, args);
+    ASSERT_EQ(results.size(), num_lanes);
+    for (size_t i = 0; i < num_lanes; ++i)
+    {
+        const auto expected = fizzy::execute(*lanes.instances[i], 0, {args[i]});
+        EXPECT_THAT(results[i], Result(expected.stack.at(0))) << "lane " << i;
+    }
+    EXPECT_THAT(results[0], Result(0));
+    EXPECT_THAT(results[26], Result(111));
+}
+
+TEST(lanes, divergent_br_table)
+{
+    Lanes lanes{basic_wasm, 6};
+    const auto results = lanes.execute(1, {0, 1, 2, 3, 1, 0xffffffff});
+    EXPECT_THAT(results[0], Result(10));
+    EXPECT_THAT(results[1], Result(20));
+    EXPECT_THAT(results[2], Result(30));
+    EXPECT_THAT(results[3], Result(30));
+    EXPECT_THAT(results[4], Result(20));
+    EXPECT_THAT(results[5], Result(30));
+}
+
+TEST(lanes, traps)
+{
+    Lanes lanes{basic_wasm, 4};
+
+    auto results = lanes.execute(2, {10, 2, 1, 0, 9, 3, 0, 0});
+    EXPECT_THAT(results[0], Result(5));
+    EXPECT_THAT(results[1], Traps());
+    EXPECT_THAT(results[2], Result(3));
+    EXPECT_THAT(results[3], Traps());
+
+    results = lanes.execute(3, {0, 65533, 65532, 0xffffffff});
+    EXPECT_THAT(results[0], Result(0));
+    EXPECT_THAT(results[1], Traps());
+    EXPECT_THAT(results[2], Result(0));
+    EXPECT_THAT(results[3], Traps());
+}
+
+TEST(lanes, instance_state)
+{
+    // The globals and the memory of each lane's instance are separate.
+    Lanes lanes{basic_wasm, 3};
+    EXPECT_THAT(lanes.execute(4, {1, 2, 3}), ElementsAre(Result(2), Result(4), Result(6)));
+    EXPECT_THAT(lanes.execute(4, {1, 2, 3}), ElementsAre(Result(3), Result(6), Result(9)));
+    EXPECT_EQ(lanes.instances[2]->globals[0], 6);
+    EXPECT_EQ(lanes.instances[1]->memory->at(0), 2);
+}
+
+TEST(lanes, recursion)
+{
+    Lanes lanes{factorial_wasm, 5};
+    const auto results = lanes.execute(0, {0, 1, 5, 20, 3});
+    EXPECT_THAT(results, ElementsAre(Result(1), Result(1), Result(120),
+                             Result(2432902008176640000), Result(6)));
+}
+
+TEST(lanes, call_depth_limit)
+{
+    Lanes lanes{factorial_wasm, 2};
+    const auto results = lanes.execute(0, {10, 1'000'000});
+    EXPECT_THAT(results, ElementsAre(Result(3628800), Traps()));
+}
+
+TEST(lanes, imported_function)
+{
+    const auto get_imports = [](size_t lane) {
+        const auto f = [lane](Instance&, std::vector<uint64_t> args, int) {
+            if (lane == 1)
+                return execution_result{true, {}};
+            return execution_result{false, {args[0] * 10 + lane}};
+        };
+        return std::vector<ExternalFunction>{{f, FuncType{{ValType::i32}, {ValType::i32}}}};
+    };
+    Lanes lanes{imported_wasm, 3, get_imports};
+
+    EXPECT_THAT(lanes.execute(3, {1, 2, 3}), ElementsAre(Result(20), Traps(), Result(42)));
+
+    // Executing the imported function directly.
+    EXPECT_THAT(lanes.execute(0, {1, 2, 3}), ElementsAre(Result(10), Traps(), Result(32)));
+}
+
+TEST(lanes, call_indirect)
+{
+    const auto get_imports = [](size_t lane) {
+        const auto f = [lane](Instance&, std::vector<uint64_t> args, int) {
+            return execution_result{false, {args[0] + lane}};
+        };
+        return std::vector<ExternalFunction>{{f, FuncType{{ValType::i32}, {ValType::i32}}}};
+    };
+    Lanes lanes{imported_wasm, 4, get_imports};
+
+    // The arguments are the value and the table element index.
+    EXPECT_THAT(lanes.execute(2, {7, 0, 7, 1, 7, 2, 7, 1}),
+        ElementsAre(Result(7), Result(14), Traps(), Result(14)));
+}
+
+TEST(lanes, access_sets)
+{
+    Lanes lanes{basic_wasm, 3};
+    std::vector<AccessSet> access_sets(3);
+
+    EXPECT_THAT(execute_lanes(lanes.code, lanes.pointers, 3,
+                    std::vector<uint64_t>{AccessSet::PageSize - 2, 65533, 8}.data(),
+                    access_sets.data()),
+        ElementsAre(Result(0), Traps(), Result(0)));
+    EXPECT_THAT(access_sets[0].read_pages, ElementsAre(true, true));
+    EXPECT_THAT(access_sets[0].written_pages, IsEmpty());
+    EXPECT_FALSE(access_sets[0].memory_size_read);
+    EXPECT_THAT(access_sets[1].read_pages, IsEmpty());
+    EXPECT_TRUE(access_sets[1].memory_size_read);
+    EXPECT_THAT(access_sets[2].read_pages, ElementsAre(true));
+
+    access_sets.assign(3, {});
+    EXPECT_THAT(execute_lanes(lanes.code, lanes.pointers, 4,
+                    std::vector<uint64_t>{1, 2, 3}.data(), access_sets.data()),
+        ElementsAre(Result(2), Result(4), Result(6)));
+    for (const auto& access_set : access_sets)
+    {
+        EXPECT_THAT(access_set.read_pages, ElementsAre(true));
+        EXPECT_THAT(access_set.written_pages, ElementsAre(true));
+        EXPECT_THAT(access_set.read_globals, ElementsAre(true));
+        EXPECT_THAT(access_set.written_globals, ElementsAre(true));
+        EXPECT_FALSE(access_set.memory_size_read);
+        EXPECT_FALSE(access_set.memory_size_written);
+    }
+}
+
+TEST(lanes, execution_resume)
+{
+    Lanes lanes{basic_wasm, 3};
+    const std::vector<uint64_t> args{27, 1, 97};
+    LaneExecution execution{lanes.code, lanes.pointers, 0, args.data()};
+    EXPECT_FALSE(execution.is_completed());
+
+    size_t num_resumes = 0;
+    while (true)
+    {
+        uint64_t fuel = 50;
+        ++num_resumes;
+        if (execution.resume(fuel))
+            break;
+        EXPECT_EQ(fuel, 0);
+    }
+    EXPECT_GT(num_resumes, 10);
+    EXPECT_TRUE(execution.is_completed());
+    EXPECT_THAT(execution.results(), ElementsAre(Result(111), Result(0), Result(118)));
+
+    // Resuming the completed execution uses no fuel.
+    uint64_t fuel = 50;
+    EXPECT_TRUE(execution.resume(fuel));
+    EXPECT_EQ(fuel, 50);
+}
+
+TEST(lanes, interrupt)
+{
+    Lanes lanes{basic_wasm, 3};
+
+    // The interrupt requested before the execution is reported at the function entry.
+    lanes.instances[1]->interrupt_requested = true;
+    EXPECT_THAT(lanes.execute(2, {10, 2, 10, 5, 9, 3}),
+        ElementsAre(Result(5), Interrupted(), Result(3)));
+
+    // The running lanes are interrupted at the next loop back-edge.
+    lanes.instances[1]->interrupt_requested = false;
+    const std::vector<uint64_t> args{27, 27, 97};
+    LaneExecution execution{lanes.code, lanes.pointers, 0, args.data()};
+    uint64_t fuel = 50;
+    EXPECT_FALSE(execution.resume(fuel));
+    lanes.instances[2]->interrupt_requested = true;
+    fuel = std::numeric_limits<uint64_t>::max();
+    EXPECT_TRUE(execution.resume(fuel));
+    EXPECT_THAT(execution.results(), ElementsAre(Result(111), Result(111), Interrupted()));
+}
+
+TEST(lanes, pending_calls)
+{
+    std::vector<std::shared_ptr<PendingCall>> calls;
+    const auto get_imports = [&calls](size_t lane) {
+        const auto f = [&calls, lane](Instance&, std::vector<uint64_t> args, int) {
+            if (lane == 1)
+                return execution_result{false, {args[0] + 100}};
+            calls.emplace_back(defer_current_call());
+            return execution_result{true, {}};
+        };
+        return std::vector<ExternalFunction>{{f, FuncType{{ValType::i32}, {ValType::i32}}}};
+    };
+    Lanes lanes{imported_wasm, 4, get_imports};
+
+    const std::vector<uint64_t> args{1, 2, 3, 4};
+    LaneExecution execution{lanes.code, lanes.pointers, 3, args.data()};
+    auto fuel = std::numeric_limits<uint64_t>::max();
+    EXPECT_FALSE(execution.resume(fuel));
+    EXPECT_TRUE(execution.is_waiting());
+    ASSERT_EQ(calls.size(), 3);
+    EXPECT_THROW(execution.checkpoint(), checkpoint_error);
+
+    bool ready = false;
+    execution.when_ready([&ready] { ready = true; });
+    EXPECT_FALSE(ready);
+    calls[0]->complete({false, {7}});
+    EXPECT_TRUE(ready);
+
+    // The lane with the completed call continues, the other lanes still wait.
+    EXPECT_FALSE(execution.resume(fuel));
+    EXPECT_TRUE(execution.is_waiting());
+
+    std::thread io_thread{[&calls] {
+        calls[1]->complete({true, {}});
+        calls[2]->complete({false, {9}});
+    }};
+    io_thread.join();
+    EXPECT_TRUE(execution.resume(fuel));
+    EXPECT_FALSE(execution.is_waiting());
+    EXPECT_THAT(execution.results(), ElementsAre(Result(7), Result(103), Traps(), Result(9)));
+}
+
+TEST(lanes, pending_calls_execute_lanes)
+{
+    std::vector<std::thread> io_threads;
+    const auto get_imports = [&io_threads](size_t) {
+        const auto f = [&io_threads](Instance&, std::vector<uint64_t> args, int) {
+            io_threads.emplace_back([call = defer_current_call(), arg = args[0]] {
+                call->complete({false, {arg * 2}});
+            });
+            return execution_result{true, {}};
+        };
+        return std::vector<ExternalFunction>{{f, FuncType{{ValType::i32}, {ValType::i32}}}};
+    };
+    Lanes lanes{imported_wasm, 2, get_imports};
+
+    // execute_lanes() waits for the completion of the calls.
+    EXPECT_THAT(lanes.execute(3, {1, 2}), ElementsAre(Result(4), Result(6)));
+    for (auto& io_thread : io_threads)
+        io_thread.join();
+
+    // The call cannot be pending in execute().
+    const auto no_defer = [](Instance&, std::vector<uint64_t>, int) {
+        EXPECT_EQ(defer_current_call(), nullptr);
+        return execution_result{false, {1}};
+    };
+    const auto instance = instantiate(
+        parse(imported_wasm), {{no_defer, FuncType{{ValType::i32}, {ValType::i32}}}});
+    EXPECT_THAT(fizzy::execute(*instance, 3, {1}), Result(1));
+}
+
+TEST(lanes, pending_calls_not_direct)
+{
+    std::vector<uint64_t> deferred;
+    const auto get_imports = [&deferred](size_t) {
+        const auto f = [&deferred](Instance&, std::vector<uint64_t> args, int) {
+            if (const auto call = defer_current_call(); call != nullptr)
+            {
+                deferred.emplace_back(args[0]);
+                call->complete({false, {args[0]}});
+                return execution_result{true, {}};
+            }
+            return execution_result{false, {args[0]}};
+        };
+        return std::vector<ExternalFunction>{{f, FuncType{{ValType::i32}, {ValType::i32}}}};
+    };
+    Lanes lanes{imported_wasm, 1, get_imports};
+
+    // Only the directly called imported function can defer the call.
+    EXPECT_THAT(lanes.execute(3, {1}), ElementsAre(Result(2)));
+    EXPECT_THAT(deferred, ElementsAre(2));
+    EXPECT_THAT(lanes.execute(2, {7, 0}), ElementsAre(Result(7)));
+    EXPECT_THAT(deferred, ElementsAre(2));
+
+    /* wat2wasm
+    (func $outer (import "env" "outer") (result i32))
+    (func $h (import "env" "h") (result i32))
+    (func $g (result i32) (i32.add (call $h) (i32.const 1)))
+    (func (result i32) (call $outer))
+    */
+    const auto nested_wasm = from_hex(
+        "0061736d010000000105016000017f02150203656e76056f75746572000003656e760168000003030200000a"
+        "0e020700100141016a0b040010000b");
+
+    // The imported function executing $g, which calls the imported function deferring the call
+    // if it can.
+    const auto outer = [](Instance& instance, std::vector<uint64_t>, int depth) {
+        return fizzy::execute(instance, 2, {}, depth + 1);
+    };
+    const auto h = [](Instance&, std::vector<uint64_t>, int) {
+        if (const auto call = defer_current_call(); call != nullptr)
+        {
+            call->complete({false, {0}});
+            return execution_result{true, {}};
+        }
+        return execution_result{false, {100}};
+    };
+    const auto get_nested_imports = [&outer, &h](size_t) {
+        const FuncType type{{}, {ValType::i32}};
+        return std::vector<ExternalFunction>{{outer, type}, {h, type}};
+    };
+    Lanes nested_lanes{nested_wasm, 2, get_nested_imports};
+
+    // The call by the nested execution is not pending, so $g completes with the result of $h.
+    EXPECT_THAT(nested_lanes.execute(3, {}), ElementsAre(Result(101), Result(101)));
+}
+
+TEST(lanes, instruction_budget)
+{
+    const auto instance = instantiate(parse(basic_wasm));
+    const auto code = compile_lane_code(instance->module);
+
+    const auto complete = execute(code, *instance, 0, {27}, std::numeric_limits<uint64_t>::max());
+    EXPECT_THAT(*complete.result, Result(111));
+    EXPECT_FALSE(complete.continuation.has_value());
+    const auto num_instructions = complete.num_instructions;
+    EXPECT_GT(num_instructions, 111);
+
+    // The execution stops after exactly the budget.
+    auto partial = execute(code, *instance, 0, {27}, num_instructions - 1);
+    EXPECT_FALSE(partial.result.has_value());
+    ASSERT_TRUE(partial.continuation.has_value());
+    EXPECT_EQ(partial.num_instructions, num_instructions - 1);
+
+    partial = resume(std::move(*partial.continuation), 10);
+    EXPECT_THAT(*partial.result, Result(111));
+    EXPECT_EQ(partial.num_instructions, 1);
+
+    // The execution one instruction at a time.
+    auto step = execute(code, *instance, 0, {27}, 0);
+    EXPECT_EQ(step.num_instructions, 0);
+    uint64_t num_steps = 0;
+    while (step.continuation.has_value())
+    {
+        step = resume(std::move(*step.continuation), 1);
+        EXPECT_EQ(step.num_instructions, 1);
+        ++num_steps;
+    }
+    EXPECT_THAT(*step.result, Result(111));
+    EXPECT_EQ(num_steps, num_instructions);
+}
+
+TEST(lanes, instruction_budget_traps)
+{
+    const auto instance = instantiate(parse(factorial_wasm));
+    const auto code = compile_lane_code(instance->module);
+
+    auto result = execute(code, *instance, 0, {1'000'000}, 100);
+    ASSERT_TRUE(result.continuation.has_value());
+    result = resume(std::move(*result.continuation), std::numeric_limits<uint64_t>::max());
+    EXPECT_THAT(*result.result, Traps());
+}
+
+TEST(lanes, instruction_budget_call_indirect)
+{
+    const auto instance = instantiate(parse(count_indirect_wasm));
+    const auto code = compile_lane_code(instance->module);
+
+    // The instance's own function called by call_indirect is executed by the lanes,
+    // so its instructions are counted.
+    const auto complete = execute(code, *instance, 1, {1000}, std::numeric_limits<uint64_t>::max());
+    EXPECT_THAT(*complete.result, Result(0));
+    EXPECT_GT(complete.num_instructions, 1000);
+
+    auto partial = execute(code, *instance, 1, {200'000'000}, 5);
+    EXPECT_FALSE(partial.result.has_value());
+    ASSERT_TRUE(partial.continuation.has_value());
+    EXPECT_EQ(partial.num_instructions, 5);
+
+    partial = resume(std::move(*partial.continuation), 100);
+    EXPECT_FALSE(partial.result.has_value());
+    ASSERT_TRUE(partial.continuation.has_value());
+    EXPECT_EQ(partial.num_instructions, 100);
+}
+
+TEST(lanes, checkpoint_restore)
+{
+    const std::vector<uint64_t> args{27, 1, 97};
+    Lanes lanes{basic_wasm, 3};
+    LaneExecution execution{lanes.code, lanes.pointers, 0, args.data()};
+    uint64_t fuel = 300;
+    ASSERT_FALSE(execution.resume(fuel));
+    const auto checkpoint = execution.checkpoint();
+
+    // The restored execution continues on other instances, e.g. in another process.
+    Lanes other{basic_wasm, 3};
+    auto restored = LaneExecution::restore(other.code, other.pointers, checkpoint);
+    fuel = std::numeric_limits<uint64_t>::max();
+    EXPECT_TRUE(restored.resume(fuel));
+    EXPECT_THAT(restored.results(), ElementsAre(Result(111), Result(0), Result(118)));
+
+    fuel = std::numeric_limits<uint64_t>::max();
+    EXPECT_TRUE(execution.resume(fuel));
+    EXPECT_THAT(execution.results(), ElementsAre(Result(111), Result(0), Result(118)));
+    EXPECT_THROW(execution.checkpoint(), checkpoint_error);
+}
+
+TEST(lanes, checkpoint_instance_state)
+{
+    // The $state function stores the argument to the memory and adds it to the global.
+    const auto instance = instantiate(parse(basic_wasm));
+    const auto code = compile_lane_code(instance->module);
+    const auto complete = execute(code, *instance, 4, {5}, 100);
+    EXPECT_THAT(*complete.result, Result(10));
+
+    // Stop before the final i32.add.
+    auto partial = execute(code, *instance, 4, {7}, complete.num_instructions - 2);
+    ASSERT_TRUE(partial.continuation.has_value());
+    EXPECT_EQ(instance->memory->at(0), 7);
+    EXPECT_EQ(instance->globals[0], 12);
+    const auto checkpoint = partial.continuation->checkpoint();
+
+    // Only the non-zero memory chunk of the 64 KiB memory is in the checkpoint.
+    EXPECT_LT(checkpoint.size(), 2 * AccessSet::PageSize);
+
+    const auto other = instantiate(parse(basic_wasm));
+    auto restored = LaneExecution::restore(code, {other.get()}, checkpoint);
+    EXPECT_EQ(other->memory->size(), instance->memory->size());
+    EXPECT_EQ(other->memory->at(0), 7);
+    EXPECT_EQ(other->globals[0], 12);
+    EXPECT_THAT(*resume(std::move(restored), 100).result, Result(19));
+}
+
+TEST(lanes, checkpoint_errors)
+{
+    Lanes lanes{basic_wasm, 1};
+    LaneExecution execution{lanes.code, lanes.pointers, 0, std::vector<uint64_t>{27}.data()};
+    uint64_t fuel = 10;
+    ASSERT_FALSE(execution.resume(fuel));
+    const auto checkpoint = execution.checkpoint();
+
+    auto instance = instantiate(parse(basic_wasm));
+    const std::vector<Instance*> instances{instance.get()};
+    EXPECT_NO_THROW(LaneExecution::restore(lanes.code, instances, checkpoint));
+
+    EXPECT_THROW_MESSAGE(LaneExecution::restore(lanes.code, instances, {}), checkpoint_error,
+        "unexpected end of the checkpoint");
+    EXPECT_THROW_MESSAGE(
+        LaneExecution::restore(lanes.code, instances, checkpoint.substr(0, checkpoint.size() - 1)),
+        checkpoint_error, "unexpected end of the checkpoint");
+    EXPECT_THROW_MESSAGE(LaneExecution::restore(lanes.code, instances, checkpoint + uint8_t{0}),
+        checkpoint_error, "unexpected data at the end of the checkpoint");
+
+    auto corrupted = checkpoint;
+    corrupted[0] = 'x';
+    EXPECT_THROW_MESSAGE(LaneExecution::restore(lanes.code, instances, corrupted),
+        checkpoint_error, "invalid checkpoint");
+
+    EXPECT_THROW_MESSAGE(LaneExecution::restore(lanes.code, {instance.get(), instance.get()},
+                             checkpoint),
+        checkpoint_error, "the checkpoint of the different number of instances");
+
+    Lanes factorial{factorial_wasm, 1};
+    EXPECT_THROW_MESSAGE(LaneExecution::restore(factorial.code, factorial.pointers, checkpoint),
+        checkpoint_error, "the checkpoint of the different module");
+}
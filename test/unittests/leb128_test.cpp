@@ -6,6 +6,7 @@
 #include <gtest/gtest.h>
 #include <test/utils/asserts.hpp>
 #include <test/utils/hex.hpp>
+#include <test/utils/leb128_encode.hpp>
 
 using namespace fizzy;
 
@@ -18,6 +19,16 @@ inline auto leb128u_decode(bytes_view input)
     return fizzy::leb128u_decode<T>(input.begin(), input.end());
 }
 
+/// A leb128u_decode_u32_vec() wrapper for convenient testing.
+inline std::vector<uint32_t> leb128u_decode_u32_vec(bytes_view input, size_t count)
+{
+    std::vector<uint32_t> result(count);
+    const auto end =
+        fizzy::leb128u_decode_u32_vec(input.begin(), input.end(), result.data(), count);
+    EXPECT_EQ(end, input.end());
+    return result;
+}
+
 /// A leb128s_decode() wrapper for convenient testing.
 template <typename T>
 inline auto leb128s_decode(bytes_view input)
@@ -134,6 +145,64 @@ TEST(leb128, decode_u32_invalid)
         "invalid LEB128 encoding: unused bits set");
 }
 
+TEST(leb128, decode_u32_vec)
+{
+    // clang-format off
+    const std::vector<uint32_t> values = {
+        0, 1, 0x7f, 0x80, 0x3fff, 0x4000, 624485, 0x1fffff, 0x200000, 0xfffffff, 0x10000000,
+        0x7fffffff, 0x80000000, std::numeric_limits<uint32_t>::max(),
+    };
+    // clang-format on
+
+    // Sequences of different lengths and alignments, crossing the SIMD chunk boundaries.
+    for (size_t count = 0; count < 64; ++count)
+    {
+        std::vector<uint32_t> expected;
+        bytes input;
+        for (size_t i = 0; i < count; ++i)
+        {
+            // Mostly single-byte values with multi-byte values interleaved.
+            const auto value = (i % 5 == 3) ? values[(i * 7) % values.size()] : uint32_t(i);
+            expected.push_back(value);
+            input += test::leb128u_encode(value);
+        }
+        EXPECT_EQ(leb128u_decode_u32_vec(input, count), expected) << hex(input);
+    }
+
+    // Values with leading zeroes.
+    const auto input = "8080808000"
+                       "8180808000"
+                       "ffffffff0f"
+                       "e58ea68000"
+                       "8100"
+                       "00"
+                       "8080808000"
+                       "7f"_bytes;
+    EXPECT_EQ(leb128u_decode_u32_vec(input, 8),
+        (std::vector<uint32_t>{0, 1, 0xffffffff, 624485, 1, 0, 0, 0x7f}));
+}
+
+TEST(leb128, decode_u32_vec_invalid)
+{
+    const auto prefix = bytes(20, 0x01);
+
+    const auto too_many_bytes = prefix + "818080808000"_bytes + bytes(16, 0x00);
+    EXPECT_THROW_MESSAGE(leb128u_decode_u32_vec(too_many_bytes, 40), parser_error,
+        "invalid LEB128 encoding: too many bytes");
+
+    const auto no_terminator = prefix + bytes(32, 0xff);
+    EXPECT_THROW_MESSAGE(leb128u_decode_u32_vec(no_terminator, 30), parser_error,
+        "invalid LEB128 encoding: too many bytes");
+
+    const auto unused_bits_set = prefix + "828080807000"_bytes + bytes(16, 0x00);
+    EXPECT_THROW_MESSAGE(leb128u_decode_u32_vec(unused_bits_set, 40), parser_error,
+        "invalid LEB128 encoding: unused bits set");
+
+    EXPECT_THROW_MESSAGE(leb128u_decode_u32_vec(prefix, 21), parser_error, "unexpected EOF");
+    EXPECT_THROW_MESSAGE(
+        leb128u_decode_u32_vec(prefix + "8182"_bytes, 21), parser_error, "unexpected EOF");
+}
+
 TEST(leb128, decode_u8)
 {
     // clang-format off
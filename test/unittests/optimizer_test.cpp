@@ -0,0 +1,247 @@
+// Fizzy: A fast WebAssembly interpreter
+// Copyright 2020 The Fizzy Authors.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "code_layout.hpp"
+#include "execute.hpp"
+#include "optimizer.hpp"
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <test/utils/asserts.hpp>
+#include <test/utils/hex.hpp>
+#include <test/utils/lowered_code_utils.hpp>
+
+using namespace fizzy;
+using namespace fizzy::test;
+using namespace testing;
+
+namespace
+{
+/// Lowers and optimizes the code of the function of the given type and expression.
+LoweredCode optimize_expr(const bytes& expr_binary, FuncType func_type = {})
+{
+    const auto module = make_single_function_module(expr_binary, std::move(func_type));
+    auto lowered_code = lower_code(module.codesec[0]);
+    optimize(lowered_code);
+    return lowered_code;
+}
+}  // namespace
+
+TEST(optimizer, fold_binary)
+{
+    // i32.const 2 i32.const 3 i32.add end
+    const auto add = optimize_expr("410241036a0b"_bytes, i32_result);
+    EXPECT_THAT(get_instructions(add), ElementsAreArray({Instr::i32_const, Instr::end}));
+    EXPECT_EQ(add.instructions[0].imm, 5);
+
+    // i32.const 2 i32.const 3 i32.add i32.const 4 i32.mul end
+    const auto chain = optimize_expr("410241036a41046c0b"_bytes, i32_result);
+    EXPECT_THAT(get_instructions(chain), ElementsAreArray({Instr::i32_const, Instr::end}));
+    EXPECT_EQ(chain.instructions[0].imm, 20);
+
+    // i32.const -1 i32.const 1 i32.shr_u end
+    const auto shr = optimize_expr("417f4101760b"_bytes, i32_result);
+    EXPECT_THAT(get_instructions(shr), ElementsAreArray({Instr::i32_const, Instr::end}));
+    EXPECT_EQ(shr.instructions[0].imm, 0x7fffffff);
+
+    // i64.const -8 i64.const 1 i64.shr_s end
+    const auto shr_s = optimize_expr("42784201870b"_bytes, i64_result);
+    EXPECT_THAT(get_instructions(shr_s), ElementsAreArray({Instr::i64_const, Instr::end}));
+    EXPECT_EQ(shr_s.instructions[0].value, uint64_t(-4));
+
+    // i64.const 1 i64.const 2 i64.lt_s end
+    const auto lt = optimize_expr("42014202530b"_bytes, i32_result);
+    EXPECT_THAT(get_instructions(lt), ElementsAreArray({Instr::i32_const, Instr::end}));
+    EXPECT_EQ(lt.instructions[0].imm, 1);
+}
+
+TEST(optimizer, fold_unary)
+{
+    // i32.const 0x10 i32.clz end
+    const auto clz = optimize_expr("4110670b"_bytes, i32_result);
+    EXPECT_THAT(get_instructions(clz), ElementsAreArray({Instr::i32_const, Instr::end}));
+    EXPECT_EQ(clz.instructions[0].imm, 27);
+
+    // i32.const -1 i64.extend_i32_s end
+    const auto extend = optimize_expr("417fac0b"_bytes, i64_result);
+    EXPECT_THAT(get_instructions(extend), ElementsAreArray({Instr::i64_const, Instr::end}));
+    EXPECT_EQ(extend.instructions[0].value, uint64_t(-1));
+
+    // i64.const -1 i32.wrap_i64 i32.eqz end
+    const auto wrap = optimize_expr("427fa7450b"_bytes, i32_result);
+    EXPECT_THAT(get_instructions(wrap), ElementsAreArray({Instr::i32_const, Instr::end}));
+    EXPECT_EQ(wrap.instructions[0].imm, 0);
+}
+
+TEST(optimizer, trapping_instructions_not_folded)
+{
+    // i32.const 1 i32.const 0 i32.div_u end
+    const auto div_by_zero = optimize_expr("410141006e0b"_bytes, i32_result);
+    EXPECT_THAT(get_instructions(div_by_zero),
+        ElementsAreArray({Instr::i32_const, Instr::i32_const, Instr::i32_div_u, Instr::end}));
+
+    // i32.const 0x80000000 i32.const -1 i32.div_s end
+    const auto overflow = optimize_expr("418080808078417f6d0b"_bytes, i32_result);
+    EXPECT_THAT(get_instructions(overflow),
+        ElementsAreArray({Instr::i32_const, Instr::i32_const, Instr::i32_div_s, Instr::end}));
+
+    // i32.const 0x80000000 i32.const -1 i32.rem_s end
+    const auto rem = optimize_expr("418080808078417f6f0b"_bytes, i32_result);
+    EXPECT_THAT(get_instructions(rem), ElementsAreArray({Instr::i32_const, Instr::end}));
+    EXPECT_EQ(rem.instructions[0].imm, 0);
+}
+
+TEST(optimizer, strength_reduction)
+{
+    // local.get 0 i32.const 8 i32.mul end
+    const auto mul = optimize_expr("200041086c0b"_bytes, i32_param_i32_result);
+    EXPECT_THAT(get_instructions(mul),
+        ElementsAreArray({Instr::local_get, Instr::i32_const, Instr::i32_shl, Instr::end}));
+    EXPECT_EQ(mul.instructions[1].imm, 3);
+
+    // local.get 0 i32.const 16 i32.div_u end
+    const auto div = optimize_expr("200041106e0b"_bytes, i32_param_i32_result);
+    EXPECT_THAT(get_instructions(div),
+        ElementsAreArray({Instr::local_get, Instr::i32_const, Instr::i32_shr_u, Instr::end}));
+    EXPECT_EQ(div.instructions[1].imm, 4);
+
+    // local.get 0 i64.extend_i32_u i64.const 16 i64.rem_u i32.wrap_i64 end
+    const auto rem = optimize_expr("2000ad421082a70b"_bytes, i32_param_i32_result);
+    EXPECT_THAT(get_instructions(rem),
+        ElementsAreArray({Instr::local_get, Instr::i64_extend_i32_u, Instr::i64_const,
+            Instr::i64_and, Instr::i32_wrap_i64, Instr::end}));
+    EXPECT_EQ(rem.instructions[2].value, 15);
+
+    // local.get 0 i32.const 6 i32.mul end
+    const auto not_power_of_two = optimize_expr("200041066c0b"_bytes, i32_param_i32_result);
+    EXPECT_THAT(get_instructions(not_power_of_two),
+        ElementsAreArray({Instr::local_get, Instr::i32_const, Instr::i32_mul, Instr::end}));
+}
+
+TEST(optimizer, identity_operations_removed)
+{
+    // local.get 0 i32.const 0 i32.add end
+    EXPECT_THAT(get_instructions(optimize_expr("200041006a0b"_bytes, i32_param_i32_result)),
+        ElementsAreArray({Instr::local_get, Instr::end}));
+
+    // local.get 0 i32.const -1 i32.and end
+    EXPECT_THAT(get_instructions(optimize_expr("2000417f710b"_bytes, i32_param_i32_result)),
+        ElementsAreArray({Instr::local_get, Instr::end}));
+
+    // local.get 0 i32.const 32 i32.shl end
+    EXPECT_THAT(get_instructions(optimize_expr("20004120740b"_bytes, i32_param_i32_result)),
+        ElementsAreArray({Instr::local_get, Instr::end}));
+
+    // local.get 0 i32.const 1 i32.div_s end
+    EXPECT_THAT(get_instructions(optimize_expr("200041016d0b"_bytes, i32_param_i32_result)),
+        ElementsAreArray({Instr::local_get, Instr::end}));
+}
+
+TEST(optimizer, stack_shuffles_removed)
+{
+    // local.get 0 drop end
+    EXPECT_THAT(get_instructions(optimize_expr("20001a0b"_bytes, i32_param)),
+        ElementsAreArray({Instr::end}));
+
+    // local.get 0 local.set 0 end
+    EXPECT_THAT(get_instructions(optimize_expr("200021000b"_bytes, i32_param)),
+        ElementsAreArray({Instr::end}));
+
+    // i32.const 1 local.set 0 local.get 0 end
+    const auto tee = optimize_expr("4101210020000b"_bytes, i32_param_i32_result);
+    EXPECT_THAT(get_instructions(tee),
+        ElementsAreArray({Instr::i32_const, Instr::local_tee, Instr::end}));
+
+    // i32.const 1 local.tee 0 drop end
+    const auto set = optimize_expr("410122001a0b"_bytes, i32_param);
+    EXPECT_THAT(
+        get_instructions(set), ElementsAreArray({Instr::i32_const, Instr::local_set, Instr::end}));
+
+    // local.get 0 i32.const 2 i32.const 1 select end
+    EXPECT_THAT(get_instructions(optimize_expr("2000410241011b0b"_bytes, i32_param_i32_result)),
+        ElementsAreArray({Instr::local_get, Instr::end}));
+}
+
+TEST(optimizer, dead_code_removed)
+{
+    // block br 0 local.get 0 i32.eqz local.set 0 end end
+    const auto br = optimize_expr("02400c0020004521000b0b"_bytes, i32_param);
+    EXPECT_THAT(get_instructions(br), ElementsAreArray({Instr::br, Instr::end}));
+    EXPECT_EQ(br.instructions[0].target, 1);
+
+    // block block br 1 end local.get 0 i32.eqz local.set 0 end end
+    const auto nested = optimize_expr("024002400c010b20004521000b0b"_bytes, i32_param);
+    EXPECT_THAT(get_instructions(nested), ElementsAreArray({Instr::br, Instr::end}));
+
+    // block block br 0 end local.get 0 i32.eqz local.set 0 end end
+    const auto target_kept = optimize_expr("024002400c000b20004521000b0b"_bytes, i32_param);
+    EXPECT_THAT(get_instructions(target_kept),
+        ElementsAreArray(
+            {Instr::br, Instr::local_get, Instr::i32_eqz, Instr::local_set, Instr::end}));
+    EXPECT_EQ(target_kept.instructions[0].target, 1);
+}
+
+TEST(optimizer, constant_condition)
+{
+    // i32.const 1 if local.get 0 i32.eqz local.set 0 else unreachable end end
+    const auto if_true = optimize_expr("41010440200045210005000b0b"_bytes, i32_param);
+    EXPECT_THAT(get_instructions(if_true),
+        ElementsAreArray({Instr::local_get, Instr::i32_eqz, Instr::local_set, Instr::end}));
+
+    // i32.const 0 if unreachable else local.get 0 i32.eqz local.set 0 end end
+    const auto if_false = optimize_expr("41000440000520004521000b0b"_bytes, i32_param);
+    EXPECT_THAT(get_instructions(if_false),
+        ElementsAreArray({Instr::local_get, Instr::i32_eqz, Instr::local_set, Instr::end}));
+
+    // block i32.const 0 br_if 0 unreachable end end
+    EXPECT_THAT(get_instructions(optimize_expr("024041000d00000b0b"_bytes)),
+        ElementsAreArray({Instr::unreachable, Instr::end}));
+
+    // block i32.const 1 br_if 0 unreachable end end
+    EXPECT_THAT(get_instructions(optimize_expr("024041010d00000b0b"_bytes)),
+        ElementsAreArray({Instr::br, Instr::end}));
+}
+
+TEST(optimizer, branch_target_not_merged)
+{
+    // i32.const 0 block br 0 end drop end
+    const auto code = optimize_expr("410002400c000b1a0b"_bytes);
+    EXPECT_THAT(get_instructions(code),
+        ElementsAreArray({Instr::i32_const, Instr::br, Instr::drop, Instr::end}));
+    EXPECT_EQ(code.instructions[1].target, 2);
+}
+
+TEST(optimizer, br_table_targets_updated)
+{
+    // block local.get 0 br_table 0 0 end local.get 0 drop end
+    const auto code = optimize_expr("024020000e0100000b20001a0b"_bytes, i32_param);
+    EXPECT_THAT(get_instructions(code),
+        ElementsAreArray({Instr::local_get, Instr::br_table, Instr::end}));
+    ASSERT_EQ(code.br_table_labels.size(), 2);
+    EXPECT_EQ(code.br_table_labels[0].target, 2);
+    EXPECT_EQ(code.br_table_labels[1].target, 2);
+}
+
+TEST(optimizer, execute)
+{
+    // local.get 0 i32.const 16 i32.rem_u i32.const 2 i32.const 3 i32.mul i32.add end
+    const auto expr = "2000411070410241036c6a0b"_bytes;
+    for (const auto optimize : {false, true})
+    {
+        auto instance = instantiate(make_single_function_module(expr, i32_param_i32_result));
+        layout_code(instance->module, {optimize, {}});
+        EXPECT_THAT(execute(*instance, 0, {35}), Result(9));
+    }
+}
+
+TEST(optimizer, execute_trap_preserved)
+{
+    // local.get 0 i32.const 7 i32.const 0 i32.div_u i32.add end
+    const auto expr = "2000410741006e6a0b"_bytes;
+    for (const auto optimize : {false, true})
+    {
+        auto instance = instantiate(make_single_function_module(expr, i32_param_i32_result));
+        layout_code(instance->module, {optimize, {}});
+        EXPECT_THAT(execute(*instance, 0, {1}), Traps());
+    }
+}
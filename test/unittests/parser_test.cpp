@@ -12,6 +12,7 @@
 
 using namespace fizzy;
 using namespace fizzy::test;
+using namespace testing;
 
 namespace
 {
@@ -89,8 +90,28 @@ TEST(parser, limits_minmax_invalid_too_short)
 
 TEST(parser, limits_invalid)
 {
-    const auto wasm = bytes{wasm_prefix} + make_section(5, make_vec({"02"_bytes}));
-    EXPECT_THROW_MESSAGE(parse(wasm), parser_error, "invalid limits 2");
+    const auto wasm = bytes{wasm_prefix} + make_section(5, make_vec({"04"_bytes}));
+    EXPECT_THROW_MESSAGE(parse(wasm), parser_error, "invalid limits 4");
+}
+
+TEST(parser, limits_shared)
+{
+    const auto wasm = bytes{wasm_prefix} + make_section(5, make_vec({"03207f"_bytes}));
+    const auto module = parse(wasm);
+    const auto& limits = module.memorysec[0].limits;
+    EXPECT_EQ(limits.min, 0x20);
+    EXPECT_EQ(limits.max, 0x7f);
+    EXPECT_TRUE(limits.shared);
+
+    const auto wasm_no_max = bytes{wasm_prefix} + make_section(5, make_vec({"0220"_bytes}));
+    EXPECT_THROW_MESSAGE(
+        parse(wasm_no_max), validation_error, "shared memory must have maximum");
+
+    // The tables cannot be shared.
+    const auto wasm_table = bytes{wasm_prefix} + make_section(4, make_vec({"7003207f"_bytes}));
+    EXPECT_THROW_MESSAGE(parse(wasm_table), parser_error, "invalid limits 3");
+    const auto wasm_table_no_max = bytes{wasm_prefix} + make_section(4, make_vec({"700220"_bytes}));
+    EXPECT_THROW_MESSAGE(parse(wasm_table_no_max), parser_error, "invalid limits 2");
 }
 
 TEST(parser, module_empty)
@@ -634,6 +655,19 @@ TEST(parser, global_multi_const_inited)
     EXPECT_EQ(module.globalsec[1].expression.value.constant, uint32_t(-1));
 }
 
+TEST(parser, global_types)
+{
+    const auto section_contents =
+        make_vec({bytes{0x7f, 0x00, uint8_t(Instr::i32_const), 0x01, 0x0b},
+            bytes{0x7e, 0x01, uint8_t(Instr::i64_const), 0x01, 0x0b}});
+    const auto bin = bytes{wasm_prefix} + make_section(6, section_contents);
+
+    const auto module = parse(bin);
+    ASSERT_EQ(module.globalsec.size(), 2);
+    EXPECT_EQ(module.globalsec[0].type, ValType::i32);
+    EXPECT_EQ(module.globalsec[1].type, ValType::i64);
+}
+
 TEST(parser, global_invalid_mutability)
 {
     const auto wasm = bytes{wasm_prefix} + make_section(6, make_vec({"7f02"_bytes}));
@@ -1054,7 +1088,7 @@ TEST(parser, code_section_with_basic_instructions)
     EXPECT_EQ(module.codesec[0].instructions[5], Instr::unreachable);
     EXPECT_EQ(module.codesec[0].instructions[6], Instr::end);
     ASSERT_EQ(module.codesec[0].immediates.size(), 3 * 4);
-    EXPECT_EQ(module.codesec[0].immediates, "010000000200000003000000"_bytes);
+    EXPECT_EQ(bytes_view{module.codesec[0].immediates}, "010000000200000003000000"_bytes);
 }
 
 TEST(parser, code_section_with_memory_size)
@@ -1105,7 +1139,7 @@ TEST(parser, code_section_with_memory_grow)
     EXPECT_EQ(module.codesec[0].instructions[1], Instr::memory_grow);
     EXPECT_EQ(module.codesec[0].instructions[2], Instr::drop);
     EXPECT_EQ(module.codesec[0].instructions[3], Instr::end);
-    EXPECT_EQ(module.codesec[0].immediates, "00000000"_bytes);
+    EXPECT_EQ(bytes_view{module.codesec[0].immediates}, "00000000"_bytes);
 
     const auto func_bin_invalid = "00"_bytes +  // vec(locals)
                                   i32_const(0) + "40011a0b"_bytes;
@@ -1118,6 +1152,44 @@ TEST(parser, code_section_with_memory_grow)
     EXPECT_THROW_MESSAGE(parse(bin_invalid), parser_error, "invalid memory index encountered");
 }
 
+TEST(parser, code_section_with_atomic_instructions)
+{
+    // i64.atomic.rmw8.cmpxchg_u offset=5, atomic.fence, i32.atomic.store offset=0x80
+    const auto func_bin = "00"_bytes +  // vec(locals)
+                          i32_const(0) + i32_const(1) + i32_const(2) + "fe4c00051a"_bytes +
+                          "fe0300"_bytes + i32_const(0) + i32_const(1) + "fe170280010b"_bytes;
+    const auto bin = bytes{wasm_prefix} + make_section(1, make_vec({make_functype({}, {})})) +
+                     make_section(3, "0100"_bytes) + make_section(5, make_vec({"030101"_bytes})) +
+                     make_section(10, make_vec({add_size_prefix(func_bin)}));
+
+    const auto module = parse(bin);
+    ASSERT_EQ(module.codesec.size(), 1);
+    const auto& code = module.codesec[0];
+    EXPECT_THAT(code.instructions,
+        ElementsAre(Instr::i32_const, Instr::i32_const, Instr::i32_const, Instr::atomic_cmpxchg,
+            Instr::drop, Instr::atomic_fence, Instr::i32_const, Instr::i32_const,
+            Instr::atomic_store, Instr::end));
+    EXPECT_EQ(bytes_view{code.immediates},
+        "000000000100000002000000"
+        "050000004c"
+        "0000000001000000"
+        "8000000017"_bytes);
+    EXPECT_EQ(code.max_stack_height, 3);
+
+    const auto parse_atomic = [](const bytes& atomic_bin) {
+        const auto invalid_func_bin = "00"_bytes + i32_const(0) + i32_const(0) + i32_const(0) +
+                                      atomic_bin + "1a0b"_bytes;
+        return parse(bytes{wasm_prefix} + make_section(1, make_vec({make_functype({}, {})})) +
+                     make_section(3, "0100"_bytes) + make_section(5, make_vec({"030101"_bytes})) +
+                     make_section(10, make_vec({add_size_prefix(invalid_func_bin)})));
+    };
+    EXPECT_THROW_MESSAGE(parse_atomic("fe04"_bytes), parser_error, "invalid atomic instruction 4");
+    EXPECT_THROW_MESSAGE(
+        parse_atomic("fe4f0200"_bytes), parser_error, "invalid atomic instruction 79");
+    EXPECT_THROW_MESSAGE(
+        parse_atomic("fe0301"_bytes), parser_error, "invalid atomic.fence flags 1");
+}
+
 TEST(parser, code_section_fp_instructions)
 {
     const uint8_t fp_instructions[] = {0x2a, 0x2b, 0x38, 0x39, 0x43, 0x44, 0x5b, 0x5c, 0x5d, 0x5e,
@@ -1175,7 +1247,7 @@ TEST(parser, code_section_invalid_instructions)
         0xc8, 0xc9, 0xca, 0xcb, 0xcc, 0xcd, 0xce, 0xcf, 0xd0, 0xd1, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6,
         0xd7, 0xd8, 0xd9, 0xda, 0xdb, 0xdc, 0xdd, 0xde, 0xdf, 0xe0, 0xe1, 0xe2, 0xe3, 0xe4, 0xe5,
         0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xeb, 0xec, 0xed, 0xee, 0xef, 0xf0, 0xf1, 0xf2, 0xf3, 0xf4,
-        0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff};
+        0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xff};
 
     for (const auto instr : invalid_instructions)
     {
@@ -1242,6 +1314,93 @@ TEST(parser, code_section_without_function_section)
         "malformed binary: number of function and code entries must match");
 }
 
+TEST(parser, code_section_prune_unreachable_functions)
+{
+    /* wat2wasm --no-check
+    (import "m" "f" (func))
+    (table 1 funcref)
+    (elem (i32.const 0) 3)
+    (func (export "e") (call 2))
+    (func (call 0))
+    (func)
+    (func (call 5))
+    (func)
+    (func nop)
+    (func i32.add)
+    (start 6)
+    */
+    const auto wasm = from_hex(
+        "0061736d01000000010401600000020701016d0166000003080700000000000000040401700001070501016500"
+        "010801060907010041000b01030a1e07040010020b040010000b02000b040010050b02000b0300010b0300"
+        "6a0b");
+
+    EXPECT_THROW_MESSAGE(parse(wasm), validation_error, "stack underflow");
+
+    const auto module = parse(wasm, {true});
+    ASSERT_EQ(module.codesec.size(), 7);
+
+    // Reachable from the export, the call, the element segment and the start function.
+    EXPECT_THAT(module.codesec[0].instructions, ElementsAre(Instr::call, Instr::end));
+    EXPECT_THAT(module.codesec[1].instructions, ElementsAre(Instr::call, Instr::end));
+    EXPECT_THAT(module.codesec[2].instructions, ElementsAre(Instr::end));
+    EXPECT_THAT(module.codesec[5].instructions, ElementsAre(Instr::nop, Instr::end));
+
+    // Unreachable, including the function called from an unreachable one and the invalid one.
+    for (const auto code_idx : {size_t{3}, size_t{4}, size_t{6}})
+    {
+        EXPECT_THAT(module.codesec[code_idx].instructions,
+            ElementsAre(Instr::unreachable, Instr::end));
+        EXPECT_TRUE(module.codesec[code_idx].immediates.empty());
+        EXPECT_EQ(module.codesec[code_idx].max_stack_height, 0);
+    }
+}
+
+TEST(parser, code_section_allocated_from_arena)
+{
+    /* wat2wasm
+    (func (export "e") (result i32) (call 1))
+    (func (result i32) (i32.const 1))
+    (func)
+    */
+    const auto wasm = from_hex(
+        "0061736d010000000108026000017f600000030403000001070501016500000a0e"
+        "03040010010b040041010b02000b");
+
+    for (const auto prune : {false, true})
+    {
+        const auto module = parse(wasm, {prune});
+        ASSERT_EQ(module.codesec.size(), 3);
+        for (const auto& code : module.codesec)
+        {
+            EXPECT_EQ(code.instructions.get_allocator().resource(), module.arena.resource());
+            EXPECT_EQ(code.immediates.get_allocator().resource(), module.arena.resource());
+        }
+    }
+}
+
+TEST(parser, module_move_assignment)
+{
+    /* wat2wasm
+    (func (export "e") (result i32) (call 1))
+    (func (result i32) (i32.const 1))
+    (func)
+    */
+    const auto wasm = from_hex(
+        "0061736d010000000108026000017f600000030403000001070501016500000a0e"
+        "03040010010b040041010b02000b");
+
+    auto module = parse(wasm);
+    // The code of the assigned module, including the unreachable stub allocated by the parser,
+    // must stay allocated after the temporary module is destroyed.
+    module = parse(wasm, {true});
+    ASSERT_EQ(module.codesec.size(), 3);
+    EXPECT_THAT(module.codesec[0].instructions, ElementsAre(Instr::call, Instr::end));
+    EXPECT_THAT(module.codesec[1].instructions, ElementsAre(Instr::i32_const, Instr::end));
+    EXPECT_THAT(module.codesec[2].instructions, ElementsAre(Instr::unreachable, Instr::end));
+    for (const auto& code : module.codesec)
+        EXPECT_EQ(code.instructions.get_allocator().resource(), module.arena.resource());
+}
+
 TEST(parser, data_section_empty)
 {
     const auto bin = bytes{wasm_prefix} + make_section(5, make_vec({"0000"_bytes})) +
@@ -1394,10 +1553,10 @@ TEST(parser, milestone1)
     ASSERT_EQ(m.codesec.size(), 1);
     const auto& c = m.codesec[0];
     EXPECT_EQ(c.local_count, 1);
-    EXPECT_EQ(c.instructions,
-        (std::vector{Instr::local_get, Instr::local_get, Instr::i32_add, Instr::local_get,
+    EXPECT_THAT(c.instructions,
+        ElementsAreArray({Instr::local_get, Instr::local_get, Instr::i32_add, Instr::local_get,
             Instr::i32_add, Instr::local_tee, Instr::local_get, Instr::i32_add, Instr::end}));
-    EXPECT_EQ(c.immediates,
+    EXPECT_EQ(bytes_view{c.immediates},
         "00000000"
         "01000000"
         "02000000"
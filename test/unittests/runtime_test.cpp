@@ -0,0 +1,177 @@
+// Fizzy: A fast WebAssembly interpreter
+// Copyright 2020 The Fizzy Authors.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "parser.hpp"
+#include "runtime.hpp"
+#include <gmock/gmock.h>
+#include <test/utils/asserts.hpp>
+#include <test/utils/hex.hpp>
+#include <atomic>
+
+using namespace fizzy;
+using namespace testing;
+
+namespace
+{
+/* wat2wasm
+(func (param i32 i32) (result i32) (i32.add (local.get 0) (local.get 1)))
+(func (result i32) unreachable)
+(global $g (mut i32) (i32.const 0))
+(func (result i32) (global.set $g (i32.add (global.get $g) (i32.const 1))) (global.get $g))
+*/
+const auto basic_wasm = from_hex(
+    "0061736d01000000010b0260027f7f017f6000017f0304030001010606017f0141000b0a19030700200020016a0b"
+    "0300000b0b00230041016a240023000b");
+
+/* wat2wasm
+(func $f (import "env" "f") (param i32) (result i32))
+(func (param i32) (result i32) (call $f (i32.add (local.get 0) (i32.const 1))))
+*/
+const auto imported_wasm = from_hex(
+    "0061736d0100000001060160017f017f02090103656e7601660000030201000a0b010900200041016a10000b");
+}  // namespace
+
+TEST(runtime, thread_count)
+{
+    EXPECT_EQ(Runtime{0}.get_thread_count(), 1);
+    EXPECT_EQ(Runtime{3}.get_thread_count(), 3);
+    EXPECT_GE(Runtime{}.get_thread_count(), 1);
+}
+
+TEST(runtime, submit_futures)
+{
+    Runtime runtime{4};
+    const auto module_id = runtime.add_module(parse(basic_wasm));
+
+    std::vector<Job> jobs;
+    for (uint64_t i = 0; i < 1000; ++i)
+        jobs.push_back({module_id, 0, {i, 2 * i}});
+
+    auto futures = runtime.submit(std::move(jobs));
+    ASSERT_EQ(futures.size(), 1000);
+    for (size_t i = 0; i < futures.size(); ++i)
+        EXPECT_THAT(futures[i].get(), Result(3 * i));
+
+    // The empty batch.
+    EXPECT_THAT(runtime.submit(std::vector<Job>{}), IsEmpty());
+}
+
+TEST(runtime, submit_callback)
+{
+    Runtime runtime{3};
+    const auto module_id = runtime.add_module(parse(basic_wasm));
+
+    std::vector<Job> jobs;
+    for (uint64_t i = 0; i < 500; ++i)
+    {
+        if (i % 2 == 0)
+            jobs.push_back({module_id, 0, {i, 1}});
+        else
+            jobs.push_back({module_id, 1, {}});
+    }
+
+    std::vector<std::atomic<uint64_t>> results(jobs.size());
+    std::atomic<size_t> num_traps{0};
+    runtime.submit(
+        std::move(jobs), [&](size_t job_idx, execution_result result, std::exception_ptr) {
+            if (result.trapped)
+                ++num_traps;
+            else
+                results[job_idx] = result.stack.at(0);
+        });
+    runtime.wait();
+
+    EXPECT_EQ(num_traps, 250);
+    for (size_t i = 0; i < results.size(); i += 2)
+        EXPECT_EQ(results[i], i + 1);
+}
+
+TEST(runtime, multiple_modules)
+{
+    Runtime runtime{2};
+    const auto basic_id = runtime.add_module(parse(basic_wasm));
+
+    std::atomic<int> num_host_calls{0};
+    const auto host_f = [&num_host_calls](Instance&, std::vector<uint64_t> args, int) {
+        ++num_host_calls;
+        return execution_result{false, {args[0] * 10}};
+    };
+    const auto imported_id = runtime.add_module(parse(imported_wasm),
+        {{host_f, FuncType{{ValType::i32}, {ValType::i32}}}});
+    EXPECT_NE(basic_id, imported_id);
+
+    std::vector<Job> jobs;
+    for (uint64_t i = 0; i < 100; ++i)
+    {
+        jobs.push_back({basic_id, 0, {i, i}});
+        jobs.push_back({imported_id, 1, {i}});
+    }
+
+    auto futures = runtime.submit(std::move(jobs));
+    for (uint64_t i = 0; i < 100; ++i)
+    {
+        EXPECT_THAT(futures[2 * i].get(), Result(2 * i));
+        EXPECT_THAT(futures[2 * i + 1].get(), Result((i + 1) * 10));
+    }
+    EXPECT_EQ(num_host_calls, 100);
+}
+
+TEST(runtime, instances_reused_by_worker)
+{
+    // The single worker executes all jobs on the single instance, so the global counter grows.
+    Runtime runtime{1};
+    const auto module_id = runtime.add_module(parse(basic_wasm));
+
+    auto futures = runtime.submit({{module_id, 2, {}}, {module_id, 2, {}}, {module_id, 2, {}}});
+    std::vector<uint64_t> results;
+    for (auto& future : futures)
+        results.push_back(future.get().stack.at(0));
+    EXPECT_THAT(results, UnorderedElementsAre(1, 2, 3));
+}
+
+TEST(runtime, exception)
+{
+    Runtime runtime{2};
+    const auto host_f = [](Instance&, std::vector<uint64_t>, int) -> execution_result {
+        throw std::runtime_error{"host error"};
+    };
+    const auto module_id = runtime.add_module(
+        parse(imported_wasm), {{host_f, FuncType{{ValType::i32}, {ValType::i32}}}});
+
+    auto futures = runtime.submit({{module_id, 1, {0}}});
+    EXPECT_THROW_MESSAGE(futures[0].get(), std::runtime_error, "host error");
+
+    // Passed to the callback with the trap.
+    bool trapped = false;
+    std::exception_ptr error;
+    runtime.submit({{module_id, 1, {0}}},
+        [&](size_t, execution_result result, std::exception_ptr e) {
+            trapped = result.trapped;
+            error = std::move(e);
+        });
+    runtime.wait();
+    EXPECT_TRUE(trapped);
+    ASSERT_NE(error, nullptr);
+    EXPECT_THROW_MESSAGE(std::rethrow_exception(error), std::runtime_error, "host error");
+}
+
+TEST(runtime, add_module_instantiate_error)
+{
+    Runtime runtime{1};
+    EXPECT_THROW_MESSAGE(runtime.add_module(parse(imported_wasm)), instantiate_error,
+        "module requires 1 imported functions, 0 provided");
+}
+
+TEST(runtime, destroy_with_pending_jobs)
+{
+    std::atomic<size_t> num_completed{0};
+    {
+        Runtime runtime{2};
+        const auto module_id = runtime.add_module(parse(basic_wasm));
+        std::vector<Job> jobs(200, {module_id, 0, {1, 2}});
+        runtime.submit(std::move(jobs),
+            [&num_completed](size_t, execution_result, std::exception_ptr) { ++num_completed; });
+    }
+    EXPECT_EQ(num_completed, 200);
+}
@@ -0,0 +1,88 @@
+// Fizzy: A fast WebAssembly interpreter
+// Copyright 2020 The Fizzy Authors.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "code_layout.hpp"
+#include "execute.hpp"
+#include "parser.hpp"
+#include "specialization.hpp"
+#include "tiering.hpp"
+#include <gtest/gtest.h>
+#include <test/utils/asserts.hpp>
+#include <test/utils/hex.hpp>
+
+using namespace fizzy;
+
+namespace
+{
+/// Creates the module with the imported mutable global, the globals
+/// 1: immutable i32 40, 2: mutable i32 7, 3: immutable i64 2^32, and the functions without
+/// parameters returning the value of the given type.
+Module make_module(const std::vector<std::pair<ValType, bytes>>& functions)
+{
+    Module module;
+    module.imported_globals_mutability.emplace_back(true);
+    module.globalsec.emplace_back(Global{false, {ConstantExpression::Kind::Constant, {40}}});
+    module.globalsec.emplace_back(Global{true, {ConstantExpression::Kind::Constant, {7}}});
+    module.globalsec.emplace_back(
+        Global{false, {ConstantExpression::Kind::Constant, {0x100000000}}, ValType::i64});
+    for (const auto& [result_type, expr] : functions)
+    {
+        module.funcsec.emplace_back(static_cast<TypeIdx>(module.typesec.size()));
+        module.typesec.emplace_back(FuncType{{}, {result_type}});
+        auto [code, _] = parse_expr(expr.data(), expr.data() + expr.size(),
+            static_cast<FuncIdx>(module.codesec.size()), module);
+        module.codesec.emplace_back(std::move(code));
+    }
+    return module;
+}
+
+const CodeWord* get_code_words(const Instance& instance, size_t code_idx)
+{
+    return get_code_words(instance.module, instance.module.codesec[code_idx]);
+}
+}  // namespace
+
+TEST(specialization, globals)
+{
+    const auto module = make_module({
+        // global.get 1 i32.const 2 i32.add global.get 0 i32.add global.set 2 global.get 2 end
+        {ValType::i32, "230141026a23006a240223020b"_bytes},
+        // global.get 3 i64.const 1 i64.add end
+        {ValType::i64, "230342017c0b"_bytes},
+    });
+
+    uint64_t imported_global = 100;
+    auto instance = instantiate(module, {}, {}, {}, {ExternalGlobal{&imported_global, true}});
+    EXPECT_EQ(get_code_words(*instance, 0)[0].op.instr, Instr::global_get);
+    EXPECT_THAT(execute(*instance, 0, {}), Result(142));
+
+    specialize(*instance);
+    const auto* const code0 = get_code_words(*instance, 0);
+    EXPECT_EQ(code0[0].op.instr, Instr::i32_const);
+    EXPECT_EQ(code0[0].op.imm, 42);
+    EXPECT_EQ(code0[1].op.instr, Instr::global_get_direct);
+    EXPECT_EQ(code0[3].op.instr, Instr::i32_add);
+    EXPECT_EQ(code0[4].op.instr, Instr::global_set_direct);
+    EXPECT_EQ(code0[6].op.instr, Instr::global_get_direct);
+    const auto* const code1 = get_code_words(*instance, 1);
+    EXPECT_EQ(code1[0].op.instr, Instr::i64_const);
+    EXPECT_EQ(code1[1].value, 0x100000001);
+
+    imported_global = 5;
+    EXPECT_THAT(execute(*instance, 0, {}), Result(47));
+    EXPECT_EQ(instance->globals[1], 47);
+    EXPECT_THAT(execute(*instance, 1, {}), Result(0x100000001));
+}
+
+TEST(specialization, stops_tiering)
+{
+    uint64_t imported_global = 0;
+    auto instance = instantiate(make_module({{ValType::i32, "23010b"_bytes}}), {}, {}, {},
+        {ExternalGlobal{&imported_global, true}});
+    enable_tiering(*instance);
+    specialize(*instance);
+    EXPECT_EQ(instance->tiering, nullptr);
+    EXPECT_EQ(get_tiering_stats(*instance).functions.size(), 0);
+    EXPECT_THAT(execute(*instance, 0, {}), Result(40));
+}
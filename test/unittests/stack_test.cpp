@@ -259,6 +259,48 @@ TEST(operand_stack, shrink)
     EXPECT_EQ(stack[new_height - 1], 0);
 }
 
+TEST(operand_stack, external_storage)
+{
+    uint64_t storage[4]{};
+    OperandStack stack(3, &storage[1]);
+    EXPECT_EQ(stack.size(), 0);
+
+    stack.push(1);
+    stack.push(2);
+    stack.push(3);
+    EXPECT_THAT(storage, ElementsAre(0, 1, 2, 3));
+
+    EXPECT_EQ(stack.drop(2), &storage[2]);
+    EXPECT_EQ(stack.size(), 1);
+    EXPECT_EQ(stack.top(), 1);
+    EXPECT_EQ(stack.drop(0), &storage[2]);
+
+    stack.push(4);
+    EXPECT_THAT(storage, ElementsAre(0, 1, 4, 3));
+}
+
+TEST(operand_stack, reserve)
+{
+    OperandStack stack(2);
+    stack.push(1);
+    stack.push(2);
+
+    stack.reserve(3);
+    stack.push(3);
+    EXPECT_THAT(std::vector(stack.rbegin(), stack.rend()), ElementsAre(1, 2, 3));
+
+    constexpr auto max_height = 40;
+    stack.reserve(max_height);
+    while (stack.size() < max_height)
+        stack.push(stack.size() + 1);
+    EXPECT_EQ(stack.top(), max_height);
+    EXPECT_EQ(stack[max_height - 1], 1);
+
+    stack.shrink(1);
+    stack.reserve(1);
+    EXPECT_THAT(std::vector(stack.rbegin(), stack.rend()), ElementsAre(1));
+}
+
 TEST(operand_stack, rbegin_rend)
 {
     OperandStack stack(3);
@@ -0,0 +1,256 @@
+// Fizzy: A fast WebAssembly interpreter
+// Copyright 2020 The Fizzy Authors.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "parser.hpp"
+#include "tiering.hpp"
+#include <gtest/gtest.h>
+#include <test/utils/asserts.hpp>
+#include <test/utils/hex.hpp>
+#include <atomic>
+#include <thread>
+
+using namespace fizzy;
+
+namespace
+{
+/* wat2wasm
+(func $add1 (param i32) (result i32)
+  (i32.add (local.get 0) (i32.const 1))
+)
+(func $call_add1 (param i32) (result i32)
+  (call $add1 (local.get 0))
+)
+(func $sum (param $n i32) (result i32) (local $s i32)
+  (block
+    (loop
+      (br_if 1 (i32.eqz (local.get $n)))
+      (local.set $s (i32.add (local.get $s) (local.get $n)))
+      (local.set $n (i32.sub (local.get $n) (i32.const 1)))
+      (br 0)
+    )
+  )
+  (local.get $s)
+)
+(func $count (param $n i32) (result i32) (local $s i32)
+  (i32.const 1000)
+  (block
+    (loop
+      (br_if 1 (i32.eqz (local.get $n)))
+      (local.set $s (call $add1 (local.get $s)))
+      (local.set $n (i32.sub (local.get $n) (i32.const 1)))
+      (br 0)
+    )
+  )
+  (i32.add (local.get $s))
+)
+*/
+const auto wasm = from_hex(
+    "0061736d0100000001060160017f017f030504000000000a57040700200041016a0b0600200010000b2101017f02"
+    "4003402000450d01200120006a2101200041016b21000c000b0b20010b2401017f41e807024003402000450d0120"
+    "0110002101200041016b21000c000b0b20016a0b");
+}  // namespace
+
+TEST(tiering, disabled_by_default)
+{
+    auto instance = instantiate(parse(wasm));
+    EXPECT_EQ(instance->tiering, nullptr);
+    EXPECT_THAT(execute(*instance, 1, {1}), Result(2));
+
+    const auto stats = get_tiering_stats(*instance);
+    EXPECT_TRUE(stats.functions.empty());
+    EXPECT_EQ(stats.promoted_count, 0);
+    EXPECT_EQ(stats.optimized_count, 0);
+}
+
+TEST(tiering, promotion_by_calls)
+{
+    auto instance = instantiate(parse(wasm));
+    enable_tiering(*instance, {3, 1000, 1000, false});
+
+    for (uint64_t i = 0; i < 5; ++i)
+    {
+        EXPECT_THAT(execute(*instance, 1, {i}), Result(i + 1));
+
+        const auto stats = get_tiering_stats(*instance);
+        ASSERT_EQ(stats.functions.size(), 4);
+        const auto& function = stats.functions[1];
+        EXPECT_EQ(function.call_count, i + 1);
+        EXPECT_EQ(function.back_edge_count, 0);
+        EXPECT_EQ(function.promoted, i + 1 >= 3);
+        EXPECT_EQ(function.tier, i + 1 >= 3 ? Tier::optimized : Tier::baseline);
+    }
+
+    // The call to $add1 is inlined in the optimized code, so $add1 stays cold.
+    const auto stats = get_tiering_stats(*instance);
+    EXPECT_EQ(stats.functions[0].call_count, 2);
+    EXPECT_FALSE(stats.functions[0].promoted);
+    EXPECT_EQ(stats.functions[0].tier, Tier::baseline);
+    EXPECT_EQ(stats.promoted_count, 1);
+    EXPECT_EQ(stats.optimized_count, 1);
+}
+
+TEST(tiering, promotion_by_back_edges)
+{
+    auto instance = instantiate(parse(wasm));
+    enable_tiering(*instance, {1000, 10, 1000, false});
+
+    // The loop takes n back-edges, the function is promoted at the exit of the second call.
+    EXPECT_THAT(execute(*instance, 2, {6}), Result(21));
+    EXPECT_EQ(get_tiering_stats(*instance).functions[2].back_edge_count, 6);
+    EXPECT_EQ(get_tiering_stats(*instance).functions[2].tier, Tier::baseline);
+
+    EXPECT_THAT(execute(*instance, 2, {4}), Result(10));
+    auto stats = get_tiering_stats(*instance);
+    EXPECT_EQ(stats.functions[2].back_edge_count, 10);
+    EXPECT_TRUE(stats.functions[2].promoted);
+    EXPECT_EQ(stats.functions[2].tier, Tier::optimized);
+
+    EXPECT_THAT(execute(*instance, 2, {100}), Result(5050));
+    stats = get_tiering_stats(*instance);
+    EXPECT_EQ(stats.functions[2].call_count, 3);
+    EXPECT_EQ(stats.functions[2].back_edge_count, 110);
+    EXPECT_EQ(stats.promoted_count, 1);
+    EXPECT_EQ(stats.optimized_count, 1);
+}
+
+TEST(tiering, background_promotion)
+{
+    auto instance = instantiate(parse(wasm));
+    enable_tiering(*instance, {10, 100, 1000, true});
+
+    // The results are the same before, during and after the promotion.
+    for (uint32_t i = 0; i < 50; ++i)
+    {
+        EXPECT_THAT(execute(*instance, 1, {i}), Result(i + 1));
+        EXPECT_THAT(execute(*instance, 2, {i}), Result(i * (i + 1) / 2));
+    }
+
+    wait_for_promotions(*instance);
+    const auto stats = get_tiering_stats(*instance);
+    EXPECT_TRUE(stats.functions[1].promoted);
+    EXPECT_TRUE(stats.functions[2].promoted);
+    EXPECT_EQ(stats.functions[1].tier, Tier::optimized);
+    EXPECT_EQ(stats.functions[2].tier, Tier::optimized);
+    EXPECT_EQ(stats.promoted_count, stats.optimized_count);
+
+    EXPECT_THAT(execute(*instance, 1, {41}), Result(42));
+    EXPECT_THAT(execute(*instance, 2, {10}), Result(55));
+}
+
+TEST(tiering, stats_read_during_execution)
+{
+    auto instance = instantiate(parse(wasm));
+    enable_tiering(*instance, {10, 100, 1000, true});
+
+    // The statistics are read by another thread while the counters are updated.
+    std::atomic<bool> done{false};
+    std::thread reader{[&instance, &done] {
+        while (!done.load())
+        {
+            const auto stats = get_tiering_stats(*instance);
+            ASSERT_EQ(stats.functions.size(), 4);
+            EXPECT_LE(stats.optimized_count, stats.promoted_count);
+        }
+    }};
+    for (uint32_t i = 0; i < 100; ++i)
+        EXPECT_THAT(execute(*instance, 3, {i}), Result(1000 + i));
+    done = true;
+    reader.join();
+
+    EXPECT_EQ(get_tiering_stats(*instance).functions[3].call_count, 100);
+}
+
+TEST(tiering, cold_instance_destroyed)
+{
+    // The background thread is only started by the first promotion.
+    auto instance = instantiate(parse(wasm));
+    enable_tiering(*instance);
+    EXPECT_THAT(execute(*instance, 2, {3}), Result(6));
+    wait_for_promotions(*instance);
+    EXPECT_EQ(get_tiering_stats(*instance).promoted_count, 0);
+}
+
+TEST(tiering, destroyed_during_compilation)
+{
+    auto instance = instantiate(parse(wasm));
+    enable_tiering(*instance, {1, 1, 1, true});
+    EXPECT_THAT(execute(*instance, 1, {0}), Result(1));
+    EXPECT_THAT(execute(*instance, 2, {2}), Result(3));
+    instance.reset();
+}
+
+TEST(tiering, enable_twice)
+{
+    auto instance = instantiate(parse(wasm));
+    enable_tiering(*instance, {1, 1, 1, false});
+    EXPECT_THAT(execute(*instance, 1, {0}), Result(1));
+    EXPECT_EQ(get_tiering_stats(*instance).optimized_count, 1);
+
+    // The statistics are reset.
+    enable_tiering(*instance, {1, 1, 1, false});
+    EXPECT_EQ(get_tiering_stats(*instance).optimized_count, 0);
+    EXPECT_THAT(execute(*instance, 1, {0}), Result(1));
+    EXPECT_EQ(get_tiering_stats(*instance).optimized_count, 1);
+}
+
+TEST(tiering, on_stack_replacement)
+{
+    auto instance = instantiate(parse(wasm));
+    enable_tiering(*instance, {1000, 10, 5, false});
+
+    // The loop is promoted at the second check and continues in the optimized code.
+    EXPECT_THAT(execute(*instance, 2, {100}), Result(5050));
+    auto stats = get_tiering_stats(*instance);
+    EXPECT_EQ(stats.functions[2].call_count, 1);
+    EXPECT_EQ(stats.functions[2].back_edge_count, 100);
+    EXPECT_EQ(stats.functions[2].osr_count, 1);
+    EXPECT_EQ(stats.functions[2].tier, Tier::optimized);
+
+    // The next calls start in the optimized code.
+    EXPECT_THAT(execute(*instance, 2, {100}), Result(5050));
+    stats = get_tiering_stats(*instance);
+    EXPECT_EQ(stats.functions[2].back_edge_count, 200);
+    EXPECT_EQ(stats.functions[2].osr_count, 1);
+}
+
+TEST(tiering, on_stack_replacement_with_inlining)
+{
+    auto instance = instantiate(parse(wasm));
+    enable_tiering(*instance, {1000, 3, 3, false});
+
+    // The operand stack at the loop header is not empty and the optimized code
+    // has the additional local of the inlined $add1.
+    EXPECT_THAT(execute(*instance, 3, {7}), Result(1007));
+    auto stats = get_tiering_stats(*instance);
+    EXPECT_EQ(stats.functions[3].osr_count, 1);
+    EXPECT_EQ(stats.functions[0].call_count, 3);
+
+    EXPECT_THAT(execute(*instance, 3, {7}), Result(1007));
+    stats = get_tiering_stats(*instance);
+    EXPECT_EQ(stats.functions[0].call_count, 3);
+}
+
+TEST(tiering, on_stack_replacement_check_interval)
+{
+    auto instance = instantiate(parse(wasm));
+    enable_tiering(*instance, {1000, 10, 1000, false});
+
+    // The back-edges are only checked at the function exit.
+    EXPECT_THAT(execute(*instance, 2, {100}), Result(5050));
+    const auto stats = get_tiering_stats(*instance);
+    EXPECT_EQ(stats.functions[2].osr_count, 0);
+    EXPECT_TRUE(stats.functions[2].promoted);
+}
+
+TEST(tiering, on_stack_replacement_background)
+{
+    auto instance = instantiate(parse(wasm));
+    enable_tiering(*instance, {1000, 10, 10, true});
+
+    // The loop may switch to the optimized code at any check after the compilation completes.
+    EXPECT_THAT(execute(*instance, 2, {100000}), Result(705082704));
+    wait_for_promotions(*instance);
+    EXPECT_EQ(get_tiering_stats(*instance).functions[2].tier, Tier::optimized);
+    EXPECT_THAT(execute(*instance, 3, {100000}), Result(101000));
+}
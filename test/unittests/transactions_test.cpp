@@ -0,0 +1,310 @@
+// Fizzy: A fast WebAssembly interpreter
+// Copyright 2020 The Fizzy Authors.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "parser.hpp"
+#include "transactions.hpp"
+#include <gmock/gmock.h>
+#include <test/utils/asserts.hpp>
+#include <test/utils/hex.hpp>
+
+using namespace fizzy;
+using namespace testing;
+
+namespace
+{
+/* wat2wasm
+(func $load (import "env" "load") (param i64) (result i64))
+(func $store (import "env" "store") (param i64 i64))
+(memory 1)
+(global $g (mut i32) (i32.const 0))
+(func $add_at (param $addr i32) (param $v i32) (result i32)
+  (i32.store (local.get $addr) (i32.add (i32.load (local.get $addr)) (local.get $v)))
+  (i32.load (local.get $addr)))
+(func $inc_global (result i32)
+  (global.set $g (i32.add (global.get $g) (i32.const 1)))
+  (global.get $g))
+(func $host_inc (param $key i64) (result i64)
+  (call $store (local.get $key) (i64.add (call $load (local.get $key)) (i64.const 1)))
+  (call $load (local.get $key)))
+(func $grow (result i32) (memory.grow (i32.const 1)))
+(func $size (result i32) (memory.size))
+*/
+const auto contract_wasm = from_hex(
+    "0061736d0100000001150460017e017e60027e7e0060027f7f017f6000017f02180203656e76046c6f6164000003"
+    "656e760573746f72650001030605020300030305030100010606017f0141000b0a400514002000200028020020"
+    "016a36020020002802000b0b00230041016a240023000b110020002000100042017c1001200010000b06004101"
+    "40000b04003f000b");
+
+constexpr uint64_t WasmPageSize = 65536;
+
+constexpr FuncIdx load_idx = 0;
+constexpr FuncIdx add_at_idx = 2;
+constexpr FuncIdx inc_global_idx = 3;
+constexpr FuncIdx host_inc_idx = 4;
+constexpr FuncIdx grow_idx = 5;
+constexpr FuncIdx size_idx = 6;
+
+std::unique_ptr<Instance> instantiate_contract(std::function<void()> on_store = [] {})
+{
+    const auto load = [](Instance&, std::vector<uint64_t> args, int) {
+        return execution_result{false, {current_host_state()->load(args[0])}};
+    };
+    const auto store = [on_store](Instance&, std::vector<uint64_t> args, int) {
+        on_store();
+        current_host_state()->store(args[0], args[1]);
+        return execution_result{false, {}};
+    };
+    return instantiate(parse(contract_wasm),
+        {{load, FuncType{{ValType::i64}, {ValType::i64}}},
+            {store, FuncType{{ValType::i64, ValType::i64}, {}}}});
+}
+
+/// Executes the transactions one by one, each in its own block.
+std::vector<execution_result> execute_serially(
+    Instance& instance, HostState& host_state, const std::vector<Transaction>& transactions)
+{
+    TransactionScheduler scheduler{instance, host_state, 1};
+    std::vector<execution_result> results;
+    for (const auto& transaction : transactions)
+        results.emplace_back(scheduler.execute_block({transaction}).results.at(0));
+    return results;
+}
+
+void expect_same_results(
+    const std::vector<execution_result>& results, const std::vector<execution_result>& expected)
+{
+    ASSERT_EQ(results.size(), expected.size());
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        EXPECT_EQ(results[i].trapped, expected[i].trapped) << "transaction " << i;
+        EXPECT_EQ(results[i].stack, expected[i].stack) << "transaction " << i;
+    }
+}
+}  // namespace
+
+TEST(transactions, host_state_view)
+{
+    const HostState committed{{1, 10}, {2, 20}};
+    HostStateView view{committed};
+    EXPECT_EQ(view.load(1), 10);
+    EXPECT_EQ(view.load(3), 0);
+    view.store(2, 21);
+    EXPECT_EQ(view.load(2), 21);
+    EXPECT_EQ(committed.at(2), 20);
+    EXPECT_THAT(view.reads(), UnorderedElementsAre(1, 2, 3));
+    EXPECT_THAT(view.writes(), UnorderedElementsAre(Pair(2, 21)));
+
+    EXPECT_EQ(current_host_state(), nullptr);
+}
+
+TEST(transactions, empty_block)
+{
+    const auto instance = instantiate_contract();
+    HostState host_state;
+    TransactionScheduler scheduler{*instance, host_state, 2};
+    const auto block = scheduler.execute_block({});
+    EXPECT_THAT(block.results, IsEmpty());
+    EXPECT_EQ(block.num_rounds, 0);
+    EXPECT_EQ(block.num_executions, 0);
+}
+
+TEST(transactions, disjoint)
+{
+    const auto instance = instantiate_contract();
+    HostState host_state;
+    TransactionScheduler scheduler{*instance, host_state, 4};
+
+    // Each transaction accesses its own memory page or host state key.
+    std::vector<Transaction> transactions;
+    for (uint64_t i = 0; i < 16; ++i)
+    {
+        transactions.push_back({add_at_idx, {i * AccessSet::PageSize, i + 1}});
+        transactions.push_back({host_inc_idx, {i}});
+    }
+
+    const auto block = scheduler.execute_block(transactions);
+    EXPECT_EQ(block.num_rounds, 1);
+    EXPECT_EQ(block.num_executions, transactions.size());
+    for (uint64_t i = 0; i < 16; ++i)
+    {
+        EXPECT_THAT(block.results[2 * i], Result(i + 1));
+        EXPECT_THAT(block.results[2 * i + 1], Result(1));
+        EXPECT_EQ((*instance->memory)[i * AccessSet::PageSize], i + 1);
+        EXPECT_EQ(host_state.at(i), 1);
+    }
+    EXPECT_GT(block.serial_time.count(), 0);
+    EXPECT_GT(block.wall_time.count(), 0);
+    EXPECT_GT(block.speedup(), 0.0);
+}
+
+TEST(transactions, conflicts)
+{
+    const auto instance = instantiate_contract();
+    HostState host_state;
+    TransactionScheduler scheduler{*instance, host_state, 3};
+
+    // All transactions of each kind access the same state, so they are executed again.
+    std::vector<Transaction> transactions;
+    for (uint64_t i = 0; i < 5; ++i)
+    {
+        transactions.push_back({add_at_idx, {8, 10}});
+        transactions.push_back({inc_global_idx, {}});
+        transactions.push_back({host_inc_idx, {7}});
+    }
+
+    const auto block = scheduler.execute_block(transactions);
+    for (uint64_t i = 0; i < 5; ++i)
+    {
+        EXPECT_THAT(block.results[3 * i], Result(10 * (i + 1)));
+        EXPECT_THAT(block.results[3 * i + 1], Result(i + 1));
+        EXPECT_THAT(block.results[3 * i + 2], Result(i + 1));
+    }
+    EXPECT_GT(block.num_rounds, 1);
+    EXPECT_GT(block.num_executions, transactions.size());
+    EXPECT_EQ(instance->globals[0], 5);
+    EXPECT_EQ(host_state.at(7), 5);
+}
+
+TEST(transactions, same_page_writes)
+{
+    // The transactions write the different bytes of the same page, the page is committed
+    // as a whole, so the later writes conflict with the earlier ones.
+    const auto instance = instantiate_contract();
+    HostState host_state;
+    TransactionScheduler scheduler{*instance, host_state, 2};
+
+    const auto block =
+        scheduler.execute_block({{add_at_idx, {0, 1}}, {add_at_idx, {4, 2}}, {add_at_idx, {8, 3}}});
+    EXPECT_THAT(block.results, ElementsAre(Result(1), Result(2), Result(3)));
+    EXPECT_EQ((*instance->memory)[0], 1);
+    EXPECT_EQ((*instance->memory)[4], 2);
+    EXPECT_EQ((*instance->memory)[8], 3);
+}
+
+TEST(transactions, memory_grow)
+{
+    const auto instance = instantiate_contract();
+    HostState host_state;
+    TransactionScheduler scheduler{*instance, host_state, 2};
+
+    // The access beyond the memory depends on the preceding grow.
+    const auto block = scheduler.execute_block({{add_at_idx, {WasmPageSize, 1}}, {grow_idx, {}},
+        {add_at_idx, {WasmPageSize, 2}}, {size_idx, {}}});
+    EXPECT_THAT(block.results, ElementsAre(Traps(), Result(1), Result(2), Result(2)));
+    EXPECT_EQ(instance->memory->size(), 2 * WasmPageSize);
+    EXPECT_EQ((*instance->memory)[WasmPageSize], 2);
+}
+
+TEST(transactions, traps_keep_writes)
+{
+    /* wat2wasm
+    (memory 1)
+    (func (param i32) (i32.store8 (i32.const 0) (local.get 0)) unreachable)
+    (func (result i32) (i32.load8_u (i32.const 0)))
+    */
+    const auto wasm = from_hex(
+        "0061736d0100000001090260017f006000017f030302000105030100010a14020a00410020003a0000000b07"
+        "0041002d00000b");
+    const auto instance = instantiate(parse(wasm));
+    HostState host_state;
+    TransactionScheduler scheduler{*instance, host_state, 2};
+
+    const auto block = scheduler.execute_block({{0, {7}}, {1, {}}});
+    EXPECT_THAT(block.results, ElementsAre(Traps(), Result(7)));
+}
+
+TEST(transactions, direct_execution)
+{
+    const auto instance = instantiate_contract();
+    HostState host_state{{3, 30}};
+    TransactionScheduler scheduler{*instance, host_state, 2};
+
+    // The imported function is executed directly, at its turn.
+    const auto block = scheduler.execute_block(
+        {{host_inc_idx, {3}}, {load_idx, {3}}, {host_inc_idx, {3}}, {load_idx, {3}}});
+    EXPECT_THAT(block.results, ElementsAre(Result(31), Result(31), Result(32), Result(32)));
+}
+
+TEST(transactions, call_indirect_executed_directly)
+{
+    /* wat2wasm
+    (memory 1)
+    (table 1 funcref)
+    (elem (i32.const 0) $inc)
+    (func $inc (result i32)
+      (i32.store (i32.const 0) (i32.add (i32.load (i32.const 0)) (i32.const 1)))
+      (i32.load (i32.const 0)))
+    (func (result i32) (call_indirect (result i32) (i32.const 0)))
+    */
+    const auto wasm = from_hex(
+        "0061736d010000000105016000017f030302000004040170000105030100010907010041000b01000a1e02"
+        "14004100410028020041016a36020041002802000b070041001100000b");
+    const auto instance = instantiate(parse(wasm));
+    HostState host_state;
+    TransactionScheduler scheduler{*instance, host_state, 2};
+
+    const auto block = scheduler.execute_block({{0, {}}, {1, {}}, {0, {}}, {1, {}}});
+    EXPECT_THAT(block.results, ElementsAre(Result(1), Result(2), Result(3), Result(4)));
+}
+
+TEST(transactions, exception)
+{
+    const auto instance = instantiate_contract([] { throw std::runtime_error{"host error"}; });
+    HostState host_state;
+    TransactionScheduler scheduler{*instance, host_state, 2};
+
+    EXPECT_THROW_MESSAGE(
+        scheduler.execute_block({{add_at_idx, {0, 1}}, {host_inc_idx, {1}}, {add_at_idx, {0, 1}}}),
+        std::runtime_error, "host error");
+    EXPECT_EQ((*instance->memory)[0], 1);
+}
+
+TEST(transactions, same_as_serial)
+{
+    std::vector<Transaction> transactions;
+    uint64_t seed = 1;
+    const auto next_random = [&seed](uint64_t n) {
+        seed = seed * 6364136223846793005 + 1442695040888963407;
+        return (seed >> 33) % n;
+    };
+    const uint64_t addresses[] = {0, 4, AccessSet::PageSize, 3 * AccessSet::PageSize,
+        WasmPageSize - 4, WasmPageSize + 8};
+    for (size_t i = 0; i < 300; ++i)
+    {
+        switch (next_random(10))
+        {
+        case 0:
+            transactions.push_back({inc_global_idx, {}});
+            break;
+        case 1:
+        case 2:
+            transactions.push_back({host_inc_idx, {next_random(4)}});
+            break;
+        case 3:
+            transactions.push_back({next_random(20) == 0 ? grow_idx : size_idx, {}});
+            break;
+        default:
+            transactions.push_back(
+                {add_at_idx, {addresses[next_random(std::size(addresses))], next_random(100)}});
+            break;
+        }
+    }
+
+    const auto expected_instance = instantiate_contract();
+    HostState expected_host_state;
+    const auto expected =
+        execute_serially(*expected_instance, expected_host_state, transactions);
+
+    for (const size_t num_threads : {size_t{1}, size_t{2}, size_t{4}})
+    {
+        const auto instance = instantiate_contract();
+        HostState host_state;
+        TransactionScheduler scheduler{*instance, host_state, num_threads};
+        const auto block = scheduler.execute_block(transactions);
+        expect_same_results(block.results, expected);
+        EXPECT_EQ(*instance->memory, *expected_instance->memory);
+        EXPECT_EQ(instance->globals, expected_instance->globals);
+        EXPECT_EQ(host_state, expected_host_state);
+    }
+}
@@ -444,6 +444,33 @@ TEST(validation_stack, unreachable_2)
     EXPECT_THAT(module.codesec[0].max_stack_height, 0);
 }
 
+TEST(validation_stack, atomic_stack_underflow)
+{
+    /* wat2wasm --enable-threads --no-check
+    (memory 1 1 shared)
+    (func (param i32) (result i32)
+      local.get 0
+      local.get 0
+      i32.atomic.rmw.cmpxchg
+    )
+    */
+    const auto wasm = from_hex(
+        "0061736d0100000001060160017f017f030201000504010301010a0c010a0020002000fe4802000b");
+    EXPECT_THROW_MESSAGE(parse(wasm), validation_error, "stack underflow");
+
+    /* wat2wasm --enable-threads
+    (memory 1 1 shared)
+    (func (result i32)
+      unreachable
+      i32.atomic.rmw.cmpxchg
+    )
+    */
+    const auto wasm_unreachable =
+        from_hex("0061736d010000000105016000017f030201000504010301010a0901070000fe4802000b");
+    const auto module = parse(wasm_unreachable);
+    EXPECT_EQ(module.codesec[0].max_stack_height, 0);
+}
+
 TEST(validation_stack, unreachable_call)
 {
     /* wat2wasm
@@ -129,6 +129,50 @@ TEST(validation, memory_size_no_memory)
         parse(wasm), validation_error, "memory instructions require imported or defined memory");
 }
 
+TEST(validation, atomic_no_memory)
+{
+    /* wat2wasm --enable-threads --no-check
+    (func (result i32)
+      (i32.atomic.load (i32.const 0))
+    )
+    */
+    const auto wasm =
+        from_hex("0061736d010000000105016000017f030201000a0a0108004100fe1002000b");
+    EXPECT_THROW_MESSAGE(
+        parse(wasm), validation_error, "memory instructions require imported or defined memory");
+
+    /* wat2wasm --enable-threads
+    (func
+      atomic.fence
+    )
+    */
+    const auto wasm_fence = from_hex("0061736d01000000010401600000030201000a07010500fe03000b");
+    EXPECT_NO_THROW(parse(wasm_fence));
+}
+
+TEST(validation, atomic_alignment)
+{
+    /* wat2wasm --enable-threads --no-check
+    (memory 1 1 shared)
+    (func (result i32)
+      (i32.atomic.load align=2 (i32.const 0))
+    )
+    */
+    const auto wasm = from_hex(
+        "0061736d010000000105016000017f030201000504010301010a0a0108004100fe1001000b");
+    EXPECT_THROW_MESSAGE(parse(wasm), validation_error, "atomic alignment must be natural");
+
+    /* wat2wasm --enable-threads --no-check
+    (memory 1 1 shared)
+    (func (result i64)
+      (i64.atomic.load align=4 (i32.const 0))
+    )
+    */
+    const auto wasm_64 = from_hex(
+        "0061736d010000000105016000017e030201000504010301010a0a0108004100fe1102000b");
+    EXPECT_THROW_MESSAGE(parse(wasm_64), validation_error, "atomic alignment must be natural");
+}
+
 TEST(validation, br_invalid_label_index)
 {
     /* wat2wasm --no-check
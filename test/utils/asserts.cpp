@@ -10,7 +10,7 @@ namespace fizzy
 std::ostream& operator<<(std::ostream& os, execution_result result)
 {
     if (result.trapped)
-        return os << "trapped";
+        return os << (result.interrupted ? "interrupted" : "trapped");
 
     os << "result(";
     std::string_view separator;
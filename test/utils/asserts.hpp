@@ -13,6 +13,11 @@ MATCHER(Traps, "")
     return arg.trapped;
 }
 
+MATCHER(Interrupted, "")
+{
+    return arg.trapped && arg.interrupted;
+}
+
 MATCHER(Result, "empty result")
 {
     return !arg.trapped && arg.stack.size() == 0;
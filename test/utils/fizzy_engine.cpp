@@ -133,8 +133,8 @@ std::optional<WasmEngine::FuncRef> FizzyEngine::find_function(
 WasmEngine::Result FizzyEngine::execute(
     WasmEngine::FuncRef func_ref, const std::vector<uint64_t>& args)
 {
-    const auto [trapped, result_stack] =
-        fizzy::execute(*m_instance, static_cast<uint32_t>(func_ref), args);
-    return {trapped, !result_stack.empty() ? result_stack.back() : std::optional<uint64_t>{}};
+    const auto result = fizzy::execute(*m_instance, static_cast<uint32_t>(func_ref), args);
+    return {result.trapped,
+        !result.stack.empty() ? result.stack.back() : std::optional<uint64_t>{}};
 }
 }  // namespace fizzy::test
@@ -0,0 +1,47 @@
+// Fizzy: A fast WebAssembly interpreter
+// Copyright 2020 The Fizzy Authors.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "lowered_code_utils.hpp"
+#include "parser.hpp"
+
+namespace fizzy::test
+{
+Module make_module(
+    const std::vector<TestFunction>& functions, std::optional<uint32_t> memory_min_pages)
+{
+    Module module;
+    if (memory_min_pages.has_value())
+        module.memorysec.emplace_back(Memory{{*memory_min_pages, std::nullopt}});
+
+    // All functions are declared first, so the code can call the functions following it.
+    for (const auto& function : functions)
+    {
+        module.funcsec.emplace_back(static_cast<TypeIdx>(module.typesec.size()));
+        module.typesec.emplace_back(function.type);
+    }
+    for (size_t i = 0; i < functions.size(); ++i)
+    {
+        const auto& expr = functions[i].expr;
+        auto [code, _] =
+            parse_expr(expr.data(), expr.data() + expr.size(), static_cast<FuncIdx>(i), module);
+        code.local_count = functions[i].local_count;
+        module.codesec.emplace_back(std::move(code));
+    }
+    return module;
+}
+
+Module make_single_function_module(
+    const bytes& expr_binary, FuncType func_type, std::optional<uint32_t> memory_min_pages)
+{
+    return make_module({{std::move(func_type), 0, expr_binary}}, memory_min_pages);
+}
+
+std::vector<Instr> get_instructions(const LoweredCode& code)
+{
+    std::vector<Instr> instructions;
+    for (const auto& instr : code.instructions)
+        instructions.emplace_back(instr.instr);
+    return instructions;
+}
+}  // namespace fizzy::test
@@ -0,0 +1,45 @@
+// Fizzy: A fast WebAssembly interpreter
+// Copyright 2020 The Fizzy Authors.
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include "bytes.hpp"
+#include "lowered_code.hpp"
+#include "module.hpp"
+#include "types.hpp"
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+namespace fizzy::test
+{
+/// The function of the module created by make_module().
+struct TestFunction
+{
+    FuncType type;
+    uint32_t local_count = 0;
+
+    /// The binary of the function's expression.
+    bytes expr;
+};
+
+/// Creates the module with the given functions, each having its own type, and the memory
+/// with the given minimum number of pages, if any.
+Module make_module(const std::vector<TestFunction>& functions,
+    std::optional<uint32_t> memory_min_pages = std::nullopt);
+
+/// Creates the module with the single function of the given type and expression, and the memory
+/// with the given minimum number of pages, if any.
+Module make_single_function_module(const bytes& expr_binary, FuncType func_type = {},
+    std::optional<uint32_t> memory_min_pages = std::nullopt);
+
+/// Returns the instructions of the lowered code, without their immediate values.
+std::vector<Instr> get_instructions(const LoweredCode& code);
+
+/// The function types used by the tests of the code transformations.
+inline const FuncType i32_result{{}, {ValType::i32}};
+inline const FuncType i64_result{{}, {ValType::i64}};
+inline const FuncType i32_param{{ValType::i32}, {}};
+inline const FuncType i32_param_i32_result{{ValType::i32}, {ValType::i32}};
+}  // namespace fizzy::test